@@ -0,0 +1,329 @@
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <new>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+#include <boost/filesystem.hpp>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "arena.hpp"
+#include "async_logger.hpp"
+#include "file_transfer.hpp"
+#include "mime_types.hpp"
+#include "server.hpp"
+
+namespace {
+    std::atomic<std::uint64_t> g_ALLOCATIONS {0};
+}    // namespace
+
+// Every allocation of the process is counted, so a benchmark can report allocations per operation
+
+auto operator new(std::size_t size) -> void* {
+    g_ALLOCATIONS.fetch_add(1, std::memory_order_relaxed);
+    if (void* memory = std::malloc(size == 0 ? 1 : size)) {
+        return memory;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* memory) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void* memory, std::size_t /*size*/) noexcept {
+    std::free(memory);
+}
+
+namespace {
+    /**
+     * @brief Entry counts of the synthetic directories
+     *
+     **/
+    constexpr std::array<std::int64_t, 3> LISTING_SIZES = {10, 1000, 100000};
+
+    /**
+     * @brief Sizes of the files sent through the socket pair
+     *
+     **/
+    constexpr std::array<std::int64_t, 3> FILE_SIZES = {4 * 1024, 64 * 1024, 1024 * 1024};
+
+    /**
+     * @brief Reports the allocations made since construction as allocs/op
+     *
+     **/
+    class AllocationCounter {
+      public:
+        explicit AllocationCounter(benchmark::State& state)
+            : m_STATE(state)
+            , m_START(g_ALLOCATIONS.load(std::memory_order_relaxed)) {}
+
+        ~AllocationCounter() {
+            m_STATE.counters["allocs/op"] = benchmark::Counter(
+                static_cast<double>(g_ALLOCATIONS.load(std::memory_order_relaxed) - m_START),
+                benchmark::Counter::kAvgIterations);
+        }
+
+        AllocationCounter(const AllocationCounter&) = delete;
+        auto operator=(const AllocationCounter&) -> AllocationCounter& = delete;
+
+      private:
+        benchmark::State& m_STATE;
+        std::uint64_t m_START;
+    };
+
+    /**
+     * @brief Served tree of the benchmarks, created on first use
+     *
+     * Holds one directory per entry count of LISTING_SIZES and one file per
+     * size of FILE_SIZES, under the temporary directory.
+     **/
+    auto root_path() -> fs::path& {
+        static fs::path root = fs::temp_directory_path() / ("httpfileserver_bench_" + std::to_string(::getpid()));
+        static bool const CREATED = [] {
+            fs::create_directories(root);
+            for (std::int64_t const ENTRIES : LISTING_SIZES) {
+                fs::path const DIR = root / ("list_" + std::to_string(ENTRIES));
+                fs::create_directories(DIR);
+                static constexpr std::array<const char*, 6> EXTENSIONS = {
+                    ".txt", ".mp4", ".zip", ".sh", ".png", ""};
+                for (std::int64_t i = 0; i < ENTRIES; ++i) {
+                    const char* const EXTENSION = EXTENSIONS[static_cast<std::size_t>(i) % EXTENSIONS.size()];
+                    std::ofstream(DIR / ("entry_" + std::to_string(i) + EXTENSION)) << "x";
+                }
+            }
+            for (std::int64_t const SIZE : FILE_SIZES) {
+                std::ofstream(root / ("file_" + std::to_string(SIZE) + ".bin"))
+                    << std::string(static_cast<std::size_t>(SIZE), 'b');
+            }
+            std::ofstream(root / "small.txt") << std::string(2048, 't');
+            return true;
+        }();
+        static_cast<void>(CREATED);
+        return root;
+    }
+
+    /**
+     * @brief Server instance shared by the benchmarks; run_server() is never called
+     *
+     **/
+    auto server() -> SHServer& {
+        static std::uint16_t port = 0;
+        static SHServer instance(root_path(), port, 1);
+        return instance;
+    }
+
+    void BM_generate_file_list(benchmark::State& state) {
+        fs::path const DIR = root_path() / ("list_" + std::to_string(state.range(0)));
+        benchmark::DoNotOptimize(server().generate_file_list(DIR));
+
+        AllocationCounter const COUNTER(state);
+        for (auto _ : state) {
+            benchmark::DoNotOptimize(server().generate_file_list(DIR));
+        }
+        state.SetItemsProcessed(state.iterations() * state.range(0));
+    }
+
+    void BM_build_listing(benchmark::State& state) {
+        fs::path const DIR = root_path() / ("list_" + std::to_string(state.range(0)));
+
+        AllocationCounter const COUNTER(state);
+        for (auto _ : state) {
+            benchmark::DoNotOptimize(server().build_listing(DIR));
+        }
+        state.SetItemsProcessed(state.iterations() * state.range(0));
+    }
+
+    void BM_sanitize_target(benchmark::State& state) {
+        static const std::array<std::string, 4> TARGETS = {
+            "/small.txt",
+            "/list_10/entry_1.mp4?download=1",
+            "/a/b/../../list_1000/./entry_999.zip",
+            "/%6c%69%73%74_10/entry%20%31.txt",
+        };
+        const std::string& target = TARGETS[static_cast<std::size_t>(state.range(0))];
+
+        AllocationCounter const COUNTER(state);
+        for (auto _ : state) {
+            benchmark::DoNotOptimize(server().sanitize_target(root_path(), target));
+        }
+    }
+
+    void BM_get_file_type_style(benchmark::State& state) {
+        static constexpr std::array<std::string_view, 5> PATHS = {
+            "movie.mp4", "setup.sh", "archive.tar", "notes.txt", "sub"};
+
+        AllocationCounter const COUNTER(state);
+        for (auto _ : state) {
+            for (std::size_t i = 0; i < PATHS.size(); ++i) {
+                benchmark::DoNotOptimize(get_file_type_style(PATHS[i], i + 1 == PATHS.size()));
+            }
+        }
+        state.SetItemsProcessed(state.iterations() * static_cast<std::int64_t>(PATHS.size()));
+    }
+
+    void BM_builtin_mime_type(benchmark::State& state) {
+        static constexpr std::array<std::string_view, 6> NAMES = {
+            "movie.mp4", "Photo.JPEG", "archive.tar.gz", "notes.txt", "Makefile", "data.unknown"};
+
+        AllocationCounter const COUNTER(state);
+        for (auto _ : state) {
+            for (std::string_view const NAME : NAMES) {
+                benchmark::DoNotOptimize(builtin_mime_type(NAME));
+            }
+        }
+        state.SetItemsProcessed(state.iterations() * static_cast<std::int64_t>(NAMES.size()));
+    }
+
+    /**
+     * @brief Allocator of a benchmark: the global heap for argument 0, the arena for 1
+     *
+     **/
+    auto allocator_for(benchmark::State& state, ConnectionArena& arena) -> ArenaAllocator<char> {
+        return state.range(0) == 0 ? ArenaAllocator<char> {} : ArenaAllocator<char> {arena};
+    }
+
+    void BM_configure_response_for_file(benchmark::State& state) {
+        fs::path const FILE = root_path() / "small.txt";
+        ConnectionArena arena;
+        ArenaAllocator<char> const ALLOCATOR = allocator_for(state, arena);
+
+        AllocationCounter const COUNTER(state);
+        for (auto _ : state) {
+            {
+                ArenaResponse res(std::piecewise_construct, std::make_tuple(), std::make_tuple(ALLOCATOR));
+                server().configure_response_for_file(FILE, res);
+                benchmark::DoNotOptimize(res);
+            }
+            arena.reset();
+        }
+    }
+
+    void BM_file_response_headers(benchmark::State& state) {
+        ConnectionArena arena;
+        ArenaAllocator<char> const ALLOCATOR = allocator_for(state, arena);
+
+        AllocationCounter const COUNTER(state);
+        for (auto _ : state) {
+            {
+                ArenaRequest req(std::piecewise_construct, std::make_tuple(), std::make_tuple(ALLOCATOR));
+                req.method(http::verb::get);
+                req.target("/small.txt");
+                req.set(http::field::host, "localhost");
+                ArenaResponse res(std::piecewise_construct, std::make_tuple(), std::make_tuple(ALLOCATOR));
+                FileTransfer file;
+                server().handle_request(root_path(), req, res, file);
+                benchmark::DoNotOptimize(res);
+            }
+            arena.reset();
+        }
+    }
+
+    void BM_parse_request(benchmark::State& state) {
+        static constexpr std::string_view REQUEST =
+            "GET /list_10/entry_1.mp4 HTTP/1.1\r\n"
+            "Host: localhost:8080\r\n"
+            "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:128.0) Gecko/20100101 Firefox/128.0\r\n"
+            "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+            "Accept-Language: en-US,en;q=0.5\r\n"
+            "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+            "Connection: keep-alive\r\n"
+            "If-None-Match: \"10-20-30\"\r\n"
+            "Range: bytes=0-\r\n"
+            "\r\n";
+        ConnectionArena arena;
+        ArenaAllocator<char> const ALLOCATOR = allocator_for(state, arena);
+
+        AllocationCounter const COUNTER(state);
+        for (auto _ : state) {
+            {
+                http::request_parser<http::string_body, ArenaAllocator<char>> parser(
+                    std::piecewise_construct, std::make_tuple(), std::make_tuple(ALLOCATOR));
+                beast::error_code ec;
+                parser.put(net::buffer(REQUEST.data(), REQUEST.size()), ec);
+                benchmark::DoNotOptimize(parser.get());
+            }
+            arena.reset();
+        }
+        state.SetBytesProcessed(state.iterations() * static_cast<std::int64_t>(REQUEST.size()));
+    }
+
+    void BM_send_file(benchmark::State& state) {
+        fs::path const FILE = root_path() / ("file_" + std::to_string(state.range(0)) + ".bin");
+
+        std::array<int, 2> sockets {};
+        if (::socketpair(AF_UNIX, SOCK_STREAM, 0, sockets.data()) != 0) {
+            state.SkipWithError("socketpair failed");
+            return;
+        }
+        ::fcntl(sockets[0], F_SETFL, ::fcntl(sockets[0], F_GETFL) | O_NONBLOCK);
+        std::vector<char> sink(256 * 1024);
+
+        {
+            AllocationCounter const COUNTER(state);
+            for (auto _ : state) {
+                FileTransfer file;
+                beast::error_code ec;
+                if (!file.open(FILE, ec)) {
+                    state.SkipWithError("cannot open the file");
+                    break;
+                }
+                while (file.remaining() > 0) {
+                    file.send_some(sockets[0], ec);
+                    if (ec == net::error::would_block) {
+                        ec = {};
+                    } else if (ec) {
+                        state.SkipWithError("send failed");
+                        break;
+                    }
+                    // The reader runs on this thread: drain what is queued so the sender can go on
+                    while (::recv(sockets[1], sink.data(), sink.size(), MSG_DONTWAIT) > 0) {
+                    }
+                }
+            }
+        }
+        state.SetBytesProcessed(state.iterations() * state.range(0));
+
+        ::close(sockets[0]);
+        ::close(sockets[1]);
+    }
+}    // namespace
+
+BENCHMARK(BM_generate_file_list)
+    ->ArgsProduct({{LISTING_SIZES.begin(), LISTING_SIZES.end()}})
+    ->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_build_listing)
+    ->ArgsProduct({{LISTING_SIZES.begin(), LISTING_SIZES.end()}})
+    ->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_sanitize_target)->DenseRange(0, 3);
+BENCHMARK(BM_get_file_type_style);
+BENCHMARK(BM_builtin_mime_type);
+BENCHMARK(BM_configure_response_for_file)->DenseRange(0, 1);
+BENCHMARK(BM_file_response_headers)->DenseRange(0, 1);
+BENCHMARK(BM_parse_request)->DenseRange(0, 1);
+BENCHMARK(BM_send_file)->ArgsProduct({{FILE_SIZES.begin(), FILE_SIZES.end()}});
+
+auto main(int argc, char** argv) -> int {
+    // Per-request log lines would dominate what is measured
+    AsyncLogger::instance().set_level(AsyncLogger::parse_level("error"));
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+        return 1;
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+
+    boost::system::error_code ec;
+    fs::remove_all(root_path(), ec);
+    return 0;
+}
@@ -0,0 +1,539 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <boost/asio/connect.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <boost/filesystem.hpp>
+#include <unistd.h>
+
+#include "async_logger.hpp"
+#include "server.hpp"
+
+/**
+ * @brief Anonymous namespace for helper functions
+ *
+ **/
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    /**
+     * @brief Files created per size of the mix, so requests do not all hit one file
+     *
+     **/
+    constexpr std::size_t FILES_PER_SIZE = 16;
+
+    /**
+     * @brief A file size of the mix and its share of the downloads
+     *
+     **/
+    struct SizeWeight {
+        std::uint64_t size = 0;
+        double weight = 0.0;
+    };
+
+    /**
+     * @brief Load shape of a run
+     *
+     **/
+    struct LoadConfig {
+        std::size_t server_threads = 2;
+        std::size_t connections = 16;
+        double duration_s = 10.0;
+        double warmup_s = 1.0;
+        bool keep_alive = true;
+        double listing_ratio = 0.1;
+        std::size_t listing_entries = 1000;
+        std::vector<SizeWeight> mix = {{4 * 1024, 70.0}, {64 * 1024, 25.0}, {1024 * 1024, 5.0}};
+        std::string output;
+        std::string thresholds;
+    };
+
+    /**
+     * @brief What one client thread measured
+     *
+     **/
+    struct ClientResult {
+        std::vector<std::uint64_t> latencies_ns;
+        std::uint64_t bytes = 0;
+        std::uint64_t errors = 0;
+    };
+
+    /**
+     * @brief Summary of a run
+     *
+     **/
+    struct LoadReport {
+        std::uint64_t requests = 0;
+        std::uint64_t errors = 0;
+        std::uint64_t bytes = 0;
+        double elapsed_s = 0.0;
+        double rps = 0.0;
+        double throughput_bytes_per_s = 0.0;
+        double error_rate = 0.0;
+        double mean_ms = 0.0;
+        double p50_ms = 0.0;
+        double p99_ms = 0.0;
+        double p999_ms = 0.0;
+        double max_ms = 0.0;
+    };
+
+    void print_usage(const char* program) {
+        std::cerr << "Usage: " << program
+                  << " [--server-threads <n>] [--connections <n>] [--duration <s>] [--warmup <s>]"
+                  << " [--no-keep-alive] [--listing-ratio <0..1>] [--listing-entries <n>]"
+                  << " [--mix <size:weight,...>] [--output <file.json>] [--thresholds <file.json>]" << "\n";
+    }
+
+    /**
+     * @brief Parse a size mix such as "4096:70,65536:25,1048576:5"
+     *
+     * @param text mix
+     * @param mix parsed mix
+     * @return true if the mix is valid
+     **/
+    auto parse_mix(const std::string& text, std::vector<SizeWeight>& mix) -> bool {
+        mix.clear();
+        std::stringstream stream(text);
+        std::string item;
+        while (std::getline(stream, item, ',')) {
+            std::size_t const COLON = item.find(':');
+            if (COLON == std::string::npos) {
+                return false;
+            }
+            SizeWeight entry;
+            entry.size = std::strtoull(item.substr(0, COLON).c_str(), nullptr, 10);
+            entry.weight = std::strtod(item.substr(COLON + 1).c_str(), nullptr);
+            if (entry.weight <= 0.0) {
+                return false;
+            }
+            mix.push_back(entry);
+        }
+        return !mix.empty();
+    }
+
+    /**
+     * @brief Parse the command line
+     *
+     * @param argc argument count
+     * @param argv arguments
+     * @param config parsed configuration
+     * @return true if the command line is valid
+     **/
+    auto parse_arguments(int argc, char* argv[], LoadConfig& config) -> bool {
+        for (int i = 1; i < argc; ++i) {
+            std::string const ARG = argv[i];
+            if (ARG == "--no-keep-alive") {
+                config.keep_alive = false;
+                continue;
+            }
+            if (i + 1 >= argc) {
+                return false;
+            }
+            std::string const VALUE = argv[++i];
+            if (ARG == "--server-threads") {
+                config.server_threads = static_cast<std::size_t>(std::atoi(VALUE.c_str()));
+            } else if (ARG == "--connections") {
+                config.connections = std::max<std::size_t>(1, static_cast<std::size_t>(std::atoi(VALUE.c_str())));
+            } else if (ARG == "--duration") {
+                config.duration_s = std::strtod(VALUE.c_str(), nullptr);
+            } else if (ARG == "--warmup") {
+                config.warmup_s = std::strtod(VALUE.c_str(), nullptr);
+            } else if (ARG == "--listing-ratio") {
+                config.listing_ratio = std::clamp(std::strtod(VALUE.c_str(), nullptr), 0.0, 1.0);
+            } else if (ARG == "--listing-entries") {
+                config.listing_entries = static_cast<std::size_t>(std::atoi(VALUE.c_str()));
+            } else if (ARG == "--mix") {
+                if (!parse_mix(VALUE, config.mix)) {
+                    return false;
+                }
+            } else if (ARG == "--output") {
+                config.output = VALUE;
+            } else if (ARG == "--thresholds") {
+                config.thresholds = VALUE;
+            } else {
+                return false;
+            }
+        }
+        return config.duration_s > 0.0;
+    }
+
+    /**
+     * @brief Create the served tree: the files of the mix and one listing directory
+     *
+     * @param root directory to fill
+     * @param config load shape
+     **/
+    void create_tree(const fs::path& root, const LoadConfig& config) {
+        fs::create_directories(root / "list");
+        for (std::size_t i = 0; i < config.listing_entries; ++i) {
+            std::ofstream(root / "list" / ("entry_" + std::to_string(i) + ".txt")) << i;
+        }
+        for (const SizeWeight& entry : config.mix) {
+            std::string const CONTENT(static_cast<std::size_t>(entry.size), 'x');
+            for (std::size_t i = 0; i < FILES_PER_SIZE; ++i) {
+                std::ofstream(root / ("file_" + std::to_string(entry.size) + "_" + std::to_string(i) + ".bin"))
+                    << CONTENT;
+            }
+        }
+    }
+
+    /**
+     * @brief Find a free loopback port
+     *
+     * @return std::uint16_t port, 0 on failure
+     **/
+    auto free_port() -> std::uint16_t {
+        net::io_context ioc;
+        tcp::acceptor probe(ioc);
+        beast::error_code ec;
+        probe.open(tcp::v4(), ec);
+        probe.bind({net::ip::address_v4::loopback(), 0}, ec);
+        return ec ? 0 : probe.local_endpoint().port();
+    }
+
+    /**
+     * @brief Issue requests on one connection at a time until the deadline
+     *
+     * @param config load shape
+     * @param port server port
+     * @param seed random seed of this client
+     * @param measure_from requests finishing earlier are warm-up and not recorded
+     * @param deadline end of the run
+     * @return ClientResult measurements
+     **/
+    auto run_client(const LoadConfig& config,
+                    std::uint16_t port,
+                    std::uint32_t seed,
+                    Clock::time_point measure_from,
+                    Clock::time_point deadline) -> ClientResult {
+        ClientResult result;
+        std::mt19937 random(seed);
+        std::uniform_real_distribution<double> coin(0.0, 1.0);
+        std::vector<double> weights;
+        for (const SizeWeight& entry : config.mix) {
+            weights.push_back(entry.weight);
+        }
+        std::discrete_distribution<std::size_t> pick_size(weights.begin(), weights.end());
+        std::uniform_int_distribution<std::size_t> pick_file(0, FILES_PER_SIZE - 1);
+
+        net::io_context ioc;
+        tcp::endpoint const ENDPOINT {net::ip::address_v4::loopback(), port};
+        std::optional<beast::tcp_stream> stream;
+        beast::flat_buffer buffer;
+
+        while (Clock::now() < deadline) {
+            std::string target = "/list/";
+            if (coin(random) >= config.listing_ratio) {
+                target = "/file_" + std::to_string(config.mix[pick_size(random)].size) + "_"
+                    + std::to_string(pick_file(random)) + ".bin";
+            }
+
+            http::request<http::empty_body> req {http::verb::get, target, 11};
+            req.set(http::field::host, "127.0.0.1");
+            req.keep_alive(config.keep_alive);
+
+            auto const START = Clock::now();
+            beast::error_code ec;
+            if (!stream) {
+                stream.emplace(ioc);
+                stream->connect(ENDPOINT, ec);
+                buffer.clear();
+            }
+            http::response_parser<http::string_body> parser;
+            parser.body_limit(std::numeric_limits<std::uint64_t>::max());
+            std::size_t written = 0;
+            if (!ec) {
+                written = http::write(*stream, req, ec);
+            }
+            std::size_t read = 0;
+            if (!ec) {
+                read = http::read(*stream, buffer, parser, ec);
+            }
+            auto const END = Clock::now();
+
+            bool const FAILED = ec || parser.get().result() != http::status::ok;
+            if (END >= measure_from) {
+                if (FAILED) {
+                    ++result.errors;
+                } else {
+                    result.latencies_ns.push_back(
+                        static_cast<std::uint64_t>(std::chrono::nanoseconds(END - START).count()));
+                    result.bytes += written + read;
+                }
+            }
+            if (FAILED || !config.keep_alive || !parser.get().keep_alive()) {
+                beast::error_code close_ec;
+                stream->socket().shutdown(tcp::socket::shutdown_both, close_ec);
+                stream.reset();
+            }
+        }
+        return result;
+    }
+
+    /**
+     * @brief Get a percentile of sorted latencies
+     *
+     * @param sorted latencies in ns, ascending
+     * @param fraction percentile, e.g. 0.99
+     * @return double latency in ms
+     **/
+    auto percentile_ms(const std::vector<std::uint64_t>& sorted, double fraction) -> double {
+        if (sorted.empty()) {
+            return 0.0;
+        }
+        auto const INDEX = static_cast<std::size_t>(fraction * static_cast<double>(sorted.size() - 1) + 0.5);
+        return static_cast<double>(sorted[std::min(INDEX, sorted.size() - 1)]) / 1e6;
+    }
+
+    /**
+     * @brief Merge the client measurements
+     *
+     * @param results client measurements
+     * @param elapsed_s measured time
+     * @return LoadReport summary
+     **/
+    auto summarize(std::vector<ClientResult>& results, double elapsed_s) -> LoadReport {
+        LoadReport report;
+        std::vector<std::uint64_t> latencies;
+        for (ClientResult& result : results) {
+            latencies.insert(latencies.end(), result.latencies_ns.begin(), result.latencies_ns.end());
+            report.bytes += result.bytes;
+            report.errors += result.errors;
+        }
+        std::sort(latencies.begin(), latencies.end());
+
+        report.requests = latencies.size();
+        report.elapsed_s = elapsed_s;
+        report.rps = static_cast<double>(report.requests) / elapsed_s;
+        report.throughput_bytes_per_s = static_cast<double>(report.bytes) / elapsed_s;
+        std::uint64_t const TOTAL = report.requests + report.errors;
+        report.error_rate = TOTAL == 0 ? 0.0 : static_cast<double>(report.errors) / static_cast<double>(TOTAL);
+        std::uint64_t sum = 0;
+        for (std::uint64_t const LATENCY : latencies) {
+            sum += LATENCY;
+        }
+        report.mean_ms =
+            latencies.empty() ? 0.0 : static_cast<double>(sum) / static_cast<double>(latencies.size()) / 1e6;
+        report.p50_ms = percentile_ms(latencies, 0.50);
+        report.p99_ms = percentile_ms(latencies, 0.99);
+        report.p999_ms = percentile_ms(latencies, 0.999);
+        report.max_ms = latencies.empty() ? 0.0 : static_cast<double>(latencies.back()) / 1e6;
+        return report;
+    }
+
+    /**
+     * @brief Read a flat JSON object of numbers, e.g. {"max_p99_ms": 5, "min_rps": 1000}
+     *
+     * @param path file path
+     * @param values parsed key/value pairs
+     * @return true if the file was read and parsed
+     **/
+    auto read_thresholds(const std::string& path, std::map<std::string, double>& values) -> bool {
+        std::ifstream file(path);
+        if (!file) {
+            return false;
+        }
+        std::string const TEXT((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        std::size_t pos = TEXT.find('{');
+        if (pos == std::string::npos) {
+            return false;
+        }
+        while (true) {
+            std::size_t const KEY_START = TEXT.find('"', pos + 1);
+            if (KEY_START == std::string::npos) {
+                return TEXT.find('}', pos) != std::string::npos;
+            }
+            std::size_t const KEY_END = TEXT.find('"', KEY_START + 1);
+            std::size_t const COLON = KEY_END == std::string::npos ? KEY_END : TEXT.find(':', KEY_END);
+            if (COLON == std::string::npos) {
+                return false;
+            }
+            char* end = nullptr;
+            double const VALUE = std::strtod(TEXT.c_str() + COLON + 1, &end);
+            if (end == TEXT.c_str() + COLON + 1) {
+                return false;
+            }
+            values[TEXT.substr(KEY_START + 1, KEY_END - KEY_START - 1)] = VALUE;
+            pos = static_cast<std::size_t>(end - TEXT.c_str());
+        }
+    }
+
+    /**
+     * @brief Compare a report with thresholds
+     *
+     * Keys: min_rps, min_throughput_bytes_per_s, max_error_rate, max_mean_ms,
+     * max_p50_ms, max_p99_ms, max_p999_ms, max_max_ms.
+     *
+     * @param report run summary
+     * @param thresholds limits
+     * @param failures descriptions of the violated limits
+     **/
+    void check_thresholds(const LoadReport& report,
+                          const std::map<std::string, double>& thresholds,
+                          std::vector<std::string>& failures) {
+        std::map<std::string, double> const MINIMUMS = {
+            {"min_rps", report.rps}, {"min_throughput_bytes_per_s", report.throughput_bytes_per_s}};
+        std::map<std::string, double> const MAXIMUMS = {{"max_error_rate", report.error_rate},
+                                                        {"max_mean_ms", report.mean_ms},
+                                                        {"max_p50_ms", report.p50_ms},
+                                                        {"max_p99_ms", report.p99_ms},
+                                                        {"max_p999_ms", report.p999_ms},
+                                                        {"max_max_ms", report.max_ms}};
+        for (const auto& [key, limit] : thresholds) {
+            char line[160];
+            if (auto minimum = MINIMUMS.find(key); minimum != MINIMUMS.end()) {
+                if (minimum->second < limit) {
+                    std::snprintf(line, sizeof(line), "%s: %.3f < %.3f", key.c_str(), minimum->second, limit);
+                    failures.emplace_back(line);
+                }
+            } else if (auto maximum = MAXIMUMS.find(key); maximum != MAXIMUMS.end()) {
+                if (maximum->second > limit) {
+                    std::snprintf(line, sizeof(line), "%s: %.3f > %.3f", key.c_str(), maximum->second, limit);
+                    failures.emplace_back(line);
+                }
+            } else {
+                failures.push_back("unknown threshold " + key);
+            }
+        }
+    }
+
+    /**
+     * @brief Render the configuration, the report and the threshold verdict as JSON
+     *
+     * @param config load shape
+     * @param report run summary
+     * @param failures violated thresholds
+     * @return std::string JSON document
+     **/
+    auto to_json(const LoadConfig& config, const LoadReport& report, const std::vector<std::string>& failures)
+        -> std::string {
+        std::ostringstream out;
+        out.precision(6);
+        out << std::fixed;
+        out << "{\n  \"config\": {\"server_threads\": " << config.server_threads
+            << ", \"connections\": " << config.connections << ", \"duration_s\": " << config.duration_s
+            << ", \"keep_alive\": " << (config.keep_alive ? "true" : "false")
+            << ", \"listing_ratio\": " << config.listing_ratio
+            << ", \"listing_entries\": " << config.listing_entries
+            << ", \"mix\": [";
+        for (std::size_t i = 0; i < config.mix.size(); ++i) {
+            out << (i == 0 ? "" : ", ") << "{\"size\": " << config.mix[i].size
+                << ", \"weight\": " << config.mix[i].weight << "}";
+        }
+        out << "]},\n";
+        out << "  \"requests\": " << report.requests << ",\n";
+        out << "  \"errors\": " << report.errors << ",\n";
+        out << "  \"elapsed_s\": " << report.elapsed_s << ",\n";
+        out << "  \"rps\": " << report.rps << ",\n";
+        out << "  \"throughput_bytes_per_s\": " << report.throughput_bytes_per_s << ",\n";
+        out << "  \"latency_ms\": {\"mean\": " << report.mean_ms << ", \"p50\": " << report.p50_ms
+            << ", \"p99\": " << report.p99_ms << ", \"p999\": " << report.p999_ms << ", \"max\": " << report.max_ms
+            << "},\n";
+        out << "  \"passed\": " << (failures.empty() ? "true" : "false") << ",\n";
+        out << "  \"failures\": [";
+        for (std::size_t i = 0; i < failures.size(); ++i) {
+            out << (i == 0 ? "" : ", ") << '"' << failures[i] << '"';
+        }
+        out << "]\n}\n";
+        return out.str();
+    }
+}    // namespace
+
+auto main(int argc, char* argv[]) -> int {
+    LoadConfig config;
+    if (!parse_arguments(argc, argv, config)) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    std::map<std::string, double> thresholds;
+    if (!config.thresholds.empty() && !read_thresholds(config.thresholds, thresholds)) {
+        std::cerr << "Cannot read thresholds from " << config.thresholds << "\n";
+        return 1;
+    }
+
+    // Per-request log lines would be part of what is measured
+    AsyncLogger::instance().set_level(AsyncLogger::parse_level("error"));
+
+    fs::path root = fs::temp_directory_path() / ("httpfileserver_load_" + std::to_string(::getpid()));
+    create_tree(root, config);
+
+    // The server announces itself on stdout, which carries the report
+    std::ostringstream banner;
+    std::streambuf* const STDOUT = std::cout.rdbuf(banner.rdbuf());
+
+    std::uint16_t port = free_port();
+    SHServer server(root, port, config.server_threads);
+    std::thread server_thread([&server] { server.run_server(); });
+
+    // The server is up once it accepts a connection
+    for (int attempt = 0; attempt < 100; ++attempt) {
+        net::io_context ioc;
+        tcp::socket probe(ioc);
+        beast::error_code ec;
+        probe.connect({net::ip::address_v4::loopback(), port}, ec);
+        if (!ec) {
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+
+    auto const START = Clock::now();
+    auto const MEASURE_FROM =
+        START + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(config.warmup_s));
+    auto const DEADLINE = MEASURE_FROM
+        + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(config.duration_s));
+
+    std::vector<ClientResult> results(config.connections);
+    std::vector<std::thread> clients;
+    clients.reserve(config.connections);
+    for (std::size_t i = 0; i < config.connections; ++i) {
+        auto const SEED = static_cast<std::uint32_t>(i + 1);
+        clients.emplace_back([&, i, SEED] { results[i] = run_client(config, port, SEED, MEASURE_FROM, DEADLINE); });
+    }
+    for (std::thread& client : clients) {
+        client.join();
+    }
+    double const ELAPSED = std::chrono::duration<double>(Clock::now() - MEASURE_FROM).count();
+
+    server.stop_server();
+    server_thread.join();
+    std::cout.rdbuf(STDOUT);
+    boost::system::error_code ec;
+    fs::remove_all(root, ec);
+
+    LoadReport const REPORT = summarize(results, ELAPSED);
+    std::vector<std::string> failures;
+    check_thresholds(REPORT, thresholds, failures);
+    std::string const JSON = to_json(config, REPORT, failures);
+
+    if (config.output.empty()) {
+        std::cout << JSON;
+    } else {
+        std::ofstream(config.output) << JSON;
+    }
+    for (const std::string& failure : failures) {
+        std::cerr << "Threshold failed: " << failure << "\n";
+    }
+    return failures.empty() ? 0 : 2;
+}
@@ -1,22 +0,0 @@
-#pragma once
-
-#define DEBUG
-
-#define START_INDENT_SYMBOL "├─"
-#define INDENT_SYMBOL "──"
-
-enum
-{
-    INDENT_LENGTH = 6
-};
-
-#define RED_COLOR "\033[1;31m"
-#define GREEN_COLOR "\033[1;32m"
-#define YELLOW_COLOR "\033[1;33m"
-#define BLUE_COLOR "\033[1;34m"
-#define PURPLE_COLOR "\033[1;35m"
-#define CYAN_COLOR "\033[1;36m"
-#define GREY_COLOR "\033[0;37m"
-#define RESET_CODE "\033[0m"
-#define BOLD "\033[1m"
-#define UNDERLINE "\033[4m"
@@ -0,0 +1,1061 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <new>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "archive.hpp"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "arena.hpp"
+#include "logger.hpp"
+
+/**
+ * @brief Anonymous namespace for helper functions
+ *
+ **/
+namespace {
+    constexpr std::size_t TAR_BLOCK = 512;
+
+    /**
+     * @brief Largest value of the 11 octal digits of a ustar size or mtime field
+     *
+     **/
+    constexpr std::uint64_t TAR_MAX_OCTAL = 077777777777ULL;
+
+    constexpr std::string_view TAR_PAX_NAME = "././@PaxHeader";
+
+    /**
+     * @brief Sizes and offsets from this value on need zip64 fields
+     *
+     **/
+    constexpr std::uint64_t ZIP32_LIMIT = 0xFFFFFFFFULL;
+
+    /**
+     * @brief Files from this size on get zip64 fields in a deflated zip
+     *
+     * The compressed size is unknown when the local header goes out, and
+     * deflate can grow incompressible data slightly, so the decision keeps
+     * a margin below ZIP32_LIMIT.
+     **/
+    constexpr std::uint64_t ZIP_DEFLATE_ZIP64_SIZE = 0xFF000000ULL;
+
+    constexpr std::uint16_t ZIP_STORED = 0;
+    constexpr std::uint16_t ZIP_DEFLATED = 8;
+
+    /**
+     * @brief General purpose flags: bit 3 data descriptor follows, bit 11 UTF-8 names
+     *
+     **/
+    constexpr std::uint16_t ZIP_FLAGS_DESCRIPTOR = 0x0808;
+    constexpr std::uint16_t ZIP_FLAGS_UTF8 = 0x0800;
+
+    /**
+     * @brief Version made by: Unix attributes, specification 4.5
+     *
+     **/
+    constexpr std::uint16_t ZIP_MADE_BY = (3 << 8) | 45;
+
+    constexpr std::size_t ZIP_LOCAL_HEADER = 30;
+    constexpr std::size_t ZIP_CENTRAL_RECORD = 46;
+    constexpr std::size_t ZIP_END_RECORD = 22;
+    constexpr std::size_t ZIP64_END_RECORDS = 56 + 20;
+
+    /**
+     * @brief Bytes read from a file per deflate step or CRC pass
+     *
+     **/
+    constexpr std::size_t READ_BLOCK = 256 * 1024;
+
+    /**
+     * @brief Output size after which ZipDeflateStream returns a piece
+     *
+     **/
+    constexpr std::size_t DEFLATE_PIECE = 256 * 1024;
+
+    constexpr int DEFLATE_LEVEL = 6;
+
+    /**
+     * @brief Round up to whole tar blocks
+     *
+     * @param size bytes
+     * @return std::uint64_t bytes in whole blocks
+     **/
+    auto tar_blocks(std::uint64_t size) -> std::uint64_t {
+        return (size + TAR_BLOCK - 1) / TAR_BLOCK * TAR_BLOCK;
+    }
+
+    /**
+     * @brief Modification time in whole seconds, rounded down
+     *
+     * @param mtime_ns nanoseconds since the epoch
+     * @return std::int64_t seconds since the epoch
+     **/
+    auto seconds_of(std::int64_t mtime_ns) -> std::int64_t {
+        std::int64_t const SECONDS = mtime_ns / 1000000000;
+        return mtime_ns < 0 && SECONDS * 1000000000 != mtime_ns ? SECONDS - 1 : SECONDS;
+    }
+
+    /**
+     * @brief Split a name into the prefix and name fields of a ustar header
+     *
+     * @param name full name
+     * @param prefix set to the part before the split slash
+     * @param rest set to the part after it
+     * @return true if the name fits
+     **/
+    auto split_ustar_name(std::string_view name, std::string_view& prefix, std::string_view& rest) -> bool {
+        if (name.size() <= 100) {
+            prefix = {};
+            rest = name;
+            return true;
+        }
+        // The name field keeps at most 100 bytes, the prefix field at most 155
+        for (std::size_t slash = name.find('/'); slash != std::string_view::npos && slash <= 155;
+             slash = name.find('/', slash + 1))
+        {
+            if (name.size() - slash - 1 <= 100 && slash + 1 < name.size()) {
+                prefix = name.substr(0, slash);
+                rest = name.substr(slash + 1);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * @brief Append one pax record, "<length> <key>=<value>\n"
+     *
+     * @param out output
+     * @param key record key
+     * @param value record value
+     **/
+    void append_pax_record(std::string& out, std::string_view key, std::string_view value) {
+        // The length counts its own digits
+        std::size_t const BODY = key.size() + value.size() + 3;
+        std::size_t length = BODY + 1;
+        while (std::to_string(length).size() + BODY != length) {
+            length = std::to_string(length).size() + BODY;
+        }
+        out += std::to_string(length);
+        out += ' ';
+        out += key;
+        out += '=';
+        out += value;
+        out += '\n';
+    }
+
+    /**
+     * @brief Build the pax extended header data of an entry
+     *
+     * @param entry archive entry
+     * @return std::string records, empty when the ustar header is enough
+     **/
+    auto tar_pax_records(const ArchiveEntry& entry) -> std::string {
+        std::string records;
+        std::string_view prefix;
+        std::string_view rest;
+        if (!split_ustar_name(entry.name, prefix, rest)) {
+            append_pax_record(records, "path", entry.name);
+        }
+        if (entry.size > TAR_MAX_OCTAL) {
+            append_pax_record(records, "size", std::to_string(entry.size));
+        }
+        return records;
+    }
+
+    /**
+     * @brief Write a value as zero-padded octal digits and a NUL
+     *
+     * @param field header field
+     * @param width field width including the NUL
+     * @param value value, must fit
+     **/
+    void put_octal(char* field, std::size_t width, std::uint64_t value) {
+        field[width - 1] = '\0';
+        for (std::size_t i = width - 1; i > 0; --i) {
+            field[i - 1] = static_cast<char>('0' + (value & 7));
+            value >>= 3;
+        }
+    }
+
+    /**
+     * @brief Append a ustar header block
+     *
+     * @param out output
+     * @param name entry name, cut if it does not fit (a pax header then carries it)
+     * @param size data size, 0 if it does not fit
+     * @param mtime_ns modification time
+     * @param mode permission bits
+     * @param type type flag
+     **/
+    void append_tar_header(std::string& out,
+                           std::string_view name,
+                           std::uint64_t size,
+                           std::int64_t mtime_ns,
+                           std::uint32_t mode,
+                           char type) {
+        std::size_t const START = out.size();
+        out.append(TAR_BLOCK, '\0');
+        char* header = out.data() + START;
+
+        std::string_view prefix;
+        std::string_view rest;
+        if (!split_ustar_name(name, prefix, rest)) {
+            rest = name.substr(0, 100);
+        }
+        std::memcpy(header, rest.data(), rest.size());
+        std::memcpy(header + 345, prefix.data(), prefix.size());
+
+        auto const SECONDS = static_cast<std::uint64_t>(std::max<std::int64_t>(seconds_of(mtime_ns), 0));
+        put_octal(header + 100, 8, mode & 07777);
+        put_octal(header + 108, 8, 0);
+        put_octal(header + 116, 8, 0);
+        put_octal(header + 124, 12, size <= TAR_MAX_OCTAL ? size : 0);
+        put_octal(header + 136, 12, std::min(SECONDS, TAR_MAX_OCTAL));
+        header[156] = type;
+        std::memcpy(header + 257, "ustar", 6);
+        std::memcpy(header + 263, "00", 2);
+
+        // The checksum is taken with its own field filled with spaces
+        std::memset(header + 148, ' ', 8);
+        std::uint32_t checksum = 0;
+        for (std::size_t i = 0; i < TAR_BLOCK; ++i) {
+            checksum += static_cast<unsigned char>(header[i]);
+        }
+        put_octal(header + 148, 7, checksum);
+        header[155] = ' ';
+    }
+
+    /**
+     * @brief Length of the tar headers of an entry
+     *
+     * @param entry archive entry
+     * @return std::uint64_t header bytes, pax header included
+     **/
+    auto tar_header_size(const ArchiveEntry& entry) -> std::uint64_t {
+        std::size_t const PAX = tar_pax_records(entry).size();
+        return TAR_BLOCK + (PAX > 0 ? TAR_BLOCK + tar_blocks(PAX) : 0);
+    }
+
+    /**
+     * @brief Append the tar headers of an entry
+     *
+     * @param out output
+     * @param entry archive entry
+     **/
+    void append_tar_entry_header(std::string& out, const ArchiveEntry& entry) {
+        std::string const PAX = tar_pax_records(entry);
+        if (!PAX.empty()) {
+            append_tar_header(out, TAR_PAX_NAME, PAX.size(), entry.mtime_ns, 0644, 'x');
+            out += PAX;
+            out.append(static_cast<std::size_t>(tar_blocks(PAX.size()) - PAX.size()), '\0');
+        }
+        char const TYPE = entry.directory ? '5' : '0';
+        append_tar_header(out, entry.name, entry.size, entry.mtime_ns, entry.mode, TYPE);
+    }
+
+    void append_le16(std::string& out, std::uint64_t value) {
+        out += static_cast<char>(value & 0xFF);
+        out += static_cast<char>((value >> 8) & 0xFF);
+    }
+
+    void append_le32(std::string& out, std::uint64_t value) {
+        append_le16(out, value & 0xFFFF);
+        append_le16(out, (value >> 16) & 0xFFFF);
+    }
+
+    void append_le64(std::string& out, std::uint64_t value) {
+        append_le32(out, value & 0xFFFFFFFF);
+        append_le32(out, value >> 32);
+    }
+
+    /**
+     * @brief MS-DOS time and date of a modification time, in UTC
+     *
+     * @param mtime_ns modification time
+     * @return std::uint32_t date in the high half, time in the low half
+     **/
+    auto dos_date_time(std::int64_t mtime_ns) -> std::uint32_t {
+        auto const SECONDS = static_cast<std::time_t>(seconds_of(mtime_ns));
+        std::tm time {};
+        if (::gmtime_r(&SECONDS, &time) == nullptr || time.tm_year < 80) {
+            return (1 << 5 | 1) << 16;    // 1980-01-01, the earliest DOS date
+        }
+        if (time.tm_year > 207) {
+            return ((127U << 9 | 12U << 5 | 31U) << 16) | (23U << 11 | 59U << 5 | 29U);
+        }
+        auto const DATE =
+            static_cast<std::uint32_t>((time.tm_year - 80) << 9 | (time.tm_mon + 1) << 5 | time.tm_mday);
+        auto const TIME = static_cast<std::uint32_t>(time.tm_hour << 11 | time.tm_min << 5 | time.tm_sec / 2);
+        return DATE << 16 | TIME;
+    }
+
+    /**
+     * @brief Fields of one zip entry
+     *
+     **/
+    struct ZipRecord {
+        const ArchiveEntry& entry;
+        std::uint16_t method;
+        std::uint32_t crc;
+        std::uint64_t compressed;
+        std::uint64_t offset;
+        bool zip64;    // sizes in zip64 fields, 8-byte data descriptor
+    };
+
+    auto zip_local_header_size(const ArchiveEntry& entry, bool zip64) -> std::uint64_t {
+        return ZIP_LOCAL_HEADER + entry.name.size() + (zip64 ? 20 : 0);
+    }
+
+    /**
+     * @brief Append a local file header; CRC and sizes follow in a data descriptor
+     *
+     * @param out output
+     * @param entry archive entry
+     * @param method compression method
+     * @param zip64 whether the sizes need zip64 fields
+     **/
+    void append_zip_local_header(std::string& out,
+                                 const ArchiveEntry& entry,
+                                 std::uint16_t method,
+                                 bool zip64) {
+        std::uint32_t const DOS = dos_date_time(entry.mtime_ns);
+        append_le32(out, 0x04034b50);
+        append_le16(out, zip64 ? 45 : 20);
+        append_le16(out, entry.directory ? ZIP_FLAGS_UTF8 : ZIP_FLAGS_DESCRIPTOR);
+        append_le16(out, entry.directory ? ZIP_STORED : method);
+        append_le16(out, DOS & 0xFFFF);
+        append_le16(out, DOS >> 16);
+        append_le32(out, 0);
+        append_le32(out, zip64 ? ZIP32_LIMIT : 0);
+        append_le32(out, zip64 ? ZIP32_LIMIT : 0);
+        append_le16(out, entry.name.size());
+        append_le16(out, zip64 ? 20 : 0);
+        out += entry.name;
+        if (zip64) {
+            append_le16(out, 0x0001);
+            append_le16(out, 16);
+            append_le64(out, 0);
+            append_le64(out, 0);
+        }
+    }
+
+    auto zip_descriptor_size(bool zip64) -> std::uint64_t {
+        return zip64 ? 24 : 16;
+    }
+
+    void append_zip_descriptor(std::string& out,
+                               std::uint32_t crc,
+                               std::uint64_t compressed,
+                               std::uint64_t size,
+                               bool zip64) {
+        append_le32(out, 0x08074b50);
+        append_le32(out, crc);
+        if (zip64) {
+            append_le64(out, compressed);
+            append_le64(out, size);
+        } else {
+            append_le32(out, compressed);
+            append_le32(out, size);
+        }
+    }
+
+    auto zip_central_record_size(const ArchiveEntry& entry, std::uint64_t offset, bool zip64)
+        -> std::uint64_t {
+        auto const EXTRA = static_cast<std::uint64_t>((zip64 ? 16 : 0) + (offset >= ZIP32_LIMIT ? 8 : 0));
+        return ZIP_CENTRAL_RECORD + entry.name.size() + (EXTRA > 0 ? 4 + EXTRA : 0);
+    }
+
+    /**
+     * @brief Append a central directory record
+     *
+     * @param out output
+     * @param record entry fields
+     **/
+    void append_zip_central_record(std::string& out, const ZipRecord& record) {
+        const ArchiveEntry& entry = record.entry;
+        bool const BIG_OFFSET = record.offset >= ZIP32_LIMIT;
+        auto const EXTRA = static_cast<std::uint64_t>((record.zip64 ? 16 : 0) + (BIG_OFFSET ? 8 : 0));
+        std::uint32_t const DOS = dos_date_time(entry.mtime_ns);
+        std::uint32_t const MODE = (entry.directory ? S_IFDIR : S_IFREG) | (entry.mode & 07777);
+
+        append_le32(out, 0x02014b50);
+        append_le16(out, ZIP_MADE_BY);
+        append_le16(out, record.zip64 || BIG_OFFSET ? 45 : 20);
+        append_le16(out, entry.directory ? ZIP_FLAGS_UTF8 : ZIP_FLAGS_DESCRIPTOR);
+        append_le16(out, entry.directory ? ZIP_STORED : record.method);
+        append_le16(out, DOS & 0xFFFF);
+        append_le16(out, DOS >> 16);
+        append_le32(out, record.crc);
+        append_le32(out, record.zip64 ? ZIP32_LIMIT : record.compressed);
+        append_le32(out, record.zip64 ? ZIP32_LIMIT : entry.size);
+        append_le16(out, entry.name.size());
+        append_le16(out, EXTRA > 0 ? 4 + EXTRA : 0);
+        append_le16(out, 0);
+        append_le16(out, 0);
+        append_le16(out, 0);
+        append_le32(out, MODE << 16 | (entry.directory ? 0x10 : 0));
+        append_le32(out, BIG_OFFSET ? ZIP32_LIMIT : record.offset);
+        out += entry.name;
+        if (EXTRA > 0) {
+            append_le16(out, 0x0001);
+            append_le16(out, EXTRA);
+            if (record.zip64) {
+                append_le64(out, entry.size);
+                append_le64(out, record.compressed);
+            }
+            if (BIG_OFFSET) {
+                append_le64(out, record.offset);
+            }
+        }
+    }
+
+    auto zip_needs_end64(std::size_t count, std::uint64_t central_offset, std::uint64_t central_size)
+        -> bool {
+        return count >= 0xFFFF || central_offset >= ZIP32_LIMIT || central_size >= ZIP32_LIMIT;
+    }
+
+    auto zip_end_size(std::size_t count, std::uint64_t central_offset, std::uint64_t central_size)
+        -> std::uint64_t {
+        bool const END64 = zip_needs_end64(count, central_offset, central_size);
+        return ZIP_END_RECORD + (END64 ? ZIP64_END_RECORDS : 0);
+    }
+
+    /**
+     * @brief Append the end of central directory record, with its zip64 variant where needed
+     *
+     * @param out output
+     * @param count number of entries
+     * @param central_offset offset of the central directory
+     * @param central_size length of the central directory
+     **/
+    void append_zip_end(std::string& out,
+                        std::size_t count,
+                        std::uint64_t central_offset,
+                        std::uint64_t central_size) {
+        if (zip_needs_end64(count, central_offset, central_size)) {
+            std::uint64_t const END64_OFFSET = central_offset + central_size;
+            append_le32(out, 0x06064b50);
+            append_le64(out, 44);
+            append_le16(out, ZIP_MADE_BY);
+            append_le16(out, 45);
+            append_le32(out, 0);
+            append_le32(out, 0);
+            append_le64(out, count);
+            append_le64(out, count);
+            append_le64(out, central_size);
+            append_le64(out, central_offset);
+
+            append_le32(out, 0x07064b50);
+            append_le32(out, 0);
+            append_le64(out, END64_OFFSET);
+            append_le32(out, 1);
+        }
+        append_le32(out, 0x06054b50);
+        append_le16(out, 0);
+        append_le16(out, 0);
+        append_le16(out, std::min<std::uint64_t>(count, 0xFFFF));
+        append_le16(out, std::min<std::uint64_t>(count, 0xFFFF));
+        append_le32(out, std::min(central_size, ZIP32_LIMIT));
+        append_le32(out, std::min(central_offset, ZIP32_LIMIT));
+        append_le16(out, 0);
+    }
+
+    /**
+     * @brief An entry of a directory being walked
+     *
+     **/
+    struct WalkEntry {
+        std::string name;
+        struct stat status;
+    };
+
+    /**
+     * @brief Append the entries below a directory
+     *
+     * @param dir directory
+     * @param name archive name of the directory, with its trailing slash
+     * @param max_entries entry limit
+     * @param entries output
+     * @return true unless the limit was exceeded
+     **/
+    auto walk_archive_tree(const fs::path& dir,
+                           std::string& name,
+                           std::size_t max_entries,
+                           std::vector<ArchiveEntry>& entries) -> bool {
+        DIR* handle = ::opendir(dir.c_str());
+        if (handle == nullptr) {
+            log_error("Cannot open directory %s: %s\n", dir.c_str(), std::strerror(errno));
+            return true;
+        }
+        int const DIR_FD = ::dirfd(handle);
+
+        // The directory is closed before descending, so deep trees do not hold a descriptor per level
+        std::vector<WalkEntry> children;
+        while (const dirent* entry = ::readdir(handle)) {
+            std::string_view const NAME = entry->d_name;
+            if (NAME == "." || NAME == "..") {
+                continue;
+            }
+            WalkEntry child {std::string(NAME), {}};
+            if (::fstatat(DIR_FD, entry->d_name, &child.status, AT_SYMLINK_NOFOLLOW) != 0) {
+                continue;
+            }
+            if (S_ISLNK(child.status.st_mode)) {
+                if (::fstatat(DIR_FD, entry->d_name, &child.status, 0) != 0
+                    || S_ISDIR(child.status.st_mode))
+                {
+                    continue;
+                }
+            }
+            // Sockets, pipes and devices have no content to archive, a pipe could even block the reader
+            if (!S_ISDIR(child.status.st_mode)
+                && (!S_ISREG(child.status.st_mode) || ::faccessat(DIR_FD, entry->d_name, R_OK, 0) != 0))
+            {
+                continue;
+            }
+            if (entries.size() + children.size() >= max_entries) {
+                ::closedir(handle);
+                return false;
+            }
+            children.push_back(std::move(child));
+        }
+        ::closedir(handle);
+
+        std::sort(children.begin(), children.end(), [](const WalkEntry& a, const WalkEntry& b) {
+            return a.name < b.name;
+        });
+
+        for (const auto& child : children) {
+            bool const IS_DIR = S_ISDIR(child.status.st_mode);
+            std::size_t const LENGTH = name.size();
+            name += child.name;
+            if (IS_DIR) {
+                name += '/';
+            }
+            entries.push_back({name,
+                               IS_DIR ? 0 : static_cast<std::uint64_t>(child.status.st_size),
+                               static_cast<std::int64_t>(child.status.st_mtim.tv_sec) * 1000000000
+                                   + child.status.st_mtim.tv_nsec,
+                               static_cast<std::uint32_t>(child.status.st_mode & 07777),
+                               IS_DIR});
+            if (IS_DIR && !walk_archive_tree(dir / child.name, name, max_entries, entries)) {
+                return false;
+            }
+            name.resize(LENGTH);
+        }
+        return true;
+    }
+
+    /**
+     * @brief Compute the CRC-32 of the first bytes of a file
+     *
+     * @param path file path
+     * @param size bytes to read
+     * @param crc set to the CRC-32
+     * @return true if all bytes were read
+     **/
+    auto file_crc(const fs::path& path, std::uint64_t size, std::uint32_t& crc) -> bool {
+        crc = static_cast<std::uint32_t>(::crc32(0, Z_NULL, 0));
+        int const FD = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (FD == -1) {
+            return false;
+        }
+        auto* buffer = static_cast<unsigned char*>(BufferPool::acquire(READ_BLOCK));
+        std::uint64_t done = 0;
+        while (done < size) {
+            auto const COUNT = static_cast<std::size_t>(std::min<std::uint64_t>(size - done, READ_BLOCK));
+            ssize_t const READ = ::pread(FD, buffer, COUNT, static_cast<off_t>(done));
+            if (READ < 0 && errno == EINTR) {
+                continue;
+            }
+            if (READ <= 0) {
+                break;
+            }
+            crc = static_cast<std::uint32_t>(::crc32(crc, buffer, static_cast<uInt>(READ)));
+            done += static_cast<std::uint64_t>(READ);
+        }
+        BufferPool::release(buffer, READ_BLOCK);
+        ::close(FD);
+        return done == size;
+    }
+}    // namespace
+
+/**
+ * @brief Collect the entries of a tree
+ *
+ * @param dir directory
+ * @param top top-level name
+ * @param max_entries entry limit
+ * @param entries output
+ * @return true unless the limit was exceeded
+ **/
+auto scan_archive(const fs::path& dir,
+                  std::string_view top,
+                  std::size_t max_entries,
+                  std::vector<ArchiveEntry>& entries) -> bool {
+    entries.clear();
+    struct stat dir_stat {};
+    if (::stat(dir.c_str(), &dir_stat) != 0) {
+        return true;
+    }
+
+    std::string name(top);
+    name += '/';
+    entries.push_back({name,
+                       0,
+                       static_cast<std::int64_t>(dir_stat.st_mtim.tv_sec) * 1000000000
+                           + dir_stat.st_mtim.tv_nsec,
+                       static_cast<std::uint32_t>(dir_stat.st_mode & 07777),
+                       true});
+    return walk_archive_tree(dir, name, max_entries, entries);
+}
+
+/**
+ * @brief Lay out an archive
+ *
+ * @param dir source directory
+ * @param top top-level name
+ * @param entries entries
+ * @param format TAR or ZIP
+ **/
+ArchiveLayout::ArchiveLayout(fs::path dir,
+                             std::string top,
+                             std::vector<ArchiveEntry> entries,
+                             ArchiveFormat format)
+    : m_DIR(std::move(dir))
+    , m_TOP(std::move(top))
+    , m_ENTRIES(std::move(entries))
+    , m_FORMAT(format)
+    , m_CRCS(m_ENTRIES.size(), 0)
+    , m_CRC_KNOWN(m_ENTRIES.size(), false)
+    , m_OBSERVED(m_ENTRIES.size()) {
+    std::size_t const COUNT = m_ENTRIES.size();
+    bool const ZIP = m_FORMAT == ArchiveFormat::ZIP;
+    m_BATCHES = ZIP ? (COUNT + CENTRAL_BATCH - 1) / CENTRAL_BATCH : 0;
+
+    // Segment k carries the trailer of entry k - 1, then its own header and data
+    m_STARTS.reserve(COUNT + m_BATCHES + 2);
+    std::uint64_t position = 0;
+    for (std::size_t i = 0; i < COUNT; ++i) {
+        const ArchiveEntry& entry = m_ENTRIES[i];
+        m_STARTS.push_back(position);
+        position += i > 0 ? trailer_size(i - 1) : 0;
+        position += ZIP ? zip_local_header_size(entry, entry.size >= ZIP32_LIMIT) : tar_header_size(entry);
+        position += entry.size;
+        if (entry.directory || entry.size == 0) {
+            m_CRC_KNOWN[i] = true;
+        }
+    }
+    std::uint64_t const TRAILER = COUNT > 0 ? trailer_size(COUNT - 1) : 0;
+
+    if (ZIP) {
+        std::uint64_t const CENTRAL_OFFSET = position + TRAILER;
+        for (std::size_t batch = 0; batch < m_BATCHES; ++batch) {
+            m_STARTS.push_back(position);
+            position += batch == 0 ? TRAILER : 0;
+            std::size_t const END = std::min(COUNT, (batch + 1) * CENTRAL_BATCH);
+            for (std::size_t i = batch * CENTRAL_BATCH; i < END; ++i) {
+                const ArchiveEntry& entry = m_ENTRIES[i];
+                position += zip_central_record_size(entry, local_offset(i), entry.size >= ZIP32_LIMIT);
+            }
+        }
+        m_CENTRAL_SIZE = position + (m_BATCHES == 0 ? TRAILER : 0) - CENTRAL_OFFSET;
+        m_STARTS.push_back(position);
+        position += (m_BATCHES == 0 ? TRAILER : 0) + zip_end_size(COUNT, CENTRAL_OFFSET, m_CENTRAL_SIZE);
+    } else {
+        m_STARTS.push_back(position);
+        position += TRAILER + 2 * TAR_BLOCK;
+    }
+    m_STARTS.push_back(position);
+}
+
+/**
+ * @brief Produce the segment holding a position
+ *
+ * @param position archive offset
+ * @param out segment
+ * @return std::uint64_t segment start
+ **/
+auto ArchiveLayout::seek(std::uint64_t position, Segment& out) -> std::uint64_t {
+    // The last start is the archive size, a position there belongs to no segment
+    auto const IT = std::upper_bound(m_STARTS.begin(), m_STARTS.end() - 1, position);
+    auto const INDEX = static_cast<std::size_t>(IT - m_STARTS.begin()) - 1;
+    produce(INDEX, out);
+    m_NEXT = INDEX + 1;
+    return m_STARTS[INDEX];
+}
+
+/**
+ * @brief Produce the following segment
+ *
+ * @param out segment
+ * @return true unless past the end
+ **/
+auto ArchiveLayout::next(Segment& out) -> bool {
+    if (m_NEXT + 1 >= m_STARTS.size()) {
+        return false;
+    }
+    produce(m_NEXT++, out);
+    return true;
+}
+
+/**
+ * @brief Fold sent bytes into the CRC of the observed file
+ *
+ * @param data file bytes
+ **/
+void ArchiveLayout::observe(std::string_view data) {
+    if (m_OBSERVED >= m_ENTRIES.size()) {
+        return;
+    }
+    m_OBSERVED_CRC = static_cast<std::uint32_t>(
+        ::crc32(m_OBSERVED_CRC, reinterpret_cast<const Bytef*>(data.data()), static_cast<uInt>(data.size())));
+    m_OBSERVED_BYTES += data.size();
+    if (m_OBSERVED_BYTES == m_ENTRIES[m_OBSERVED].size) {
+        m_CRCS[m_OBSERVED] = m_OBSERVED_CRC;
+        m_CRC_KNOWN[m_OBSERVED] = true;
+        m_OBSERVED = m_ENTRIES.size();
+    }
+}
+
+/**
+ * @brief Get the entity tag
+ *
+ * @return std::string tag
+ **/
+auto ArchiveLayout::etag() const -> std::string {
+    std::uint64_t hash = 14695981039346656037ULL;
+    auto fold = [&hash](const void* data, std::size_t size)
+    {
+        const auto* bytes = static_cast<const unsigned char*>(data);
+        for (std::size_t i = 0; i < size; ++i) {
+            hash = (hash ^ bytes[i]) * 1099511628211ULL;
+        }
+    };
+    for (const auto& entry : m_ENTRIES) {
+        fold(entry.name.c_str(), entry.name.size() + 1);
+        fold(&entry.size, sizeof(entry.size));
+        fold(&entry.mtime_ns, sizeof(entry.mtime_ns));
+        fold(&entry.mode, sizeof(entry.mode));
+    }
+
+    char tag[40];
+    std::snprintf(tag,
+                  sizeof(tag),
+                  "\"%016llx-%s\"",
+                  static_cast<unsigned long long>(hash),
+                  m_FORMAT == ArchiveFormat::ZIP ? "zip" : "tar");
+    return tag;
+}
+
+/**
+ * @brief Get the newest mtime
+ *
+ * @return std::time_t mtime
+ **/
+auto ArchiveLayout::last_modified() const -> std::time_t {
+    std::int64_t newest = 0;
+    for (const auto& entry : m_ENTRIES) {
+        newest = std::max(newest, seconds_of(entry.mtime_ns));
+    }
+    return static_cast<std::time_t>(newest);
+}
+
+/**
+ * @brief Build a segment
+ *
+ * @param index segment number
+ * @param out segment
+ **/
+void ArchiveLayout::produce(std::size_t index, Segment& out) {
+    std::size_t const COUNT = m_ENTRIES.size();
+    out = {};
+    if (index > 0 && index <= COUNT) {
+        append_trailer(out.prefix, index - 1);
+    }
+
+    if (index < COUNT) {
+        const ArchiveEntry& entry = m_ENTRIES[index];
+        if (m_FORMAT == ArchiveFormat::ZIP) {
+            append_zip_local_header(out.prefix, entry, ZIP_STORED, entry.size >= ZIP32_LIMIT);
+        } else {
+            append_tar_entry_header(out.prefix, entry);
+        }
+        if (entry.size > 0) {
+            out.path = entry_path(index);
+            out.length = entry.size;
+        }
+        // The CRC is taken from the bytes as they are sent
+        if (m_FORMAT == ArchiveFormat::ZIP && !m_CRC_KNOWN[index]) {
+            out.observe = true;
+            m_OBSERVED = index;
+            m_OBSERVED_BYTES = 0;
+            m_OBSERVED_CRC = static_cast<std::uint32_t>(::crc32(0, Z_NULL, 0));
+        }
+        return;
+    }
+
+    if (index < COUNT + m_BATCHES) {
+        std::size_t const BATCH = index - COUNT;
+        for (std::size_t i = BATCH * CENTRAL_BATCH; i < std::min(COUNT, (BATCH + 1) * CENTRAL_BATCH); ++i) {
+            const ArchiveEntry& entry = m_ENTRIES[i];
+            append_zip_central_record(
+                out.prefix,
+                {entry, ZIP_STORED, entry_crc(i), entry.size, local_offset(i), entry.size >= ZIP32_LIMIT});
+        }
+        return;
+    }
+
+    if (m_FORMAT == ArchiveFormat::ZIP) {
+        std::uint64_t const CENTRAL_OFFSET = m_STARTS[COUNT] + (COUNT > 0 ? trailer_size(COUNT - 1) : 0);
+        append_zip_end(out.prefix, COUNT, CENTRAL_OFFSET, m_CENTRAL_SIZE);
+    } else {
+        out.prefix.append(2 * TAR_BLOCK, '\0');
+    }
+}
+
+/**
+ * @brief Length of the bytes after an entry's data
+ *
+ * @param index entry number
+ * @return std::uint64_t length
+ **/
+auto ArchiveLayout::trailer_size(std::size_t index) const -> std::uint64_t {
+    const ArchiveEntry& entry = m_ENTRIES[index];
+    if (m_FORMAT == ArchiveFormat::ZIP) {
+        return entry.directory ? 0 : zip_descriptor_size(entry.size >= ZIP32_LIMIT);
+    }
+    return tar_blocks(entry.size) - entry.size;
+}
+
+/**
+ * @brief Append the bytes after an entry's data
+ *
+ * @param out output
+ * @param index entry number
+ **/
+void ArchiveLayout::append_trailer(std::string& out, std::size_t index) {
+    const ArchiveEntry& entry = m_ENTRIES[index];
+    if (m_FORMAT != ArchiveFormat::ZIP) {
+        out.append(static_cast<std::size_t>(trailer_size(index)), '\0');
+        return;
+    }
+    if (!entry.directory) {
+        append_zip_descriptor(out, entry_crc(index), entry.size, entry.size, entry.size >= ZIP32_LIMIT);
+    }
+}
+
+/**
+ * @brief Get the CRC of an entry
+ *
+ * @param index entry number
+ * @return std::uint32_t CRC-32
+ **/
+auto ArchiveLayout::entry_crc(std::size_t index) -> std::uint32_t {
+    if (!m_CRC_KNOWN[index]) {
+        std::uint32_t crc = 0;
+        if (!file_crc(entry_path(index), m_ENTRIES[index].size, crc)) {
+            log_error("Cannot read %s for its CRC, the archive entry will not verify\n",
+                      entry_path(index).c_str());
+        }
+        m_CRCS[index] = crc;
+        m_CRC_KNOWN[index] = true;
+    }
+    return m_CRCS[index];
+}
+
+/**
+ * @brief Get the file path of an entry
+ *
+ * @param index entry number
+ * @return fs::path path
+ **/
+auto ArchiveLayout::entry_path(std::size_t index) const -> fs::path {
+    return m_DIR / m_ENTRIES[index].name.substr(m_TOP.size() + 1);
+}
+
+/**
+ * @brief Set up the deflate stream
+ *
+ * @param dir source directory
+ * @param top top-level name
+ * @param entries entries
+ **/
+ZipDeflateStream::ZipDeflateStream(fs::path dir, std::string top, std::vector<ArchiveEntry> entries)
+    : m_DIR(std::move(dir))
+    , m_TOP(std::move(top))
+    , m_ENTRIES(std::move(entries))
+    , m_WRITTEN(m_ENTRIES.size()) {
+    auto* stream = new z_stream {};
+    // Negative window bits: raw deflate, zip has its own framing
+    if (deflateInit2(stream, DEFLATE_LEVEL, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        delete stream;
+        throw std::bad_alloc();
+    }
+    m_ZSTREAM = stream;
+    m_INPUT = static_cast<char*>(BufferPool::acquire(READ_BLOCK));
+}
+
+/**
+ * @brief Release zlib, the buffer and any open file
+ *
+ **/
+ZipDeflateStream::~ZipDeflateStream() {
+    auto* stream = static_cast<z_stream*>(m_ZSTREAM);
+    deflateEnd(stream);
+    delete stream;
+    BufferPool::release(m_INPUT, READ_BLOCK);
+    if (m_FD != -1) {
+        ::close(m_FD);
+    }
+}
+
+/**
+ * @brief Produce the next piece of the archive
+ *
+ * @param out output
+ * @return true while more follows
+ **/
+auto ZipDeflateStream::next(std::string& out) -> bool {
+    std::size_t const START = out.size();
+    auto position = [&] { return m_OFFSET + (out.size() - START); };
+
+    while (out.size() - START < DEFLATE_PIECE) {
+        if (m_ENTRY == m_ENTRIES.size()) {
+            if (m_RECORD == 0) {
+                m_CENTRAL_OFFSET = position();
+            }
+            // The central directory of a large tree spans several pieces too
+            while (m_RECORD < m_ENTRIES.size() && out.size() - START < DEFLATE_PIECE) {
+                Written const& written = m_WRITTEN[m_RECORD];
+                append_zip_central_record(out,
+                                          {m_ENTRIES[m_RECORD],
+                                           ZIP_DEFLATED,
+                                           written.crc,
+                                           written.compressed,
+                                           written.offset,
+                                           written.zip64});
+                ++m_RECORD;
+            }
+            if (m_RECORD < m_ENTRIES.size()) {
+                break;
+            }
+            append_zip_end(out, m_ENTRIES.size(), m_CENTRAL_OFFSET, position() - m_CENTRAL_OFFSET);
+            m_OFFSET = position();
+            return false;
+        }
+
+        const ArchiveEntry& entry = m_ENTRIES[m_ENTRY];
+        if (!m_IN_ENTRY) {
+            Written& written = m_WRITTEN[m_ENTRY];
+            written.offset = position();
+            written.zip64 = !entry.directory && entry.size >= ZIP_DEFLATE_ZIP64_SIZE;
+            append_zip_local_header(out, entry, ZIP_DEFLATED, written.zip64);
+            if (entry.directory) {
+                ++m_ENTRY;
+                continue;
+            }
+
+            m_FD = ::open(entry_path().c_str(), O_RDONLY | O_CLOEXEC);
+            if (m_FD == -1) {
+                // The header is out already, the entry stays and ends up empty
+                log_error("Cannot open %s for the archive: %s\n", entry_path().c_str(), std::strerror(errno));
+            }
+            deflateReset(static_cast<z_stream*>(m_ZSTREAM));
+            written.crc = static_cast<std::uint32_t>(::crc32(0, Z_NULL, 0));
+            m_DATA_START = position();
+            m_READ = 0;
+            m_IN_ENTRY = true;
+        }
+
+        if (deflate_piece(out)) {
+            m_WRITTEN[m_ENTRY].compressed = position() - m_DATA_START;
+            finish_entry(out);
+        }
+    }
+
+    m_OFFSET = position();
+    return true;
+}
+
+/**
+ * @brief Read and deflate one block of the current file
+ *
+ * @param out output
+ * @return true once the file is complete
+ **/
+auto ZipDeflateStream::deflate_piece(std::string& out) -> bool {
+    const ArchiveEntry& entry = m_ENTRIES[m_ENTRY];
+    auto* stream = static_cast<z_stream*>(m_ZSTREAM);
+
+    ssize_t read = 0;
+    if (m_FD != -1 && m_READ < entry.size) {
+        auto const COUNT = static_cast<std::size_t>(std::min<std::uint64_t>(entry.size - m_READ, READ_BLOCK));
+        do {
+            read = ::pread(m_FD, m_INPUT, COUNT, static_cast<off_t>(m_READ));
+        } while (read < 0 && errno == EINTR);
+    }
+    if (read > 0) {
+        std::uint32_t& crc = m_WRITTEN[m_ENTRY].crc;
+        crc = static_cast<std::uint32_t>(
+            ::crc32(crc, reinterpret_cast<const Bytef*>(m_INPUT), static_cast<uInt>(read)));
+        m_READ += static_cast<std::uint64_t>(read);
+    }
+    // A file which shrank simply ends early; the descriptor carries what was read
+    bool const LAST = read <= 0 || m_READ == entry.size;
+
+    stream->next_in = reinterpret_cast<Bytef*>(m_INPUT);
+    stream->avail_in = read > 0 ? static_cast<uInt>(read) : 0;
+    int result = Z_OK;
+    do {
+        std::size_t const BEFORE = out.size();
+        std::size_t const ROOM = deflateBound(stream, stream->avail_in) + 64;
+        out.resize(BEFORE + ROOM);
+        stream->next_out = reinterpret_cast<Bytef*>(out.data() + BEFORE);
+        stream->avail_out = static_cast<uInt>(ROOM);
+        result = deflate(stream, LAST ? Z_FINISH : Z_NO_FLUSH);
+        out.resize(BEFORE + ROOM - stream->avail_out);
+    } while (stream->avail_out == 0 || (LAST && result != Z_STREAM_END));
+    return LAST;
+}
+
+/**
+ * @brief Close the current file and write its descriptor
+ *
+ * @param out output
+ **/
+void ZipDeflateStream::finish_entry(std::string& out) {
+    Written const& written = m_WRITTEN[m_ENTRY];
+    if (m_FD != -1) {
+        ::close(m_FD);
+        m_FD = -1;
+    }
+    // What was read becomes the size of the entry, in the descriptor and the central directory
+    m_ENTRIES[m_ENTRY].size = m_READ;
+    append_zip_descriptor(out, written.crc, written.compressed, m_READ, written.zip64);
+    m_IN_ENTRY = false;
+    ++m_ENTRY;
+}
+
+/**
+ * @brief Get the file path of the current entry
+ *
+ * @return fs::path path
+ **/
+auto ZipDeflateStream::entry_path() const -> fs::path {
+    return m_DIR / m_ENTRIES[m_ENTRY].name.substr(m_TOP.size() + 1);
+}
@@ -0,0 +1,267 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include "file_transfer.hpp"
+#include "http_utils.hpp"
+
+namespace fs = boost::filesystem;
+
+/**
+ * @brief Most entries an archive of a directory may have
+ *
+ * The layout of an archive keeps every entry in memory while it is sent;
+ * larger trees are refused.
+ **/
+constexpr std::size_t MAX_ARCHIVE_ENTRIES = 200000;
+
+/**
+ * @brief One file or directory of an archive
+ *
+ **/
+struct ArchiveEntry {
+    std::string name;    // path inside the archive, '/' separated, directories end with '/'
+    std::uint64_t size = 0;
+    std::int64_t mtime_ns = 0;
+    std::uint32_t mode = 0;    // permission bits
+    bool directory = false;
+};
+
+/**
+ * @brief Collect the entries of a directory tree in archive order
+ *
+ * The walk is depth-first with the names of every directory sorted
+ * bytewise, so the same tree always yields the same archive. Every name
+ * starts with @p top and a slash, the directory itself being the first
+ * entry. Symbolic links to files are archived as the files they point to;
+ * symbolic links to directories are skipped, which also keeps loops out.
+ * Entries which cannot be stat'ed or read are skipped.
+ *
+ * @param dir directory to archive
+ * @param top name of the top-level directory inside the archive
+ * @param max_entries most entries to collect
+ * @param entries receives the entries
+ * @return true unless the tree has more than @p max_entries entries
+ **/
+auto scan_archive(const fs::path& dir,
+                  std::string_view top,
+                  std::size_t max_entries,
+                  std::vector<ArchiveEntry>& entries) -> bool;
+
+class ArchiveLayout : public PartSource {
+    /**
+     * @brief ArchiveLayout - a tar or stored zip of a directory tree, laid out in advance
+     *
+     * Both formats put every file's bytes verbatim after a header, so the
+     * offset of every header and file is known from the sizes alone and the
+     * whole archive has a Content-Length before a byte is read. Each segment
+     * is the bytes which follow the previous file (tar padding or a zip data
+     * descriptor) and the header of the next one, then that file's bytes,
+     * which go out with sendfile(2) like any other file. A ranged request
+     * seeks straight to the segment holding its first byte.
+     *
+     * Zip also needs the CRC-32 of every file, for its data descriptor and
+     * the central directory. Local headers announce a data descriptor, so
+     * the CRC is only needed after the file: zip files are sent through the
+     * copy buffer, which sees their bytes anyway, and the CRC is taken from
+     * them. A file whose bytes were not all seen (a resumed download) is
+     * read once more for its CRC when the descriptor or the central
+     * directory is produced.
+     *
+     * Sizes of 4 GiB and more use zip64 fields, tar entries with long names
+     * or sizes of 8 GiB and more get a pax extended header; small archives
+     * carry neither.
+     **/
+
+  public:
+    /**
+     * @brief Number of central directory records produced per segment
+     *
+     **/
+    static constexpr std::size_t CENTRAL_BATCH = 256;
+
+    /**
+     * @brief Construct a new Archive Layout object
+     *
+     * @param dir directory the entries were collected from
+     * @param top name of the top-level directory, the prefix of every entry name
+     * @param entries entries from scan_archive()
+     * @param format TAR or ZIP
+     **/
+    ArchiveLayout(fs::path dir, std::string top, std::vector<ArchiveEntry> entries, ArchiveFormat format);
+
+    auto size() const -> std::uint64_t override { return m_STARTS.back(); }
+
+    auto seek(std::uint64_t position, Segment& out) -> std::uint64_t override;
+
+    auto next(Segment& out) -> bool override;
+
+    void observe(std::string_view data) override;
+
+    /**
+     * @brief Get the entity tag of the archive
+     *
+     * Derived from the format and the name, size, mode and exact mtime of
+     * every entry, which determine every byte but the zip CRCs.
+     *
+     * @return std::string strong entity tag
+     **/
+    auto etag() const -> std::string;
+
+    /**
+     * @brief Get the newest modification time of the entries
+     *
+     * @return std::time_t last modification
+     **/
+    auto last_modified() const -> std::time_t;
+
+  private:
+    /**
+     * @brief Build segment @p index
+     *
+     * @param index segment number
+     * @param out receives the segment
+     **/
+    void produce(std::size_t index, Segment& out);
+
+    /**
+     * @brief Bytes following the data of an entry
+     *
+     * @param index entry number
+     * @return std::uint64_t tar padding or zip data descriptor length
+     **/
+    auto trailer_size(std::size_t index) const -> std::uint64_t;
+
+    /**
+     * @brief Append the bytes following the data of an entry
+     *
+     * @param out output
+     * @param index entry number
+     **/
+    void append_trailer(std::string& out, std::size_t index);
+
+    /**
+     * @brief Get the CRC-32 of a file entry, reading the file if it was not observed
+     *
+     * @param index entry number
+     * @return std::uint32_t CRC-32
+     **/
+    auto entry_crc(std::size_t index) -> std::uint32_t;
+
+    /**
+     * @brief Get the offset of the local header of a zip entry
+     *
+     * @param index entry number
+     * @return std::uint64_t archive offset
+     **/
+    auto local_offset(std::size_t index) const -> std::uint64_t {
+        return m_STARTS[index] + (index > 0 ? trailer_size(index - 1) : 0);
+    }
+
+    /**
+     * @brief Get the path of the file of an entry
+     *
+     * @param index entry number
+     * @return fs::path file path
+     **/
+    auto entry_path(std::size_t index) const -> fs::path;
+
+    fs::path m_DIR;
+    std::string m_TOP;
+    std::vector<ArchiveEntry> m_ENTRIES;
+    ArchiveFormat m_FORMAT;
+
+    std::size_t m_BATCHES = 0;
+    std::vector<std::uint64_t> m_STARTS;    // offset of every segment, then the archive size
+    std::uint64_t m_CENTRAL_SIZE = 0;
+    std::size_t m_NEXT = 0;
+
+    std::vector<std::uint32_t> m_CRCS;
+    std::vector<bool> m_CRC_KNOWN;
+    std::size_t m_OBSERVED = 0;
+    std::uint64_t m_OBSERVED_BYTES = 0;
+    std::uint32_t m_OBSERVED_CRC = 0;
+};
+
+class ZipDeflateStream : public BodyStream {
+    /**
+     * @brief ZipDeflateStream - a deflated zip of a directory tree, compressed while it is sent
+     *
+     * Compressed sizes are only known once a file has gone through zlib, so
+     * the archive has no length up front and no ranges; the session sends it
+     * chunked. Every file is read and deflated in pieces of a fixed size,
+     * and every local header announces a data descriptor which carries the
+     * CRC-32 and sizes after the data.
+     **/
+
+  public:
+    /**
+     * @brief Construct a new Zip Deflate Stream object
+     *
+     * @param dir directory the entries were collected from
+     * @param top name of the top-level directory, the prefix of every entry name
+     * @param entries entries from scan_archive()
+     **/
+    ZipDeflateStream(fs::path dir, std::string top, std::vector<ArchiveEntry> entries);
+
+    ~ZipDeflateStream() override;
+
+    auto next(std::string& out) -> bool override;
+
+  private:
+    /**
+     * @brief What is produced per entry
+     *
+     **/
+    struct Written {
+        std::uint32_t crc = 0;
+        std::uint64_t compressed = 0;
+        std::uint64_t offset = 0;
+        bool zip64 = false;
+    };
+
+    /**
+     * @brief Deflate the next input piece of the current file
+     *
+     * @param out output
+     * @return true once the file is complete
+     **/
+    auto deflate_piece(std::string& out) -> bool;
+
+    /**
+     * @brief Close the current file and append its data descriptor
+     *
+     * @param out output
+     **/
+    void finish_entry(std::string& out);
+
+    /**
+     * @brief Get the path of the file of the current entry
+     *
+     * @return fs::path file path
+     **/
+    auto entry_path() const -> fs::path;
+
+    fs::path m_DIR;
+    std::string m_TOP;
+    std::vector<ArchiveEntry> m_ENTRIES;
+    std::vector<Written> m_WRITTEN;
+
+    void* m_ZSTREAM = nullptr;
+    char* m_INPUT = nullptr;
+    std::size_t m_ENTRY = 0;
+    bool m_IN_ENTRY = false;
+    int m_FD = -1;
+    std::uint64_t m_READ = 0;
+    std::uint64_t m_DATA_START = 0;
+    std::uint64_t m_OFFSET = 0;
+    std::size_t m_RECORD = 0;
+    std::uint64_t m_CENTRAL_OFFSET = 0;
+};
@@ -0,0 +1,159 @@
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <memory_resource>
+#include <new>
+#include <utility>
+
+#include "arena.hpp"
+
+/**
+ * @brief Anonymous namespace for helper functions
+ *
+ **/
+namespace {
+    constexpr std::size_t SIZE_CLASSES = std::countr_zero(BufferPool::MAX_BLOCK / BufferPool::MIN_BLOCK) + 1;
+
+    /**
+     * @brief Blocks cached by one thread
+     *
+     **/
+    struct Freelists {
+        struct Node {
+            Node* next;
+        };
+
+        std::array<Node*, SIZE_CLASSES> heads {};
+        std::array<std::size_t, SIZE_CLASSES> cached_bytes {};
+
+        Freelists() = default;
+        Freelists(const Freelists&) = delete;
+        auto operator=(const Freelists&) -> Freelists& = delete;
+
+        ~Freelists() {
+            for (Node* head : heads) {
+                while (head != nullptr) {
+                    ::operator delete(std::exchange(head, head->next));
+                }
+            }
+        }
+    };
+
+    thread_local Freelists t_FREELISTS;
+
+    /**
+     * @brief Index of the size class of a pooled block size
+     *
+     * @param block_size power of two between MIN_BLOCK and MAX_BLOCK
+     * @return std::size_t index
+     **/
+    auto size_class(std::size_t block_size) -> std::size_t {
+        return static_cast<std::size_t>(std::countr_zero(block_size / BufferPool::MIN_BLOCK));
+    }
+
+    class PooledResource : public std::pmr::memory_resource {
+        /**
+         * @brief PooledResource - upstream of the arenas, serving blocks from the BufferPool
+         *
+         **/
+
+      private:
+        auto do_allocate(std::size_t bytes, std::size_t alignment) -> void* override {
+            if (alignment > __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+                return ::operator new(bytes, std::align_val_t {alignment});
+            }
+            return BufferPool::acquire(bytes);
+        }
+
+        void do_deallocate(void* block, std::size_t bytes, std::size_t alignment) override {
+            if (alignment > __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+                ::operator delete(block, std::align_val_t {alignment});
+                return;
+            }
+            BufferPool::release(block, bytes);
+        }
+
+        auto do_is_equal(const std::pmr::memory_resource& other) const noexcept -> bool override {
+            return this == &other;
+        }
+    };
+
+    PooledResource g_POOLED_RESOURCE;
+}    // namespace
+
+/**
+ * @brief Round a size up to its block size
+ *
+ * @param size requested bytes
+ * @return std::size_t block size
+ **/
+auto BufferPool::block_size(std::size_t size) -> std::size_t {
+    if (size > MAX_BLOCK) {
+        return size;
+    }
+    return std::bit_ceil(size < MIN_BLOCK ? MIN_BLOCK : size);
+}
+
+/**
+ * @brief Take a block
+ *
+ * @param size requested bytes
+ * @return void* block
+ **/
+auto BufferPool::acquire(std::size_t size) -> void* {
+    std::size_t const BLOCK = block_size(size);
+    if (BLOCK > MAX_BLOCK) {
+        return ::operator new(BLOCK);
+    }
+
+    std::size_t const CLASS = size_class(BLOCK);
+    if (Freelists::Node* node = t_FREELISTS.heads[CLASS]) {
+        t_FREELISTS.heads[CLASS] = node->next;
+        t_FREELISTS.cached_bytes[CLASS] -= BLOCK;
+        return node;
+    }
+    return ::operator new(BLOCK);
+}
+
+/**
+ * @brief Give a block back
+ *
+ * @param block block
+ * @param size requested bytes
+ **/
+void BufferPool::release(void* block, std::size_t size) noexcept {
+    if (block == nullptr) {
+        return;
+    }
+    std::size_t const BLOCK = block_size(size);
+    if (BLOCK > MAX_BLOCK) {
+        ::operator delete(block);
+        return;
+    }
+
+    std::size_t const CLASS = size_class(BLOCK);
+    if (t_FREELISTS.cached_bytes[CLASS] + BLOCK > MAX_CACHED_BYTES) {
+        ::operator delete(block);
+        return;
+    }
+    auto* node = ::new (block) Freelists::Node {t_FREELISTS.heads[CLASS]};
+    t_FREELISTS.heads[CLASS] = node;
+    t_FREELISTS.cached_bytes[CLASS] += BLOCK;
+}
+
+/**
+ * @brief Construct a new ConnectionArena object around a block of the pool
+ *
+ **/
+ConnectionArena::ConnectionArena()
+    : m_INITIAL(BufferPool::acquire(INITIAL_SIZE))
+    , m_RESOURCE(m_INITIAL, INITIAL_SIZE, &g_POOLED_RESOURCE) {}
+
+/**
+ * @brief Destroy the ConnectionArena object, returning its blocks to the pool
+ *
+ **/
+ConnectionArena::~ConnectionArena() {
+    m_RESOURCE.release();
+    BufferPool::release(m_INITIAL, INITIAL_SIZE);
+}
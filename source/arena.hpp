@@ -0,0 +1,203 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <new>
+#include <type_traits>
+
+#include <boost/beast/core/flat_buffer.hpp>
+#include <boost/beast/http/fields.hpp>
+#include <boost/beast/http/message.hpp>
+#include <boost/beast/http/string_body.hpp>
+
+namespace beast = boost::beast;
+namespace http = beast::http;
+
+class BufferPool {
+    /**
+     * @brief BufferPool - per-thread freelists of buffers and arena blocks
+     *
+     * Blocks come in power-of-two sizes from MIN_BLOCK to MAX_BLOCK. A
+     * released block goes onto a freelist of the releasing thread, up to
+     * MAX_CACHED_BYTES per size, and the next acquire of that size on the
+     * thread takes it back, so steady traffic does not reach malloc. Larger
+     * blocks, and blocks beyond the cap, go to the global heap.
+     *
+     * A block may be released on another thread than the one which acquired
+     * it; it then simply joins the freelist of that thread.
+     **/
+
+  public:
+    static constexpr std::size_t MIN_BLOCK = 4 * 1024;
+    static constexpr std::size_t MAX_BLOCK = 256 * 1024;
+    static constexpr std::size_t MAX_CACHED_BYTES = 2 * 1024 * 1024;
+
+    /**
+     * @brief Size of the block which serves a request
+     *
+     * @param size requested bytes
+     * @return std::size_t bytes actually reserved
+     **/
+    static auto block_size(std::size_t size) -> std::size_t;
+
+    /**
+     * @brief Take a block from the freelist of this thread, or allocate one
+     *
+     * @param size requested bytes, the block is aligned for any type
+     * @return void* block of block_size(size) bytes
+     **/
+    static auto acquire(std::size_t size) -> void*;
+
+    /**
+     * @brief Give a block back
+     *
+     * @param block block returned by acquire()
+     * @param size size passed to acquire()
+     **/
+    static void release(void* block, std::size_t size) noexcept;
+};
+
+/**
+ * @brief Standard allocator over the BufferPool, for connection buffers
+ *
+ **/
+template <class T>
+class PooledAllocator {
+  public:
+    static_assert(alignof(T) <= __STDCPP_DEFAULT_NEW_ALIGNMENT__,
+                  "BufferPool blocks have the default alignment");
+
+    using value_type = T;
+
+    PooledAllocator() noexcept = default;
+
+    template <class U>
+    PooledAllocator(const PooledAllocator<U>& /*other*/) noexcept {}
+
+    auto allocate(std::size_t count) -> T* { return static_cast<T*>(BufferPool::acquire(count * sizeof(T))); }
+
+    void deallocate(T* block, std::size_t count) noexcept { BufferPool::release(block, count * sizeof(T)); }
+
+    template <class U>
+    auto operator==(const PooledAllocator<U>& /*other*/) const -> bool {
+        return true;
+    }
+};
+
+/**
+ * @brief Read buffer of a connection, grown from the BufferPool
+ *
+ **/
+using PooledFlatBuffer = beast::basic_flat_buffer<PooledAllocator<char>>;
+
+class ConnectionArena {
+    /**
+     * @brief ConnectionArena - memory for one request at a time of a connection
+     *
+     * A monotonic arena: allocation bumps a pointer and deallocation does
+     * nothing. Its first block is taken from the BufferPool when the
+     * connection opens, further blocks come from the pool too. reset() drops
+     * everything at once between keep-alive requests, returning the extra
+     * blocks to the pool and starting over in the first one.
+     *
+     * Everything allocated from the arena must be destroyed before reset().
+     **/
+
+  public:
+    /**
+     * @brief Size of the first block, enough for the fields of a typical request and its response
+     *
+     **/
+    static constexpr std::size_t INITIAL_SIZE = 16 * 1024;
+
+    ConnectionArena();
+    ~ConnectionArena();
+
+    ConnectionArena(const ConnectionArena&) = delete;
+    auto operator=(const ConnectionArena&) -> ConnectionArena& = delete;
+
+    /**
+     * @brief Get the memory resource of the arena
+     *
+     * @return std::pmr::memory_resource* resource
+     **/
+    auto resource() -> std::pmr::memory_resource* { return &m_RESOURCE; }
+
+    /**
+     * @brief Release all memory allocated since the last reset
+     *
+     **/
+    void reset() { m_RESOURCE.release(); }
+
+  private:
+    void* m_INITIAL;
+    std::pmr::monotonic_buffer_resource m_RESOURCE;
+};
+
+/**
+ * @brief Allocator over a memory resource which, unlike std::pmr::polymorphic_allocator,
+ * can be assigned
+ *
+ * Beast's basic_fields must move-assign its allocator. The allocator moves
+ * with the container, so a message assigned from one built on the same
+ * arena keeps using the arena. Default-constructed, it allocates from the
+ * global heap like std::allocator.
+ **/
+template <class T>
+class ArenaAllocator {
+  public:
+    using value_type = T;
+    using propagate_on_container_copy_assignment = std::true_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+
+    ArenaAllocator() noexcept = default;
+
+    explicit ArenaAllocator(ConnectionArena& arena) noexcept
+        : m_RESOURCE(arena.resource()) {}
+
+    template <class U>
+    ArenaAllocator(const ArenaAllocator<U>& other) noexcept
+        : m_RESOURCE(other.resource()) {}
+
+    auto allocate(std::size_t count) -> T* {
+        if (m_RESOURCE == nullptr) {
+            return std::allocator<T> {}.allocate(count);
+        }
+        return static_cast<T*>(m_RESOURCE->allocate(count * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* block, std::size_t count) noexcept {
+        if (m_RESOURCE == nullptr) {
+            std::allocator<T> {}.deallocate(block, count);
+            return;
+        }
+        m_RESOURCE->deallocate(block, count * sizeof(T), alignof(T));
+    }
+
+    /**
+     * @brief Get the memory resource
+     *
+     * @return std::pmr::memory_resource* resource, nullptr for the global heap
+     **/
+    auto resource() const -> std::pmr::memory_resource* { return m_RESOURCE; }
+
+    template <class U>
+    auto operator==(const ArenaAllocator<U>& other) const -> bool {
+        return m_RESOURCE == other.resource();
+    }
+
+  private:
+    std::pmr::memory_resource* m_RESOURCE = nullptr;
+};
+
+/**
+ * @brief Header fields allocated from a ConnectionArena
+ *
+ **/
+using ArenaFields = http::basic_fields<ArenaAllocator<char>>;
+
+using ArenaRequest = http::request<http::string_body, ArenaFields>;
+using ArenaRequestHeader = http::request_header<ArenaFields>;
+using ArenaResponse = http::response<http::string_body, ArenaFields>;
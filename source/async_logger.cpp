@@ -0,0 +1,613 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "async_logger.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "logger.hpp"
+
+/**
+ * @brief Anonymous namespace for helper functions
+ *
+ **/
+namespace {
+    /**
+     * @brief How long the drainer sleeps when the rings are empty
+     *
+     **/
+    constexpr std::chrono::milliseconds IDLE_WAIT {5};
+
+    /**
+     * @brief Ring of the calling thread, owned through the logger's registry
+     *
+     **/
+    thread_local std::shared_ptr<void> t_RING;
+
+    /**
+     * @brief Record of a thread which logs after the drainer stopped
+     *
+     **/
+    thread_local AsyncLogger::Record t_SCRATCH;
+
+    /**
+     * @brief Whether the pending record is t_SCRATCH, written synchronously
+     *
+     **/
+    thread_local bool t_SYNCHRONOUS = false;
+
+    /**
+     * @brief Sequential reader of a record payload
+     *
+     **/
+    struct PayloadReader {
+        const AsyncLogger::Record& record;
+        std::size_t pos = 0;
+
+        auto next(AsyncLogger::ArgType& type) -> bool {
+            if (pos >= record.size) {
+                return false;
+            }
+            type = static_cast<AsyncLogger::ArgType>(record.payload[pos++]);
+            return true;
+        }
+
+        template<typename T>
+        auto value() -> T {
+            T result {};
+            std::memcpy(&result, record.payload.data() + pos, sizeof(T));
+            pos += sizeof(T);
+            return result;
+        }
+
+        auto text() -> std::string {
+            auto const LENGTH = value<std::uint16_t>();
+            std::string result(reinterpret_cast<const char*>(record.payload.data() + pos), LENGTH);
+            pos += LENGTH;
+            return result;
+        }
+    };
+
+    /**
+     * @brief snprintf one value into a string
+     *
+     * @param out target
+     * @param spec conversion specification
+     * @param value value
+     **/
+#pragma GCC diagnostic push
+    // spec holds only flags, width and precision, and a conversion picked to match T by append_argument
+#pragma GCC diagnostic ignored "-Wformat-nonliteral"
+    template<typename T>
+    void append_formatted(std::string& out, const std::string& spec, T value) {
+        char buffer[128];
+        int const LENGTH = std::snprintf(buffer, sizeof(buffer), spec.c_str(), value);
+        if (LENGTH < 0) {
+            return;
+        }
+        if (static_cast<std::size_t>(LENGTH) < sizeof(buffer)) {
+            out.append(buffer, static_cast<std::size_t>(LENGTH));
+            return;
+        }
+        std::size_t const START = out.size();
+        out.resize(START + static_cast<std::size_t>(LENGTH) + 1);
+        std::snprintf(out.data() + START, static_cast<std::size_t>(LENGTH) + 1, spec.c_str(), value);
+        out.resize(START + static_cast<std::size_t>(LENGTH));
+    }
+#pragma GCC diagnostic pop
+
+    /**
+     * @brief Append the value of a '*' width or precision to a conversion specification
+     *
+     * @param spec specification
+     * @param reader payload reader positioned at the int argument
+     * @return long value, 0 if the argument is missing
+     **/
+    auto append_star(std::string& spec, PayloadReader& reader) -> long {
+        AsyncLogger::ArgType type {};
+        if (!reader.next(type)) {
+            return 0;
+        }
+        auto const VALUE = type == AsyncLogger::ArgType::SIGNED
+            ? reader.value<std::int64_t>()
+            : static_cast<std::int64_t>(reader.value<std::uint64_t>());
+        spec += std::to_string(VALUE);
+        return static_cast<long>(VALUE);
+    }
+
+    /**
+     * @brief Format one argument for one conversion
+     *
+     * Length modifiers of the format are replaced by the width the value was
+     * stored with, so "%zu", "%lu" and "%u" all print a 64-bit value.
+     *
+     * @param out target
+     * @param spec flags, width and precision, starting with '%'
+     * @param conversion conversion character
+     * @param reader payload reader positioned at the argument
+     **/
+    void append_argument(std::string& out, const std::string& spec, char conversion, PayloadReader& reader) {
+        AsyncLogger::ArgType type {};
+        if (!reader.next(type)) {
+            out.append("<?>");
+            return;
+        }
+
+        bool const INTEGER_CONVERSION = std::strchr("diuxXoc", conversion) != nullptr;
+        switch (type) {
+            case AsyncLogger::ArgType::SIGNED: {
+                auto const VALUE = reader.value<std::int64_t>();
+                if (conversion == 'c') {
+                    append_formatted(out, spec + 'c', static_cast<int>(VALUE));
+                } else if (conversion == 'd' || conversion == 'i' || !INTEGER_CONVERSION) {
+                    append_formatted(out, spec + "lld", static_cast<long long>(VALUE));
+                } else {
+                    append_formatted(out, spec + "ll" + conversion, static_cast<unsigned long long>(VALUE));
+                }
+                break;
+            }
+            case AsyncLogger::ArgType::UNSIGNED: {
+                auto const VALUE = reader.value<std::uint64_t>();
+                if (conversion == 'c') {
+                    append_formatted(out, spec + 'c', static_cast<int>(VALUE));
+                } else if (conversion == 'd' || conversion == 'i') {
+                    append_formatted(out, spec + "lld", static_cast<long long>(VALUE));
+                } else {
+                    append_formatted(
+                        out, spec + "ll" + (INTEGER_CONVERSION ? conversion : 'u'), static_cast<unsigned long long>(VALUE));
+                }
+                break;
+            }
+            case AsyncLogger::ArgType::DOUBLE: {
+                auto const VALUE = reader.value<double>();
+                bool const FLOAT_CONVERSION = std::strchr("fFeEgGaA", conversion) != nullptr;
+                append_formatted(out, spec + (FLOAT_CONVERSION ? conversion : 'g'), VALUE);
+                break;
+            }
+            case AsyncLogger::ArgType::STRING: {
+                std::string const TEXT = reader.text();
+                append_formatted(out, spec + 's', TEXT.c_str());
+                break;
+            }
+            case AsyncLogger::ArgType::POINTER: {
+                auto const VALUE = reader.value<std::uintptr_t>();
+                append_formatted(out, spec + 'p', reinterpret_cast<void*>(VALUE));
+                break;
+            }
+        }
+    }
+}    // namespace
+
+/**
+ * @brief Get the logger
+ *
+ * @return AsyncLogger& logger
+ **/
+auto AsyncLogger::instance() -> AsyncLogger& {
+    static AsyncLogger logger;
+    return logger;
+}
+
+/**
+ * @brief Construct a new AsyncLogger::AsyncLogger object
+ *
+ **/
+AsyncLogger::AsyncLogger()
+    : m_LEVEL(LOG_LEVEL_THRESHOLD) {
+    m_THREAD = std::thread([this] { run(); });
+}
+
+/**
+ * @brief Destroy the AsyncLogger::AsyncLogger object, writing what is left
+ *
+ **/
+AsyncLogger::~AsyncLogger() {
+    {
+        std::lock_guard<std::mutex> const LOCK(m_WAKE_MUTEX);
+        m_STOP = true;
+    }
+    m_WAKE_CV.notify_all();
+    if (m_THREAD.joinable()) {
+        m_THREAD.join();
+    }
+    m_STOPPED = true;
+    drain();
+
+    int const FD = m_FD.load();
+    if (FD > 2) {
+        ::close(FD);
+    }
+}
+
+/**
+ * @brief Switch the output to a file
+ *
+ * @param path file path
+ * @return true on success
+ **/
+auto AsyncLogger::open_file(const std::string& path) -> bool {
+    int const FD = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (FD == -1) {
+        return false;
+    }
+    flush();
+    int const OLD = m_FD.exchange(FD);
+    if (OLD > 2) {
+        ::close(OLD);
+    }
+    return true;
+}
+
+/**
+ * @brief Wait for the drainer to catch up
+ *
+ **/
+void AsyncLogger::flush() {
+    if (m_STOPPED) {
+        return;
+    }
+    std::unique_lock<std::mutex> lock(m_WAKE_MUTEX);
+    std::uint64_t const TARGET = ++m_FLUSH_REQUESTS;
+    m_WAKE_CV.notify_all();
+    m_FLUSHED_CV.wait(lock, [this, TARGET] { return m_FLUSHED >= TARGET || m_STOP; });
+}
+
+/**
+ * @brief Parse a level name
+ *
+ * @param name level name
+ * @return int level or -1
+ **/
+auto AsyncLogger::parse_level(std::string_view name) -> int {
+    if (name == "debug") {
+        return LOG_LEVEL_DEBUG;
+    }
+    if (name == "info") {
+        return LOG_LEVEL_INFO;
+    }
+    if (name == "warn") {
+        return LOG_LEVEL_WARN;
+    }
+    if (name == "error") {
+        return LOG_LEVEL_ERROR;
+    }
+    return -1;
+}
+
+/**
+ * @brief Current steady time
+ *
+ * @return std::uint64_t ns
+ **/
+auto AsyncLogger::now_ns() -> std::uint64_t {
+    return static_cast<std::uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+            .count());
+}
+
+/**
+ * @brief Format a record
+ *
+ * @param record record
+ * @param out target
+ * @param colors colored level tag
+ **/
+void AsyncLogger::format(const Record& record, std::string& out, bool colors) {
+    switch (record.level) {
+        case LOG_LEVEL_ERROR:
+            out.append(colors ? "[" RED "ERROR" RESET "]" : "[ERROR]");
+            break;
+        case LOG_LEVEL_WARN:
+            out.append(colors ? "[" YELLOW "WARN" RESET "]" : "[WARN]");
+            break;
+        case LOG_LEVEL_INFO:
+            out.append(colors ? "[" GREEN "INFO" RESET "]" : "[INFO]");
+            break;
+        default:
+            out.append(colors ? "[" BLUE "DEBUG" RESET "]" : "[DEBUG]");
+            break;
+    }
+    out.push_back(' ');
+    if (record.level == LOG_LEVEL_WARN || record.level == LOG_LEVEL_ERROR) {
+        out.append(record.file).push_back(':');
+        out.append(std::to_string(record.line)).append(" ").append(record.function).append("(): ");
+    }
+
+    PayloadReader reader {record};
+    for (const char* p = record.format; *p != '\0';) {
+        if (*p != '%') {
+            const char* const NEXT = std::strchr(p, '%');
+            std::size_t const LENGTH = NEXT == nullptr ? std::strlen(p) : static_cast<std::size_t>(NEXT - p);
+            out.append(p, LENGTH);
+            p += LENGTH;
+            continue;
+        }
+        if (p[1] == '%') {
+            out.push_back('%');
+            p += 2;
+            continue;
+        }
+
+        // %[flags][width][.precision][length]conversion
+        std::string spec = "%";
+        ++p;
+        while (*p != '\0' && std::strchr("-+ #0", *p) != nullptr) {
+            spec.push_back(*p++);
+        }
+        if (*p == '*') {
+            append_star(spec, reader);
+            ++p;
+        }
+        while (*p >= '0' && *p <= '9') {
+            spec.push_back(*p++);
+        }
+        if (*p == '.') {
+            spec.push_back(*p++);
+            if (*p == '*') {
+                // A negative precision counts as none
+                if (append_star(spec, reader) < 0) {
+                    spec.erase(spec.rfind('.'));
+                }
+                ++p;
+            }
+            while (*p >= '0' && *p <= '9') {
+                spec.push_back(*p++);
+            }
+        }
+        while (*p != '\0' && std::strchr("hlLqjzt", *p) != nullptr) {
+            ++p;
+        }
+        if (*p == '\0') {
+            break;
+        }
+        append_argument(out, spec, *p++, reader);
+    }
+
+    if (record.truncated) {
+        // The format usually ends with the newline, keep it last
+        bool const NEWLINE = !out.empty() && out.back() == '\n';
+        if (NEWLINE) {
+            out.pop_back();
+        }
+        out.append(" [truncated]");
+        if (NEWLINE) {
+            out.push_back('\n');
+        }
+    }
+}
+
+/**
+ * @brief Find the conversion of the next argument
+ *
+ * @param cursor position in the format
+ * @return Slot what the argument stands for
+ **/
+auto AsyncLogger::next_slot(FormatCursor& cursor) -> Slot {
+    if (cursor.pending == 0) {
+        const char* p = cursor.next;
+        while (p != nullptr && (p = std::strchr(p, '%')) != nullptr && p[1] == '%') {
+            p += 2;
+        }
+        cursor.pending = 1;
+        cursor.star_precision = false;
+        cursor.precision = -1;
+        if (p == nullptr) {
+            cursor.next = nullptr;
+        } else {
+            // %[flags][width][.precision][length]conversion
+            ++p;
+            while (*p != '\0' && std::strchr("-+ #0", *p) != nullptr) {
+                ++p;
+            }
+            if (*p == '*') {
+                ++cursor.pending;
+                ++p;
+            }
+            while (*p >= '0' && *p <= '9') {
+                ++p;
+            }
+            if (*p == '.') {
+                ++p;
+                if (*p == '*') {
+                    ++cursor.pending;
+                    cursor.star_precision = true;
+                    ++p;
+                } else {
+                    cursor.precision = 0;
+                    while (*p >= '0' && *p <= '9') {
+                        cursor.precision = cursor.precision * 10 + (*p++ - '0');
+                    }
+                }
+            }
+            while (*p != '\0' && std::strchr("hlLqjzt", *p) != nullptr) {
+                ++p;
+            }
+            cursor.next = *p == '\0' ? p : p + 1;
+        }
+    }
+
+    // The '*' arguments come first, the value last
+    --cursor.pending;
+    if (cursor.pending == 0) {
+        return Slot::VALUE;
+    }
+    return cursor.pending == 1 && cursor.star_precision ? Slot::PRECISION : Slot::WIDTH;
+}
+
+/**
+ * @brief Reserve the next slot of the calling thread's ring
+ *
+ * @return Record* slot or nullptr
+ **/
+auto AsyncLogger::begin_record() -> Record* {
+    if (m_STOPPED.load(std::memory_order_acquire)) {
+        t_SYNCHRONOUS = true;
+        return &t_SCRATCH;
+    }
+
+    Ring& ring = local_ring();
+    std::size_t const TAIL = ring.tail.load(std::memory_order_relaxed);
+    while (TAIL - ring.head.load(std::memory_order_acquire) >= RING_CAPACITY) {
+        if (m_OVERFLOW.load(std::memory_order_relaxed) == Overflow::DROP || m_STOPPED.load()) {
+            ring.dropped.fetch_add(1, std::memory_order_relaxed);
+            m_DROPPED_TOTAL.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        m_WAKE_CV.notify_one();
+        std::this_thread::yield();
+    }
+    t_SYNCHRONOUS = false;
+    return &ring.records[TAIL & (RING_CAPACITY - 1)];
+}
+
+/**
+ * @brief Publish the record
+ *
+ **/
+void AsyncLogger::commit_record() {
+    if (t_SYNCHRONOUS) {
+        std::string line;
+        format(t_SCRATCH, line, m_FD.load() == 2);
+        write_out(line);
+        return;
+    }
+    Ring& ring = local_ring();
+    ring.tail.store(ring.tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+/**
+ * @brief Get the calling thread's ring
+ *
+ * @return Ring& ring
+ **/
+auto AsyncLogger::local_ring() -> Ring& {
+    if (!t_RING) {
+        auto ring = std::make_shared<Ring>();
+        {
+            std::lock_guard<std::mutex> const LOCK(m_RINGS_MUTEX);
+            m_RINGS.push_back(ring);
+        }
+        t_RING = ring;
+    }
+    return *static_cast<Ring*>(t_RING.get());
+}
+
+/**
+ * @brief Drain the rings until stopped
+ *
+ **/
+void AsyncLogger::run() {
+    std::unique_lock<std::mutex> lock(m_WAKE_MUTEX);
+    while (!m_STOP) {
+        std::uint64_t const REQUESTS = m_FLUSH_REQUESTS;
+        lock.unlock();
+        std::size_t const WRITTEN = drain();
+        lock.lock();
+
+        m_FLUSHED = REQUESTS;
+        m_FLUSHED_CV.notify_all();
+        if (WRITTEN == 0 && m_FLUSH_REQUESTS == REQUESTS) {
+            m_WAKE_CV.wait_for(lock, IDLE_WAIT);
+        }
+    }
+    m_FLUSHED_CV.notify_all();
+}
+
+/**
+ * @brief Write out every published record
+ *
+ * @return std::size_t records written
+ **/
+auto AsyncLogger::drain() -> std::size_t {
+    std::vector<std::shared_ptr<Ring>> rings;
+    {
+        std::lock_guard<std::mutex> const LOCK(m_RINGS_MUTEX);
+        rings = m_RINGS;
+    }
+
+    struct Entry {
+        std::uint64_t time_ns;
+        std::size_t offset;
+        std::size_t length;
+    };
+    std::vector<Entry> entries;
+    std::string text;
+    bool const COLORS = m_FD.load() == 2;
+
+    std::uint64_t dropped = 0;
+    for (const auto& ring : rings) {
+        std::size_t head = ring->head.load(std::memory_order_relaxed);
+        std::size_t const TAIL = ring->tail.load(std::memory_order_acquire);
+        for (; head != TAIL; ++head) {
+            Record const& record = ring->records[head & (RING_CAPACITY - 1)];
+            std::size_t const OFFSET = text.size();
+            format(record, text, COLORS);
+            entries.push_back({record.time_ns, OFFSET, text.size() - OFFSET});
+        }
+        ring->head.store(head, std::memory_order_release);
+        dropped += ring->dropped.exchange(0, std::memory_order_relaxed);
+    }
+
+    if (!entries.empty()) {
+        // Rings are drained one after the other, the time stamps restore the order across threads
+        std::stable_sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.time_ns < b.time_ns; });
+        std::string batch;
+        batch.reserve(text.size());
+        for (const Entry& entry : entries) {
+            batch.append(text, entry.offset, entry.length);
+        }
+        write_out(batch);
+    }
+    if (dropped != 0) {
+        write_out((COLORS ? "[" YELLOW "WARN" RESET "] " : "[WARN] ") + std::to_string(dropped)
+                  + " log records dropped, the log rings were full\n");
+    }
+
+    // Rings of exited threads are only referenced here once empty
+    {
+        std::lock_guard<std::mutex> const LOCK(m_RINGS_MUTEX);
+        m_RINGS.erase(std::remove_if(m_RINGS.begin(),
+                                     m_RINGS.end(),
+                                     [](const std::shared_ptr<Ring>& ring)
+                                     {
+                                         return ring.use_count() == 1
+                                             && ring->head.load(std::memory_order_relaxed)
+                                             == ring->tail.load(std::memory_order_acquire);
+                                     }),
+                      m_RINGS.end());
+    }
+    return entries.size();
+}
+
+/**
+ * @brief Write to the output
+ *
+ * @param data bytes
+ **/
+void AsyncLogger::write_out(std::string_view data) {
+    int const FD = m_FD.load();
+    while (!data.empty()) {
+        ssize_t const WRITTEN = ::write(FD, data.data(), data.size());
+        if (WRITTEN < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        data.remove_prefix(static_cast<std::size_t>(WRITTEN));
+    }
+}
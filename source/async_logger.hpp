@@ -0,0 +1,436 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+class AsyncLogger {
+    /**
+     * @brief AsyncLogger - log records written off the request path
+     *
+     * The log macros of logger.hpp end up here. A record is not formatted by
+     * the thread which logs it: the format string pointer, the call site and
+     * the raw arguments (strings copied, they may be temporaries) go into a
+     * fixed-size slot of a ring owned by the calling thread. Each ring has a
+     * single producer and a single consumer, so logging takes no lock and
+     * never touches another thread's cache lines.
+     *
+     * A background thread drains all rings, formats the records in time
+     * order and hands each batch to the output with one write(2). When a ring
+     * is full the record is dropped and counted (the drainer reports the
+     * count), or with the BLOCK policy the producer waits for room.
+     *
+     * Formatting follows printf for the conversions the server uses (d i u x
+     * X o c s p f e g a, with flags, width, precision and length modifiers).
+     * A '*' width or precision takes its int argument as printf does. A
+     * string with a precision is copied up to that length only, so "%.*s"
+     * may name text which is not NUL-terminated.
+     **/
+
+  public:
+    /**
+     * @brief What a producer does when its ring is full
+     *
+     **/
+    enum class Overflow : std::uint8_t
+    {
+        DROP,
+        BLOCK
+    };
+
+    /**
+     * @brief Bytes available for the arguments of one record
+     *
+     **/
+    static constexpr std::size_t RECORD_PAYLOAD = 200;
+
+    /**
+     * @brief Records per thread ring, a power of two
+     *
+     **/
+    static constexpr std::size_t RING_CAPACITY = 1024;
+
+    /**
+     * @brief Type tags of encoded arguments
+     *
+     **/
+    enum class ArgType : std::uint8_t
+    {
+        SIGNED,
+        UNSIGNED,
+        DOUBLE,
+        STRING,
+        POINTER
+    };
+
+    /**
+     * @brief A captured, not yet formatted log call
+     *
+     **/
+    struct Record {
+        const char* format = nullptr;
+        const char* file = nullptr;
+        const char* function = nullptr;
+        int line = 0;
+        int level = 0;
+        std::uint64_t time_ns = 0;
+        std::size_t size = 0;
+        bool truncated = false;
+        std::array<unsigned char, RECORD_PAYLOAD> payload {};
+    };
+
+    /**
+     * @brief Get the process-wide logger, starting its drainer on first use
+     *
+     * @return AsyncLogger& logger
+     **/
+    static auto instance() -> AsyncLogger&;
+
+    ~AsyncLogger();
+
+    AsyncLogger(const AsyncLogger&) = delete;
+    auto operator=(const AsyncLogger&) -> AsyncLogger& = delete;
+
+    /**
+     * @brief Check whether records of a level are currently logged
+     *
+     * @param level LOG_LEVEL_* value
+     * @return true if level is at or above the runtime threshold
+     **/
+    auto enabled(int level) const -> bool { return level >= m_LEVEL.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief Set the runtime threshold
+     *
+     * Levels below the compile-time LOG_LEVEL_THRESHOLD stay compiled out.
+     *
+     * @param level lowest LOG_LEVEL_* value which is logged
+     **/
+    void set_level(int level) { m_LEVEL.store(level, std::memory_order_relaxed); }
+
+    /**
+     * @brief Set the full-ring policy
+     *
+     * @param policy DROP or BLOCK
+     **/
+    void set_overflow_policy(Overflow policy) { m_OVERFLOW.store(policy, std::memory_order_relaxed); }
+
+    /**
+     * @brief Append records to a file instead of stderr
+     *
+     * @param path file path, created if missing
+     * @return true if the file was opened
+     **/
+    auto open_file(const std::string& path) -> bool;
+
+    /**
+     * @brief Wait until every record logged so far has been written
+     *
+     **/
+    void flush();
+
+    /**
+     * @brief Get the number of records dropped since start
+     *
+     * @return std::uint64_t dropped records
+     **/
+    auto dropped() const -> std::uint64_t { return m_DROPPED_TOTAL.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief Log a record
+     *
+     * @param level LOG_LEVEL_* value
+     * @param file source file
+     * @param line source line
+     * @param function function name
+     * @param format printf-style format, must be a string literal
+     * @param args arguments
+     **/
+    template<typename... Args>
+    void write(int level, const char* file, int line, const char* function, const char* format, const Args&... args) {
+        Record* record = begin_record();
+        if (record == nullptr) {
+            return;
+        }
+        capture(*record, level, file, line, function, format, args...);
+        commit_record();
+    }
+
+    /**
+     * @brief Fill a record with a call site and its arguments
+     *
+     * @param record record to fill
+     * @param level LOG_LEVEL_* value
+     * @param file source file
+     * @param line source line
+     * @param function function name
+     * @param format printf-style format
+     * @param args arguments
+     **/
+    template<typename... Args>
+    static void capture(Record& record,
+                        int level,
+                        const char* file,
+                        int line,
+                        const char* function,
+                        const char* format,
+                        const Args&... args) {
+        record.format = format;
+        record.file = file;
+        record.function = function;
+        record.line = line;
+        record.level = level;
+        record.time_ns = now_ns();
+        record.size = 0;
+        record.truncated = false;
+        [[maybe_unused]] FormatCursor cursor {format};
+        (encode_argument(record, cursor, args), ...);
+    }
+
+    /**
+     * @brief Format a record, prefix included, as the synchronous logger did
+     *
+     * @param record captured record
+     * @param out string the formatted line is appended to
+     * @param colors whether the level tag is colored
+     **/
+    static void format(const Record& record, std::string& out, bool colors = true);
+
+    /**
+     * @brief Parse a level name
+     *
+     * @param name "debug", "info", "warn" or "error"
+     * @return int LOG_LEVEL_* value, -1 if unknown
+     **/
+    static auto parse_level(std::string_view name) -> int;
+
+  private:
+    /**
+     * @brief What an argument stands for in the format
+     *
+     **/
+    enum class Slot : std::uint8_t
+    {
+        WIDTH,        // a '*' width
+        PRECISION,    // a '*' precision
+        VALUE
+    };
+
+    /**
+     * @brief Position of capture() in the format
+     *
+     **/
+    struct FormatCursor {
+        const char* next = nullptr;    // rest of the format after the current conversion
+        int pending = 0;               // arguments the current conversion still takes
+        bool star_precision = false;   // whether the last of them is the precision
+        long precision = -1;           // precision of the current conversion, -1 for none
+    };
+
+    /**
+     * @brief Single-producer single-consumer ring of one thread
+     *
+     **/
+    struct Ring {
+        std::array<Record, RING_CAPACITY> records;
+        alignas(64) std::atomic<std::size_t> head {0};
+        alignas(64) std::atomic<std::size_t> tail {0};
+        std::atomic<std::uint64_t> dropped {0};
+    };
+
+    AsyncLogger();
+
+    /**
+     * @brief Get the current time for record ordering
+     *
+     * @return std::uint64_t steady clock in ns
+     **/
+    static auto now_ns() -> std::uint64_t;
+
+    /**
+     * @brief Append raw bytes to the payload
+     *
+     * @param record record
+     * @param data bytes
+     * @param size number of bytes
+     * @return true if they fit
+     **/
+    static auto put(Record& record, const void* data, std::size_t size) -> bool {
+        if (record.truncated || record.size + size > RECORD_PAYLOAD) {
+            record.truncated = true;
+            return false;
+        }
+        std::memcpy(record.payload.data() + record.size, data, size);
+        record.size += size;
+        return true;
+    }
+
+    /**
+     * @brief Append a tagged value to the payload
+     *
+     * @param record record
+     * @param type tag
+     * @param value value
+     **/
+    template<typename T>
+    static void put_value(Record& record, ArgType type, T value) {
+        if (record.truncated || record.size + 1 + sizeof(T) > RECORD_PAYLOAD) {
+            record.truncated = true;
+            return;
+        }
+        put(record, &type, 1);
+        put(record, &value, sizeof(T));
+    }
+
+    /**
+     * @brief Find what the next argument stands for, advancing the cursor
+     *
+     * @param cursor position in the format
+     * @return Slot width, precision or value
+     **/
+    static auto next_slot(FormatCursor& cursor) -> Slot;
+
+    /**
+     * @brief Encode the next argument of a call
+     *
+     * @param record record
+     * @param cursor position in the format
+     * @param value argument
+     **/
+    template<typename T>
+    static void encode_argument(Record& record, FormatCursor& cursor, const T& value) {
+        Slot const SLOT = next_slot(cursor);
+        if constexpr (std::is_same_v<T, int>) {
+            if (SLOT == Slot::PRECISION) {
+                cursor.precision = value < 0 ? -1 : value;
+            }
+        }
+        encode(record, value, SLOT == Slot::VALUE ? cursor.precision : -1);
+    }
+
+    /**
+     * @brief Encode a string argument, copied into the payload
+     *
+     * @param record record
+     * @param value string, may be null
+     * @param precision most bytes to read from it, -1 to read up to the NUL
+     **/
+    static void encode_text(Record& record, const char* value, long precision) {
+        std::string_view TEXT = "(null)";
+        if (value != nullptr) {
+            TEXT = precision < 0
+                ? std::string_view(value)
+                : std::string_view(value, ::strnlen(value, static_cast<std::size_t>(precision)));
+        }
+        std::size_t const ROOM = record.size + 3 < RECORD_PAYLOAD ? RECORD_PAYLOAD - record.size - 3 : 0;
+        if (record.truncated || ROOM == 0) {
+            record.truncated = true;
+            return;
+        }
+        auto const LENGTH = static_cast<std::uint16_t>(std::min(TEXT.size(), ROOM));
+        auto const TYPE = ArgType::STRING;
+        put(record, &TYPE, 1);
+        put(record, &LENGTH, sizeof(LENGTH));
+        put(record, TEXT.data(), LENGTH);
+        record.truncated = LENGTH < TEXT.size();
+    }
+
+    /**
+     * @brief Encode one argument
+     *
+     * Strings are copied (cut short if the payload runs out), everything
+     * else is stored by value.
+     *
+     * @param record record
+     * @param value argument
+     * @param precision precision of a string conversion, -1 for none
+     **/
+    template<typename T>
+    static void encode(Record& record, const T& value, long precision = -1) {
+        using Type = std::decay_t<T>;
+        if constexpr (std::is_same_v<Type, char*> || std::is_same_v<Type, const char*>) {
+            encode_text(record, value, precision);
+        } else if constexpr (std::is_enum_v<Type>) {
+            encode(record, static_cast<std::underlying_type_t<Type>>(value));
+        } else if constexpr (std::is_integral_v<Type> && std::is_signed_v<Type>) {
+            put_value(record, ArgType::SIGNED, static_cast<std::int64_t>(value));
+        } else if constexpr (std::is_integral_v<Type>) {
+            put_value(record, ArgType::UNSIGNED, static_cast<std::uint64_t>(value));
+        } else if constexpr (std::is_floating_point_v<Type>) {
+            put_value(record, ArgType::DOUBLE, static_cast<double>(value));
+        } else if constexpr (std::is_pointer_v<Type> || std::is_null_pointer_v<Type>) {
+            put_value(record, ArgType::POINTER, reinterpret_cast<std::uintptr_t>(value));
+        } else {
+            static_assert(std::is_pointer_v<Type>, "unsupported log argument type");
+        }
+    }
+
+    /**
+     * @brief Get the slot for the next record of the calling thread
+     *
+     * @return Record* slot, nullptr if the record is dropped
+     **/
+    auto begin_record() -> Record*;
+
+    /**
+     * @brief Publish the record filled after begin_record()
+     *
+     **/
+    void commit_record();
+
+    /**
+     * @brief Get the ring of the calling thread, registering it on first use
+     *
+     * @return Ring& ring
+     **/
+    auto local_ring() -> Ring&;
+
+    /**
+     * @brief Drainer thread
+     *
+     **/
+    void run();
+
+    /**
+     * @brief Move every published record out of the rings and write them
+     *
+     * @return std::size_t number of records written
+     **/
+    auto drain() -> std::size_t;
+
+    /**
+     * @brief Write bytes to the output
+     *
+     * @param data bytes
+     **/
+    void write_out(std::string_view data);
+
+    std::atomic<int> m_LEVEL;
+    std::atomic<Overflow> m_OVERFLOW {Overflow::DROP};
+    std::atomic<std::uint64_t> m_DROPPED_TOTAL {0};
+    std::atomic<int> m_FD {2};
+    bool m_COLORS = true;
+
+    std::mutex m_RINGS_MUTEX;
+    std::vector<std::shared_ptr<Ring>> m_RINGS;
+
+    std::mutex m_WAKE_MUTEX;
+    std::condition_variable m_WAKE_CV;
+    std::condition_variable m_FLUSHED_CV;
+    std::uint64_t m_FLUSH_REQUESTS = 0;
+    std::uint64_t m_FLUSHED = 0;
+    bool m_STOP = false;
+    std::atomic<bool> m_STOPPED {false};
+    std::thread m_THREAD;
+};
@@ -0,0 +1,283 @@
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "compression.hpp"
+
+#include <zlib.h>
+
+#ifdef HTTPFILESERVER_HAVE_ZSTD
+#    include <zstd.h>
+#endif
+
+/**
+ * @brief Anonymous namespace for helper functions
+ *
+ **/
+namespace {
+    /**
+     * @brief zlib compression level, the usual speed/ratio balance
+     *
+     **/
+    constexpr int DEFLATE_LEVEL = 6;
+
+#ifdef HTTPFILESERVER_HAVE_ZSTD
+    /**
+     * @brief zstd compression level
+     *
+     **/
+    constexpr int ZSTD_LEVEL = 3;
+#endif
+
+    /**
+     * @brief zlib window bits: 15 for a zlib stream, +16 for gzip, negative for raw deflate
+     *
+     **/
+    constexpr int WINDOW_BITS = 15;
+
+    /**
+     * @brief Largest payload of one stored deflate block
+     *
+     **/
+    constexpr std::size_t MAX_STORED_BLOCK = 0xffff;
+
+    /**
+     * @brief Run deflate over the whole input
+     *
+     * @param input bytes to compress
+     * @param window_bits stream format (see WINDOW_BITS)
+     * @param flush Z_FINISH to end the stream, Z_FULL_FLUSH to stop on a byte boundary
+     * @param out receives the compressed bytes
+     * @return true on success
+     **/
+    auto run_deflate(std::string_view input, int window_bits, int flush, std::string& out) -> bool {
+        z_stream stream {};
+        if (deflateInit2(&stream, DEFLATE_LEVEL, Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            return false;
+        }
+
+        // deflateBound covers Z_FINISH; a full flush adds an empty stored block on top
+        out.resize(deflateBound(&stream, static_cast<uLong>(input.size())) + 16);
+        stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input.data()));
+        stream.avail_in = static_cast<uInt>(input.size());
+        stream.next_out = reinterpret_cast<Bytef*>(out.data());
+        stream.avail_out = static_cast<uInt>(out.size());
+
+        int const RESULT = deflate(&stream, flush);
+        bool const DONE = flush == Z_FINISH ? RESULT == Z_STREAM_END : RESULT == Z_OK && stream.avail_in == 0;
+        out.resize(stream.total_out);
+        deflateEnd(&stream);
+        return DONE;
+    }
+
+    /**
+     * @brief Checksum of the container format: CRC-32 for gzip, Adler-32 for zlib
+     *
+     * @param coding GZIP or DEFLATE
+     * @param data bytes
+     * @return std::uint32_t checksum
+     **/
+    auto checksum(ContentCoding coding, std::string_view data) -> std::uint32_t {
+        const auto* bytes = reinterpret_cast<const Bytef*>(data.data());
+        auto const SIZE = static_cast<uInt>(data.size());
+        if (coding == ContentCoding::GZIP) {
+            return static_cast<std::uint32_t>(crc32(crc32(0, nullptr, 0), bytes, SIZE));
+        }
+        return static_cast<std::uint32_t>(adler32(adler32(0, nullptr, 0), bytes, SIZE));
+    }
+
+    /**
+     * @brief Checksum of two concatenated pieces
+     *
+     * @param coding GZIP or DEFLATE
+     * @param first checksum of the first piece
+     * @param second checksum of the second piece
+     * @param second_size size of the second piece
+     * @return std::uint32_t checksum of both
+     **/
+    auto combine(ContentCoding coding, std::uint32_t first, std::uint32_t second, std::size_t second_size)
+        -> std::uint32_t {
+        auto const SIZE = static_cast<z_off_t>(second_size);
+        if (coding == ContentCoding::GZIP) {
+            return static_cast<std::uint32_t>(crc32_combine(first, second, SIZE));
+        }
+        return static_cast<std::uint32_t>(adler32_combine(first, second, SIZE));
+    }
+
+    /**
+     * @brief Append a 32-bit value in little-endian byte order
+     *
+     * @param out target
+     * @param value value
+     **/
+    void append_le32(std::string& out, std::uint32_t value) {
+        for (int shift = 0; shift < 32; shift += 8) {
+            out.push_back(static_cast<char>((value >> shift) & 0xff));
+        }
+    }
+
+    /**
+     * @brief Append a 32-bit value in big-endian byte order
+     *
+     * @param out target
+     * @param value value
+     **/
+    void append_be32(std::string& out, std::uint32_t value) {
+        for (int shift = 24; shift >= 0; shift -= 8) {
+            out.push_back(static_cast<char>((value >> shift) & 0xff));
+        }
+    }
+}    // namespace
+
+/**
+ * @brief Content-Encoding token
+ *
+ * @param coding coding
+ * @return std::string_view token
+ **/
+auto coding_name(ContentCoding coding) -> std::string_view {
+    switch (coding) {
+        case ContentCoding::GZIP:
+            return "gzip";
+        case ContentCoding::DEFLATE:
+            return "deflate";
+        case ContentCoding::ZSTD:
+            return "zstd";
+        case ContentCoding::IDENTITY:
+            break;
+    }
+    return "identity";
+}
+
+/**
+ * @brief Check runtime support of a coding
+ *
+ * @param coding coding
+ * @return true if compress() handles it
+ **/
+auto can_compress(ContentCoding coding) -> bool {
+    switch (coding) {
+        case ContentCoding::GZIP:
+        case ContentCoding::DEFLATE:
+            return true;
+        case ContentCoding::ZSTD:
+#ifdef HTTPFILESERVER_HAVE_ZSTD
+            return true;
+#else
+            return false;
+#endif
+        case ContentCoding::IDENTITY:
+            break;
+    }
+    return false;
+}
+
+/**
+ * @brief Compress a representation
+ *
+ * @param input bytes
+ * @param coding coding
+ * @param out encoded bytes
+ * @return true on success
+ **/
+auto compress(std::string_view input, ContentCoding coding, std::string& out) -> bool {
+    switch (coding) {
+        case ContentCoding::GZIP:
+            return run_deflate(input, WINDOW_BITS + 16, Z_FINISH, out);
+        case ContentCoding::DEFLATE:
+            return run_deflate(input, WINDOW_BITS, Z_FINISH, out);
+        case ContentCoding::ZSTD: {
+#ifdef HTTPFILESERVER_HAVE_ZSTD
+            out.resize(ZSTD_compressBound(input.size()));
+            std::size_t const SIZE = ZSTD_compress(out.data(), out.size(), input.data(), input.size(), ZSTD_LEVEL);
+            if (ZSTD_isError(SIZE) != 0) {
+                return false;
+            }
+            out.resize(SIZE);
+            return true;
+#else
+            return false;
+#endif
+        }
+        case ContentCoding::IDENTITY:
+            break;
+    }
+    return false;
+}
+
+/**
+ * @brief Compress the fixed parts of a page
+ *
+ * @param coding GZIP or DEFLATE
+ * @param head bytes before the hole
+ * @param tail bytes after the hole
+ * @return std::optional<DeflateTemplate> template
+ **/
+auto make_deflate_template(ContentCoding coding, std::string_view head, std::string_view tail)
+    -> std::optional<DeflateTemplate> {
+    if (coding != ContentCoding::GZIP && coding != ContentCoding::DEFLATE) {
+        return std::nullopt;
+    }
+
+    DeflateTemplate page;
+    page.coding = coding;
+    if (!run_deflate(head, -WINDOW_BITS, Z_FULL_FLUSH, page.head) || !run_deflate(tail, -WINDOW_BITS, Z_FINISH, page.tail))
+    {
+        return std::nullopt;
+    }
+    page.head_check = checksum(coding, head);
+    page.tail_check = checksum(coding, tail);
+    page.head_size = head.size();
+    page.tail_size = tail.size();
+    return page;
+}
+
+/**
+ * @brief Fill in the hole of a compressed page
+ *
+ * @param page template
+ * @param hole bytes between head and tail
+ * @return std::string encoded page
+ **/
+auto render_deflate_template(const DeflateTemplate& page, std::string_view hole) -> std::string {
+    static constexpr char GZIP_HEADER[] = {'\x1f', '\x8b', '\x08', '\0', '\0', '\0', '\0', '\0', '\0', '\x03'};
+    static constexpr char ZLIB_HEADER[] = {'\x78', '\x9c'};
+
+    std::string out;
+    out.reserve(sizeof(GZIP_HEADER) + page.head.size() + hole.size() + hole.size() / MAX_STORED_BLOCK * 5 + 5
+                + page.tail.size() + 8);
+
+    if (page.coding == ContentCoding::GZIP) {
+        out.append(GZIP_HEADER, sizeof(GZIP_HEADER));
+    } else {
+        out.append(ZLIB_HEADER, sizeof(ZLIB_HEADER));
+    }
+    out.append(page.head);
+
+    // The head ends byte-aligned, so a stored block starts with a plain zero byte (BFINAL=0, BTYPE=00)
+    for (std::size_t offset = 0; offset < hole.size(); offset += MAX_STORED_BLOCK) {
+        std::string_view const CHUNK = hole.substr(offset, MAX_STORED_BLOCK);
+        auto const LENGTH = static_cast<std::uint16_t>(CHUNK.size());
+        auto const COMPLEMENT = static_cast<std::uint16_t>(~LENGTH);
+        out.push_back('\0');
+        out.push_back(static_cast<char>(LENGTH & 0xff));
+        out.push_back(static_cast<char>(LENGTH >> 8));
+        out.push_back(static_cast<char>(COMPLEMENT & 0xff));
+        out.push_back(static_cast<char>(COMPLEMENT >> 8));
+        out.append(CHUNK);
+    }
+    out.append(page.tail);
+
+    std::uint32_t check = combine(page.coding, page.head_check, checksum(page.coding, hole), hole.size());
+    check = combine(page.coding, check, page.tail_check, page.tail_size);
+
+    if (page.coding == ContentCoding::GZIP) {
+        append_le32(out, check);
+        append_le32(out, static_cast<std::uint32_t>(page.head_size + hole.size() + page.tail_size));
+    } else {
+        append_be32(out, check);
+    }
+    return out;
+}
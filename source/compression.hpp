@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+/**
+ * @brief Content codings the server can produce or serve
+ *
+ **/
+enum class ContentCoding : std::uint8_t
+{
+    IDENTITY,
+    GZIP,
+    DEFLATE,    // zlib format (RFC 1950), which is what HTTP calls "deflate"
+    ZSTD
+};
+
+/**
+ * @brief Get the Content-Encoding token of a coding
+ *
+ * @param coding content coding
+ * @return std::string_view token ("gzip", "deflate", "zstd", "identity")
+ **/
+auto coding_name(ContentCoding coding) -> std::string_view;
+
+/**
+ * @brief Check whether a coding can be produced at runtime
+ *
+ * gzip and deflate always can (zlib); zstd only when the server was built
+ * with libzstd. Precompressed siblings of any coding can be served anyway.
+ *
+ * @param coding content coding
+ * @return true if compress() supports the coding
+ **/
+auto can_compress(ContentCoding coding) -> bool;
+
+/**
+ * @brief Compress a whole representation
+ *
+ * @param input uncompressed bytes
+ * @param coding GZIP, DEFLATE or (if available) ZSTD
+ * @param out receives the encoded bytes
+ * @return true on success
+ **/
+auto compress(std::string_view input, ContentCoding coding, std::string& out) -> bool;
+
+/**
+ * @brief A page compressed around one uncompressed hole
+ *
+ * The head is deflated and full-flushed, so it ends on a byte boundary and
+ * nothing after it refers back into it; the tail is deflated on its own and
+ * finishes the stream. Any hole can then be spliced in between as a stored
+ * block, which turns a page with a changing field (the listing's server
+ * time) into a per-request copy instead of a per-request compression.
+ **/
+struct DeflateTemplate {
+    ContentCoding coding = ContentCoding::GZIP;
+    std::string head;
+    std::string tail;
+    std::uint32_t head_check = 0;
+    std::uint32_t tail_check = 0;
+    std::size_t head_size = 0;
+    std::size_t tail_size = 0;
+
+    /**
+     * @brief Approximate memory used by the template
+     *
+     * @return std::size_t bytes
+     **/
+    auto bytes() const -> std::size_t { return sizeof(*this) + head.capacity() + tail.capacity(); }
+};
+
+/**
+ * @brief Compress the fixed parts of a page
+ *
+ * @param coding GZIP or DEFLATE
+ * @param head bytes before the hole
+ * @param tail bytes after the hole
+ * @return std::optional<DeflateTemplate> template, empty on failure
+ **/
+auto make_deflate_template(ContentCoding coding, std::string_view head, std::string_view tail)
+    -> std::optional<DeflateTemplate>;
+
+/**
+ * @brief Produce the encoded page with a hole filled in
+ *
+ * @param page template
+ * @param hole bytes between head and tail
+ * @return std::string complete gzip or zlib stream
+ **/
+auto render_deflate_template(const DeflateTemplate& page, std::string_view hole) -> std::string;
@@ -0,0 +1,230 @@
+#include <array>
+#include <cctype>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "digest.hpp"
+
+#include <openssl/evp.h>
+
+/**
+ * @brief Anonymous namespace for helper functions
+ *
+ **/
+namespace {
+    constexpr std::string_view BASE64_ALPHABET =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+    constexpr std::string_view HEX_DIGITS = "0123456789abcdef";
+
+    /**
+     * @brief Decode base64 of exactly the size of a digest
+     *
+     * @param text base64 text with padding
+     * @return std::optional<Sha256Digest> decoded bytes
+     **/
+    auto decode_base64_digest(std::string_view text) -> std::optional<Sha256Digest> {
+        Sha256Digest digest {};
+        std::size_t length = 0;
+        std::uint32_t bits = 0;
+        int pending = 0;
+        for (char const CHARACTER : text) {
+            if (CHARACTER == '=') {
+                break;
+            }
+            std::size_t const VALUE = BASE64_ALPHABET.find(CHARACTER);
+            if (VALUE == std::string_view::npos) {
+                return std::nullopt;
+            }
+            bits = (bits << 6) | static_cast<std::uint32_t>(VALUE);
+            pending += 6;
+            if (pending >= 8) {
+                pending -= 8;
+                if (length == digest.size()) {
+                    return std::nullopt;
+                }
+                digest[length++] = static_cast<std::uint8_t>(bits >> pending);
+            }
+        }
+        if (length != digest.size()) {
+            return std::nullopt;
+        }
+        return digest;
+    }
+
+    /**
+     * @brief Value of a hexadecimal digit
+     *
+     * @param character digit
+     * @return int value, -1 if not a digit
+     **/
+    auto hex_value(char character) -> int {
+        if (character >= '0' && character <= '9') {
+            return character - '0';
+        }
+        auto const LOWER = static_cast<char>(std::tolower(static_cast<unsigned char>(character)));
+        if (LOWER >= 'a' && LOWER <= 'f') {
+            return LOWER - 'a' + 10;
+        }
+        return -1;
+    }
+
+    /**
+     * @brief Trim spaces and tabs
+     *
+     * @param text text
+     * @return std::string_view trimmed text
+     **/
+    auto trim(std::string_view text) -> std::string_view {
+        while (!text.empty() && (text.front() == ' ' || text.front() == '\t')) {
+            text.remove_prefix(1);
+        }
+        while (!text.empty() && (text.back() == ' ' || text.back() == '\t')) {
+            text.remove_suffix(1);
+        }
+        return text;
+    }
+}  // namespace
+
+/**
+ * @brief Construct a new Sha256 object
+ *
+ **/
+Sha256::Sha256()
+    : m_CONTEXT(EVP_MD_CTX_new()) {
+    auto* context = static_cast<EVP_MD_CTX*>(m_CONTEXT);
+    if (context == nullptr || EVP_DigestInit_ex(context, EVP_sha256(), nullptr) != 1) {
+        EVP_MD_CTX_free(context);
+        throw std::bad_alloc();
+    }
+}
+
+/**
+ * @brief Destroy the Sha256 object
+ *
+ **/
+Sha256::~Sha256() {
+    EVP_MD_CTX_free(static_cast<EVP_MD_CTX*>(m_CONTEXT));
+}
+
+/**
+ * @brief Hash more bytes
+ *
+ * @param data bytes
+ **/
+void Sha256::update(std::string_view data) {
+    EVP_DigestUpdate(static_cast<EVP_MD_CTX*>(m_CONTEXT), data.data(), data.size());
+}
+
+/**
+ * @brief Finish the digest
+ *
+ * @return Sha256Digest digest
+ **/
+auto Sha256::finish() -> Sha256Digest {
+    Sha256Digest digest {};
+    unsigned int length = 0;
+    auto* context = static_cast<EVP_MD_CTX*>(m_CONTEXT);
+    EVP_DigestFinal_ex(context, digest.data(), &length);
+    EVP_DigestInit_ex(context, EVP_sha256(), nullptr);
+    return digest;
+}
+
+/**
+ * @brief Encode bytes as base64
+ *
+ * @param out output
+ * @param data bytes
+ **/
+void append_base64(std::string& out, std::string_view data) {
+    out.reserve(out.size() + (data.size() + 2) / 3 * 4);
+    std::size_t i = 0;
+    for (; i + 3 <= data.size(); i += 3) {
+        std::uint32_t const BITS = static_cast<std::uint32_t>(static_cast<unsigned char>(data[i])) << 16
+            | static_cast<std::uint32_t>(static_cast<unsigned char>(data[i + 1])) << 8
+            | static_cast<unsigned char>(data[i + 2]);
+        out.push_back(BASE64_ALPHABET[(BITS >> 18) & 63]);
+        out.push_back(BASE64_ALPHABET[(BITS >> 12) & 63]);
+        out.push_back(BASE64_ALPHABET[(BITS >> 6) & 63]);
+        out.push_back(BASE64_ALPHABET[BITS & 63]);
+    }
+    std::size_t const REST = data.size() - i;
+    if (REST > 0) {
+        std::uint32_t bits = static_cast<std::uint32_t>(static_cast<unsigned char>(data[i])) << 16;
+        if (REST == 2) {
+            bits |= static_cast<std::uint32_t>(static_cast<unsigned char>(data[i + 1])) << 8;
+        }
+        out.push_back(BASE64_ALPHABET[(bits >> 18) & 63]);
+        out.push_back(BASE64_ALPHABET[(bits >> 12) & 63]);
+        out.push_back(REST == 2 ? BASE64_ALPHABET[(bits >> 6) & 63] : '=');
+        out.push_back('=');
+    }
+}
+
+/**
+ * @brief Encode bytes as hexadecimal
+ *
+ * @param out output
+ * @param data bytes
+ **/
+void append_hex(std::string& out, std::string_view data) {
+    out.reserve(out.size() + data.size() * 2);
+    for (char const CHARACTER : data) {
+        auto const BYTE = static_cast<unsigned char>(CHARACTER);
+        out.push_back(HEX_DIGITS[BYTE >> 4]);
+        out.push_back(HEX_DIGITS[BYTE & 0xF]);
+    }
+}
+
+/**
+ * @brief Find the SHA-256 digest of a Content-Digest field
+ *
+ * @param field header value
+ * @return std::optional<Sha256Digest> digest
+ **/
+auto parse_sha256_field(std::string_view field) -> std::optional<Sha256Digest> {
+    while (!field.empty()) {
+        std::size_t const COMMA = field.find(',');
+        std::string_view const MEMBER = trim(field.substr(0, COMMA));
+        field = COMMA == std::string_view::npos ? std::string_view {} : field.substr(COMMA + 1);
+
+        std::size_t const EQUALS = MEMBER.find('=');
+        if (EQUALS == std::string_view::npos) {
+            continue;
+        }
+        std::string_view const KEY = trim(MEMBER.substr(0, EQUALS));
+        std::string_view const VALUE = trim(MEMBER.substr(EQUALS + 1));
+        // Dictionary keys are lowercase, byte sequences are wrapped in colons
+        if (KEY == "sha-256" && VALUE.size() >= 2 && VALUE.front() == ':' && VALUE.back() == ':') {
+            return decode_base64_digest(VALUE.substr(1, VALUE.size() - 2));
+        }
+    }
+    return std::nullopt;
+}
+
+/**
+ * @brief Parse a hexadecimal SHA-256 digest
+ *
+ * @param hex digits
+ * @return std::optional<Sha256Digest> digest
+ **/
+auto parse_sha256_hex(std::string_view hex) -> std::optional<Sha256Digest> {
+    hex = trim(hex);
+    Sha256Digest digest {};
+    if (hex.size() != digest.size() * 2) {
+        return std::nullopt;
+    }
+    for (std::size_t i = 0; i < digest.size(); ++i) {
+        int const HIGH = hex_value(hex[2 * i]);
+        int const LOW = hex_value(hex[2 * i + 1]);
+        if (HIGH < 0 || LOW < 0) {
+            return std::nullopt;
+        }
+        digest[i] = static_cast<std::uint8_t>(HIGH << 4 | LOW);
+    }
+    return digest;
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+/**
+ * @brief A SHA-256 digest
+ *
+ **/
+using Sha256Digest = std::array<std::uint8_t, 32>;
+
+class Sha256 {
+    /**
+     * @brief Sha256 - incremental SHA-256 through OpenSSL's EVP interface
+     *
+     * OpenSSL picks the fastest implementation the CPU supports (SHA-NI,
+     * AVX2 or the generic code) at startup.
+     **/
+
+  public:
+    Sha256();
+    ~Sha256();
+
+    Sha256(const Sha256&) = delete;
+    auto operator=(const Sha256&) -> Sha256& = delete;
+
+    /**
+     * @brief Hash more bytes
+     *
+     * @param data bytes
+     **/
+    void update(std::string_view data);
+
+    /**
+     * @brief Finish the digest; the object starts over afterwards
+     *
+     * @return Sha256Digest digest of everything passed to update()
+     **/
+    auto finish() -> Sha256Digest;
+
+  private:
+    void* m_CONTEXT;
+};
+
+/**
+ * @brief Encode bytes as standard base64 with padding
+ *
+ * @param out receives the encoded text
+ * @param data bytes
+ **/
+void append_base64(std::string& out, std::string_view data);
+
+/**
+ * @brief Encode bytes as lowercase hexadecimal
+ *
+ * @param out receives the encoded text
+ * @param data bytes
+ **/
+void append_hex(std::string& out, std::string_view data);
+
+/**
+ * @brief View a digest as bytes
+ *
+ * @param digest digest
+ * @return std::string_view its bytes
+ **/
+inline auto digest_bytes(const Sha256Digest& digest) -> std::string_view {
+    return {reinterpret_cast<const char*>(digest.data()), digest.size()};
+}
+
+/**
+ * @brief Find the SHA-256 digest of a Content-Digest or Repr-Digest field
+ *
+ * The field is an RFC 9530 dictionary such as "sha-256=:<base64>:", and
+ * may list other algorithms, which are ignored.
+ *
+ * @param field header value
+ * @return std::optional<Sha256Digest> digest, empty if there is none or it is malformed
+ **/
+auto parse_sha256_field(std::string_view field) -> std::optional<Sha256Digest>;
+
+/**
+ * @brief Parse a hexadecimal SHA-256 digest, as sent in X-Checksum-Sha256
+ *
+ * @param hex 64 hexadecimal digits, any case
+ * @return std::optional<Sha256Digest> digest, empty if malformed
+ **/
+auto parse_sha256_hex(std::string_view hex) -> std::optional<Sha256Digest>;
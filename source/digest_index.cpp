@@ -0,0 +1,620 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include "digest_index.hpp"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "arena.hpp"
+#include "inotify_watcher.hpp"
+#include "logger.hpp"
+
+/**
+ * @brief Anonymous namespace for helper functions
+ *
+ **/
+namespace {
+    /**
+     * @brief Bytes hashed per read
+     *
+     **/
+    constexpr std::size_t READ_BLOCK = BufferPool::MAX_BLOCK;
+
+    /**
+     * @brief First line of a store file
+     *
+     **/
+    constexpr std::string_view STORE_HEADER = "httpfileserver-digests 1";
+
+    /**
+     * @brief Append an entry name to a directory key
+     *
+     * @param dir normalized directory
+     * @param name entry name
+     * @return std::string normalized child path
+     **/
+    auto join_key(const std::string& dir, std::string_view name) -> std::string {
+        std::string key;
+        key.reserve(dir.size() + name.size() + 1);
+        key.append(dir);
+        if (key.empty() || key.back() != '/') {
+            key.push_back('/');
+        }
+        key.append(name);
+        return key;
+    }
+
+    /**
+     * @brief Get the modification time of a stat(2) result in nanoseconds
+     *
+     * @param file_stat result of stat
+     * @return std::int64_t nanoseconds since the epoch
+     **/
+    auto mtime_ns_of(const struct stat& file_stat) -> std::int64_t {
+        return static_cast<std::int64_t>(file_stat.st_mtim.tv_sec) * 1000000000 + file_stat.st_mtim.tv_nsec;
+    }
+
+    /**
+     * @brief Split the next space-separated field off a store line
+     *
+     * @param line rest of the line, advanced past the field
+     * @return std::string_view field
+     **/
+    auto next_field(std::string_view& line) -> std::string_view {
+        std::size_t const SPACE = std::min(line.find(' '), line.size());
+        std::string_view const FIELD = line.substr(0, SPACE);
+        line.remove_prefix(std::min(SPACE + 1, line.size()));
+        return FIELD;
+    }
+
+    /**
+     * @brief Parse a decimal store field
+     *
+     * @param field field
+     * @param value receives the number
+     * @return true if the whole field is a number
+     **/
+    template <class T>
+    auto parse_number(std::string_view field, T& value) -> bool {
+        auto const [END, ERROR] = std::from_chars(field.data(), field.data() + field.size(), value);
+        return ERROR == std::errc() && END == field.data() + field.size();
+    }
+}    // namespace
+
+/**
+ * @brief Destroy the DigestIndex::DigestIndex object
+ *
+ **/
+DigestIndex::~DigestIndex() {
+    stop();
+}
+
+/**
+ * @brief Configure the index
+ *
+ * @param store store file, empty for none
+ * @param threads hashing threads, 0 for the default
+ * @param rate bytes per second, 0 for unlimited
+ **/
+void DigestIndex::configure(std::string store, std::size_t threads, std::uint64_t rate) {
+    m_STORE = std::move(store);
+    m_THREAD_COUNT = threads == 0 ? DEFAULT_THREADS : threads;
+    m_RATE = rate;
+}
+
+/**
+ * @brief Start the background index
+ *
+ * @param root normalized root
+ **/
+void DigestIndex::start(const std::string& root) {
+    if (!is_enabled() || !m_THREADS.empty()) {
+        return;
+    }
+    m_ROOT = root;
+    m_STOP = false;
+    load();
+
+    for (std::size_t i = 0; i < m_THREAD_COUNT; ++i) {
+        m_WORKERS.push_back(std::make_unique<Worker>());
+    }
+    push({m_ROOT, true}, 0);
+    for (std::size_t i = 0; i < m_THREAD_COUNT; ++i) {
+        m_THREADS.emplace_back([this, i] { run(i); });
+    }
+    if (!m_STORE.empty()) {
+        m_SAVER = std::thread([this] { run_saver(); });
+    }
+    log_info("Hashing files below %s with %zu threads\n", m_ROOT.c_str(), m_THREAD_COUNT);
+}
+
+/**
+ * @brief Stop the background index
+ *
+ **/
+void DigestIndex::stop() {
+    {
+        std::lock_guard<std::mutex> const LOCK(m_IDLE_MUTEX);
+        m_STOP = true;
+    }
+    m_IDLE_CV.notify_all();
+    {
+        std::lock_guard<std::mutex> const LOCK(m_PACE_MUTEX);
+    }
+    m_PACE_CV.notify_all();
+
+    for (auto& thread : m_THREADS) {
+        thread.join();
+    }
+    m_THREADS.clear();
+    m_WORKERS.clear();
+    m_QUEUED = 0;
+    if (m_SAVER.joinable()) {
+        m_SAVER.join();
+    }
+    if (!m_STORE.empty() && m_DIRTY.exchange(false)) {
+        save();
+    }
+}
+
+/**
+ * @brief Get the digest of a file
+ *
+ * @param key normalized path
+ * @param size size
+ * @param mtime_ns modification time in nanoseconds
+ * @param inode inode
+ * @return std::optional<Sha256Digest> digest if known for this metadata
+ **/
+auto DigestIndex::lookup(const std::string& key,
+                         std::uint64_t size,
+                         std::int64_t mtime_ns,
+                         std::uint64_t inode) -> std::optional<Sha256Digest> {
+    if (m_WORKERS.empty()) {
+        return std::nullopt;
+    }
+    {
+        Shard& shard = shard_of(key);
+        std::shared_lock<std::shared_mutex> const LOCK(shard.mutex);
+        auto const IT = shard.records.find(key);
+        if (IT != shard.records.end()) {
+            const Record& record = IT->second;
+            if (record.digest && record.size == size && record.mtime_ns == mtime_ns
+                && record.inode == inode)
+            {
+                return record.digest;
+            }
+            if (record.queued) {
+                return std::nullopt;
+            }
+        }
+    }
+    request(key, size, mtime_ns, inode, m_WORKERS.size());
+    return std::nullopt;
+}
+
+/**
+ * @brief Apply an inotify event
+ *
+ * @param dir watched directory
+ * @param name entry name
+ * @param mask inotify mask
+ **/
+void DigestIndex::on_event(const fs::path& dir, std::string_view name, std::uint32_t mask) {
+    if (m_WORKERS.empty()) {
+        return;
+    }
+    // Stale digests are never returned, the walk only hashes changed files again sooner
+    if ((mask & InotifyWatcher::OVERFLOW_MASK) != 0) {
+        push({m_ROOT, true}, m_WORKERS.size());
+        return;
+    }
+    if (name.empty() || (mask & InotifyWatcher::SELF_GONE_MASK) != 0) {
+        return;
+    }
+
+    std::string key = join_key(dir.string(), name);
+    bool const IS_DIR = (mask & InotifyWatcher::ISDIR_MASK) != 0;
+    if ((mask & InotifyWatcher::REMOVED_MASK) != 0) {
+        if (IS_DIR) {
+            erase_tree(key);
+        } else {
+            Shard& shard = shard_of(key);
+            std::unique_lock<std::shared_mutex> const LOCK(shard.mutex);
+            shard.records.erase(key);
+        }
+        m_DIRTY = true;
+    } else if (IS_DIR) {
+        // A directory moved in brings its files along
+        if ((mask & InotifyWatcher::CREATED_MASK) != 0) {
+            push({std::move(key), true}, m_WORKERS.size());
+        }
+    } else if ((mask & (InotifyWatcher::CREATED_MASK | InotifyWatcher::WRITTEN_MASK)) != 0) {
+        push({std::move(key), false}, m_WORKERS.size());
+    }
+}
+
+/**
+ * @brief Queue a job
+ *
+ * @param job job
+ * @param worker deque, any when out of range
+ **/
+void DigestIndex::push(Job job, std::size_t worker) {
+    if (worker >= m_WORKERS.size()) {
+        worker = m_NEXT_WORKER.fetch_add(1, std::memory_order_relaxed) % m_WORKERS.size();
+    }
+    {
+        std::lock_guard<std::mutex> const LOCK(m_WORKERS[worker]->mutex);
+        m_WORKERS[worker]->jobs.push_back(std::move(job));
+    }
+    m_QUEUED.fetch_add(1);
+
+    // The count is raised before the lock, so a thread about to wait sees it
+    {
+        std::lock_guard<std::mutex> const LOCK(m_IDLE_MUTEX);
+    }
+    m_IDLE_CV.notify_one();
+}
+
+/**
+ * @brief Take the next job
+ *
+ * @param worker thread number
+ * @param job receives the job
+ * @return true unless stopping
+ **/
+auto DigestIndex::pop(std::size_t worker, Job& job) -> bool {
+    while (!m_STOP) {
+        for (std::size_t i = 0; i < m_WORKERS.size(); ++i) {
+            Worker& victim = *m_WORKERS[(worker + i) % m_WORKERS.size()];
+            std::lock_guard<std::mutex> const LOCK(victim.mutex);
+            if (victim.jobs.empty()) {
+                continue;
+            }
+            // The own newest job keeps a walk depth-first; a thief takes the oldest, often a directory
+            if (i == 0) {
+                job = std::move(victim.jobs.back());
+                victim.jobs.pop_back();
+            } else {
+                job = std::move(victim.jobs.front());
+                victim.jobs.pop_front();
+            }
+            m_QUEUED.fetch_sub(1);
+            return true;
+        }
+
+        std::unique_lock<std::mutex> lock(m_IDLE_MUTEX);
+        m_IDLE_CV.wait(lock, [this] { return m_STOP || m_QUEUED.load() > 0; });
+    }
+    return false;
+}
+
+/**
+ * @brief Hashing thread
+ *
+ * @param worker thread number
+ **/
+void DigestIndex::run(std::size_t worker) {
+    auto* buffer = static_cast<char*>(BufferPool::acquire(READ_BLOCK));
+    Job job;
+    while (pop(worker, job)) {
+        if (job.directory) {
+            walk(job.path, worker);
+        } else {
+            hash_file(job.path, buffer);
+        }
+    }
+    BufferPool::release(buffer, READ_BLOCK);
+}
+
+/**
+ * @brief Queue the contents of a directory
+ *
+ * @param dir normalized directory
+ * @param worker thread number
+ **/
+void DigestIndex::walk(const std::string& dir, std::size_t worker) {
+    DIR* handle = ::opendir(dir.c_str());
+    if (handle == nullptr) {
+        log_debug("Cannot open directory %s: %s\n", dir.c_str(), std::strerror(errno));
+        return;
+    }
+    int const DIR_FD = ::dirfd(handle);
+
+    while (const dirent* entry = ::readdir(handle)) {
+        std::string_view const NAME = entry->d_name;
+        if (NAME == "." || NAME == "..") {
+            continue;
+        }
+        struct stat entry_stat {};
+        if (::fstatat(DIR_FD, entry->d_name, &entry_stat, AT_SYMLINK_NOFOLLOW) != 0) {
+            continue;
+        }
+        // Links to files are served as the files, links to directories are not followed (no loops)
+        if (S_ISLNK(entry_stat.st_mode)
+            && (::fstatat(DIR_FD, entry->d_name, &entry_stat, 0) != 0 || !S_ISREG(entry_stat.st_mode)))
+        {
+            continue;
+        }
+
+        std::string child = join_key(dir, NAME);
+        if (S_ISDIR(entry_stat.st_mode)) {
+            push({std::move(child), true}, worker);
+        } else if (S_ISREG(entry_stat.st_mode)) {
+            request(child,
+                    static_cast<std::uint64_t>(entry_stat.st_size),
+                    mtime_ns_of(entry_stat),
+                    static_cast<std::uint64_t>(entry_stat.st_ino),
+                    worker);
+        }
+    }
+    ::closedir(handle);
+}
+
+/**
+ * @brief Queue a file unless it is current or queued
+ *
+ * @param key normalized path
+ * @param size size
+ * @param mtime_ns modification time in nanoseconds
+ * @param inode inode
+ * @param worker deque
+ **/
+void DigestIndex::request(const std::string& key,
+                          std::uint64_t size,
+                          std::int64_t mtime_ns,
+                          std::uint64_t inode,
+                          std::size_t worker) {
+    {
+        Shard& shard = shard_of(key);
+        std::unique_lock<std::shared_mutex> const LOCK(shard.mutex);
+        Record& record = shard.records[key];
+        if (record.digest && record.size == size && record.mtime_ns == mtime_ns && record.inode == inode) {
+            return;
+        }
+        if (std::exchange(record.queued, true)) {
+            return;
+        }
+    }
+    push({key, false}, worker);
+}
+
+/**
+ * @brief Hash a file
+ *
+ * @param key normalized path
+ * @param buffer read buffer
+ **/
+void DigestIndex::hash_file(const std::string& key, char* buffer) {
+    Shard& shard = shard_of(key);
+    int const FD = ::open(key.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat before {};
+    if (FD == -1 || ::fstat(FD, &before) != 0 || !S_ISREG(before.st_mode)) {
+        if (FD != -1) {
+            ::close(FD);
+        }
+        std::unique_lock<std::shared_mutex> const LOCK(shard.mutex);
+        shard.records.erase(key);
+        return;
+    }
+
+    auto const SIZE = static_cast<std::uint64_t>(before.st_size);
+    std::int64_t const MTIME_NS = mtime_ns_of(before);
+    auto const INODE = static_cast<std::uint64_t>(before.st_ino);
+    {
+        // Events and the walk may queue a file twice
+        std::unique_lock<std::shared_mutex> const LOCK(shard.mutex);
+        Record& record = shard.records[key];
+        if (record.digest && record.size == SIZE && record.mtime_ns == MTIME_NS && record.inode == INODE) {
+            record.queued = false;
+            ::close(FD);
+            return;
+        }
+        record.queued = true;
+    }
+
+    ::posix_fadvise(FD, 0, 0, POSIX_FADV_SEQUENTIAL);
+    Sha256 hash;
+    std::uint64_t offset = 0;
+    bool complete = true;
+    while (offset < SIZE) {
+        std::size_t const WANT = static_cast<std::size_t>(std::min<std::uint64_t>(READ_BLOCK, SIZE - offset));
+        if (!throttle(WANT)) {
+            complete = false;
+            break;
+        }
+        ssize_t const GOT = ::pread(FD, buffer, WANT, static_cast<off_t>(offset));
+        if (GOT < 0 && errno == EINTR) {
+            continue;
+        }
+        if (GOT <= 0) {
+            if (GOT < 0) {
+                log_warn("Cannot hash %s: %s\n", key.c_str(), std::strerror(errno));
+            }
+            complete = false;
+            break;
+        }
+        hash.update({buffer, static_cast<std::size_t>(GOT)});
+        offset += static_cast<std::uint64_t>(GOT);
+    }
+
+    // A file written while it was read gets no digest; its next event or lookup queues it again
+    struct stat after {};
+    complete = complete && ::fstat(FD, &after) == 0 && static_cast<std::uint64_t>(after.st_size) == SIZE
+        && mtime_ns_of(after) == MTIME_NS;
+    ::close(FD);
+
+    {
+        std::unique_lock<std::shared_mutex> const LOCK(shard.mutex);
+        Record& record = shard.records[key];
+        record.queued = false;
+        if (!complete) {
+            return;
+        }
+        record.size = SIZE;
+        record.mtime_ns = MTIME_NS;
+        record.inode = INODE;
+        record.digest = hash.finish();
+    }
+    m_DIRTY = true;
+
+    if (m_LISTENER) {
+        std::size_t const SLASH = key.rfind('/');
+        m_LISTENER(SLASH == 0 ? std::string("/") : key.substr(0, SLASH));
+    }
+}
+
+/**
+ * @brief Pace reads to the configured rate
+ *
+ * @param bytes bytes about to be read
+ * @return true unless stopping
+ **/
+auto DigestIndex::throttle(std::size_t bytes) -> bool {
+    if (m_RATE == 0) {
+        return !m_STOP;
+    }
+    auto const NOW = std::chrono::steady_clock::now();
+    std::unique_lock<std::mutex> lock(m_PACE_MUTEX);
+
+    // Every read reserves the next slot of the shared schedule; idle time is not saved up for bursts
+    auto const START = std::max(NOW, m_PACE);
+    m_PACE = START + std::chrono::nanoseconds(bytes * 1000000000ULL / m_RATE);
+    return !m_PACE_CV.wait_until(lock, START, [this] { return m_STOP.load(); });
+}
+
+/**
+ * @brief Forget a tree
+ *
+ * @param key normalized path
+ **/
+void DigestIndex::erase_tree(const std::string& key) {
+    for (Shard& shard : m_SHARDS) {
+        std::unique_lock<std::shared_mutex> const LOCK(shard.mutex);
+        std::erase_if(shard.records,
+                      [&key](const auto& item)
+                      {
+                          const std::string& path = item.first;
+                          return path.compare(0, key.size(), key) == 0
+                              && (path.size() == key.size() || path[key.size()] == '/');
+                      });
+    }
+}
+
+/**
+ * @brief Read the store
+ *
+ **/
+void DigestIndex::load() {
+    if (m_STORE.empty()) {
+        return;
+    }
+    std::ifstream in(m_STORE, std::ios::binary);
+    if (!in) {
+        return;
+    }
+    std::string line;
+    if (!std::getline(in, line) || line != STORE_HEADER) {
+        log_warn("Ignoring digest store %s: unknown format\n", m_STORE.c_str());
+        return;
+    }
+
+    // Records outside the root belong to another tree and are dropped at the next save
+    std::string const PREFIX = join_key(m_ROOT, "");
+    std::size_t count = 0;
+    while (std::getline(in, line)) {
+        std::string_view rest = line;
+        auto const DIGEST = parse_sha256_hex(next_field(rest));
+        Record record;
+        if (!DIGEST || !parse_number(next_field(rest), record.size)
+            || !parse_number(next_field(rest), record.mtime_ns)
+            || !parse_number(next_field(rest), record.inode) || !rest.starts_with(PREFIX))
+        {
+            continue;
+        }
+        record.digest = DIGEST;
+        Shard& shard = shard_of(rest);
+        std::unique_lock<std::shared_mutex> const LOCK(shard.mutex);
+        shard.records.insert_or_assign(std::string(rest), record);
+        count++;
+    }
+    log_info("Loaded %zu digests from %s\n", count, m_STORE.c_str());
+}
+
+/**
+ * @brief Write the store
+ *
+ **/
+void DigestIndex::save() {
+    std::string const TEMP = m_STORE + ".tmp";
+    std::ofstream out(TEMP, std::ios::binary | std::ios::trunc);
+    out << STORE_HEADER << '\n';
+
+    std::size_t count = 0;
+    std::string lines;
+    for (Shard& shard : m_SHARDS) {
+        lines.clear();
+        {
+            std::shared_lock<std::shared_mutex> const LOCK(shard.mutex);
+            for (const auto& [key, record] : shard.records) {
+                // The store is line-based; the rare name with a newline is hashed again after a restart
+                if (!record.digest || key.find('\n') != std::string::npos) {
+                    continue;
+                }
+                append_hex(lines, digest_bytes(*record.digest));
+                lines += ' ';
+                lines += std::to_string(record.size);
+                lines += ' ';
+                lines += std::to_string(record.mtime_ns);
+                lines += ' ';
+                lines += std::to_string(record.inode);
+                lines += ' ';
+                lines += key;
+                lines += '\n';
+                count++;
+            }
+        }
+        out << lines;
+    }
+    out.close();
+
+    if (!out || std::rename(TEMP.c_str(), m_STORE.c_str()) != 0) {
+        log_warn("Cannot write digest store %s: %s\n", m_STORE.c_str(), std::strerror(errno));
+        std::remove(TEMP.c_str());
+        m_DIRTY = true;
+        return;
+    }
+    log_debug("Saved %zu digests to %s\n", count, m_STORE.c_str());
+}
+
+/**
+ * @brief Store thread
+ *
+ **/
+void DigestIndex::run_saver() {
+    std::unique_lock<std::mutex> lock(m_PACE_MUTEX);
+    while (!m_PACE_CV.wait_for(lock, SAVE_INTERVAL, [this] { return m_STOP.load(); })) {
+        lock.unlock();
+        if (m_DIRTY.exchange(false)) {
+            save();
+        }
+        lock.lock();
+    }
+}
@@ -0,0 +1,311 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include "digest.hpp"
+
+namespace fs = boost::filesystem;
+
+class DigestIndex {
+    /**
+     * @brief DigestIndex - SHA-256 digests of every file below the served root
+     *
+     * A pool of background threads walks the tree and hashes every regular
+     * file. Directories and files are jobs in per-thread deques: a thread
+     * takes its newest job and, when its deque is empty, steals the oldest
+     * job of another thread, so one large directory spreads over the whole
+     * pool. Reads are paced to a byte rate shared by all threads, which
+     * keeps the walk from starving requests of disk bandwidth.
+     *
+     * Every digest is stored with the size, exact mtime and inode it was
+     * taken at, and only returned while the file still has them. A lookup
+     * which finds no digest, or a stale one, queues the file, so a file is
+     * hashed soon after it is first served. Inotify events queue written
+     * files and drop removed ones early.
+     *
+     * With a store file the digests survive restarts: they are loaded at
+     * start, and written back (to a temporary file renamed over the store)
+     * periodically while they change and at stop. Only files whose metadata
+     * changed in the meantime are hashed again.
+     **/
+
+  public:
+    /**
+     * @brief Hashing threads used when none are configured
+     *
+     **/
+    static constexpr std::size_t DEFAULT_THREADS = 2;
+
+    /**
+     * @brief Read rate of all hashing threads together, in bytes per second
+     *
+     **/
+    static constexpr std::uint64_t DEFAULT_RATE = 128ULL * 1024 * 1024;
+
+    /**
+     * @brief Interval at which changed digests are written to the store
+     *
+     **/
+    static constexpr std::chrono::seconds SAVE_INTERVAL {30};
+
+    /**
+     * @brief Called with the normalized directory of a file whose digest is now known
+     *
+     **/
+    using Listener = std::function<void(const std::string& dir)>;
+
+    DigestIndex() = default;
+    ~DigestIndex();
+
+    DigestIndex(const DigestIndex&) = delete;
+    auto operator=(const DigestIndex&) -> DigestIndex& = delete;
+
+    /**
+     * @brief Configure the index; it stays disabled until this is called
+     *
+     * Must be called before start().
+     *
+     * @param store file the digests are kept in, empty to keep them in memory only
+     * @param threads hashing threads (0 means DEFAULT_THREADS)
+     * @param rate read rate in bytes per second (0 means unlimited)
+     **/
+    void configure(std::string store, std::size_t threads, std::uint64_t rate);
+
+    /**
+     * @brief Check whether the index was configured
+     *
+     * @return true if lookups may return digests
+     **/
+    auto is_enabled() const -> bool { return m_THREAD_COUNT > 0; }
+
+    /**
+     * @brief Set the listener called when a digest becomes known
+     *
+     * Must be called before start(). It runs on a hashing thread.
+     *
+     * @param listener listener
+     **/
+    void set_listener(Listener listener) { m_LISTENER = std::move(listener); }
+
+    /**
+     * @brief Load the store and start indexing a tree in the background
+     *
+     * @param root normalized root of the served tree
+     **/
+    void start(const std::string& root);
+
+    /**
+     * @brief Stop the hashing threads and write the store
+     *
+     **/
+    void stop();
+
+    /**
+     * @brief Get the digest of a file
+     *
+     * A miss queues the file for hashing.
+     *
+     * @param key normalized path
+     * @param size current size of the file
+     * @param mtime_ns current modification time in nanoseconds
+     * @param inode current inode
+     * @return std::optional<Sha256Digest> digest, empty while it is not known for this metadata
+     **/
+    auto lookup(const std::string& key, std::uint64_t size, std::int64_t mtime_ns, std::uint64_t inode)
+        -> std::optional<Sha256Digest>;
+
+    /**
+     * @brief Apply an inotify event
+     *
+     * @param dir watched directory
+     * @param name entry name
+     * @param mask inotify mask
+     **/
+    void on_event(const fs::path& dir, std::string_view name, std::uint32_t mask);
+
+  private:
+    /**
+     * @brief Number of independently locked parts of the map
+     *
+     **/
+    static constexpr std::size_t SHARD_COUNT = 64;
+
+    /**
+     * @brief What is known about one file
+     *
+     **/
+    struct Record {
+        std::uint64_t size = 0;
+        std::int64_t mtime_ns = 0;
+        std::uint64_t inode = 0;
+        std::optional<Sha256Digest> digest;
+        bool queued = false;
+    };
+
+    struct KeyHash {
+        using is_transparent = void;
+        auto operator()(std::string_view key) const -> std::size_t { return std::hash<std::string_view> {}(key); }
+    };
+
+    struct Shard {
+        std::shared_mutex mutex;
+        std::unordered_map<std::string, Record, KeyHash, std::equal_to<>> records;
+    };
+
+    /**
+     * @brief A directory to walk or a file to hash
+     *
+     **/
+    struct Job {
+        std::string path;
+        bool directory = false;
+    };
+
+    /**
+     * @brief Jobs of one hashing thread; others steal from the front
+     *
+     **/
+    struct Worker {
+        std::mutex mutex;
+        std::deque<Job> jobs;
+    };
+
+    /**
+     * @brief Get the shard of a key
+     *
+     * @param key normalized path
+     * @return Shard& shard
+     **/
+    auto shard_of(std::string_view key) -> Shard& {
+        return m_SHARDS[std::hash<std::string_view> {}(key) % SHARD_COUNT];
+    }
+
+    /**
+     * @brief Queue a job
+     *
+     * @param job job
+     * @param worker deque to queue it in, any when out of range
+     **/
+    void push(Job job, std::size_t worker);
+
+    /**
+     * @brief Take the next job of a thread, stealing when its deque is empty
+     *
+     * @param worker thread number
+     * @param job receives the job
+     * @return true unless the index is stopping
+     **/
+    auto pop(std::size_t worker, Job& job) -> bool;
+
+    /**
+     * @brief Hashing thread
+     *
+     * @param worker thread number
+     **/
+    void run(std::size_t worker);
+
+    /**
+     * @brief Queue the subdirectories and stale files of a directory
+     *
+     * @param dir normalized directory
+     * @param worker thread number
+     **/
+    void walk(const std::string& dir, std::size_t worker);
+
+    /**
+     * @brief Queue a file unless its digest is current or it is already queued
+     *
+     * @param key normalized path
+     * @param size size
+     * @param mtime_ns modification time in nanoseconds
+     * @param inode inode
+     * @param worker deque to queue it in
+     **/
+    void request(const std::string& key,
+                 std::uint64_t size,
+                 std::int64_t mtime_ns,
+                 std::uint64_t inode,
+                 std::size_t worker);
+
+    /**
+     * @brief Hash a file and record its digest
+     *
+     * @param key normalized path
+     * @param buffer read buffer of READ_BLOCK bytes
+     **/
+    void hash_file(const std::string& key, char* buffer);
+
+    /**
+     * @brief Wait until the rate allows reading more bytes
+     *
+     * @param bytes bytes about to be read
+     * @return true unless the index is stopping
+     **/
+    auto throttle(std::size_t bytes) -> bool;
+
+    /**
+     * @brief Forget a path and, for a directory, everything below it
+     *
+     * @param key normalized path
+     **/
+    void erase_tree(const std::string& key);
+
+    /**
+     * @brief Read the store into the map
+     *
+     **/
+    void load();
+
+    /**
+     * @brief Write the known digests to the store
+     *
+     **/
+    void save();
+
+    /**
+     * @brief Store thread: writes changed digests every SAVE_INTERVAL
+     *
+     **/
+    void run_saver();
+
+    std::string m_STORE;
+    std::size_t m_THREAD_COUNT = 0;
+    std::uint64_t m_RATE = 0;
+    std::string m_ROOT;
+    Listener m_LISTENER;
+
+    std::array<Shard, SHARD_COUNT> m_SHARDS;
+    std::atomic<bool> m_DIRTY {false};
+
+    std::vector<std::unique_ptr<Worker>> m_WORKERS;
+    std::atomic<std::size_t> m_NEXT_WORKER {0};
+    std::atomic<std::size_t> m_QUEUED {0};
+    std::mutex m_IDLE_MUTEX;
+    std::condition_variable m_IDLE_CV;
+
+    std::mutex m_PACE_MUTEX;
+    std::condition_variable m_PACE_CV;
+    std::chrono::steady_clock::time_point m_PACE;
+
+    std::atomic<bool> m_STOP {false};
+    std::vector<std::thread> m_THREADS;
+    std::thread m_SAVER;
+};
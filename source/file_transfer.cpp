@@ -0,0 +1,586 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "file_transfer.hpp"
+
+#include <boost/asio/error.hpp>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#    include <sys/sendfile.h>
+#endif
+
+#include "logger.hpp"
+
+namespace net = boost::asio;
+
+/**
+ * @brief Anonymous namespace for helper functions
+ *
+ **/
+namespace {
+    /**
+     * @brief Largest count a single sendfile(2) call accepts on Linux
+     *
+     **/
+    constexpr std::uint64_t MAX_SENDFILE_CHUNK = 0x7ffff000;
+
+    /**
+     * @brief send(2) flags: never raise SIGPIPE where the platform allows it
+     *
+     **/
+#ifdef MSG_NOSIGNAL
+    constexpr int SEND_FLAGS = MSG_NOSIGNAL;
+#else
+    constexpr int SEND_FLAGS = 0;
+#endif
+
+    /**
+     * @brief Build an error code from errno
+     *
+     * @param err errno value
+     * @return beast::error_code
+     **/
+    auto errno_code(int err) -> beast::error_code {
+        if (err == EAGAIN || err == EWOULDBLOCK) {
+            return net::error::would_block;
+        }
+        return {err, boost::system::system_category()};
+    }
+}    // namespace
+
+FileTransfer::FileTransfer(FileTransfer&& other) noexcept
+    : m_FD(std::exchange(other.m_FD, -1))
+    , m_MEMORY(std::move(other.m_MEMORY))
+    , m_STREAM(std::move(other.m_STREAM))
+    , m_SOURCE(std::move(other.m_SOURCE))
+    , m_SOURCE_POSITION(std::exchange(other.m_SOURCE_POSITION, 0))
+    , m_SOURCE_LEFT(std::exchange(other.m_SOURCE_LEFT, 0))
+    , m_SOURCE_SEEK(std::exchange(other.m_SOURCE_SEEK, false))
+    , m_OBSERVE(std::exchange(other.m_OBSERVE, false))
+    , m_SIZE(std::exchange(other.m_SIZE, 0))
+    , m_MTIME(std::exchange(other.m_MTIME, 0))
+    , m_MTIME_NS(std::exchange(other.m_MTIME_NS, 0))
+    , m_INODE(std::exchange(other.m_INODE, 0))
+    , m_CONTENT_LENGTH(std::exchange(other.m_CONTENT_LENGTH, 0))
+    , m_REMAINING(std::exchange(other.m_REMAINING, 0))
+    , m_PARTS(std::move(other.m_PARTS))
+    , m_PART(std::exchange(other.m_PART, 0))
+    , m_PREFIX_POS(std::exchange(other.m_PREFIX_POS, 0))
+    , m_ZERO_COPY(std::exchange(other.m_ZERO_COPY, true))
+    , m_BUFFER(std::move(other.m_BUFFER))
+    , m_BUFFER_POS(std::exchange(other.m_BUFFER_POS, 0))
+    , m_BUFFER_END(std::exchange(other.m_BUFFER_END, 0)) {}
+
+auto FileTransfer::operator=(FileTransfer&& other) noexcept -> FileTransfer& {
+    if (this != &other) {
+        close();
+        m_FD = std::exchange(other.m_FD, -1);
+        m_MEMORY = std::move(other.m_MEMORY);
+        m_STREAM = std::move(other.m_STREAM);
+        m_SOURCE = std::move(other.m_SOURCE);
+        m_SOURCE_POSITION = std::exchange(other.m_SOURCE_POSITION, 0);
+        m_SOURCE_LEFT = std::exchange(other.m_SOURCE_LEFT, 0);
+        m_SOURCE_SEEK = std::exchange(other.m_SOURCE_SEEK, false);
+        m_OBSERVE = std::exchange(other.m_OBSERVE, false);
+        m_SIZE = std::exchange(other.m_SIZE, 0);
+        m_MTIME = std::exchange(other.m_MTIME, 0);
+        m_MTIME_NS = std::exchange(other.m_MTIME_NS, 0);
+        m_INODE = std::exchange(other.m_INODE, 0);
+        m_CONTENT_LENGTH = std::exchange(other.m_CONTENT_LENGTH, 0);
+        m_REMAINING = std::exchange(other.m_REMAINING, 0);
+        m_PARTS = std::move(other.m_PARTS);
+        m_PART = std::exchange(other.m_PART, 0);
+        m_PREFIX_POS = std::exchange(other.m_PREFIX_POS, 0);
+        m_ZERO_COPY = std::exchange(other.m_ZERO_COPY, true);
+        m_BUFFER = std::move(other.m_BUFFER);
+        m_BUFFER_POS = std::exchange(other.m_BUFFER_POS, 0);
+        m_BUFFER_END = std::exchange(other.m_BUFFER_END, 0);
+    }
+    return *this;
+}
+
+FileTransfer::~FileTransfer() {
+    close();
+}
+
+/**
+ * @brief Open the file and select all of it for sending
+ *
+ * @param path file path
+ * @param ec error code
+ * @return true on success
+ **/
+auto FileTransfer::open(const fs::path& path, beast::error_code& ec) -> bool {
+    close();
+
+    int const FD = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (FD == -1) {
+        ec = errno_code(errno);
+        return false;
+    }
+
+    struct stat file_stat {};
+    if (::fstat(FD, &file_stat) == -1) {
+        ec = errno_code(errno);
+        ::close(FD);
+        return false;
+    }
+
+    m_FD = FD;
+    m_SIZE = static_cast<std::uint64_t>(file_stat.st_size);
+    m_MTIME = file_stat.st_mtime;
+    m_MTIME_NS = static_cast<std::int64_t>(file_stat.st_mtim.tv_sec) * 1000000000 + file_stat.st_mtim.tv_nsec;
+    m_INODE = static_cast<std::uint64_t>(file_stat.st_ino);
+    select(0, m_SIZE);
+
+#ifdef __linux__
+    m_ZERO_COPY = true;
+#else
+    m_ZERO_COPY = false;
+#endif
+
+    ec = {};
+    return true;
+}
+
+/**
+ * @brief Attach in-memory content
+ *
+ * @param content content
+ * @param inode inode of the source file
+ * @param mtime_ns mtime in ns
+ * @param mtime mtime
+ **/
+void FileTransfer::attach(std::shared_ptr<const std::string> content,
+                          std::uint64_t inode,
+                          std::int64_t mtime_ns,
+                          std::time_t mtime) {
+    close();
+
+    m_SIZE = content->size();
+    m_MEMORY = std::move(content);
+    m_MTIME = mtime;
+    m_MTIME_NS = mtime_ns;
+    m_INODE = inode;
+    select(0, m_SIZE);
+}
+
+/**
+ * @brief Attach a body stream
+ *
+ * @param stream body producer
+ **/
+void FileTransfer::attach_stream(std::shared_ptr<BodyStream> stream) {
+    close();
+    m_STREAM = std::move(stream);
+}
+
+/**
+ * @brief Attach a body assembled from many files
+ *
+ * @param source segment producer
+ * @param mtime mtime of the body
+ **/
+void FileTransfer::attach_source(std::shared_ptr<PartSource> source, std::time_t mtime) {
+    close();
+
+    m_SIZE = source->size();
+    m_SOURCE = std::move(source);
+    m_MTIME = mtime;
+    select(0, m_SIZE);
+}
+
+/**
+ * @brief Read the opened file
+ *
+ * @param out content
+ * @param ec error code
+ * @return true if the whole file was read
+ **/
+auto FileTransfer::read_all(std::string& out, beast::error_code& ec) const -> bool {
+    out.resize(static_cast<std::size_t>(m_SIZE));
+
+    std::size_t done = 0;
+    while (done < out.size()) {
+        ssize_t const READ = ::pread(m_FD, out.data() + done, out.size() - done, static_cast<off_t>(done));
+        if (READ < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            ec = errno_code(errno);
+            return false;
+        }
+        if (READ == 0) {
+            // File shrank since fstat, its content no longer matches the validators
+            ec = net::error::eof;
+            return false;
+        }
+        done += static_cast<std::size_t>(READ);
+    }
+
+    ec = {};
+    return true;
+}
+
+/**
+ * @brief Close the file
+ *
+ **/
+void FileTransfer::close() {
+    if (m_FD != -1) {
+        ::close(m_FD);
+        m_FD = -1;
+    }
+    m_MEMORY.reset();
+    m_STREAM.reset();
+    m_SOURCE.reset();
+    m_SIZE = 0;
+    m_MTIME = 0;
+    m_MTIME_NS = 0;
+    m_INODE = 0;
+    clear_parts();
+}
+
+/**
+ * @brief Send a single range of the file
+ *
+ * @param offset range start
+ * @param length range length
+ **/
+void FileTransfer::select(std::uint64_t offset, std::uint64_t length) {
+    clear_parts();
+    if (m_SOURCE) {
+        // Parts are loaded while sending, starting with a seek to the range
+        m_CONTENT_LENGTH = length;
+        m_REMAINING = length;
+        m_SOURCE_POSITION = offset;
+        m_SOURCE_LEFT = length;
+        m_SOURCE_SEEK = true;
+        return;
+    }
+    add_part({}, offset, length);
+}
+
+/**
+ * @brief Reset the body to no parts
+ *
+ **/
+void FileTransfer::clear_parts() {
+    m_PARTS.clear();
+    m_PART = 0;
+    m_PREFIX_POS = 0;
+    m_BUFFER_POS = 0;
+    m_BUFFER_END = 0;
+    m_CONTENT_LENGTH = 0;
+    m_REMAINING = 0;
+    m_SOURCE_LEFT = 0;
+    m_SOURCE_SEEK = false;
+    m_OBSERVE = false;
+}
+
+/**
+ * @brief Append a prefix and file range to the body
+ *
+ * @param prefix in-memory bytes sent first
+ * @param offset range start
+ * @param length range length
+ **/
+void FileTransfer::add_part(std::string prefix, std::uint64_t offset, std::uint64_t length) {
+    std::uint64_t const PART_LENGTH = prefix.size() + length;
+    m_PARTS.push_back({std::move(prefix), offset, offset + length});
+    m_CONTENT_LENGTH += PART_LENGTH;
+    m_REMAINING += PART_LENGTH;
+}
+
+/**
+ * @brief Send body bytes to a non-blocking socket
+ *
+ * @param socket_fd socket handle
+ * @param ec error code
+ * @param prefixes_only stop before file ranges
+ * @return std::size_t bytes sent
+ **/
+auto FileTransfer::send_some(int socket_fd, beast::error_code& ec, bool prefixes_only) -> std::size_t {
+    ec = {};
+
+    std::size_t total = 0;
+    while (true) {
+        if (m_PART >= m_PARTS.size() && (m_SOURCE_LEFT == 0 || !load_source_part(ec))) {
+            return total;
+        }
+        Part const& part = m_PARTS[m_PART];
+
+        std::size_t sent = 0;
+        if (m_PREFIX_POS < part.prefix.size()) {
+            sent = send_prefix(socket_fd, ec);
+        } else if (part.offset < part.end || m_BUFFER_POS < m_BUFFER_END) {
+            if (prefixes_only) {
+                return total;
+            }
+            if (m_MEMORY) {
+                sent = send_memory(socket_fd, ec);
+            } else {
+                sent = m_ZERO_COPY ? send_zero_copy(socket_fd, ec) : send_buffered(socket_fd, ec);
+            }
+        } else {
+            ++m_PART;
+            m_PREFIX_POS = 0;
+            continue;
+        }
+
+        total += sent;
+        m_REMAINING -= sent;
+        if (ec) {
+            return total;
+        }
+    }
+}
+
+/**
+ * @brief Load the next segment of the source as the only part
+ *
+ * @param ec error code
+ * @return true if a part was loaded
+ **/
+auto FileTransfer::load_source_part(beast::error_code& ec) -> bool {
+    PartSource::Segment segment;
+    std::uint64_t skip = 0;
+    if (std::exchange(m_SOURCE_SEEK, false)) {
+        skip = m_SOURCE_POSITION - m_SOURCE->seek(m_SOURCE_POSITION, segment);
+    } else if (!m_SOURCE->next(segment)) {
+        ec = net::error::eof;
+        return false;
+    }
+
+    // A range may start inside the segment and end inside it
+    if (skip < segment.prefix.size()) {
+        segment.prefix.erase(0, static_cast<std::size_t>(skip));
+    } else {
+        skip -= segment.prefix.size();
+        segment.prefix.clear();
+        segment.offset += skip;
+        segment.length -= skip;
+        segment.observe = segment.observe && skip == 0;
+    }
+    if (segment.prefix.size() > m_SOURCE_LEFT) {
+        segment.prefix.resize(static_cast<std::size_t>(m_SOURCE_LEFT));
+    }
+    segment.length = std::min(segment.length, m_SOURCE_LEFT - segment.prefix.size());
+    m_SOURCE_LEFT -= segment.prefix.size() + segment.length;
+
+    if (m_FD != -1) {
+        ::close(m_FD);
+        m_FD = -1;
+    }
+    if (segment.length > 0) {
+        m_FD = ::open(segment.path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (m_FD == -1) {
+            ec = errno_code(errno);
+            return false;
+        }
+    }
+
+    m_PARTS.clear();
+    m_PARTS.push_back({std::move(segment.prefix), segment.offset, segment.offset + segment.length});
+    m_PART = 0;
+    m_PREFIX_POS = 0;
+    m_BUFFER_POS = 0;
+    m_BUFFER_END = 0;
+    m_OBSERVE = segment.observe;
+#ifdef __linux__
+    // Bytes the source wants to see go through the buffer
+    m_ZERO_COPY = !m_OBSERVE;
+#else
+    m_ZERO_COPY = false;
+#endif
+    return true;
+}
+
+/**
+ * @brief Get the next file range
+ *
+ * @param offset range start
+ * @param length range length
+ * @return true if a file range is next
+ **/
+auto FileTransfer::pending_file_range(std::uint64_t& offset, std::uint64_t& length) const -> bool {
+    if (m_PART >= m_PARTS.size() || m_PREFIX_POS < m_PARTS[m_PART].prefix.size() || m_OBSERVE) {
+        return false;
+    }
+    Part const& part = m_PARTS[m_PART];
+    offset = part.offset;
+    length = part.end - part.offset;
+    return length > 0;
+}
+
+/**
+ * @brief Advance the pending file range
+ *
+ * @param count bytes read
+ **/
+void FileTransfer::consume_file_bytes(std::uint64_t count) {
+    m_PARTS[m_PART].offset += count;
+}
+
+/**
+ * @brief Send the prefix of the current part
+ *
+ * @param socket_fd socket handle
+ * @param ec error code
+ * @return std::size_t bytes sent
+ **/
+auto FileTransfer::send_prefix(int socket_fd, beast::error_code& ec) -> std::size_t {
+    std::string const& prefix = m_PARTS[m_PART].prefix;
+
+    while (true) {
+        ssize_t const SENT =
+            ::send(socket_fd, prefix.data() + m_PREFIX_POS, prefix.size() - m_PREFIX_POS, SEND_FLAGS);
+        if (SENT >= 0) {
+            m_PREFIX_POS += static_cast<std::size_t>(SENT);
+            return static_cast<std::size_t>(SENT);
+        }
+        if (errno != EINTR) {
+            ec = errno_code(errno);
+            return 0;
+        }
+    }
+}
+
+/**
+ * @brief Send the file range of the current part with sendfile(2)
+ *
+ * @param socket_fd socket handle
+ * @param ec error code
+ * @return std::size_t bytes sent
+ **/
+auto FileTransfer::send_zero_copy(int socket_fd, beast::error_code& ec) -> std::size_t {
+#ifdef __linux__
+    Part& part = m_PARTS[m_PART];
+
+    std::size_t total = 0;
+    while (part.offset < part.end) {
+        auto offset = static_cast<off_t>(part.offset);
+        auto const COUNT = static_cast<std::size_t>(std::min(part.end - part.offset, MAX_SENDFILE_CHUNK));
+        ssize_t const SENT = ::sendfile(socket_fd, m_FD, &offset, COUNT);
+
+        if (SENT > 0) {
+            part.offset += static_cast<std::uint64_t>(SENT);
+            total += static_cast<std::size_t>(SENT);
+            continue;
+        }
+        if (SENT == 0) {
+            // File shrank underneath us, nothing more can be sent
+            ec = net::error::eof;
+            return total;
+        }
+
+        int const ERR = errno;
+        if (ERR == EINTR) {
+            continue;
+        }
+        if (ERR == EINVAL || ERR == ENOSYS || ERR == EOPNOTSUPP) {
+            log_debug("sendfile unavailable for this file, using buffered copy\n");
+            m_ZERO_COPY = false;
+            return total + send_buffered(socket_fd, ec);
+        }
+        ec = errno_code(ERR);
+        return total;
+    }
+    return total;
+#else
+    m_ZERO_COPY = false;
+    return send_buffered(socket_fd, ec);
+#endif
+}
+
+/**
+ * @brief Send the range of the current part from memory
+ *
+ * @param socket_fd socket handle
+ * @param ec error code
+ * @return std::size_t bytes sent
+ **/
+auto FileTransfer::send_memory(int socket_fd, beast::error_code& ec) -> std::size_t {
+    Part& part = m_PARTS[m_PART];
+
+    std::size_t total = 0;
+    while (part.offset < part.end) {
+        ssize_t const SENT = ::send(socket_fd,
+                                    m_MEMORY->data() + part.offset,
+                                    static_cast<std::size_t>(part.end - part.offset),
+                                    SEND_FLAGS);
+        if (SENT < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            ec = errno_code(errno);
+            return total;
+        }
+        part.offset += static_cast<std::uint64_t>(SENT);
+        total += static_cast<std::size_t>(SENT);
+    }
+    return total;
+}
+
+/**
+ * @brief Send the file range of the current part through the fallback buffer
+ *
+ * @param socket_fd socket handle
+ * @param ec error code
+ * @return std::size_t bytes sent
+ **/
+auto FileTransfer::send_buffered(int socket_fd, beast::error_code& ec) -> std::size_t {
+    if (m_BUFFER.empty()) {
+        m_BUFFER.resize(FALLBACK_BUFFER_SIZE);
+        log_debug("Open buffer (%zu) for file transfer\n", FALLBACK_BUFFER_SIZE);
+    }
+
+    Part& part = m_PARTS[m_PART];
+
+    std::size_t total = 0;
+    while (part.offset < part.end || m_BUFFER_POS < m_BUFFER_END) {
+        if (m_BUFFER_POS == m_BUFFER_END) {
+            auto const COUNT = static_cast<std::size_t>(std::min<std::uint64_t>(part.end - part.offset, m_BUFFER.size()));
+            ssize_t const READ = ::pread(m_FD, m_BUFFER.data(), COUNT, static_cast<off_t>(part.offset));
+            if (READ < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                ec = errno_code(errno);
+                return total;
+            }
+            if (READ == 0) {
+                ec = net::error::eof;
+                return total;
+            }
+            part.offset += static_cast<std::uint64_t>(READ);
+            m_BUFFER_POS = 0;
+            m_BUFFER_END = static_cast<std::size_t>(READ);
+            if (m_OBSERVE) {
+                m_SOURCE->observe({m_BUFFER.data(), m_BUFFER_END});
+            }
+        }
+
+        ssize_t const SENT =
+            ::send(socket_fd, m_BUFFER.data() + m_BUFFER_POS, m_BUFFER_END - m_BUFFER_POS, SEND_FLAGS);
+        if (SENT < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            ec = errno_code(errno);
+            return total;
+        }
+        m_BUFFER_POS += static_cast<std::size_t>(SENT);
+        total += static_cast<std::size_t>(SENT);
+    }
+    return total;
+}
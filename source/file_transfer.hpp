@@ -0,0 +1,436 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <boost/beast/core/error.hpp>
+#include <boost/filesystem.hpp>
+
+namespace beast = boost::beast;
+namespace fs = boost::filesystem;
+
+class BodyStream {
+    /**
+     * @brief BodyStream - a response body produced piece by piece
+     *
+     * Bodies whose length is unknown when the header goes out (a large
+     * directory listing rendered while it is sent) implement this interface;
+     * the session writes every piece as one chunk of a chunked response.
+     **/
+
+  public:
+    BodyStream() = default;
+    virtual ~BodyStream() = default;
+
+    BodyStream(const BodyStream&) = delete;
+    auto operator=(const BodyStream&) -> BodyStream& = delete;
+
+    /**
+     * @brief Produce the next piece of the body
+     *
+     * @param out string the piece is appended to
+     * @return true while more pieces follow, false once the body is complete
+     **/
+    virtual auto next(std::string& out) -> bool = 0;
+};
+
+class PartSource {
+    /**
+     * @brief PartSource - a body of known length assembled from many files
+     *
+     * Bodies such as an archive of a directory tree implement this interface.
+     * The body is a sequence of segments, each an in-memory prefix followed
+     * by a byte range of one file. Segments are produced one at a time while
+     * the body is sent, so only the current one is held in memory, and the
+     * layout is deterministic, so any byte range of the body can be produced
+     * again by seeking to it.
+     **/
+
+  public:
+    /**
+     * @brief A prefix and a byte range of one file
+     *
+     **/
+    struct Segment {
+        std::string prefix;
+        fs::path path;
+        std::uint64_t offset = 0;
+        std::uint64_t length = 0;
+        bool observe = false;    // hand the file bytes to observe() as they are sent
+    };
+
+    PartSource() = default;
+    virtual ~PartSource() = default;
+
+    PartSource(const PartSource&) = delete;
+    auto operator=(const PartSource&) -> PartSource& = delete;
+
+    /**
+     * @brief Get the length of the whole body
+     *
+     * @return std::uint64_t body length
+     **/
+    virtual auto size() const -> std::uint64_t = 0;
+
+    /**
+     * @brief Produce the segment which contains a body offset
+     *
+     * @param position body offset, below size()
+     * @param out receives the segment
+     * @return std::uint64_t body offset at which the segment starts
+     **/
+    virtual auto seek(std::uint64_t position, Segment& out) -> std::uint64_t = 0;
+
+    /**
+     * @brief Produce the segment after the last one produced
+     *
+     * @param out receives the segment
+     * @return true unless the body is complete
+     **/
+    virtual auto next(Segment& out) -> bool = 0;
+
+    /**
+     * @brief Receive the file bytes of a segment produced with observe set
+     *
+     * @param data next bytes of the file range, in order
+     **/
+    virtual void observe(std::string_view /*data*/) {}
+};
+
+class FileTransfer {
+    /**
+     * @brief FileTransfer - zero-copy file body of a response
+     *
+     * Owns the file descriptor of a file being served and moves its bytes
+     * to a socket. On Linux the bytes go straight from the page cache to the
+     * socket with sendfile(2); where that is not available (other platforms,
+     * or files sendfile refuses) it falls back to a pread/send loop through
+     * one large buffer. The response header is written separately by the
+     * session, so the file is sent exactly once, after exactly one header.
+     *
+     * The body is a list of parts. Each part is an optional in-memory prefix
+     * followed by a byte range of the file, which is how single ranges and
+     * multipart/byteranges bodies share the same zero-copy path.
+     *
+     * Instead of a file, the body can also come from memory (attach()), for
+     * files held by the hot-file cache; ranges work the same way.
+     *
+     * A body of unknown length is attached as a BodyStream instead
+     * (attach_stream()); it has no parts and is sent chunked by the session.
+     * A body of known length spread over many files is attached as a
+     * PartSource (attach_source()); its parts are loaded one at a time, each
+     * opening its own file, and select() picks a single range of it.
+     **/
+
+  public:
+    /**
+     * @brief Size of the fallback copy buffer
+     *
+     **/
+    static constexpr std::size_t FALLBACK_BUFFER_SIZE = 256 * 1024;
+
+    FileTransfer() = default;
+
+    FileTransfer(const FileTransfer&) = delete;
+    auto operator=(const FileTransfer&) -> FileTransfer& = delete;
+
+    FileTransfer(FileTransfer&& other) noexcept;
+    auto operator=(FileTransfer&& other) noexcept -> FileTransfer&;
+
+    /**
+     * @brief Destroy the File Transfer object, closing the file
+     *
+     **/
+    ~FileTransfer();
+
+    /**
+     * @brief Open a file for sending
+     *
+     * The whole file is selected for transfer.
+     *
+     * @param path path of the file
+     * @param ec set on failure
+     * @return true if the file was opened
+     **/
+    auto open(const fs::path& path, beast::error_code& ec) -> bool;
+
+    /**
+     * @brief Send in-memory content instead of a file
+     *
+     * The whole content is selected for transfer. The metadata describes the
+     * file the content was read from.
+     *
+     * @param content file content, kept alive until the transfer is closed
+     * @param inode inode number of the file
+     * @param mtime_ns modification time in nanoseconds since the epoch
+     * @param mtime modification time
+     **/
+    void attach(std::shared_ptr<const std::string> content,
+                std::uint64_t inode,
+                std::int64_t mtime_ns,
+                std::time_t mtime);
+
+    /**
+     * @brief Send a body produced while it is written
+     *
+     * @param stream producer of the body, kept alive until the transfer is closed
+     **/
+    void attach_stream(std::shared_ptr<BodyStream> stream);
+
+    /**
+     * @brief Send a body assembled from the files of a PartSource
+     *
+     * The whole body is selected for transfer.
+     *
+     * @param source producer of the segments, kept alive until the transfer is closed
+     * @param mtime modification time reported for the body
+     **/
+    void attach_source(std::shared_ptr<PartSource> source, std::time_t mtime);
+
+    /**
+     * @brief Check whether the body comes from a PartSource
+     *
+     * Such bodies support a single range only, not add_part().
+     *
+     * @return true if a source is attached
+     **/
+    auto has_source() const -> bool { return m_SOURCE != nullptr; }
+
+    /**
+     * @brief Check whether the body is a stream
+     *
+     * @return true if a stream is attached
+     **/
+    auto is_streaming() const -> bool { return m_STREAM != nullptr; }
+
+    /**
+     * @brief Produce the next piece of a streamed body
+     *
+     * @param out string the piece is appended to
+     * @return true while more pieces follow
+     **/
+    auto next_chunk(std::string& out) -> bool { return m_STREAM->next(out); }
+
+    /**
+     * @brief Read the whole opened file into memory
+     *
+     * @param out receives the content
+     * @param ec set on failure
+     * @return true if exactly size() bytes were read
+     **/
+    auto read_all(std::string& out, beast::error_code& ec) const -> bool;
+
+    /**
+     * @brief Close the file and reset the transfer
+     *
+     **/
+    void close();
+
+    /**
+     * @brief Replace the body with a single byte range of the file
+     *
+     * @param offset first byte to send
+     * @param length number of bytes to send
+     **/
+    void select(std::uint64_t offset, std::uint64_t length);
+
+    /**
+     * @brief Drop all parts of the body
+     *
+     * Used before building a body from add_part() calls.
+     **/
+    void clear_parts();
+
+    /**
+     * @brief Append a part to the body
+     *
+     * @param prefix bytes sent before the file range (e.g. a multipart header)
+     * @param offset first byte of the file range
+     * @param length length of the file range, may be 0
+     **/
+    void add_part(std::string prefix, std::uint64_t offset, std::uint64_t length);
+
+    /**
+     * @brief Check whether a file is attached
+     *
+     * @return true if open
+     **/
+    auto is_open() const -> bool { return m_FD != -1 || m_MEMORY != nullptr || m_SOURCE != nullptr; }
+
+    /**
+     * @brief Get the size of the attached file
+     *
+     * @return std::uint64_t file size in bytes
+     **/
+    auto size() const -> std::uint64_t { return m_SIZE; }
+
+    /**
+     * @brief Get the modification time of the attached file
+     *
+     * @return std::time_t mtime
+     **/
+    auto mtime() const -> std::time_t { return m_MTIME; }
+
+    /**
+     * @brief Get the modification time of the attached file in nanoseconds
+     *
+     * @return std::int64_t mtime in ns since the epoch
+     **/
+    auto mtime_ns() const -> std::int64_t { return m_MTIME_NS; }
+
+    /**
+     * @brief Get the inode number of the attached file
+     *
+     * @return std::uint64_t inode
+     **/
+    auto inode() const -> std::uint64_t { return m_INODE; }
+
+    /**
+     * @brief Get the total length of the body, for Content-Length
+     *
+     * @return std::uint64_t body length
+     **/
+    auto content_length() const -> std::uint64_t { return m_CONTENT_LENGTH; }
+
+    /**
+     * @brief Get the number of bytes which are still to be sent
+     *
+     * @return std::uint64_t remaining bytes
+     **/
+    auto remaining() const -> std::uint64_t { return m_REMAINING; }
+
+    /**
+     * @brief Send as many bytes as the socket accepts without blocking
+     *
+     * The socket must be in non-blocking mode. When the socket buffer is full
+     * ec is set to net::error::would_block and the caller should wait for the
+     * socket to become writable before calling again.
+     *
+     * With @p prefixes_only the call stops, without an error, once the next
+     * bytes are a file range; a caller moving file bytes by other means
+     * (io_uring) uses it for the in-memory parts.
+     *
+     * @param socket_fd native socket handle
+     * @param ec set on failure or would_block
+     * @param prefixes_only send in-memory prefixes only
+     * @return std::size_t number of bytes sent by this call
+     **/
+    auto send_some(int socket_fd, beast::error_code& ec, bool prefixes_only = false) -> std::size_t;
+
+    /**
+     * @brief Get the file descriptor of an opened file
+     *
+     * @return int descriptor, -1 for in-memory content, a PartSource or no file
+     **/
+    auto native_handle() const -> int { return m_FD; }
+
+    /**
+     * @brief Get the file range which is to be sent next
+     *
+     * Only meaningful after send_some(..., true) returned without error, and
+     * only for file-backed transfers.
+     *
+     * @param offset set to the first byte of the range
+     * @param length set to the remaining length of the range
+     * @return true if the next bytes are a non-empty file range
+     **/
+    auto pending_file_range(std::uint64_t& offset, std::uint64_t& length) const -> bool;
+
+    /**
+     * @brief Mark file bytes as read by the caller
+     *
+     * @param count bytes of the pending file range which were read
+     **/
+    void consume_file_bytes(std::uint64_t count);
+
+    /**
+     * @brief Mark body bytes as sent by the caller
+     *
+     * @param count bytes written to the socket
+     **/
+    void mark_sent(std::uint64_t count) { m_REMAINING -= count; }
+
+  private:
+    /**
+     * @brief A prefix and a byte range of the file
+     *
+     **/
+    struct Part {
+        std::string prefix;
+        std::uint64_t offset;
+        std::uint64_t end;
+    };
+
+    /**
+     * @brief Send the in-memory prefix of the current part
+     *
+     * @param socket_fd native socket handle
+     * @param ec set on failure or would_block
+     * @return std::size_t number of bytes sent
+     **/
+    auto send_prefix(int socket_fd, beast::error_code& ec) -> std::size_t;
+
+    /**
+     * @brief Replace the finished part with the next segment of the PartSource
+     *
+     * Opens the file of the segment and clips the segment to the selected range.
+     *
+     * @param ec set on failure, or to net::error::eof if the source ended early
+     * @return true if a part was loaded
+     **/
+    auto load_source_part(beast::error_code& ec) -> bool;
+
+    /**
+     * @brief Zero-copy path: sendfile the file range of the current part
+     *
+     * @param socket_fd native socket handle
+     * @param ec set on failure or would_block
+     * @return std::size_t number of bytes sent
+     **/
+    auto send_zero_copy(int socket_fd, beast::error_code& ec) -> std::size_t;
+
+    /**
+     * @brief Memory path: send the range of the current part from m_MEMORY
+     *
+     * @param socket_fd native socket handle
+     * @param ec set on failure or would_block
+     * @return std::size_t number of bytes sent
+     **/
+    auto send_memory(int socket_fd, beast::error_code& ec) -> std::size_t;
+
+    /**
+     * @brief Fallback path: copy through m_BUFFER with pread/send
+     *
+     * @param socket_fd native socket handle
+     * @param ec set on failure or would_block
+     * @return std::size_t number of bytes sent
+     **/
+    auto send_buffered(int socket_fd, beast::error_code& ec) -> std::size_t;
+
+    int m_FD = -1;
+    std::shared_ptr<const std::string> m_MEMORY;
+    std::shared_ptr<BodyStream> m_STREAM;
+    std::shared_ptr<PartSource> m_SOURCE;
+    std::uint64_t m_SOURCE_POSITION = 0;
+    std::uint64_t m_SOURCE_LEFT = 0;
+    bool m_SOURCE_SEEK = false;
+    bool m_OBSERVE = false;
+    std::uint64_t m_SIZE = 0;
+    std::time_t m_MTIME = 0;
+    std::int64_t m_MTIME_NS = 0;
+    std::uint64_t m_INODE = 0;
+    std::uint64_t m_CONTENT_LENGTH = 0;
+    std::uint64_t m_REMAINING = 0;
+    std::vector<Part> m_PARTS;
+    std::size_t m_PART = 0;
+    std::size_t m_PREFIX_POS = 0;
+    bool m_ZERO_COPY = true;
+    std::vector<char> m_BUFFER;
+    std::size_t m_BUFFER_POS = 0;
+    std::size_t m_BUFFER_END = 0;
+};
@@ -0,0 +1,320 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+
+#include "hot_file_cache.hpp"
+
+/**
+ * @brief Anonymous namespace for helper functions
+ *
+ **/
+namespace {
+    /**
+     * @brief Saturation value of a sketch counter
+     *
+     **/
+    constexpr std::uint8_t MAX_COUNT = 15;
+
+    /**
+     * @brief Share of a shard's budget given to the admission window, in percent
+     *
+     **/
+    constexpr std::size_t WINDOW_PERCENT = 1;
+
+    /**
+     * @brief Share of the main segment given to protected files, in percent
+     *
+     **/
+    constexpr std::size_t PROTECTED_PERCENT = 80;
+
+    /**
+     * @brief Odd step between the sketch rows of a key
+     *
+     * @param hash hash of the key
+     * @return std::size_t step
+     **/
+    auto sketch_step(std::size_t hash) -> std::size_t {
+        std::uint64_t step = static_cast<std::uint64_t>(hash) * 0x9E3779B97F4A7C15ULL;
+        step ^= step >> 31;
+        return static_cast<std::size_t>(step) | 1;
+    }
+}    // namespace
+
+/**
+ * @brief Count one access
+ *
+ * @param hash hash of the key
+ **/
+void HotFileCache::Sketch::record(std::size_t hash) {
+    std::size_t const STEP = sketch_step(hash);
+    for (std::size_t row = 0; row < SKETCH_DEPTH; ++row, hash += STEP) {
+        std::uint8_t& counter = counters[row * SKETCH_WIDTH + (hash & (SKETCH_WIDTH - 1))];
+        if (counter < MAX_COUNT) {
+            ++counter;
+        }
+    }
+
+    // Halving ages the counts, so yesterday's popular files eventually lose against today's
+    if (++additions >= SKETCH_WIDTH * 10) {
+        for (auto& count : counters) {
+            count /= 2;
+        }
+        additions /= 2;
+    }
+}
+
+/**
+ * @brief Estimate the access count of a key
+ *
+ * @param hash hash of the key
+ * @return std::uint8_t smallest counter of the key's rows
+ **/
+auto HotFileCache::Sketch::estimate(std::size_t hash) const -> std::uint8_t {
+    std::size_t const STEP = sketch_step(hash);
+    std::uint8_t estimate = MAX_COUNT;
+    for (std::size_t row = 0; row < SKETCH_DEPTH; ++row, hash += STEP) {
+        estimate = std::min(estimate, counters[row * SKETCH_WIDTH + (hash & (SKETCH_WIDTH - 1))]);
+    }
+    return estimate;
+}
+
+/**
+ * @brief Construct a new HotFileCache::HotFileCache object
+ *
+ * @param budget_bytes memory budget
+ * @param max_file_size largest cached file
+ **/
+HotFileCache::HotFileCache(std::size_t budget_bytes, std::uint64_t max_file_size)
+    : m_SHARD_BUDGET(budget_bytes / SHARDS)
+    , m_MAX_FILE_SIZE(max_file_size) {}
+
+/**
+ * @brief Look up a file
+ *
+ * @param key normalized path
+ * @return std::shared_ptr<const CachedFile> file or nullptr
+ **/
+auto HotFileCache::find(const std::string& key) -> std::shared_ptr<const CachedFile> {
+    std::size_t const HASH = std::hash<std::string> {}(key);
+    Shard& shard = shard_of(HASH);
+
+    std::lock_guard<std::mutex> const LOCK(shard.mutex);
+    shard.sketch.record(HASH);
+
+    auto const IT = shard.index.find(key);
+    if (IT == shard.index.end()) {
+        return nullptr;
+    }
+
+    NodeList::iterator const NODE = IT->second;
+    if (NODE->segment == Segment::WINDOW) {
+        shard.window.splice(shard.window.begin(), shard.window, NODE);
+    } else {
+        promote_locked(shard, NODE);
+    }
+    return NODE->file;
+}
+
+/**
+ * @brief Get the invalidation epoch of a path
+ *
+ * @param key normalized path
+ * @return std::uint64_t epoch
+ **/
+auto HotFileCache::epoch(const std::string& key) -> std::uint64_t {
+    Shard& shard = shard_of(std::hash<std::string> {}(key));
+
+    std::lock_guard<std::mutex> const LOCK(shard.mutex);
+    return shard.epoch;
+}
+
+/**
+ * @brief Insert a file
+ *
+ * @param key normalized path
+ * @param file content
+ * @param epoch epoch taken before the read
+ **/
+void HotFileCache::insert(const std::string& key, std::shared_ptr<const CachedFile> file, std::uint64_t epoch) {
+    std::size_t const HASH = std::hash<std::string> {}(key);
+    std::size_t const BYTES = file->bytes() + key.capacity() + sizeof(Node);
+    Shard& shard = shard_of(HASH);
+
+    std::lock_guard<std::mutex> const LOCK(shard.mutex);
+
+    if (BYTES > m_SHARD_BUDGET - m_SHARD_BUDGET * WINDOW_PERCENT / 100) {
+        return;
+    }
+    // Checked under the lock: invalidations bump the epoch while holding it
+    if (epoch != shard.epoch) {
+        return;
+    }
+
+    auto const EXISTING = shard.index.find(key);
+    if (EXISTING != shard.index.end()) {
+        erase_locked(shard, EXISTING->second);
+    }
+
+    shard.window.push_front(Node {key, HASH, std::move(file), BYTES, Segment::WINDOW});
+    shard.index.emplace(key, shard.window.begin());
+    shard.window_bytes += BYTES;
+
+    drain_window_locked(shard);
+}
+
+/**
+ * @brief Drop one file
+ *
+ * @param key normalized path
+ **/
+void HotFileCache::invalidate(const std::string& key) {
+    Shard& shard = shard_of(std::hash<std::string> {}(key));
+
+    std::lock_guard<std::mutex> const LOCK(shard.mutex);
+    ++shard.epoch;
+    auto const IT = shard.index.find(key);
+    if (IT != shard.index.end()) {
+        erase_locked(shard, IT->second);
+    }
+}
+
+/**
+ * @brief Drop everything
+ *
+ **/
+void HotFileCache::clear() {
+    for (auto& shard : m_SHARDS) {
+        std::lock_guard<std::mutex> const LOCK(shard.mutex);
+        ++shard.epoch;
+        shard.index.clear();
+        shard.window.clear();
+        shard.probation.clear();
+        shard.protected_.clear();
+        shard.window_bytes = 0;
+        shard.probation_bytes = 0;
+        shard.protected_bytes = 0;
+    }
+}
+
+/**
+ * @brief Memory charged to the cache
+ *
+ * @return std::size_t bytes
+ **/
+auto HotFileCache::size_bytes() -> std::size_t {
+    std::size_t total = 0;
+    for (auto& shard : m_SHARDS) {
+        std::lock_guard<std::mutex> const LOCK(shard.mutex);
+        total += shard.window_bytes + shard.probation_bytes + shard.protected_bytes;
+    }
+    return total;
+}
+
+/**
+ * @brief Shard of a hash
+ *
+ * @param hash key hash
+ * @return Shard& shard
+ **/
+auto HotFileCache::shard_of(std::size_t hash) -> Shard& {
+    // The low bits index the sketch, the shard comes from the high ones
+    return m_SHARDS[(static_cast<std::uint64_t>(hash) >> 48) % SHARDS];
+}
+
+/**
+ * @brief Promote a main-segment node
+ *
+ * @param shard shard
+ * @param node node
+ **/
+void HotFileCache::promote_locked(Shard& shard, NodeList::iterator node) {
+    if (node->segment == Segment::PROTECTED) {
+        shard.protected_.splice(shard.protected_.begin(), shard.protected_, node);
+        return;
+    }
+
+    shard.protected_.splice(shard.protected_.begin(), shard.probation, node);
+    node->segment = Segment::PROTECTED;
+    shard.probation_bytes -= node->bytes;
+    shard.protected_bytes += node->bytes;
+
+    std::size_t const MAIN_BUDGET = m_SHARD_BUDGET - m_SHARD_BUDGET * WINDOW_PERCENT / 100;
+    std::size_t const PROTECTED_BUDGET = MAIN_BUDGET * PROTECTED_PERCENT / 100;
+    while (shard.protected_bytes > PROTECTED_BUDGET && shard.protected_.size() > 1) {
+        auto const DEMOTED = std::prev(shard.protected_.end());
+        shard.probation.splice(shard.probation.begin(), shard.protected_, DEMOTED);
+        DEMOTED->segment = Segment::PROBATION;
+        shard.protected_bytes -= DEMOTED->bytes;
+        shard.probation_bytes += DEMOTED->bytes;
+    }
+}
+
+/**
+ * @brief Admit window overflow into the main segment
+ *
+ * @param shard shard
+ **/
+void HotFileCache::drain_window_locked(Shard& shard) {
+    std::size_t const WINDOW_BUDGET = m_SHARD_BUDGET * WINDOW_PERCENT / 100;
+    std::size_t const MAIN_BUDGET = m_SHARD_BUDGET - WINDOW_BUDGET;
+
+    while (shard.window_bytes > WINDOW_BUDGET && !shard.window.empty()) {
+        auto const CANDIDATE = std::prev(shard.window.end());
+        shard.probation.splice(shard.probation.begin(), shard.window, CANDIDATE);
+        CANDIDATE->segment = Segment::PROBATION;
+        shard.window_bytes -= CANDIDATE->bytes;
+        shard.probation_bytes += CANDIDATE->bytes;
+
+        std::uint8_t const CANDIDATE_FREQUENCY = shard.sketch.estimate(CANDIDATE->hash);
+        while (shard.probation_bytes + shard.protected_bytes > MAIN_BUDGET) {
+            NodeList::iterator victim;
+            if (shard.probation.size() > 1) {
+                victim = std::prev(shard.probation.end());
+            } else if (!shard.protected_.empty()) {
+                victim = std::prev(shard.protected_.end());
+            } else {
+                break;
+            }
+
+            // Ties go to the incumbent: a file must be more popular to get in
+            if (CANDIDATE_FREQUENCY > shard.sketch.estimate(victim->hash)) {
+                erase_locked(shard, victim);
+            } else {
+                erase_locked(shard, CANDIDATE);
+                break;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Remove a node
+ *
+ * @param shard shard
+ * @param node node
+ **/
+void HotFileCache::erase_locked(Shard& shard, NodeList::iterator node) {
+    switch (node->segment) {
+        case Segment::WINDOW:
+            shard.window_bytes -= node->bytes;
+            shard.index.erase(node->key);
+            shard.window.erase(node);
+            break;
+        case Segment::PROBATION:
+            shard.probation_bytes -= node->bytes;
+            shard.index.erase(node->key);
+            shard.probation.erase(node);
+            break;
+        case Segment::PROTECTED:
+            shard.protected_bytes -= node->bytes;
+            shard.index.erase(node->key);
+            shard.protected_.erase(node);
+            break;
+    }
+}
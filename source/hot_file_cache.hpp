@@ -0,0 +1,225 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+/**
+ * @brief A small file held in memory, ready to be sent
+ *
+ * Besides the content it carries the header values of its response, so a
+ * hit neither touches the filesystem nor recomputes validators.
+ **/
+struct CachedFile {
+    std::string body;
+    std::string content_type;
+    std::string content_disposition;
+    std::string etag;
+    std::string last_modified;
+    std::uint64_t inode = 0;
+    std::int64_t mtime_ns = 0;
+    std::time_t mtime = 0;
+
+    /**
+     * @brief Approximate memory charged to the cache for this file
+     *
+     * @return std::size_t bytes
+     **/
+    auto bytes() const -> std::size_t {
+        return sizeof(*this) + body.capacity() + content_type.capacity() + content_disposition.capacity()
+            + etag.capacity() + last_modified.capacity();
+    }
+};
+
+class HotFileCache {
+    /**
+     * @brief HotFileCache - content of small, frequently requested files
+     *
+     * Maps a normalized path to the file's content and response header
+     * values, bounded by a global byte budget split evenly across shards.
+     * Each shard has its own mutex and runs W-TinyLFU: new files enter a
+     * small LRU window, and a file leaving the window only displaces a file
+     * of the main segment if a count-min sketch says it is requested more
+     * often. The main segment is a segmented LRU (probation / protected), so
+     * one-off requests, such as a crawler walking the whole tree, cannot
+     * flush the popular set.
+     *
+     * Entries are invalidated through the inotify watcher; like the listing
+     * cache, callers take epoch() before reading the file and insert()
+     * refuses content which raced with an invalidation.
+     **/
+
+  public:
+    /**
+     * @brief Construct a new Hot File Cache object
+     *
+     * @param budget_bytes memory budget, 0 disables the cache
+     * @param max_file_size largest file size worth caching
+     **/
+    HotFileCache(std::size_t budget_bytes, std::uint64_t max_file_size);
+
+    /**
+     * @brief Look up a file and record the access
+     *
+     * Misses are recorded too: the frequency sketch is what lets a file
+     * into the main segment once it is read and inserted.
+     *
+     * @param key normalized path
+     * @return std::shared_ptr<const CachedFile> file, nullptr on a miss
+     **/
+    auto find(const std::string& key) -> std::shared_ptr<const CachedFile>;
+
+    /**
+     * @brief Get the invalidation epoch of a path
+     *
+     * @param key normalized path
+     * @return std::uint64_t counter incremented by invalidations
+     **/
+    auto epoch(const std::string& key) -> std::uint64_t;
+
+    /**
+     * @brief Insert a file which was just read
+     *
+     * @param key normalized path
+     * @param file content and header values
+     * @param epoch value of epoch(key) taken before the file was read
+     **/
+    void insert(const std::string& key, std::shared_ptr<const CachedFile> file, std::uint64_t epoch);
+
+    /**
+     * @brief Drop one file
+     *
+     * @param key normalized path
+     **/
+    void invalidate(const std::string& key);
+
+    /**
+     * @brief Drop every file
+     *
+     **/
+    void clear();
+
+    /**
+     * @brief Check whether a file of this size should be cached
+     *
+     * @param size file size in bytes
+     * @return true if the cache is enabled and the file is small enough
+     **/
+    auto accepts(std::uint64_t size) const -> bool { return m_SHARD_BUDGET != 0 && size <= m_MAX_FILE_SIZE; }
+
+    /**
+     * @brief Check whether the cache stores anything at all
+     *
+     * @return true if the budget is not 0
+     **/
+    auto is_enabled() const -> bool { return m_SHARD_BUDGET != 0; }
+
+    /**
+     * @brief Get the memory currently charged to the cache
+     *
+     * @return std::size_t bytes
+     **/
+    auto size_bytes() -> std::size_t;
+
+  private:
+    /**
+     * @brief Number of independently locked shards
+     *
+     **/
+    static constexpr std::size_t SHARDS = 8;
+
+    /**
+     * @brief Counters per row of the frequency sketch of one shard
+     *
+     **/
+    static constexpr std::size_t SKETCH_WIDTH = 4096;
+
+    /**
+     * @brief Rows of the frequency sketch
+     *
+     **/
+    static constexpr std::size_t SKETCH_DEPTH = 4;
+
+    enum class Segment : std::uint8_t
+    {
+        WINDOW,
+        PROBATION,
+        PROTECTED
+    };
+
+    struct Node {
+        std::string key;
+        std::size_t hash;
+        std::shared_ptr<const CachedFile> file;
+        std::size_t bytes;
+        Segment segment;
+    };
+
+    using NodeList = std::list<Node>;
+
+    /**
+     * @brief Count-min sketch with counters saturating at 15 and periodic halving
+     *
+     **/
+    struct Sketch {
+        std::array<std::uint8_t, SKETCH_WIDTH * SKETCH_DEPTH> counters {};
+        std::size_t additions = 0;
+
+        void record(std::size_t hash);
+        auto estimate(std::size_t hash) const -> std::uint8_t;
+    };
+
+    struct Shard {
+        std::mutex mutex;
+        std::uint64_t epoch = 0;
+        Sketch sketch;
+        NodeList window;
+        NodeList probation;
+        NodeList protected_;
+        std::size_t window_bytes = 0;
+        std::size_t probation_bytes = 0;
+        std::size_t protected_bytes = 0;
+        std::unordered_map<std::string, NodeList::iterator> index;
+    };
+
+    /**
+     * @brief Get the shard of a key
+     *
+     * @param hash hash of the key
+     * @return Shard& shard
+     **/
+    auto shard_of(std::size_t hash) -> Shard&;
+
+    /**
+     * @brief Move a node of the main segment to the front of the protected list
+     *
+     * @param shard shard, its mutex must be held
+     * @param node node
+     **/
+    void promote_locked(Shard& shard, NodeList::iterator node);
+
+    /**
+     * @brief Move window overflow into the main segment, subject to admission
+     *
+     * @param shard shard, its mutex must be held
+     **/
+    void drain_window_locked(Shard& shard);
+
+    /**
+     * @brief Remove a node from its list and the index
+     *
+     * @param shard shard, its mutex must be held
+     * @param node node
+     **/
+    void erase_locked(Shard& shard, NodeList::iterator node);
+
+    std::size_t m_SHARD_BUDGET;
+    std::uint64_t m_MAX_FILE_SIZE;
+    std::array<Shard, SHARDS> m_SHARDS;
+};
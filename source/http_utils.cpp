@@ -0,0 +1,717 @@
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <limits>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "http_utils.hpp"
+
+/**
+ * @brief Anonymous namespace for helper functions
+ *
+ **/
+namespace {
+    /**
+     * @brief Strip optional whitespace around a header token
+     *
+     * @param value token
+     * @return std::string_view trimmed token
+     **/
+    auto trim(std::string_view value) -> std::string_view {
+        while (!value.empty() && (value.front() == ' ' || value.front() == '\t')) {
+            value.remove_prefix(1);
+        }
+        while (!value.empty() && (value.back() == ' ' || value.back() == '\t')) {
+            value.remove_suffix(1);
+        }
+        return value;
+    }
+
+    /**
+     * @brief Strip the weakness indicator from an entity tag
+     *
+     * @param etag entity tag
+     * @return std::string_view opaque quoted tag
+     **/
+    auto strip_weak(std::string_view etag) -> std::string_view {
+        if (etag.substr(0, 2) == "W/") {
+            etag.remove_prefix(2);
+        }
+        return etag;
+    }
+
+    /**
+     * @brief Append a number in lowercase hexadecimal
+     *
+     * @param out target string
+     * @param value number
+     **/
+    void append_hex(std::string& out, std::uint64_t value) {
+        char buffer[16];
+        auto const [ptr, ec] = std::to_chars(buffer, buffer + sizeof(buffer), value, 16);
+        out.append(buffer, ptr);
+    }
+
+    /**
+     * @brief Parse a non-empty run of decimal digits
+     *
+     * @param value digits
+     * @return std::optional<std::uint64_t> number, empty on malformed input or overflow
+     **/
+    auto parse_number(std::string_view value) -> std::optional<std::uint64_t> {
+        if (value.empty()) {
+            return std::nullopt;
+        }
+        std::uint64_t number = 0;
+        auto const [ptr, ec] = std::from_chars(value.data(), value.data() + value.size(), number);
+        if (ec != std::errc {} || ptr != value.data() + value.size()) {
+            return std::nullopt;
+        }
+        return number;
+    }
+
+    /**
+     * @brief Value of a hexadecimal digit
+     *
+     * @param digit character
+     * @return int value, -1 if the character is not a hex digit
+     **/
+    auto hex_value(char digit) -> int {
+        if (digit >= '0' && digit <= '9') {
+            return digit - '0';
+        }
+        if (digit >= 'a' && digit <= 'f') {
+            return digit - 'a' + 10;
+        }
+        if (digit >= 'A' && digit <= 'F') {
+            return digit - 'A' + 10;
+        }
+        return -1;
+    }
+
+    /**
+     * @brief Compare two tokens ignoring ASCII case
+     *
+     * @param a token
+     * @param b token
+     * @return true if equal
+     **/
+    auto iequals(std::string_view a, std::string_view b) -> bool {
+        if (a.size() != b.size()) {
+            return false;
+        }
+        for (std::size_t i = 0; i < a.size(); ++i) {
+            if (std::tolower(static_cast<unsigned char>(a[i])) != std::tolower(static_cast<unsigned char>(b[i]))) {
+                return false;
+            }
+        }
+        return true;
+    }
+}    // namespace
+
+/**
+ * @brief Parse a Range header
+ *
+ * @param header header value
+ * @param size representation size
+ * @param ranges satisfiable ranges
+ * @return RangeResult outcome
+ **/
+auto parse_range_header(std::string_view header, std::uint64_t size, std::vector<ByteRange>& ranges)
+    -> RangeResult {
+    ranges.clear();
+
+    constexpr std::string_view UNIT = "bytes=";
+    header = trim(header);
+    if (header.substr(0, UNIT.size()) != UNIT) {
+        return RangeResult::IGNORED;
+    }
+    header.remove_prefix(UNIT.size());
+
+    std::size_t range_count = 0;
+    while (!header.empty()) {
+        std::size_t const COMMA = header.find(',');
+        std::string_view const SPEC = trim(header.substr(0, COMMA));
+        header = COMMA == std::string_view::npos ? std::string_view {} : header.substr(COMMA + 1);
+
+        if (SPEC.empty()) {
+            continue;
+        }
+        if (++range_count > MAX_RANGES) {
+            ranges.clear();
+            return RangeResult::IGNORED;
+        }
+
+        std::size_t const DASH = SPEC.find('-');
+        if (DASH == std::string_view::npos) {
+            ranges.clear();
+            return RangeResult::IGNORED;
+        }
+
+        std::string_view const FIRST = SPEC.substr(0, DASH);
+        std::string_view const LAST = SPEC.substr(DASH + 1);
+
+        if (FIRST.empty()) {
+            // Suffix range: the last N bytes
+            auto const SUFFIX = parse_number(LAST);
+            if (!SUFFIX) {
+                ranges.clear();
+                return RangeResult::IGNORED;
+            }
+            if (*SUFFIX == 0 || size == 0) {
+                continue;
+            }
+            std::uint64_t const LENGTH = *SUFFIX < size ? *SUFFIX : size;
+            ranges.push_back({size - LENGTH, LENGTH});
+            continue;
+        }
+
+        auto const START = parse_number(FIRST);
+        std::optional<std::uint64_t> end;
+        if (!LAST.empty()) {
+            end = parse_number(LAST);
+            if (!end) {
+                ranges.clear();
+                return RangeResult::IGNORED;
+            }
+        }
+        if (!START || (end && *end < *START)) {
+            ranges.clear();
+            return RangeResult::IGNORED;
+        }
+        if (*START >= size) {
+            continue;
+        }
+
+        std::uint64_t const LAST_BYTE = end && *end < size ? *end : size - 1;
+        ranges.push_back({*START, LAST_BYTE - *START + 1});
+    }
+
+    if (range_count == 0) {
+        return RangeResult::IGNORED;
+    }
+    return ranges.empty() ? RangeResult::UNSATISFIABLE : RangeResult::SATISFIABLE;
+}
+
+/**
+ * @brief Format an HTTP date
+ *
+ * @param time timestamp
+ * @return std::string date
+ **/
+auto format_http_date(std::time_t time) -> std::string {
+    std::tm gmt_tm {};
+    gmtime_r(&time, &gmt_tm);
+
+    char buffer[64];
+    std::size_t const LENGTH = std::strftime(buffer, sizeof(buffer), "%a, %d %b %Y %H:%M:%S GMT", &gmt_tm);
+    return {buffer, LENGTH};
+}
+
+/**
+ * @brief Parse an HTTP date
+ *
+ * @param value date string
+ * @return std::optional<std::time_t> timestamp
+ **/
+auto parse_http_date(std::string_view value) -> std::optional<std::time_t> {
+    std::string const DATE(trim(value));
+
+    std::tm gmt_tm {};
+    char const* const END = strptime(DATE.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &gmt_tm);
+    if (END == nullptr || *END != '\0') {
+        return std::nullopt;
+    }
+    return timegm(&gmt_tm);
+}
+
+/**
+ * @brief Build an entity tag
+ *
+ * @param inode inode
+ * @param size size
+ * @param mtime_ns mtime in ns
+ * @param weak weak tag
+ * @return std::string tag
+ **/
+auto make_etag(std::uint64_t inode, std::uint64_t size, std::int64_t mtime_ns, bool weak) -> std::string {
+    std::string etag;
+    etag.reserve(52);
+    append_etag(etag, inode, size, mtime_ns, weak);
+    return etag;
+}
+
+/**
+ * @brief Append an entity tag
+ *
+ * @param out output
+ * @param inode inode number
+ * @param size size in bytes
+ * @param mtime_ns modification time in ns
+ * @param weak weak tag
+ **/
+void append_etag(
+    std::string& out, std::uint64_t inode, std::uint64_t size, std::int64_t mtime_ns, bool weak) {
+    if (weak) {
+        out += "W/";
+    }
+    out += '"';
+    append_hex(out, inode);
+    out += '-';
+    append_hex(out, size);
+    out += '-';
+    append_hex(out, static_cast<std::uint64_t>(mtime_ns));
+    out += '"';
+}
+
+/**
+ * @brief Match an If-None-Match list
+ *
+ * @param header header value
+ * @param etag current tag
+ * @return true on match
+ **/
+auto etag_list_matches(std::string_view header, std::string_view etag) -> bool {
+    header = trim(header);
+    if (header == "*") {
+        return true;
+    }
+
+    std::string_view const OPAQUE = strip_weak(etag);
+    while (!header.empty()) {
+        std::size_t const COMMA = header.find(',');
+        std::string_view const CANDIDATE = trim(header.substr(0, COMMA));
+        header = COMMA == std::string_view::npos ? std::string_view {} : header.substr(COMMA + 1);
+
+        if (!CANDIDATE.empty() && strip_weak(CANDIDATE) == OPAQUE) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Evaluate GET preconditions
+ *
+ * @param if_none_match If-None-Match value
+ * @param if_modified_since If-Modified-Since value
+ * @param etag current tag
+ * @param last_modified current mtime
+ * @return true if not modified
+ **/
+auto is_not_modified(std::string_view if_none_match,
+                     std::string_view if_modified_since,
+                     std::string_view etag,
+                     std::time_t last_modified) -> bool {
+    if (!if_none_match.empty()) {
+        return etag_list_matches(if_none_match, etag);
+    }
+    if (!if_modified_since.empty()) {
+        auto const SINCE = parse_http_date(if_modified_since);
+        return SINCE && last_modified <= *SINCE;
+    }
+    return false;
+}
+
+/**
+ * @brief Decode percent escapes
+ *
+ * @param text escaped text
+ * @return std::optional<std::string> decoded text or empty
+ **/
+auto percent_decode(std::string_view text) -> std::optional<std::string> {
+    std::string decoded;
+    decoded.reserve(text.size());
+    for (std::size_t i = 0; i < text.size(); ++i) {
+        if (text[i] != '%') {
+            decoded.push_back(text[i]);
+            continue;
+        }
+        if (i + 2 >= text.size()) {
+            return std::nullopt;
+        }
+        int const HIGH = hex_value(text[i + 1]);
+        int const LOW = hex_value(text[i + 2]);
+        if (HIGH < 0 || LOW < 0) {
+            return std::nullopt;
+        }
+        decoded.push_back(static_cast<char>(HIGH * 16 + LOW));
+        i += 2;
+    }
+    return decoded;
+}
+
+/**
+ * @brief Escape everything but unreserved characters
+ *
+ * @param text raw text
+ * @return std::string escaped text
+ **/
+auto percent_encode(std::string_view text) -> std::string {
+    std::string encoded;
+    encoded.reserve(text.size());
+    append_percent_encoded(encoded, text);
+    return encoded;
+}
+
+/**
+ * @brief Append percent-encoded text
+ *
+ * @param out output
+ * @param text raw text
+ **/
+void append_percent_encoded(std::string& out, std::string_view text) {
+    static constexpr std::string_view HEX = "0123456789ABCDEF";
+    for (char const CHARACTER : text) {
+        auto const BYTE = static_cast<unsigned char>(CHARACTER);
+        bool const UNRESERVED = std::isalnum(BYTE) != 0 || CHARACTER == '-' || CHARACTER == '.'
+            || CHARACTER == '_' || CHARACTER == '~';
+        if (UNRESERVED) {
+            out.push_back(CHARACTER);
+        } else {
+            out.push_back('%');
+            out.push_back(HEX[BYTE >> 4]);
+            out.push_back(HEX[BYTE & 0xF]);
+        }
+    }
+}
+
+/**
+ * @brief Find a parameter of the query string
+ *
+ * @param target request target
+ * @param name parameter name
+ * @return std::optional<std::string> decoded value or empty
+ **/
+auto query_parameter(std::string_view target, std::string_view name) -> std::optional<std::string> {
+    std::size_t const QUESTION = target.find('?');
+    if (QUESTION == std::string_view::npos) {
+        return std::nullopt;
+    }
+    std::string_view query = target.substr(QUESTION + 1);
+    query = query.substr(0, query.find('#'));
+
+    while (!query.empty()) {
+        std::size_t const AMPERSAND = query.find('&');
+        std::string_view const PAIR = query.substr(0, AMPERSAND);
+        query = AMPERSAND == std::string_view::npos ? std::string_view {} : query.substr(AMPERSAND + 1);
+
+        std::size_t const EQUALS = PAIR.find('=');
+        if (PAIR.substr(0, EQUALS) == name) {
+            std::string_view const VALUE =
+                EQUALS == std::string_view::npos ? std::string_view {} : PAIR.substr(EQUALS + 1);
+            return percent_decode(VALUE);
+        }
+    }
+    return std::nullopt;
+}
+
+/**
+ * @brief Parse the pagination parameters of a listing request
+ *
+ * @param target request target
+ * @return std::optional<ListingPage> requested page or empty
+ **/
+auto parse_listing_page(std::string_view target) -> std::optional<ListingPage> {
+    auto const OFFSET = query_parameter(target, "offset");
+    auto const LIMIT = query_parameter(target, "limit");
+    auto CURSOR = query_parameter(target, "cursor");
+    if (!OFFSET && !LIMIT && !CURSOR) {
+        return std::nullopt;
+    }
+
+    ListingPage page;
+    if (auto const NUMBER = OFFSET ? parse_number(*OFFSET) : std::nullopt) {
+        page.offset = static_cast<std::size_t>(
+            std::min<std::uint64_t>(*NUMBER, std::numeric_limits<std::size_t>::max()));
+    }
+    if (auto const NUMBER = LIMIT ? parse_number(*LIMIT) : std::nullopt) {
+        page.limit = static_cast<std::size_t>(std::clamp<std::uint64_t>(*NUMBER, 1, ListingPage::MAX_LIMIT));
+    }
+    if (CURSOR && !CURSOR->empty()) {
+        page.cursor = std::move(*CURSOR);
+    }
+    return page;
+}
+
+/**
+ * @brief Pick the format of a listing
+ *
+ * @param target request target
+ * @param accept Accept header
+ * @return ListingFormat format
+ **/
+auto parse_listing_format(std::string_view target, std::string_view accept) -> ListingFormat {
+    if (auto const FORMAT = query_parameter(target, "format")) {
+        if (*FORMAT == "json") {
+            return ListingFormat::JSON;
+        }
+        if (*FORMAT == "ndjson") {
+            return ListingFormat::NDJSON;
+        }
+        return ListingFormat::HTML;
+    }
+
+    while (!accept.empty()) {
+        std::size_t const COMMA = accept.find(',');
+        std::string_view const ELEMENT = accept.substr(0, COMMA);
+        accept = COMMA == std::string_view::npos ? std::string_view {} : accept.substr(COMMA + 1);
+
+        std::string_view const TYPE = trim(ELEMENT.substr(0, ELEMENT.find(';')));
+        if (iequals(TYPE, "application/x-ndjson") || iequals(TYPE, "application/ndjson")) {
+            return ListingFormat::NDJSON;
+        }
+        if (iequals(TYPE, "application/json")) {
+            return ListingFormat::JSON;
+        }
+    }
+    return ListingFormat::HTML;
+}
+
+/**
+ * @brief Get the depth of a recursive listing
+ *
+ * @param target request target
+ * @return std::size_t levels below the directory
+ **/
+auto parse_listing_depth(std::string_view target) -> std::size_t {
+    if (auto const DEPTH = query_parameter(target, "depth")) {
+        auto const NUMBER = parse_number(*DEPTH);
+        return NUMBER ? static_cast<std::size_t>(std::min<std::uint64_t>(*NUMBER, MAX_LISTING_DEPTH)) : 0;
+    }
+    auto const RECURSIVE = query_parameter(target, "recursive");
+    if (RECURSIVE && *RECURSIVE != "0" && *RECURSIVE != "false") {
+        return MAX_LISTING_DEPTH;
+    }
+    return 0;
+}
+
+/**
+ * @brief Pick the archive format of a directory download
+ *
+ * @param target request target
+ * @return std::optional<ArchiveFormat> format
+ **/
+auto parse_archive_format(std::string_view target) -> std::optional<ArchiveFormat> {
+    auto const ARCHIVE = query_parameter(target, "archive");
+    if (!ARCHIVE) {
+        return ArchiveFormat::NONE;
+    }
+    if (*ARCHIVE == "tar") {
+        return ArchiveFormat::TAR;
+    }
+    if (*ARCHIVE == "zip") {
+        auto const METHOD = query_parameter(target, "method");
+        if (!METHOD || *METHOD == "store") {
+            return ArchiveFormat::ZIP;
+        }
+        if (*METHOD == "deflate") {
+            return ArchiveFormat::ZIP_DEFLATE;
+        }
+    }
+    return std::nullopt;
+}
+
+/**
+ * @brief Get the boundary of a multipart/form-data Content-Type
+ *
+ * @param content_type Content-Type header
+ * @return std::optional<std::string> boundary
+ **/
+auto parse_multipart_boundary(std::string_view content_type) -> std::optional<std::string> {
+    std::size_t const SEMICOLON = content_type.find(';');
+    if (SEMICOLON == std::string_view::npos
+        || !iequals(trim(content_type.substr(0, SEMICOLON)), "multipart/form-data"))
+    {
+        return std::nullopt;
+    }
+    std::string_view parameters = content_type.substr(SEMICOLON + 1);
+    while (!parameters.empty()) {
+        std::size_t const NEXT = parameters.find(';');
+        std::string_view const PARAMETER = trim(parameters.substr(0, NEXT));
+        parameters = NEXT == std::string_view::npos ? std::string_view {} : parameters.substr(NEXT + 1);
+
+        std::size_t const EQUALS = PARAMETER.find('=');
+        if (EQUALS == std::string_view::npos || !iequals(trim(PARAMETER.substr(0, EQUALS)), "boundary")) {
+            continue;
+        }
+        std::string_view boundary = trim(PARAMETER.substr(EQUALS + 1));
+        if (boundary.size() >= 2 && boundary.front() == '"' && boundary.back() == '"') {
+            boundary = boundary.substr(1, boundary.size() - 2);
+        }
+        if (boundary.empty() || boundary.size() > 70) {
+            return std::nullopt;
+        }
+        return std::string(boundary);
+    }
+    return std::nullopt;
+}
+
+/**
+ * @brief Append a JSON string literal
+ *
+ * @param out output
+ * @param text text
+ **/
+void append_json_string(std::string& out, std::string_view text) {
+    static constexpr std::string_view HEX = "0123456789abcdef";
+    out += '"';
+    for (char const CHARACTER : text) {
+        if (CHARACTER == '"' || CHARACTER == '\\') {
+            out += '\\';
+            out += CHARACTER;
+        } else if (static_cast<unsigned char>(CHARACTER) < 0x20) {
+            out += "\\u00";
+            out += HEX[static_cast<unsigned char>(CHARACTER) >> 4];
+            out += HEX[static_cast<unsigned char>(CHARACTER) & 0xF];
+        } else {
+            out += CHARACTER;
+        }
+    }
+    out += '"';
+}
+
+/**
+ * @brief Append text escaped for HTML
+ *
+ * @param out output
+ * @param text text
+ **/
+void append_html_escaped(std::string& out, std::string_view text) {
+    for (char const CHARACTER : text) {
+        switch (CHARACTER) {
+            case '&':
+                out += "&amp;";
+                break;
+            case '<':
+                out += "&lt;";
+                break;
+            case '>':
+                out += "&gt;";
+                break;
+            case '"':
+                out += "&quot;";
+                break;
+            case '\'':
+                out += "&#39;";
+                break;
+            default:
+                out += CHARACTER;
+        }
+    }
+}
+
+/**
+ * @brief Normalize a request target
+ *
+ * @param target request target
+ * @return std::optional<std::string> relative path or empty
+ **/
+auto normalize_target(std::string_view target) -> std::optional<std::string> {
+    std::string_view decoded = target.substr(0, target.find_first_of("?#"));
+
+    // Most targets carry no escapes and are resolved in place
+    std::optional<std::string> storage;
+    if (decoded.find('%') != std::string_view::npos) {
+        storage = percent_decode(decoded);
+        if (!storage) {
+            return std::nullopt;
+        }
+        decoded = *storage;
+    }
+    if (decoded.find('\0') != std::string_view::npos) {
+        return std::nullopt;
+    }
+
+    // Resolved on the decoded text, so "%2e%2e" cannot smuggle a ".." past the check. A ".." drops
+    // the last segment of the result built so far
+    std::string normal;
+    normal.reserve(decoded.size());
+    std::string_view rest = decoded;
+    while (!rest.empty()) {
+        std::size_t const SLASH = rest.find('/');
+        std::string_view const SEGMENT = rest.substr(0, SLASH);
+        rest = SLASH == std::string_view::npos ? std::string_view {} : rest.substr(SLASH + 1);
+
+        if (SEGMENT.empty() || SEGMENT == ".") {
+            continue;
+        }
+        if (SEGMENT == "..") {
+            if (normal.empty()) {
+                return std::nullopt;
+            }
+            std::size_t const LAST = normal.rfind('/');
+            normal.resize(LAST == std::string::npos ? 0 : LAST);
+            continue;
+        }
+        if (!normal.empty()) {
+            normal.push_back('/');
+        }
+        normal.append(SEGMENT);
+    }
+    return normal;
+}
+
+/**
+ * @brief Quality of a coding in Accept-Encoding
+ *
+ * @param header header value
+ * @param coding coding token
+ * @return float q-value
+ **/
+auto encoding_quality(std::string_view header, std::string_view coding) -> float {
+    float wildcard = 0.0F;
+    bool has_wildcard = false;
+
+    while (!header.empty()) {
+        std::size_t const COMMA = header.find(',');
+        std::string_view element = trim(header.substr(0, COMMA));
+        header = COMMA == std::string_view::npos ? std::string_view {} : header.substr(COMMA + 1);
+
+        std::size_t const SEMICOLON = element.find(';');
+        std::string_view const NAME = trim(element.substr(0, SEMICOLON));
+        float quality = 1.0F;
+        if (SEMICOLON != std::string_view::npos) {
+            std::string_view const PARAM = trim(element.substr(SEMICOLON + 1));
+            if (PARAM.size() > 2 && (PARAM[0] == 'q' || PARAM[0] == 'Q') && PARAM[1] == '=') {
+                auto const [ptr, ec] = std::from_chars(PARAM.data() + 2, PARAM.data() + PARAM.size(), quality);
+                if (ec != std::errc {} || quality < 0.0F || quality > 1.0F) {
+                    quality = 0.0F;
+                }
+            }
+        }
+
+        if (iequals(NAME, coding) || (coding == "gzip" && iequals(NAME, "x-gzip"))) {
+            return quality;
+        }
+        if (NAME == "*") {
+            wildcard = quality;
+            has_wildcard = true;
+        }
+    }
+    return has_wildcard ? wildcard : 0.0F;
+}
+
+/**
+ * @brief Entity tag of an encoded variant
+ *
+ * @param etag identity tag
+ * @param suffix coding token
+ * @return std::string variant tag
+ **/
+auto make_variant_etag(std::string_view etag, std::string_view suffix) -> std::string {
+    std::string variant(etag);
+    std::size_t const CLOSE = variant.rfind('"');
+    if (CLOSE == std::string::npos || CLOSE == 0) {
+        return variant;
+    }
+    variant.insert(CLOSE, "-" + std::string(suffix));
+    return variant;
+}
@@ -0,0 +1,315 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * @brief A satisfiable byte range of a representation
+ *
+ **/
+struct ByteRange {
+    std::uint64_t offset;
+    std::uint64_t length;
+};
+
+/**
+ * @brief Representation of a directory listing
+ *
+ **/
+enum class ListingFormat
+{
+    HTML,
+    JSON,    // one JSON array of entry objects
+    NDJSON    // one JSON object per line
+};
+
+/**
+ * @brief Archive formats a directory can be downloaded as
+ *
+ **/
+enum class ArchiveFormat
+{
+    NONE,          // no archive requested
+    TAR,           // POSIX ustar, with pax headers where ustar falls short
+    ZIP,           // zip, files stored
+    ZIP_DEFLATE    // zip, files deflated
+};
+
+/**
+ * @brief Deepest subdirectory level a recursive JSON listing descends to
+ *
+ **/
+constexpr std::size_t MAX_LISTING_DEPTH = 16;
+
+/**
+ * @brief A page of a directory listing requested through the query string
+ *
+ * Pages start either at an entry index (offset) or right after the entry
+ * named by an opaque cursor, which stays stable while entries are added
+ * in front of it.
+ **/
+struct ListingPage {
+    /**
+     * @brief Entries per page when the request names no limit
+     *
+     **/
+    static constexpr std::size_t DEFAULT_LIMIT = 1000;
+
+    /**
+     * @brief Largest page a client may ask for
+     *
+     **/
+    static constexpr std::size_t MAX_LIMIT = 10000;
+
+    std::size_t offset = 0;
+    std::size_t limit = DEFAULT_LIMIT;
+    std::optional<std::string> cursor;
+};
+
+/**
+ * @brief Outcome of parsing a Range header
+ *
+ **/
+enum class RangeResult
+{
+    IGNORED,    // absent, malformed or not worth honouring: send the full representation
+    SATISFIABLE,    // at least one range overlaps the representation: 206
+    UNSATISFIABLE    // valid syntax but no range overlaps: 416
+};
+
+/**
+ * @brief Maximum number of ranges honoured in one request
+ *
+ * Requests for more ranges are answered with the full representation, which
+ * keeps multipart bodies from being abused to amplify traffic.
+ **/
+constexpr std::size_t MAX_RANGES = 64;
+
+/**
+ * @brief Parse a Range header against a representation size
+ *
+ * Supports the "bytes" unit with single, open-ended ("a-"), suffix ("-n")
+ * and multiple comma-separated ranges (RFC 9110, section 14.2). Ranges which
+ * start beyond the end are dropped; ends beyond the size are clamped.
+ *
+ * @param header value of the Range header
+ * @param size size of the representation in bytes
+ * @param ranges receives the satisfiable ranges, in request order
+ * @return RangeResult how to answer the request
+ **/
+auto parse_range_header(std::string_view header, std::uint64_t size, std::vector<ByteRange>& ranges)
+    -> RangeResult;
+
+/**
+ * @brief Format a timestamp as an IMF-fixdate (e.g. "Sun, 06 Nov 1994 08:49:37 GMT")
+ *
+ * @param time timestamp
+ * @return std::string HTTP date
+ **/
+auto format_http_date(std::time_t time) -> std::string;
+
+/**
+ * @brief Parse an IMF-fixdate
+ *
+ * @param value header value
+ * @return std::optional<std::time_t> timestamp, empty if the value is not a valid date
+ **/
+auto parse_http_date(std::string_view value) -> std::optional<std::time_t>;
+
+/**
+ * @brief Build an entity tag from file metadata
+ *
+ * The tag changes whenever the file is replaced (inode), resized or
+ * rewritten (mtime with nanosecond resolution), without reading the file.
+ *
+ * @param inode inode number
+ * @param size size in bytes
+ * @param mtime_ns modification time in nanoseconds since the epoch
+ * @param weak build a weak tag (W/"...") for representations which are not byte-stable
+ * @return std::string quoted entity tag
+ **/
+auto make_etag(std::uint64_t inode, std::uint64_t size, std::int64_t mtime_ns, bool weak = false) -> std::string;
+
+/**
+ * @brief Append the entity tag make_etag() builds, without a temporary
+ *
+ * @param out string the tag is appended to
+ * @param inode inode number
+ * @param size size in bytes
+ * @param mtime_ns modification time in nanoseconds since the epoch
+ * @param weak build a weak tag
+ **/
+void append_etag(
+    std::string& out, std::uint64_t inode, std::uint64_t size, std::int64_t mtime_ns, bool weak = false);
+
+/**
+ * @brief Check an If-None-Match list against an entity tag
+ *
+ * Uses the weak comparison function, as RFC 9110 requires for If-None-Match.
+ *
+ * @param header value of If-None-Match ("*" or a comma-separated list of tags)
+ * @param etag current entity tag
+ * @return true if any listed tag matches
+ **/
+auto etag_list_matches(std::string_view header, std::string_view etag) -> bool;
+
+/**
+ * @brief Evaluate If-None-Match / If-Modified-Since for a GET request
+ *
+ * If-None-Match takes precedence; If-Modified-Since is only consulted when
+ * the request carries no If-None-Match.
+ *
+ * @param if_none_match value of If-None-Match, may be empty
+ * @param if_modified_since value of If-Modified-Since, may be empty
+ * @param etag current entity tag
+ * @param last_modified current modification time
+ * @return true if the request should be answered with 304 Not Modified
+ **/
+auto is_not_modified(std::string_view if_none_match,
+                     std::string_view if_modified_since,
+                     std::string_view etag,
+                     std::time_t last_modified) -> bool;
+
+/**
+ * @brief Decode the percent escapes of a URI component
+ *
+ * @param text escaped text
+ * @return std::optional<std::string> decoded text, empty on a malformed escape
+ **/
+auto percent_decode(std::string_view text) -> std::optional<std::string>;
+
+/**
+ * @brief Percent-encode every byte but the unreserved characters of RFC 3986
+ *
+ * @param text raw text
+ * @return std::string text safe for a query value or a path segment
+ **/
+auto percent_encode(std::string_view text) -> std::string;
+
+/**
+ * @brief Append text percent-encoded like percent_encode()
+ *
+ * @param out string the encoded text is appended to
+ * @param text raw text
+ **/
+void append_percent_encoded(std::string& out, std::string_view text);
+
+/**
+ * @brief Get a parameter of the query string of a request target
+ *
+ * @param target request target, e.g. "/docs/?limit=10"
+ * @param name parameter name
+ * @return std::optional<std::string> decoded value ("" for a bare name), empty if absent or malformed
+ **/
+auto query_parameter(std::string_view target, std::string_view name) -> std::optional<std::string>;
+
+/**
+ * @brief Parse the offset, limit and cursor parameters of a listing request
+ *
+ * Malformed numbers fall back to the defaults and the limit is clamped to
+ * ListingPage::MAX_LIMIT.
+ *
+ * @param target request target
+ * @return std::optional<ListingPage> requested page, empty if the target asks for the whole listing
+ **/
+auto parse_listing_page(std::string_view target) -> std::optional<ListingPage>;
+
+/**
+ * @brief Pick the representation of a directory listing
+ *
+ * A format query parameter ("html", "json" or "ndjson") wins; otherwise an
+ * Accept header listing application/x-ndjson (or application/ndjson) or
+ * application/json selects that format. Everything else gets HTML.
+ *
+ * @param target request target
+ * @param accept value of the Accept header, may be empty
+ * @return ListingFormat format of the response
+ **/
+auto parse_listing_format(std::string_view target, std::string_view accept) -> ListingFormat;
+
+/**
+ * @brief Get the subdirectory depth a JSON listing request asks for
+ *
+ * "depth=<n>" descends n levels below the listed directory and a bare
+ * "recursive" (or "recursive=1") descends MAX_LISTING_DEPTH levels; both
+ * are capped at MAX_LISTING_DEPTH, which also stops symlink loops.
+ *
+ * @param target request target
+ * @return std::size_t levels to descend, 0 for the directory alone
+ **/
+auto parse_listing_depth(std::string_view target) -> std::size_t;
+
+/**
+ * @brief Get the archive format a directory request asks for
+ *
+ * "archive=tar" and "archive=zip" select the format; zip entries are
+ * stored unless "method=deflate" is also given.
+ *
+ * @param target request target
+ * @return std::optional<ArchiveFormat> NONE without an archive parameter, empty for an unsupported one
+ **/
+auto parse_archive_format(std::string_view target) -> std::optional<ArchiveFormat>;
+
+/**
+ * @brief Get the boundary of a multipart/form-data Content-Type
+ *
+ * @param content_type Content-Type header
+ * @return std::optional<std::string> boundary (1 to 70 characters), empty for other types
+ **/
+auto parse_multipart_boundary(std::string_view content_type) -> std::optional<std::string>;
+
+/**
+ * @brief Append text as a JSON string literal
+ *
+ * Quotes, backslashes and control characters are escaped; other bytes are
+ * copied as they are.
+ *
+ * @param out string the literal is appended to
+ * @param text text
+ **/
+void append_json_string(std::string& out, std::string_view text);
+
+/**
+ * @brief Append text escaped for HTML element content and quoted attributes
+ *
+ * @param out string the text is appended to
+ * @param text text
+ **/
+void append_html_escaped(std::string& out, std::string_view text);
+
+/**
+ * @brief Turn a request target into a path relative to the served root
+ *
+ * Drops the query string, percent-decodes the path and resolves "." and
+ * ".." segments and repeated slashes. Targets which climb above the root,
+ * carry malformed escapes or a NUL byte are rejected.
+ *
+ * @param target request target (origin-form, e.g. "/docs/a%20b.txt?x=1")
+ * @return std::optional<std::string> normalized relative path ("" for the root), empty if rejected
+ **/
+auto normalize_target(std::string_view target) -> std::optional<std::string>;
+
+/**
+ * @brief Get the quality an Accept-Encoding header gives a content coding
+ *
+ * An explicitly listed coding wins over "*"; "x-gzip" counts as "gzip".
+ *
+ * @param header value of Accept-Encoding
+ * @param coding coding token, e.g. "gzip"
+ * @return float q-value between 0 (not acceptable) and 1
+ **/
+auto encoding_quality(std::string_view header, std::string_view coding) -> float;
+
+/**
+ * @brief Derive the entity tag of an encoded variant
+ *
+ * @param etag entity tag of the identity representation
+ * @param suffix coding token appended inside the quotes
+ * @return std::string entity tag, e.g. "1-2-3-gzip"
+ **/
+auto make_variant_etag(std::string_view etag, std::string_view suffix) -> std::string;
@@ -0,0 +1,263 @@
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include "inotify_watcher.hpp"
+
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include "logger.hpp"
+
+/**
+ * @brief Anonymous namespace for helper functions
+ *
+ **/
+namespace {
+    /**
+     * @brief Events which change what a directory listing shows
+     *
+     **/
+    constexpr std::uint32_t WATCH_MASK = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_MODIFY
+        | IN_ATTRIB | IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR;
+
+    /**
+     * @brief Read buffer size, room for many events at once
+     *
+     **/
+    constexpr std::size_t EVENT_BUFFER_SIZE = 64 * 1024;
+
+    /**
+     * @brief Create the inotify descriptor
+     *
+     * @return int descriptor, -1 if inotify is unavailable
+     **/
+    auto open_inotify() -> int {
+        int const FD = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (FD == -1) {
+            log_warn("inotify unavailable (%s), change-invalidated caches are disabled\n", std::strerror(errno));
+        }
+        return FD;
+    }
+}    // namespace
+
+const std::uint32_t InotifyWatcher::OVERFLOW_MASK = IN_Q_OVERFLOW;
+const std::uint32_t InotifyWatcher::CREATED_MASK = IN_CREATE | IN_MOVED_TO;
+const std::uint32_t InotifyWatcher::WRITTEN_MASK = IN_CLOSE_WRITE | IN_ATTRIB;
+const std::uint32_t InotifyWatcher::REMOVED_MASK = IN_DELETE | IN_MOVED_FROM;
+const std::uint32_t InotifyWatcher::ISDIR_MASK = IN_ISDIR;
+const std::uint32_t InotifyWatcher::SELF_GONE_MASK = IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED;
+
+/**
+ * @brief Construct a new InotifyWatcher::InotifyWatcher object
+ *
+ * @param ioc io_context
+ **/
+InotifyWatcher::InotifyWatcher(net::io_context& ioc)
+    : m_DESCRIPTOR(ioc) {
+    m_FD = open_inotify();
+    if (m_FD != -1) {
+        m_DESCRIPTOR.assign(m_FD);
+    }
+}
+
+/**
+ * @brief Register an event callback
+ *
+ * @param callback callback
+ **/
+void InotifyWatcher::subscribe(Callback callback) {
+    m_CALLBACKS.push_back(std::move(callback));
+}
+
+/**
+ * @brief Start the asynchronous event loop
+ *
+ **/
+void InotifyWatcher::start() {
+    if (!is_enabled()) {
+        return;
+    }
+    m_BUFFER.resize(EVENT_BUFFER_SIZE);
+    do_read();
+}
+
+/**
+ * @brief Watch a directory
+ *
+ * @param dir directory
+ * @return true on success
+ **/
+auto InotifyWatcher::add_watch(const fs::path& dir) -> bool {
+    if (!is_enabled()) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> const LOCK(m_MUTEX);
+
+    if (m_WATCHES.count(dir.string()) != 0) {
+        return true;
+    }
+
+    int const WD = ::inotify_add_watch(m_DESCRIPTOR.native_handle(), dir.c_str(), WATCH_MASK);
+    if (WD == -1) {
+        log_once_warn("inotify_add_watch failed (%s), some directories are not cached\n", std::strerror(errno));
+        return false;
+    }
+
+    // The same inode reached through another spelling yields the same descriptor, keep the first path
+    auto const [IT, INSERTED] = m_PATHS.emplace(WD, dir);
+    if (INSERTED) {
+        m_WATCHES.emplace(dir.string(), WD);
+    }
+    return INSERTED || IT->second == dir;
+}
+
+/**
+ * @brief Check whether every queued event was dispatched
+ *
+ * @return true if settled
+ **/
+auto InotifyWatcher::is_settled() const -> bool {
+    if (m_FD == -1) {
+        return false;
+    }
+    std::uint64_t const BEFORE = m_SEQUENCE.load();
+    if (BEFORE % 2 != 0) {
+        return false;
+    }
+    int queued = 0;
+    if (::ioctl(m_FD, FIONREAD, &queued) != 0 || queued != 0) {
+        return false;
+    }
+
+    // A batch read after the first load would have emptied the queue before the ioctl looked
+    return m_SEQUENCE.load() == BEFORE;
+}
+
+/**
+ * @brief Wait for more events
+ *
+ **/
+void InotifyWatcher::do_read() {
+    m_DESCRIPTOR.async_wait(net::posix::stream_descriptor::wait_read,
+                            [this](beast::error_code ec) { on_read(ec); });
+}
+
+/**
+ * @brief Read and dispatch the queued events
+ *
+ * @param ec error code of the wait
+ **/
+void InotifyWatcher::on_read(beast::error_code ec) {
+    if (ec == net::error::operation_aborted) {
+        return;
+    }
+    if (ec) {
+        log_error("inotify wait failed: %s\n", ec.message().c_str());
+        return;
+    }
+
+    m_SEQUENCE.fetch_add(1);
+    while (true) {
+        ssize_t const BYTES = ::read(m_FD, m_BUFFER.data(), m_BUFFER.size());
+        if (BYTES > 0) {
+            dispatch(static_cast<std::size_t>(BYTES));
+            continue;
+        }
+        if (BYTES == -1 && errno == EINTR) {
+            continue;
+        }
+        if (BYTES == -1 && errno != EAGAIN) {
+            // The sequence stays odd: nothing is settled any more
+            log_error("inotify read failed: %s\n", std::strerror(errno));
+            return;
+        }
+        break;
+    }
+    m_SEQUENCE.fetch_add(1);
+
+    do_read();
+}
+
+/**
+ * @brief Dispatch events to subscribers
+ *
+ * @param bytes_transferred bytes read
+ **/
+void InotifyWatcher::dispatch(std::size_t bytes_transferred) {
+    std::size_t offset = 0;
+    while (offset + sizeof(inotify_event) <= bytes_transferred) {
+        inotify_event event {};
+        std::memcpy(&event, m_BUFFER.data() + offset, sizeof(event));
+        std::string_view name;
+        if (event.len > 0) {
+            name = m_BUFFER.data() + offset + sizeof(inotify_event);
+        }
+        offset += sizeof(inotify_event) + event.len;
+
+        if ((event.mask & IN_Q_OVERFLOW) != 0) {
+            log_warn("inotify queue overflow, invalidating all cached state\n");
+            for (const auto& callback : m_CALLBACKS) {
+                callback({}, {}, event.mask);
+            }
+            continue;
+        }
+
+        fs::path dir;
+        {
+            std::lock_guard<std::mutex> const LOCK(m_MUTEX);
+            auto const IT = m_PATHS.find(event.wd);
+            if (IT == m_PATHS.end()) {
+                continue;
+            }
+            dir = IT->second;
+        }
+
+        for (const auto& callback : m_CALLBACKS) {
+            callback(dir, name, event.mask);
+        }
+
+        if ((event.mask & SELF_GONE_MASK) != 0) {
+            forget_watch(event.wd);
+        }
+    }
+}
+
+/**
+ * @brief Drop a watch whose directory is gone or moved
+ *
+ * A moved directory keeps its descriptor under the new name, and so do the
+ * directories below it, so the whole subtree is unwatched and will be
+ * re-added under the new paths when they are needed again.
+ *
+ * @param wd watch descriptor
+ **/
+void InotifyWatcher::forget_watch(int wd) {
+    std::lock_guard<std::mutex> const LOCK(m_MUTEX);
+
+    auto const IT = m_PATHS.find(wd);
+    if (IT == m_PATHS.end()) {
+        return;
+    }
+    std::string const DIR = IT->second.string();
+
+    for (auto it = m_WATCHES.begin(); it != m_WATCHES.end();) {
+        const std::string& path = it->first;
+        bool const IN_TREE =
+            path.compare(0, DIR.size(), DIR) == 0 && (path.size() == DIR.size() || path[DIR.size()] == '/');
+        if (IN_TREE) {
+            m_PATHS.erase(it->second);
+            ::inotify_rm_watch(m_DESCRIPTOR.native_handle(), it->second);
+            it = m_WATCHES.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
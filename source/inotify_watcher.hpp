@@ -0,0 +1,171 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/posix/stream_descriptor.hpp>
+#include <boost/beast/core/error.hpp>
+#include <boost/filesystem.hpp>
+
+namespace beast = boost::beast;
+namespace net = boost::asio;
+namespace fs = boost::filesystem;
+
+class InotifyWatcher {
+    /**
+     * @brief InotifyWatcher - change notifications for served directories
+     *
+     * Wraps an inotify descriptor in the server's io_context and reads its
+     * events asynchronously. Directories are watched on demand (add_watch),
+     * and every event is forwarded to the subscribed callbacks with the
+     * watched directory, the entry name and the inotify mask. Caches use it to
+     * drop exactly the entries a change affects.
+     *
+     * When inotify is unavailable is_enabled() returns false and add_watch()
+     * always fails, so callers must not cache what they cannot invalidate.
+     *
+     * Events are read once the descriptor is readable, until the kernel
+     * queue is empty, and m_SEQUENCE is odd while a batch is being read and
+     * dispatched. is_settled() combines it with the length of the kernel
+     * queue to tell whether every change made so far has reached the
+     * subscribers.
+     **/
+
+  public:
+    /**
+     * @brief Event callback: watched directory, entry name (may be empty) and mask
+     *
+     **/
+    using Callback = std::function<void(const fs::path& dir, std::string_view name, std::uint32_t mask)>;
+
+    /**
+     * @brief Mask bit reported when the kernel event queue overflowed
+     *
+     * Subscribers must treat it as "anything may have changed".
+     **/
+    static const std::uint32_t OVERFLOW_MASK;
+
+    /**
+     * @brief Mask bits which mean a new entry appeared in the directory
+     *
+     **/
+    static const std::uint32_t CREATED_MASK;
+
+    /**
+     * @brief Mask bits which mean an entry was written or its metadata changed
+     *
+     **/
+    static const std::uint32_t WRITTEN_MASK;
+
+    /**
+     * @brief Mask bits which mean an entry left the directory
+     *
+     **/
+    static const std::uint32_t REMOVED_MASK;
+
+    /**
+     * @brief Mask bit set when the event concerns a directory
+     *
+     **/
+    static const std::uint32_t ISDIR_MASK;
+
+    /**
+     * @brief Mask bits which mean the watched directory itself is gone or moved
+     *
+     **/
+    static const std::uint32_t SELF_GONE_MASK;
+
+    /**
+     * @brief Construct a new Inotify Watcher object
+     *
+     * @param ioc io_context which runs the event reads
+     **/
+    explicit InotifyWatcher(net::io_context& ioc);
+
+    /**
+     * @brief Register an event callback
+     *
+     * Callbacks run on an io_context thread. Must be called before start().
+     *
+     * @param callback callback
+     **/
+    void subscribe(Callback callback);
+
+    /**
+     * @brief Start reading events
+     *
+     **/
+    void start();
+
+    /**
+     * @brief Watch a directory
+     *
+     * Watching an already watched directory is cheap and returns true.
+     *
+     * @param dir normalized directory path
+     * @return true if changes to the directory will be reported
+     **/
+    auto add_watch(const fs::path& dir) -> bool;
+
+    /**
+     * @brief Check whether inotify is available
+     *
+     * @return true if watches can be added
+     **/
+    auto is_enabled() const -> bool { return m_DESCRIPTOR.is_open(); }
+
+    /**
+     * @brief Check whether every event queued so far has been dispatched
+     *
+     * A change made before the call (by any process) is then known to the
+     * subscribers. Costs one ioctl(2).
+     *
+     * @return true if no event is waiting in the kernel queue or being dispatched
+     **/
+    auto is_settled() const -> bool;
+
+  private:
+    /**
+     * @brief Wait until the inotify descriptor is readable
+     *
+     **/
+    void do_read();
+
+    /**
+     * @brief Read and dispatch events until the kernel queue is empty
+     *
+     * @param ec error code of the wait
+     **/
+    void on_read(beast::error_code ec);
+
+    /**
+     * @brief Dispatch the events read into m_BUFFER
+     *
+     * @param bytes_transferred number of bytes read
+     **/
+    void dispatch(std::size_t bytes_transferred);
+
+    /**
+     * @brief Forget a watch descriptor whose directory disappeared
+     *
+     * @param wd watch descriptor
+     **/
+    void forget_watch(int wd);
+
+    net::posix::stream_descriptor m_DESCRIPTOR;
+    int m_FD = -1;
+    std::atomic<std::uint64_t> m_SEQUENCE {0};
+    std::vector<char> m_BUFFER;
+    std::vector<Callback> m_CALLBACKS;
+
+    std::mutex m_MUTEX;
+    std::unordered_map<int, fs::path> m_PATHS;
+    std::unordered_map<std::string, int> m_WATCHES;
+};
@@ -0,0 +1,220 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+
+#include "listing_cache.hpp"
+
+/**
+ * @brief Construct a new ListingCache::ListingCache object
+ *
+ * @param budget_bytes memory budget
+ **/
+ListingCache::ListingCache(std::size_t budget_bytes)
+    : m_BUDGET(budget_bytes) {}
+
+/**
+ * @brief Get the invalidation epoch of a directory
+ *
+ * @param dir directory
+ * @return std::uint64_t epoch
+ **/
+auto ListingCache::epoch(const std::string& dir) const -> std::uint64_t {
+    std::lock_guard<std::mutex> const LOCK(m_MUTEX);
+    return m_EPOCHS[std::hash<std::string> {}(dir) % EPOCH_STRIPES];
+}
+
+/**
+ * @brief Look up a listing and mark it as recently used
+ *
+ * @param dir directory
+ * @return std::shared_ptr<const DirectoryListing> listing or nullptr
+ **/
+auto ListingCache::find(const std::string& dir) -> std::shared_ptr<const DirectoryListing> {
+    std::lock_guard<std::mutex> const LOCK(m_MUTEX);
+
+    auto const IT = m_ENTRIES.find(dir);
+    if (IT == m_ENTRIES.end()) {
+        return nullptr;
+    }
+    m_LRU.splice(m_LRU.begin(), m_LRU, IT->second.lru);
+    return IT->second.listing;
+}
+
+/**
+ * @brief Insert a listing
+ *
+ * @param dir directory
+ * @param listing listing
+ * @param epoch epoch taken before the build
+ **/
+void ListingCache::insert(const std::string& dir,
+                          std::shared_ptr<const DirectoryListing> listing,
+                          std::uint64_t epoch) {
+    std::size_t const BYTES = listing->bytes() + dir.capacity();
+
+    std::lock_guard<std::mutex> const LOCK(m_MUTEX);
+
+    if (BYTES > m_BUDGET) {
+        return;
+    }
+
+    // Checked under the lock: invalidations bump the epoch while holding it
+    if (epoch != stripe_locked(dir)) {
+        return;
+    }
+
+    auto const EXISTING = m_ENTRIES.find(dir);
+    if (EXISTING != m_ENTRIES.end()) {
+        erase_locked(EXISTING);
+    }
+
+    evict_locked(BYTES);
+
+    m_LRU.push_front(dir);
+    m_ENTRIES.emplace(dir, Slot {std::move(listing), BYTES, m_LRU.begin()});
+    m_BYTES += BYTES;
+}
+
+/**
+ * @brief Invalidate one directory
+ *
+ * @param dir directory
+ **/
+void ListingCache::invalidate(const std::string& dir) {
+    std::lock_guard<std::mutex> const LOCK(m_MUTEX);
+
+    ++stripe_locked(dir);
+    auto const IT = m_ENTRIES.find(dir);
+    if (IT != m_ENTRIES.end()) {
+        erase_locked(IT);
+    }
+}
+
+/**
+ * @brief Invalidate a changed directory and its parent
+ *
+ * @param dir directory
+ **/
+void ListingCache::invalidate_changed(const std::string& dir) {
+    invalidate(dir);
+
+    std::size_t const SLASH = dir.rfind('/');
+    if (SLASH != std::string::npos && dir.size() > 1) {
+        invalidate(dir.substr(0, std::max<std::size_t>(SLASH, 1)));
+    }
+}
+
+/**
+ * @brief Invalidate a directory tree
+ *
+ * @param dir tree root
+ **/
+void ListingCache::invalidate_tree(const std::string& dir) {
+    std::lock_guard<std::mutex> const LOCK(m_MUTEX);
+
+    bump_all_locked();
+    for (auto it = m_ENTRIES.begin(); it != m_ENTRIES.end();) {
+        const std::string& key = it->first;
+        bool const IN_TREE =
+            key.compare(0, dir.size(), dir) == 0 && (key.size() == dir.size() || key[dir.size()] == '/');
+        if (IN_TREE) {
+            m_BYTES -= it->second.bytes;
+            m_LRU.erase(it->second.lru);
+            it = m_ENTRIES.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+/**
+ * @brief Invalidate everything
+ *
+ **/
+void ListingCache::clear() {
+    std::lock_guard<std::mutex> const LOCK(m_MUTEX);
+
+    bump_all_locked();
+    m_ENTRIES.clear();
+    m_LRU.clear();
+    m_BYTES = 0;
+}
+
+/**
+ * @brief Change the budget
+ *
+ * @param budget_bytes budget
+ **/
+void ListingCache::set_budget(std::size_t budget_bytes) {
+    std::lock_guard<std::mutex> const LOCK(m_MUTEX);
+
+    m_BUDGET = budget_bytes;
+    evict_locked(0);
+}
+
+/**
+ * @brief Check whether the cache is enabled
+ *
+ * @return true if the budget is not 0
+ **/
+auto ListingCache::is_enabled() const -> bool {
+    std::lock_guard<std::mutex> const LOCK(m_MUTEX);
+    return m_BUDGET != 0;
+}
+
+/**
+ * @brief Memory charged to the cache
+ *
+ * @return std::size_t bytes
+ **/
+auto ListingCache::size_bytes() const -> std::size_t {
+    std::lock_guard<std::mutex> const LOCK(m_MUTEX);
+    return m_BYTES;
+}
+
+/**
+ * @brief Remove one entry
+ *
+ * @param it entry
+ **/
+void ListingCache::erase_locked(std::unordered_map<std::string, Slot>::iterator it) {
+    m_BYTES -= it->second.bytes;
+    m_LRU.erase(it->second.lru);
+    m_ENTRIES.erase(it);
+}
+
+/**
+ * @brief Epoch stripe of a directory
+ *
+ * @param dir directory
+ * @return std::uint64_t& counter
+ **/
+auto ListingCache::stripe_locked(const std::string& dir) -> std::uint64_t& {
+    return m_EPOCHS[std::hash<std::string> {}(dir) % EPOCH_STRIPES];
+}
+
+/**
+ * @brief Bump all epoch stripes
+ *
+ **/
+void ListingCache::bump_all_locked() {
+    for (auto& stripe_epoch : m_EPOCHS) {
+        ++stripe_epoch;
+    }
+}
+
+/**
+ * @brief Evict least recently used listings
+ *
+ * @param incoming bytes about to be inserted
+ **/
+void ListingCache::evict_locked(std::size_t incoming) {
+    while (m_BYTES + incoming > m_BUDGET && !m_LRU.empty()) {
+        erase_locked(m_ENTRIES.find(m_LRU.back()));
+    }
+}
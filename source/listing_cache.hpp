@@ -0,0 +1,204 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief A rendered directory listing
+ *
+ * The page is stored as the bytes before and after the "Current Server
+ * Time" value, which is the only part that changes between requests.
+ * The same entries are also kept as NDJSON records for the JSON listing
+ * API, together with the names of the subdirectories for recursive walks.
+ **/
+struct DirectoryListing {
+    std::string head;
+    std::string tail;
+    std::string etag;
+    std::time_t last_modified = 0;
+    std::string records;
+    std::vector<std::string> subdirectories;
+
+    /**
+     * @brief Approximate memory charged to the cache for this listing
+     *
+     * @return std::size_t bytes
+     **/
+    auto bytes() const -> std::size_t {
+        std::size_t total = sizeof(*this) + head.capacity() + tail.capacity() + etag.capacity()
+            + records.capacity() + subdirectories.capacity() * sizeof(std::string);
+        for (const std::string& name : subdirectories) {
+            total += name.capacity();
+        }
+        return total;
+    }
+};
+
+class ListingCache {
+    /**
+     * @brief ListingCache - rendered directory listings keyed by directory
+     *
+     * An LRU map from a normalized directory path to its rendered listing,
+     * bounded by a byte budget. Entries are dropped by invalidate_changed()
+     * when the inotify watcher reports a change in the directory or in one
+     * of its subdirectories, so a hit is always current. Readers get a
+     * shared_ptr, so an entry evicted or invalidated while a response is
+     * being rendered stays valid for that response.
+     *
+     * Builds race with invalidations: a listing rendered while an
+     * invalidation happened may already be stale. Callers take epoch(dir)
+     * before walking the directory and pass it to insert(), which refuses
+     * the listing if the directory was invalidated in between. Epochs are
+     * striped by a hash of the path, so busy directories elsewhere in the
+     * tree rarely keep a listing out of the cache.
+     **/
+
+  public:
+    /**
+     * @brief Construct a new Listing Cache object
+     *
+     * @param budget_bytes memory budget, 0 disables the cache
+     **/
+    explicit ListingCache(std::size_t budget_bytes);
+
+    /**
+     * @brief Look up a listing
+     *
+     * @param dir normalized directory path
+     * @return std::shared_ptr<const DirectoryListing> listing, nullptr on a miss
+     **/
+    auto find(const std::string& dir) -> std::shared_ptr<const DirectoryListing>;
+
+    /**
+     * @brief Get the invalidation epoch of a directory
+     *
+     * @param dir normalized directory path
+     * @return std::uint64_t counter incremented by every invalidation of the directory
+     **/
+    auto epoch(const std::string& dir) const -> std::uint64_t;
+
+    /**
+     * @brief Insert a freshly rendered listing
+     *
+     * Evicts least recently used listings until the budget fits. Listings
+     * larger than the whole budget are not cached.
+     *
+     * @param dir normalized directory path
+     * @param listing rendered listing
+     * @param epoch value of epoch(dir) taken before the directory was read
+     **/
+    void insert(const std::string& dir, std::shared_ptr<const DirectoryListing> listing, std::uint64_t epoch);
+
+    /**
+     * @brief Drop the listing of one directory
+     *
+     * @param dir normalized directory path
+     **/
+    void invalidate(const std::string& dir);
+
+    /**
+     * @brief Drop the listings a change inside a directory makes stale
+     *
+     * The directory's own listing, and its parent's, whose entry for the
+     * directory shows its modification time. Recursive record streams load
+     * every directory on their way separately, so they need nothing more.
+     *
+     * @param dir normalized directory path
+     **/
+    void invalidate_changed(const std::string& dir);
+
+    /**
+     * @brief Drop the listings of a directory and everything below it
+     *
+     * @param dir normalized directory path
+     **/
+    void invalidate_tree(const std::string& dir);
+
+    /**
+     * @brief Drop every listing
+     *
+     **/
+    void clear();
+
+    /**
+     * @brief Change the memory budget
+     *
+     * Shrinking evicts least recently used listings; 0 empties and disables the cache.
+     *
+     * @param budget_bytes new budget
+     **/
+    void set_budget(std::size_t budget_bytes);
+
+    /**
+     * @brief Check whether the cache stores anything at all
+     *
+     * @return true if the budget is not 0
+     **/
+    auto is_enabled() const -> bool;
+
+    /**
+     * @brief Get the memory currently charged to the cache
+     *
+     * @return std::size_t bytes
+     **/
+    auto size_bytes() const -> std::size_t;
+
+  private:
+    using LruList = std::list<std::string>;
+
+    /**
+     * @brief Number of invalidation epoch stripes
+     *
+     **/
+    static constexpr std::size_t EPOCH_STRIPES = 256;
+
+    struct Slot {
+        std::shared_ptr<const DirectoryListing> listing;
+        std::size_t bytes;
+        LruList::iterator lru;
+    };
+
+    /**
+     * @brief Remove one entry, the mutex must be held
+     *
+     * @param it entry
+     **/
+    void erase_locked(std::unordered_map<std::string, Slot>::iterator it);
+
+    /**
+     * @brief Get the epoch stripe of a directory, the mutex must be held
+     *
+     * @param dir directory
+     * @return std::uint64_t& stripe counter
+     **/
+    auto stripe_locked(const std::string& dir) -> std::uint64_t&;
+
+    /**
+     * @brief Bump every epoch stripe, the mutex must be held
+     *
+     **/
+    void bump_all_locked();
+
+    /**
+     * @brief Evict until the cache fits the budget, the mutex must be held
+     *
+     * @param incoming bytes about to be inserted
+     **/
+    void evict_locked(std::size_t incoming);
+
+    mutable std::mutex m_MUTEX;
+    std::size_t m_BUDGET;
+    std::size_t m_BYTES = 0;
+    std::array<std::uint64_t, EPOCH_STRIPES> m_EPOCHS {};
+    LruList m_LRU;
+    std::unordered_map<std::string, Slot> m_ENTRIES;
+};
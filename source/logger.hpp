@@ -40,49 +40,22 @@ static auto _ = []
 #define BLUE COLOR("\033[1;34m")
 #define RESET COLOR("\033[0m")
 
-#ifdef ENABLE_LOG_MUTEX
-#    include <mutex>
-inline std::mutex log_mutex;
-#    define LOCK_LOG() std::lock_guard<std::mutex> lock(log_mutex)
-#    define IS_LOG_MUTEX_ENABLED 1
-#else
-#    define LOCK_LOG() (void)0
-#    define IS_LOG_MUTEX_ENABLED 0
-#endif
+#include <cstdio>
 
-#if defined(__GNUC__) && !defined(__clang__)
-// GNU-style macro with ##__VA_ARGS__
-#    define log(level, fmt, ...) \
-        do { \
-            LOCK_LOG(); \
-            const char* lvl_str = (level == LOG_LEVEL_ERROR) ? "[" RED "ERROR" RESET "]" \
-                : (level == LOG_LEVEL_WARN)                  ? "[" YELLOW "WARN" RESET "]" \
-                : (level == LOG_LEVEL_INFO)                  ? "[" GREEN "INFO" RESET "]" \
-                                                             : "[" BLUE "DEBUG" RESET "]"; \
-            if (level == LOG_LEVEL_INFO || level == LOG_LEVEL_DEBUG) { \
-                fprintf(stderr, "%s ", lvl_str); \
-            } else { \
-                fprintf(stderr, "%s %s:%d %s(): ", lvl_str, __FILE__, __LINE__, __func__); \
-            } \
-            fprintf(stderr, fmt, ##__VA_ARGS__); \
-        } while (0)
-#else
-// C++ standard-compliant version
-#    define log(level, ...) \
-        do { \
-            LOCK_LOG(); \
-            const char* lvl_str = (level == LOG_LEVEL_ERROR) ? "[" RED "ERROR" RESET "]" \
-                : (level == LOG_LEVEL_WARN)                  ? "[" YELLOW "WARN" RESET "]" \
-                : (level == LOG_LEVEL_INFO)                  ? "[" GREEN "INFO" RESET "]" \
-                                                             : "[" BLUE "DEBUG" RESET "]"; \
-            if (level == LOG_LEVEL_INFO || level == LOG_LEVEL_DEBUG) { \
-                fprintf(stderr, "%s ", lvl_str); \
-            } else { \
-                fprintf(stderr, "%s %s:%d %s(): ", lvl_str, __FILE__, __LINE__, __func__); \
-            } \
-            fprintf(stderr, __VA_ARGS__); \
-        } while (0)
-#endif
+#include "async_logger.hpp"
+
+// Records go to AsyncLogger, which formats and writes them on its own thread.
+// The dead fprintf only lets the compiler check the format against the arguments.
+#define log(level, ...) \
+    do { \
+        if (false) { \
+            std::fprintf(stderr, __VA_ARGS__); \
+        } \
+        AsyncLogger& async_logger = AsyncLogger::instance(); \
+        if (async_logger.enabled(level)) { \
+            async_logger.write(level, __FILE__, __LINE__, __func__, __VA_ARGS__); \
+        } \
+    } while (0)
 
 #if LOG_LEVEL_DEBUG >= LOG_LEVEL_THRESHOLD
 #    define log_debug(...) log(LOG_LEVEL_DEBUG, __VA_ARGS__)
@@ -1,30 +1,150 @@
+#include <cstddef>
 #include <cstdint>
 #include <cstdlib>
 #include <iostream>
+#include <string>
+#include <vector>
 
 #include <boost/filesystem.hpp>
 
+#include "async_logger.hpp"
 #include "server.hpp"
 #include "tracelogger.hpp"
 
 auto main(int argc, char* argv[]) -> int {
     LOG_TRACE
 
-    if (argc != 3) {
-        std::cerr << "Usage: " << argv[0] << " <path_to_directory> <port>" << "\n";
+    // Options may appear anywhere, the remaining arguments are positional
+    std::vector<std::string> args;
+    bool use_io_uring = false;
+    bool use_shards = false;
+    bool pin_threads = false;
+    std::size_t shards = 0;
+    int log_level = -1;
+    std::string log_file;
+    std::string mime_types;
+    std::uint64_t upload_limit = 0;
+    bool use_digests = false;
+    std::string digest_store;
+    std::size_t digest_threads = 0;
+    std::uint64_t digest_rate = DigestIndex::DEFAULT_RATE;
+    bool valid = true;
+    for (int i = 1; i < argc; ++i) {
+        std::string const ARG = argv[i];
+        if (ARG == "--io-uring") {
+            use_io_uring = true;
+        } else if (ARG == "--shards") {
+            use_shards = true;
+            if (i + 1 < argc) {
+                shards = static_cast<std::size_t>(std::atoi(argv[++i]));
+            } else {
+                valid = false;
+            }
+        } else if (ARG == "--pin") {
+            pin_threads = true;
+        } else if (ARG == "--uploads") {
+            if (upload_limit == 0) {
+                upload_limit = SHServer::DEFAULT_UPLOAD_LIMIT;
+            }
+        } else if (ARG == "--upload-limit") {
+            if (i + 1 >= argc) {
+                valid = false;
+                break;
+            }
+            upload_limit = std::strtoull(argv[++i], nullptr, 10);
+            valid = upload_limit > 0;
+        } else if (ARG == "--digests") {
+            use_digests = true;
+        } else if (ARG == "--digest-index" || ARG == "--digest-threads" || ARG == "--digest-rate") {
+            if (i + 1 >= argc) {
+                valid = false;
+                break;
+            }
+            use_digests = true;
+            if (ARG == "--digest-index") {
+                digest_store = argv[++i];
+            } else if (ARG == "--digest-threads") {
+                digest_threads = static_cast<std::size_t>(std::atoi(argv[++i]));
+            } else {
+                digest_rate = std::strtoull(argv[++i], nullptr, 10);
+            }
+        } else if (ARG == "--mime-types") {
+            if (i + 1 >= argc) {
+                valid = false;
+                break;
+            }
+            mime_types = argv[++i];
+        } else if (ARG == "--log-level" || ARG == "--log-file") {
+            if (i + 1 >= argc) {
+                valid = false;
+                break;
+            }
+            std::string const VALUE = argv[++i];
+            if (ARG == "--log-file") {
+                log_file = VALUE;
+            } else if ((log_level = AsyncLogger::parse_level(VALUE)) == -1) {
+                valid = false;
+            }
+        } else if (ARG == "--trace-sample") {
+            if (i + 1 >= argc) {
+                valid = false;
+                break;
+            }
+            TraceLogger::set_sample_rate(static_cast<std::uint32_t>(std::atoi(argv[++i])));
+        } else if (ARG == "--log-block") {
+            AsyncLogger::instance().set_overflow_policy(AsyncLogger::Overflow::BLOCK);
+        } else {
+            args.push_back(ARG);
+        }
+    }
+
+    if (!valid || (args.size() != 2 && args.size() != 3)) {
+        std::cerr << "Usage: " << argv[0]
+                  << " <path_to_directory> <port> [threads] [--io-uring] [--shards <n>] [--pin]"
+                  << " [--log-level debug|info|warn|error] [--log-file <path>] [--log-block]"
+                  << " [--trace-sample <n>] [--mime-types <file>] [--uploads] [--upload-limit <bytes>]"
+                  << " [--digests] [--digest-index <file>] [--digest-threads <n>] [--digest-rate <bytes/s>]"
+                  << "\n";
         return 1;
     }
 
-    boost::filesystem::path root_path(argv[1]);
+    if (log_level != -1) {
+        AsyncLogger::instance().set_level(log_level);
+    }
+    if (!log_file.empty() && !AsyncLogger::instance().open_file(log_file)) {
+        std::cerr << "Cannot open log file " << log_file << "\n";
+        return 1;
+    }
+
+    boost::filesystem::path root_path(args[0]);
+
+    auto port = static_cast<std::uint16_t>(std::atoi(args[1].c_str()));
 
-    auto port = static_cast<std::uint16_t>(std::atoi(argv[2]));
+    std::size_t const THREADS = args.size() == 3 ? static_cast<std::size_t>(std::atoi(args[2].c_str())) : 0;
 
     if (!boost::filesystem::exists(root_path) || !boost::filesystem::is_directory(root_path)) {
         std::cerr << "Invalid directory path" << "\n";
         return 1;
     }
 
-    SHServer const SERVER(root_path, port);
+    SHServer server(root_path, port, THREADS);
+    if (!mime_types.empty() && !server.load_mime_types(mime_types)) {
+        std::cerr << "Cannot read media types from " << mime_types << "\n";
+        return 1;
+    }
+    if (upload_limit > 0) {
+        server.enable_uploads(upload_limit);
+    }
+    if (use_digests) {
+        server.enable_digests(digest_store, digest_threads, digest_rate);
+    }
+    if (use_io_uring) {
+        server.enable_io_uring();
+    }
+    if (use_shards || pin_threads) {
+        server.enable_sharding(shards, pin_threads);
+    }
+    server.run_server();
 
     return 0;
 }
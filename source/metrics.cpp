@@ -0,0 +1,262 @@
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+#include "metrics.hpp"
+
+/**
+ * @brief Anonymous namespace for helper functions
+ *
+ **/
+namespace {
+    constexpr std::array<const char*, static_cast<std::size_t>(Route::COUNT)> ROUTE_NAMES = {
+        "root", "directory", "file", "not_found", "upload", "internal"};
+
+    constexpr std::array<const char*, static_cast<std::size_t>(Phase::COUNT)> PHASE_NAMES = {
+        "read", "resolve", "listing", "send"};
+
+    constexpr std::array<const char*, static_cast<std::size_t>(CacheKind::COUNT)> CACHE_NAMES = {
+        "file", "listing", "variant"};
+
+    constexpr std::array<const char*, Metrics::STATUS_CLASSES> STATUS_NAMES = {"1xx", "2xx", "3xx", "4xx", "5xx"};
+
+    std::atomic<std::size_t> g_NEXT_SHARD {0};
+
+    /**
+     * @brief Append a formatted line
+     *
+     * Lines which do not fit the stack buffer are formatted again straight
+     * into @p out, so nothing is cut off.
+     *
+     * @param out output
+     * @param format printf-style format, checked against the arguments
+     **/
+    __attribute__((format(printf, 2, 3))) void append(std::string& out, const char* format, ...) {
+        std::va_list args;
+        va_start(args, format);
+        std::va_list retry;
+        va_copy(retry, args);
+
+        char line[256];
+        int const LENGTH = std::vsnprintf(line, sizeof(line), format, args);
+        if (LENGTH > 0 && static_cast<std::size_t>(LENGTH) < sizeof(line)) {
+            out.append(line, static_cast<std::size_t>(LENGTH));
+        } else if (LENGTH > 0) {
+            std::size_t const START = out.size();
+            out.resize(START + static_cast<std::size_t>(LENGTH) + 1);
+            std::vsnprintf(out.data() + START, static_cast<std::size_t>(LENGTH) + 1, format, retry);
+            out.resize(START + static_cast<std::size_t>(LENGTH));
+        }
+
+        va_end(retry);
+        va_end(args);
+    }
+
+    /**
+     * @brief Append the HELP and TYPE lines of a metric
+     *
+     * @param out output
+     * @param name metric name
+     * @param type counter, gauge or histogram
+     * @param help description
+     **/
+    void append_header(std::string& out, const char* name, const char* type, const char* help) {
+        append(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+    }
+}  // namespace
+
+/**
+ * @brief Count an answered request
+ *
+ * @param route handler
+ * @param status HTTP status code
+ * @param bytes bytes written
+ **/
+void Metrics::count_request(Route route, unsigned status, std::uint64_t bytes) {
+    std::size_t const CLASS = std::clamp<unsigned>(status / 100, 1, STATUS_CLASSES) - 1;
+    Shard& shard = local_shard();
+    shard.requests[static_cast<std::size_t>(route)][CLASS].fetch_add(1, std::memory_order_relaxed);
+    shard.bytes[static_cast<std::size_t>(route)][CLASS].fetch_add(bytes, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Record the duration of a phase
+ *
+ * @param phase phase
+ * @param duration duration
+ **/
+void Metrics::record_latency(Phase phase, std::chrono::steady_clock::duration duration) {
+    auto const NANOS =
+        static_cast<std::uint64_t>(std::max<std::int64_t>(0, std::chrono::nanoseconds(duration).count()));
+    Shard& shard = local_shard();
+    shard.latency[static_cast<std::size_t>(phase)][bucket_of(NANOS)].fetch_add(1, std::memory_order_relaxed);
+    shard.latency_sum_ns[static_cast<std::size_t>(phase)].fetch_add(NANOS, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Count a cache lookup
+ *
+ * @param cache cache
+ * @param hit whether the entry was found
+ **/
+void Metrics::count_cache(CacheKind cache, bool hit) {
+    local_shard().cache[static_cast<std::size_t>(cache)][hit ? 0 : 1].fetch_add(1, std::memory_order_relaxed);
+}
+
+void Metrics::connection_opened() {
+    local_shard().connections.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Metrics::connection_closed() {
+    local_shard().connections.fetch_sub(1, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Get the histogram bucket of a duration
+ *
+ * @param nanos duration in nanoseconds
+ * @return std::size_t bucket index
+ **/
+auto Metrics::bucket_of(std::uint64_t nanos) -> std::size_t {
+    if (nanos < (std::uint64_t {1} << BASE_SHIFT)) {
+        return 0;
+    }
+    auto const SHIFT = static_cast<std::size_t>(std::bit_width(nanos) - 1);
+    std::size_t const OCTAVE = SHIFT - BASE_SHIFT;
+    if (OCTAVE >= OCTAVES) {
+        return BUCKETS - 1;
+    }
+    auto const SUB = static_cast<std::size_t>(((nanos - (std::uint64_t {1} << SHIFT)) * SUB_BUCKETS) >> SHIFT);
+    return 1 + OCTAVE * SUB_BUCKETS + SUB;
+}
+
+/**
+ * @brief Get the upper bound of a bucket
+ *
+ * @param index bucket index
+ * @return double bound in seconds
+ **/
+auto Metrics::bucket_bound(std::size_t index) -> double {
+    if (index == 0) {
+        return static_cast<double>(std::uint64_t {1} << BASE_SHIFT) * 1e-9;
+    }
+    std::size_t const OCTAVE = (index - 1) / SUB_BUCKETS;
+    std::size_t const SUB = (index - 1) % SUB_BUCKETS;
+    double const NANOS = static_cast<double>(std::uint64_t {1} << (OCTAVE + BASE_SHIFT))
+        * static_cast<double>(SUB_BUCKETS + SUB + 1) / static_cast<double>(SUB_BUCKETS);
+    return NANOS * 1e-9;
+}
+
+/**
+ * @brief Get the shard of the calling thread
+ *
+ * Threads are spread round-robin on first use.
+ *
+ * @return Shard& shard
+ **/
+auto Metrics::local_shard() -> Shard& {
+    thread_local std::size_t const INDEX = g_NEXT_SHARD.fetch_add(1, std::memory_order_relaxed) % SHARDS;
+    return m_SHARDS[INDEX];
+}
+
+/**
+ * @brief Render all metrics in the Prometheus text format
+ *
+ * @param out output
+ **/
+void Metrics::render(std::string& out) const {
+    auto const SUM = [this](auto select) {
+        std::uint64_t total = 0;
+        for (const Shard& shard : m_SHARDS) {
+            total += select(shard).load(std::memory_order_relaxed);
+        }
+        return static_cast<unsigned long long>(total);
+    };
+
+    append_header(out, "httpfileserver_requests_total", "counter", "Requests answered, by handler and status class.");
+    for (std::size_t route = 0; route < ROUTES; ++route) {
+        for (std::size_t code = 0; code < STATUS_CLASSES; ++code) {
+            append(out,
+                   "httpfileserver_requests_total{handler=\"%s\",code=\"%s\"} %llu\n",
+                   ROUTE_NAMES[route],
+                   STATUS_NAMES[code],
+                   SUM([&](const Shard& shard) -> const Counter& { return shard.requests[route][code]; }));
+        }
+    }
+
+    append_header(out,
+                  "httpfileserver_response_bytes_total",
+                  "counter",
+                  "Bytes written to clients, headers included, by handler and status class.");
+    for (std::size_t route = 0; route < ROUTES; ++route) {
+        for (std::size_t code = 0; code < STATUS_CLASSES; ++code) {
+            append(out,
+                   "httpfileserver_response_bytes_total{handler=\"%s\",code=\"%s\"} %llu\n",
+                   ROUTE_NAMES[route],
+                   STATUS_NAMES[code],
+                   SUM([&](const Shard& shard) -> const Counter& { return shard.bytes[route][code]; }));
+        }
+    }
+
+    std::int64_t connections = 0;
+    for (const Shard& shard : m_SHARDS) {
+        connections += shard.connections.load(std::memory_order_relaxed);
+    }
+    append_header(out, "httpfileserver_connections_in_flight", "gauge", "Open client connections.");
+    append(out, "httpfileserver_connections_in_flight %lld\n", static_cast<long long>(std::max<std::int64_t>(0, connections)));
+
+    append_header(out, "httpfileserver_cache_lookups_total", "counter", "Cache lookups, by cache and result.");
+    std::array<std::array<unsigned long long, 2>, CACHES> lookups {};
+    for (std::size_t cache = 0; cache < CACHES; ++cache) {
+        for (std::size_t result = 0; result < 2; ++result) {
+            lookups[cache][result] =
+                SUM([&](const Shard& shard) -> const Counter& { return shard.cache[cache][result]; });
+            append(out,
+                   "httpfileserver_cache_lookups_total{cache=\"%s\",result=\"%s\"} %llu\n",
+                   CACHE_NAMES[cache],
+                   result == 0 ? "hit" : "miss",
+                   lookups[cache][result]);
+        }
+    }
+    append_header(out, "httpfileserver_cache_hit_ratio", "gauge", "Share of cache lookups which hit.");
+    for (std::size_t cache = 0; cache < CACHES; ++cache) {
+        unsigned long long const TOTAL = lookups[cache][0] + lookups[cache][1];
+        append(out,
+               "httpfileserver_cache_hit_ratio{cache=\"%s\"} %g\n",
+               CACHE_NAMES[cache],
+               TOTAL == 0 ? 0.0 : static_cast<double>(lookups[cache][0]) / static_cast<double>(TOTAL));
+    }
+
+    append_header(out, "httpfileserver_phase_duration_seconds", "histogram", "Duration of request phases.");
+    for (std::size_t phase = 0; phase < PHASES; ++phase) {
+        unsigned long long cumulative = 0;
+        for (std::size_t bucket = 0; bucket < BUCKETS; ++bucket) {
+            cumulative += SUM([&](const Shard& shard) -> const Counter& { return shard.latency[phase][bucket]; });
+            if (bucket + 1 < BUCKETS) {
+                append(out,
+                       "httpfileserver_phase_duration_seconds_bucket{phase=\"%s\",le=\"%.9g\"} %llu\n",
+                       PHASE_NAMES[phase],
+                       bucket_bound(bucket),
+                       cumulative);
+            } else {
+                append(out,
+                       "httpfileserver_phase_duration_seconds_bucket{phase=\"%s\",le=\"+Inf\"} %llu\n",
+                       PHASE_NAMES[phase],
+                       cumulative);
+            }
+        }
+        unsigned long long const SUM_NS =
+            SUM([&](const Shard& shard) -> const Counter& { return shard.latency_sum_ns[phase]; });
+        append(out,
+               "httpfileserver_phase_duration_seconds_sum{phase=\"%s\"} %.9g\n",
+               PHASE_NAMES[phase],
+               static_cast<double>(SUM_NS) * 1e-9);
+        append(out, "httpfileserver_phase_duration_seconds_count{phase=\"%s\"} %llu\n", PHASE_NAMES[phase], cumulative);
+    }
+}
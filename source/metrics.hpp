@@ -0,0 +1,208 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/**
+ * @brief The handler which answered a request
+ *
+ **/
+enum class Route : std::uint8_t
+{
+    ROOT,
+    DIRECTORY,
+    STATIC_FILE,
+    NOT_FOUND,
+    UPLOAD,
+    INTERNAL,    // /__metrics, /__trace
+    COUNT
+};
+
+/**
+ * @brief Timed phases of a request
+ *
+ **/
+enum class Phase : std::uint8_t
+{
+    READ,       // reading and parsing the request
+    RESOLVE,    // cache lookups and stat until the handler is known
+    LISTING,    // building and rendering a directory listing
+    SEND,       // writing the response, file body included
+    COUNT
+};
+
+/**
+ * @brief Caches whose hit ratio is reported
+ *
+ **/
+enum class CacheKind : std::uint8_t
+{
+    HOT_FILE,
+    LISTING,
+    VARIANT,
+    COUNT
+};
+
+class Metrics {
+    /**
+     * @brief Metrics - request counters and latency histograms
+     *
+     * Every thread updates one of SHARDS cache-line aligned shards with
+     * relaxed atomic increments, so the request path never takes a lock and
+     * rarely shares a cache line with another thread. render() sums the
+     * shards into the Prometheus text exposition format.
+     *
+     * Latencies go into log-linear (HDR-style) buckets: each power of two of
+     * nanoseconds from about 1us up is split into SUB_BUCKETS equal buckets,
+     * which bounds the relative error of a quantile to 1 / SUB_BUCKETS over
+     * the whole range.
+     **/
+
+  public:
+    /**
+     * @brief Number of independently updated shards
+     *
+     **/
+    static constexpr std::size_t SHARDS = 16;
+
+    /**
+     * @brief Buckets per power of two
+     *
+     **/
+    static constexpr std::size_t SUB_BUCKETS = 4;
+
+    /**
+     * @brief Lower bound of the first octave, 2^10 ns
+     *
+     **/
+    static constexpr std::size_t BASE_SHIFT = 10;
+
+    /**
+     * @brief Powers of two covered, about 1us to 69s
+     *
+     **/
+    static constexpr std::size_t OCTAVES = 26;
+
+    /**
+     * @brief Buckets of a histogram: below 1us, the octaves, and overflow
+     *
+     **/
+    static constexpr std::size_t BUCKETS = 1 + OCTAVES * SUB_BUCKETS + 1;
+
+    /**
+     * @brief Status classes 1xx to 5xx
+     *
+     **/
+    static constexpr std::size_t STATUS_CLASSES = 5;
+
+    /**
+     * @brief Count an answered request
+     *
+     * @param route handler which answered it
+     * @param status HTTP status code
+     * @param bytes bytes written to the client
+     **/
+    void count_request(Route route, unsigned status, std::uint64_t bytes);
+
+    /**
+     * @brief Record the duration of a phase
+     *
+     * @param phase phase
+     * @param duration duration
+     **/
+    void record_latency(Phase phase, std::chrono::steady_clock::duration duration);
+
+    /**
+     * @brief Count a cache lookup
+     *
+     * @param cache cache
+     * @param hit whether the entry was found
+     **/
+    void count_cache(CacheKind cache, bool hit);
+
+    /**
+     * @brief Count an accepted connection
+     *
+     **/
+    void connection_opened();
+
+    /**
+     * @brief Count a closed connection
+     *
+     **/
+    void connection_closed();
+
+    /**
+     * @brief Render all metrics in the Prometheus text format
+     *
+     * @param out string the metrics are appended to
+     **/
+    void render(std::string& out) const;
+
+    /**
+     * @brief Get the histogram bucket of a duration
+     *
+     * @param nanos duration in nanoseconds
+     * @return std::size_t bucket index
+     **/
+    static auto bucket_of(std::uint64_t nanos) -> std::size_t;
+
+    /**
+     * @brief Get the inclusive upper bound of a bucket
+     *
+     * @param index bucket index, below BUCKETS - 1
+     * @return double bound in seconds
+     **/
+    static auto bucket_bound(std::size_t index) -> double;
+
+  private:
+    static constexpr std::size_t ROUTES = static_cast<std::size_t>(Route::COUNT);
+    static constexpr std::size_t PHASES = static_cast<std::size_t>(Phase::COUNT);
+    static constexpr std::size_t CACHES = static_cast<std::size_t>(CacheKind::COUNT);
+
+    using Counter = std::atomic<std::uint64_t>;
+
+    struct alignas(64) Shard {
+        std::array<std::array<Counter, STATUS_CLASSES>, ROUTES> requests {};
+        std::array<std::array<Counter, STATUS_CLASSES>, ROUTES> bytes {};
+        std::array<std::array<Counter, BUCKETS>, PHASES> latency {};
+        std::array<Counter, PHASES> latency_sum_ns {};
+        std::array<std::array<Counter, 2>, CACHES> cache {};
+        std::atomic<std::int64_t> connections {0};
+    };
+
+    /**
+     * @brief Get the shard of the calling thread
+     *
+     * @return Shard& shard
+     **/
+    auto local_shard() -> Shard&;
+
+    std::array<Shard, SHARDS> m_SHARDS;
+};
+
+/**
+ * @brief Records the time until the end of its scope as one phase
+ *
+ **/
+class PhaseTimer {
+  public:
+    PhaseTimer(Metrics& metrics, Phase phase)
+        : m_METRICS(metrics)
+        , m_PHASE(phase)
+        , m_START(std::chrono::steady_clock::now()) {}
+
+    ~PhaseTimer() { m_METRICS.record_latency(m_PHASE, std::chrono::steady_clock::now() - m_START); }
+
+    PhaseTimer(const PhaseTimer&) = delete;
+    auto operator=(const PhaseTimer&) -> PhaseTimer& = delete;
+
+  private:
+    Metrics& m_METRICS;
+    Phase m_PHASE;
+    std::chrono::steady_clock::time_point m_START;
+};
@@ -0,0 +1,721 @@
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include "mime_types.hpp"
+
+#include "http_utils.hpp"
+#include "logger.hpp"
+
+/**
+ * @brief Anonymous namespace for helper functions
+ *
+ **/
+namespace {
+    /**
+     * @brief An extension, lowercase and without its dot, and its media type
+     *
+     **/
+    struct MimeMapping {
+        std::string_view extension;
+        std::string_view type;
+    };
+
+    constexpr std::array MIME_MAPPINGS = {
+        // Text and markup
+        MimeMapping {"txt", "text/plain"},
+        MimeMapping {"text", "text/plain"},
+        MimeMapping {"log", "text/plain"},
+        MimeMapping {"conf", "text/plain"},
+        MimeMapping {"cfg", "text/plain"},
+        MimeMapping {"ini", "text/plain"},
+        MimeMapping {"list", "text/plain"},
+        MimeMapping {"asc", "text/plain"},
+        MimeMapping {"diff", "text/plain"},
+        MimeMapping {"patch", "text/plain"},
+        MimeMapping {"srt", "text/plain"},
+        MimeMapping {"toml", "text/plain"},
+        MimeMapping {"env", "text/plain"},
+        MimeMapping {"properties", "text/plain"},
+        MimeMapping {"html", "text/html"},
+        MimeMapping {"htm", "text/html"},
+        MimeMapping {"shtml", "text/html"},
+        MimeMapping {"xhtml", "application/xhtml+xml"},
+        MimeMapping {"css", "text/css"},
+        MimeMapping {"csv", "text/csv"},
+        MimeMapping {"tsv", "text/tab-separated-values"},
+        MimeMapping {"md", "text/markdown"},
+        MimeMapping {"markdown", "text/markdown"},
+        MimeMapping {"rst", "text/x-rst"},
+        MimeMapping {"tex", "text/x-tex"},
+        MimeMapping {"ics", "text/calendar"},
+        MimeMapping {"vcf", "text/vcard"},
+        MimeMapping {"vtt", "text/vtt"},
+        MimeMapping {"rtf", "application/rtf"},
+        MimeMapping {"xml", "application/xml"},
+        MimeMapping {"xsl", "application/xml"},
+        MimeMapping {"xsd", "application/xml"},
+        MimeMapping {"dtd", "application/xml-dtd"},
+        MimeMapping {"rss", "application/rss+xml"},
+        MimeMapping {"atom", "application/atom+xml"},
+        MimeMapping {"kml", "application/vnd.google-earth.kml+xml"},
+        MimeMapping {"gpx", "application/gpx+xml"},
+        MimeMapping {"yaml", "application/yaml"},
+        MimeMapping {"yml", "application/yaml"},
+        MimeMapping {"json", "application/json"},
+        MimeMapping {"map", "application/json"},
+        MimeMapping {"geojson", "application/geo+json"},
+        MimeMapping {"jsonld", "application/ld+json"},
+        MimeMapping {"webmanifest", "application/manifest+json"},
+        MimeMapping {"ndjson", "application/x-ndjson"},
+        MimeMapping {"js", "text/javascript"},
+        MimeMapping {"mjs", "text/javascript"},
+        MimeMapping {"cjs", "text/javascript"},
+        MimeMapping {"wasm", "application/wasm"},
+        // Source code, shown as text
+        MimeMapping {"c", "text/x-c"},
+        MimeMapping {"h", "text/x-c"},
+        MimeMapping {"cc", "text/x-c++"},
+        MimeMapping {"cpp", "text/x-c++"},
+        MimeMapping {"cxx", "text/x-c++"},
+        MimeMapping {"hh", "text/x-c++"},
+        MimeMapping {"hpp", "text/x-c++"},
+        MimeMapping {"hxx", "text/x-c++"},
+        MimeMapping {"ipp", "text/x-c++"},
+        MimeMapping {"inl", "text/x-c++"},
+        MimeMapping {"cs", "text/plain"},
+        MimeMapping {"java", "text/x-java-source"},
+        MimeMapping {"kt", "text/plain"},
+        MimeMapping {"kts", "text/plain"},
+        MimeMapping {"scala", "text/plain"},
+        MimeMapping {"go", "text/plain"},
+        MimeMapping {"rs", "text/plain"},
+        MimeMapping {"py", "text/x-python"},
+        MimeMapping {"pyi", "text/x-python"},
+        MimeMapping {"rb", "text/plain"},
+        MimeMapping {"pl", "text/plain"},
+        MimeMapping {"pm", "text/plain"},
+        MimeMapping {"php", "text/plain"},
+        MimeMapping {"lua", "text/plain"},
+        MimeMapping {"swift", "text/plain"},
+        MimeMapping {"m", "text/plain"},
+        MimeMapping {"mm", "text/plain"},
+        MimeMapping {"d", "text/plain"},
+        MimeMapping {"zig", "text/plain"},
+        MimeMapping {"nim", "text/plain"},
+        MimeMapping {"hs", "text/plain"},
+        MimeMapping {"ml", "text/plain"},
+        MimeMapping {"erl", "text/plain"},
+        MimeMapping {"ex", "text/plain"},
+        MimeMapping {"exs", "text/plain"},
+        MimeMapping {"clj", "text/plain"},
+        MimeMapping {"lisp", "text/plain"},
+        MimeMapping {"el", "text/plain"},
+        MimeMapping {"r", "text/plain"},
+        MimeMapping {"jl", "text/plain"},
+        MimeMapping {"dart", "text/plain"},
+        MimeMapping {"tsx", "text/plain"},
+        MimeMapping {"jsx", "text/plain"},
+        MimeMapping {"vue", "text/plain"},
+        MimeMapping {"svelte", "text/plain"},
+        MimeMapping {"sql", "text/plain"},
+        MimeMapping {"graphql", "text/plain"},
+        MimeMapping {"proto", "text/plain"},
+        MimeMapping {"cmake", "text/plain"},
+        MimeMapping {"mk", "text/plain"},
+        MimeMapping {"gradle", "text/plain"},
+        MimeMapping {"bash", "text/plain"},
+        MimeMapping {"zsh", "text/plain"},
+        MimeMapping {"fish", "text/plain"},
+        MimeMapping {"ps1", "text/plain"},
+        MimeMapping {"asm", "text/plain"},
+        MimeMapping {"s", "text/plain"},
+        MimeMapping {"f90", "text/plain"},
+        MimeMapping {"v", "text/plain"},
+        MimeMapping {"glsl", "text/plain"},
+        MimeMapping {"cu", "text/plain"},
+        // Images
+        MimeMapping {"png", "image/png"},
+        MimeMapping {"apng", "image/apng"},
+        MimeMapping {"jpg", "image/jpeg"},
+        MimeMapping {"jpeg", "image/jpeg"},
+        MimeMapping {"jpe", "image/jpeg"},
+        MimeMapping {"jfif", "image/jpeg"},
+        MimeMapping {"pjpeg", "image/jpeg"},
+        MimeMapping {"gif", "image/gif"},
+        MimeMapping {"webp", "image/webp"},
+        MimeMapping {"avif", "image/avif"},
+        MimeMapping {"heic", "image/heic"},
+        MimeMapping {"heif", "image/heif"},
+        MimeMapping {"jxl", "image/jxl"},
+        MimeMapping {"bmp", "image/bmp"},
+        MimeMapping {"ico", "image/vnd.microsoft.icon"},
+        MimeMapping {"cur", "image/x-icon"},
+        MimeMapping {"svg", "image/svg+xml"},
+        MimeMapping {"svgz", "image/svg+xml"},
+        MimeMapping {"tif", "image/tiff"},
+        MimeMapping {"tiff", "image/tiff"},
+        MimeMapping {"psd", "image/vnd.adobe.photoshop"},
+        MimeMapping {"xcf", "image/x-xcf"},
+        MimeMapping {"cr2", "image/x-canon-cr2"},
+        MimeMapping {"nef", "image/x-nikon-nef"},
+        MimeMapping {"dng", "image/x-adobe-dng"},
+        MimeMapping {"pbm", "image/x-portable-bitmap"},
+        MimeMapping {"pgm", "image/x-portable-graymap"},
+        MimeMapping {"ppm", "image/x-portable-pixmap"},
+        MimeMapping {"pnm", "image/x-portable-anymap"},
+        MimeMapping {"tga", "image/x-tga"},
+        MimeMapping {"exr", "image/x-exr"},
+        MimeMapping {"hdr", "image/vnd.radiance"},
+        // Audio
+        MimeMapping {"mp3", "audio/mpeg"},
+        MimeMapping {"mpga", "audio/mpeg"},
+        MimeMapping {"m4a", "audio/mp4"},
+        MimeMapping {"m4b", "audio/mp4"},
+        MimeMapping {"aac", "audio/aac"},
+        MimeMapping {"oga", "audio/ogg"},
+        MimeMapping {"ogg", "audio/ogg"},
+        MimeMapping {"opus", "audio/ogg"},
+        MimeMapping {"spx", "audio/ogg"},
+        MimeMapping {"flac", "audio/flac"},
+        MimeMapping {"wav", "audio/wav"},
+        MimeMapping {"weba", "audio/webm"},
+        MimeMapping {"mid", "audio/midi"},
+        MimeMapping {"midi", "audio/midi"},
+        MimeMapping {"kar", "audio/midi"},
+        MimeMapping {"aif", "audio/aiff"},
+        MimeMapping {"aiff", "audio/aiff"},
+        MimeMapping {"au", "audio/basic"},
+        MimeMapping {"snd", "audio/basic"},
+        MimeMapping {"amr", "audio/amr"},
+        MimeMapping {"wma", "audio/x-ms-wma"},
+        MimeMapping {"ra", "audio/x-realaudio"},
+        MimeMapping {"mka", "audio/x-matroska"},
+        MimeMapping {"m3u", "audio/x-mpegurl"},
+        MimeMapping {"pls", "audio/x-scpls"},
+        // Video
+        MimeMapping {"mp4", "video/mp4"},
+        MimeMapping {"m4v", "video/mp4"},
+        MimeMapping {"mp4v", "video/mp4"},
+        MimeMapping {"mpg4", "video/mp4"},
+        MimeMapping {"webm", "video/webm"},
+        MimeMapping {"ogv", "video/ogg"},
+        MimeMapping {"mkv", "video/x-matroska"},
+        MimeMapping {"mk3d", "video/x-matroska"},
+        MimeMapping {"mov", "video/quicktime"},
+        MimeMapping {"qt", "video/quicktime"},
+        MimeMapping {"avi", "video/x-msvideo"},
+        MimeMapping {"wmv", "video/x-ms-wmv"},
+        MimeMapping {"asf", "video/x-ms-asf"},
+        MimeMapping {"flv", "video/x-flv"},
+        MimeMapping {"mpeg", "video/mpeg"},
+        MimeMapping {"mpg", "video/mpeg"},
+        MimeMapping {"mpe", "video/mpeg"},
+        MimeMapping {"m1v", "video/mpeg"},
+        MimeMapping {"m2v", "video/mpeg"},
+        MimeMapping {"ts", "video/mp2t"},
+        MimeMapping {"m2ts", "video/mp2t"},
+        MimeMapping {"mts", "video/mp2t"},
+        MimeMapping {"3gp", "video/3gpp"},
+        MimeMapping {"3g2", "video/3gpp2"},
+        MimeMapping {"m3u8", "application/vnd.apple.mpegurl"},
+        MimeMapping {"mpd", "application/dash+xml"},
+        // Fonts
+        MimeMapping {"woff", "font/woff"},
+        MimeMapping {"woff2", "font/woff2"},
+        MimeMapping {"ttf", "font/ttf"},
+        MimeMapping {"otf", "font/otf"},
+        MimeMapping {"ttc", "font/collection"},
+        MimeMapping {"eot", "application/vnd.ms-fontobject"},
+        // Documents
+        MimeMapping {"pdf", "application/pdf"},
+        MimeMapping {"ps", "application/postscript"},
+        MimeMapping {"eps", "application/postscript"},
+        MimeMapping {"ai", "application/postscript"},
+        MimeMapping {"epub", "application/epub+zip"},
+        MimeMapping {"mobi", "application/x-mobipocket-ebook"},
+        MimeMapping {"djvu", "image/vnd.djvu"},
+        MimeMapping {"doc", "application/msword"},
+        MimeMapping {"dot", "application/msword"},
+        MimeMapping {"docx", "application/vnd.openxmlformats-officedocument.wordprocessingml.document"},
+        MimeMapping {"xls", "application/vnd.ms-excel"},
+        MimeMapping {"xlsx", "application/vnd.openxmlformats-officedocument.spreadsheetml.sheet"},
+        MimeMapping {"ppt", "application/vnd.ms-powerpoint"},
+        MimeMapping {"pptx", "application/vnd.openxmlformats-officedocument.presentationml.presentation"},
+        MimeMapping {"odt", "application/vnd.oasis.opendocument.text"},
+        MimeMapping {"ods", "application/vnd.oasis.opendocument.spreadsheet"},
+        MimeMapping {"odp", "application/vnd.oasis.opendocument.presentation"},
+        MimeMapping {"odg", "application/vnd.oasis.opendocument.graphics"},
+        MimeMapping {"pages", "application/vnd.apple.pages"},
+        MimeMapping {"numbers", "application/vnd.apple.numbers"},
+        MimeMapping {"key", "application/vnd.apple.keynote"},
+        MimeMapping {"xps", "application/vnd.ms-xpsdocument"},
+        MimeMapping {"chm", "application/vnd.ms-htmlhelp"},
+        // Archives and compressed data
+        MimeMapping {"zip", "application/zip"},
+        MimeMapping {"tar", "application/x-tar"},
+        MimeMapping {"gz", "application/gzip"},
+        MimeMapping {"tgz", "application/gzip"},
+        MimeMapping {"bz2", "application/x-bzip2"},
+        MimeMapping {"tbz2", "application/x-bzip2"},
+        MimeMapping {"xz", "application/x-xz"},
+        MimeMapping {"txz", "application/x-xz"},
+        MimeMapping {"lz", "application/x-lzip"},
+        MimeMapping {"lzma", "application/x-lzma"},
+        MimeMapping {"lz4", "application/x-lz4"},
+        MimeMapping {"zst", "application/zstd"},
+        MimeMapping {"br", "application/x-brotli"},
+        MimeMapping {"z", "application/x-compress"},
+        MimeMapping {"7z", "application/x-7z-compressed"},
+        MimeMapping {"rar", "application/vnd.rar"},
+        MimeMapping {"cab", "application/vnd.ms-cab-compressed"},
+        MimeMapping {"arj", "application/x-arj"},
+        MimeMapping {"cpio", "application/x-cpio"},
+        MimeMapping {"ar", "application/x-archive"},
+        MimeMapping {"jar", "application/java-archive"},
+        MimeMapping {"war", "application/java-archive"},
+        MimeMapping {"ear", "application/java-archive"},
+        MimeMapping {"apk", "application/vnd.android.package-archive"},
+        MimeMapping {"xpi", "application/x-xpinstall"},
+        MimeMapping {"crx", "application/x-chrome-extension"},
+        MimeMapping {"whl", "application/zip"},
+        MimeMapping {"nupkg", "application/zip"},
+        MimeMapping {"iso", "application/x-iso9660-image"},
+        MimeMapping {"img", "application/octet-stream"},
+        MimeMapping {"dmg", "application/x-apple-diskimage"},
+        MimeMapping {"vhd", "application/x-vhd"},
+        MimeMapping {"vmdk", "application/x-vmdk"},
+        MimeMapping {"qcow2", "application/x-qemu-disk"},
+        // Packages and executables
+        MimeMapping {"deb", "application/vnd.debian.binary-package"},
+        MimeMapping {"rpm", "application/x-rpm"},
+        MimeMapping {"msi", "application/x-msi"},
+        MimeMapping {"msix", "application/msix"},
+        MimeMapping {"appx", "application/appx"},
+        MimeMapping {"exe", "application/vnd.microsoft.portable-executable"},
+        MimeMapping {"dll", "application/vnd.microsoft.portable-executable"},
+        MimeMapping {"com", "application/x-msdownload"},
+        MimeMapping {"bat", "application/x-msdownload"},
+        MimeMapping {"cmd", "application/x-msdownload"},
+        MimeMapping {"sh", "application/x-sh"},
+        MimeMapping {"csh", "application/x-csh"},
+        MimeMapping {"run", "application/x-makeself"},
+        MimeMapping {"bin", "application/octet-stream"},
+        MimeMapping {"elf", "application/x-elf"},
+        MimeMapping {"so", "application/x-sharedlib"},
+        MimeMapping {"o", "application/x-object"},
+        MimeMapping {"a", "application/x-archive"},
+        MimeMapping {"class", "application/java-vm"},
+        MimeMapping {"pyc", "application/x-python-code"},
+        MimeMapping {"appimage", "application/vnd.appimage"},
+        MimeMapping {"flatpak", "application/vnd.flatpak"},
+        MimeMapping {"snap", "application/vnd.snap"},
+        // Data
+        MimeMapping {"sqlite", "application/vnd.sqlite3"},
+        MimeMapping {"sqlite3", "application/vnd.sqlite3"},
+        MimeMapping {"db", "application/octet-stream"},
+        MimeMapping {"parquet", "application/vnd.apache.parquet"},
+        MimeMapping {"avro", "application/avro"},
+        MimeMapping {"arrow", "application/vnd.apache.arrow.file"},
+        MimeMapping {"h5", "application/x-hdf5"},
+        MimeMapping {"hdf5", "application/x-hdf5"},
+        MimeMapping {"nc", "application/x-netcdf"},
+        MimeMapping {"npy", "application/octet-stream"},
+        MimeMapping {"pkl", "application/octet-stream"},
+        MimeMapping {"torrent", "application/x-bittorrent"},
+        MimeMapping {"pem", "application/x-pem-file"},
+        MimeMapping {"crt", "application/x-x509-ca-cert"},
+        MimeMapping {"cer", "application/pkix-cert"},
+        MimeMapping {"der", "application/x-x509-ca-cert"},
+        MimeMapping {"p12", "application/x-pkcs12"},
+        MimeMapping {"pfx", "application/x-pkcs12"},
+        MimeMapping {"sig", "application/pgp-signature"},
+        MimeMapping {"gpg", "application/pgp-encrypted"},
+        MimeMapping {"stl", "model/stl"},
+        MimeMapping {"obj", "model/obj"},
+        MimeMapping {"gltf", "model/gltf+json"},
+        MimeMapping {"glb", "model/gltf-binary"},
+        MimeMapping {"swf", "application/x-shockwave-flash"},
+    };
+
+    /**
+     * @brief Marks an empty slot of the table
+     *
+     **/
+    constexpr std::uint16_t EMPTY_SLOT = 0xFFFF;
+
+    /**
+     * @brief Buckets of the first hash level, a power of two
+     *
+     **/
+    constexpr std::size_t MIME_BUCKETS = 256;
+
+    /**
+     * @brief Slots of the table, a power of two at least twice the mappings
+     *
+     **/
+    constexpr std::size_t MIME_SLOTS = 1024;
+
+    /**
+     * @brief Most extensions a bucket may hold
+     *
+     **/
+    constexpr std::size_t BUCKET_CAPACITY = 8;
+
+    /**
+     * @brief Longest extension which can be looked up
+     *
+     **/
+    constexpr std::size_t MAX_EXTENSION_LENGTH = 16;
+
+    static_assert(MIME_MAPPINGS.size() * 2 <= MIME_SLOTS && MIME_SLOTS <= EMPTY_SLOT);
+
+    /**
+     * @brief Seeded FNV-1a hash of an extension with a murmur3 finalizer
+     *
+     * @param extension lowercase extension
+     * @param seed hash seed
+     * @return std::uint32_t hash
+     **/
+    constexpr auto hash_extension(std::string_view extension, std::uint32_t seed) -> std::uint32_t {
+        std::uint32_t hash = 2166136261U ^ (seed * 0x9E3779B9U);
+        for (char const CHARACTER : extension) {
+            hash = (hash ^ static_cast<unsigned char>(CHARACTER)) * 16777619U;
+        }
+        hash ^= hash >> 16;
+        hash *= 0x85EBCA6BU;
+        hash ^= hash >> 13;
+        hash *= 0xC2B2AE35U;
+        hash ^= hash >> 16;
+        return hash;
+    }
+
+    constexpr auto bucket_of(std::string_view extension) -> std::size_t {
+        return hash_extension(extension, 0) & (MIME_BUCKETS - 1);
+    }
+
+    constexpr auto slot_of(std::string_view extension, std::uint16_t seed) -> std::size_t {
+        return hash_extension(extension, seed) & (MIME_SLOTS - 1);
+    }
+
+    /**
+     * @brief Two-level perfect hash of MIME_MAPPINGS (hash and displace)
+     *
+     * Extensions are spread over buckets by one hash; every bucket then gets
+     * the first seed which places all its extensions into free slots.
+     **/
+    struct PerfectHash {
+        std::array<std::uint16_t, MIME_BUCKETS> seeds {};
+        std::array<std::uint16_t, MIME_SLOTS> slots {};
+    };
+
+    constexpr auto build_perfect_hash() -> PerfectHash {
+        PerfectHash table {};
+        table.slots.fill(EMPTY_SLOT);
+
+        std::array<std::size_t, MIME_BUCKETS> sizes {};
+        std::size_t largest = 0;
+        for (const MimeMapping& mapping : MIME_MAPPINGS) {
+            std::size_t const SIZE = ++sizes[bucket_of(mapping.extension)];
+            largest = SIZE > largest ? SIZE : largest;
+        }
+
+        // Fullest buckets first, while most slots are still free
+        for (std::size_t size = largest; size > 0; --size) {
+            for (std::size_t bucket = 0; bucket < MIME_BUCKETS; ++bucket) {
+                if (sizes[bucket] != size) {
+                    continue;
+                }
+                std::array<std::size_t, BUCKET_CAPACITY> members {};
+                std::size_t count = 0;
+                for (std::size_t i = 0; i < MIME_MAPPINGS.size(); ++i) {
+                    if (bucket_of(MIME_MAPPINGS[i].extension) == bucket) {
+                        members[count++] = i;
+                    }
+                }
+                for (std::uint16_t seed = 1;; ++seed) {
+                    std::array<std::size_t, BUCKET_CAPACITY> chosen {};
+                    bool placed = true;
+                    for (std::size_t k = 0; k < count && placed; ++k) {
+                        chosen[k] = slot_of(MIME_MAPPINGS[members[k]].extension, seed);
+                        placed = table.slots[chosen[k]] == EMPTY_SLOT;
+                        for (std::size_t m = 0; m < k && placed; ++m) {
+                            placed = chosen[m] != chosen[k];
+                        }
+                    }
+                    if (placed) {
+                        for (std::size_t k = 0; k < count; ++k) {
+                            table.slots[chosen[k]] = static_cast<std::uint16_t>(members[k]);
+                        }
+                        table.seeds[bucket] = seed;
+                        break;
+                    }
+                }
+            }
+        }
+        return table;
+    }
+
+    constexpr PerfectHash MIME_TABLE = build_perfect_hash();
+
+    /**
+     * @brief Default disposition of a media type
+     *
+     * @param type media type
+     * @return Disposition disposition
+     **/
+    constexpr auto default_disposition(std::string_view type) -> Disposition {
+        type = type.substr(0, type.find(';'));
+        for (std::string_view const PREFIX : {"text/", "image/", "audio/", "video/", "font/"}) {
+            if (type.starts_with(PREFIX)) {
+                return Disposition::INLINE;
+            }
+        }
+        if (!type.starts_with("application/")) {
+            return Disposition::ATTACHMENT;
+        }
+        for (std::string_view const SUFFIX : {"/json", "+json", "/xml", "+xml", "/pdf", "/javascript", "/wasm"}) {
+            if (type.ends_with(SUFFIX)) {
+                return Disposition::INLINE;
+            }
+        }
+        return Disposition::ATTACHMENT;
+    }
+
+    /**
+     * @brief Dispositions of MIME_MAPPINGS, by index
+     *
+     **/
+    constexpr auto MIME_DISPOSITIONS = []
+    {
+        std::array<Disposition, MIME_MAPPINGS.size()> dispositions {};
+        for (std::size_t i = 0; i < MIME_MAPPINGS.size(); ++i) {
+            dispositions[i] = default_disposition(MIME_MAPPINGS[i].type);
+        }
+        return dispositions;
+    }();
+
+    /**
+     * @brief Find an extension in the built-in table
+     *
+     * @param extension lowercase extension without its dot
+     * @return std::size_t index in MIME_MAPPINGS, or its size if unknown
+     **/
+    constexpr auto find_mapping(std::string_view extension) -> std::size_t {
+        std::uint16_t const SEED = MIME_TABLE.seeds[bucket_of(extension)];
+        std::uint16_t const INDEX = MIME_TABLE.slots[slot_of(extension, SEED)];
+        bool const FOUND = INDEX != EMPTY_SLOT && MIME_MAPPINGS[INDEX].extension == extension;
+        return FOUND ? INDEX : MIME_MAPPINGS.size();
+    }
+
+    constexpr auto every_mapping_found() -> bool {
+        for (std::size_t i = 0; i < MIME_MAPPINGS.size(); ++i) {
+            // A duplicated extension would find its first mapping
+            if (find_mapping(MIME_MAPPINGS[i].extension) != i || MIME_MAPPINGS[i].type.empty()
+                || MIME_MAPPINGS[i].extension.size() > MAX_EXTENSION_LENGTH)
+            {
+                return false;
+            }
+            for (char const CHARACTER : MIME_MAPPINGS[i].extension) {
+                if (CHARACTER >= 'A' && CHARACTER <= 'Z') {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    static_assert(every_mapping_found());
+    static_assert(find_mapping("unknown") == MIME_MAPPINGS.size());
+    static_assert(default_disposition("video/mp4") == Disposition::INLINE);
+    static_assert(default_disposition("application/ld+json") == Disposition::INLINE);
+    static_assert(default_disposition("application/zip") == Disposition::ATTACHMENT);
+
+    /**
+     * @brief Lowercase the extension of a file name into a buffer
+     *
+     * @param name file name
+     * @param buffer receives the extension
+     * @return std::string_view extension without its dot, empty if there is none or it is too long
+     **/
+    auto lowercase_extension(std::string_view name, std::array<char, MAX_EXTENSION_LENGTH>& buffer)
+        -> std::string_view {
+        std::size_t const DOT = name.rfind('.');
+        // Dot files such as ".bashrc" have no extension
+        if (DOT == std::string_view::npos || DOT == 0 || name.size() - DOT - 1 > buffer.size()) {
+            return {};
+        }
+        std::string_view const EXTENSION = name.substr(DOT + 1);
+        for (std::size_t i = 0; i < EXTENSION.size(); ++i) {
+            buffer[i] = static_cast<char>(std::tolower(static_cast<unsigned char>(EXTENSION[i])));
+        }
+        return {buffer.data(), EXTENSION.size()};
+    }
+
+    /**
+     * @brief Parse a disposition keyword
+     *
+     * @param word "inline" or "attachment"
+     * @param disposition receives the disposition
+     * @return true if the word is a disposition
+     **/
+    auto parse_disposition(std::string_view word, Disposition& disposition) -> bool {
+        if (word == "inline") {
+            disposition = Disposition::INLINE;
+            return true;
+        }
+        if (word == "attachment") {
+            disposition = Disposition::ATTACHMENT;
+            return true;
+        }
+        return false;
+    }
+}  // namespace
+
+/**
+ * @brief Get the media type of a file from the built-in table
+ *
+ * @param name file name
+ * @return MimeType media type and disposition
+ **/
+auto builtin_mime_type(std::string_view name) -> MimeType {
+    std::array<char, MAX_EXTENSION_LENGTH> buffer {};
+    std::string_view const EXTENSION = lowercase_extension(name, buffer);
+    if (EXTENSION.empty()) {
+        return {};
+    }
+    std::size_t const INDEX = find_mapping(EXTENSION);
+    if (INDEX == MIME_MAPPINGS.size()) {
+        return {};
+    }
+    return {MIME_MAPPINGS[INDEX].type, MIME_DISPOSITIONS[INDEX]};
+}
+
+/**
+ * @brief Get the default disposition of a media type
+ *
+ * @param type media type
+ * @return Disposition disposition
+ **/
+auto disposition_of(std::string_view type) -> Disposition {
+    return default_disposition(type);
+}
+
+/**
+ * @brief Append a Content-Disposition value
+ *
+ * @param out header value
+ * @param disposition inline or attachment
+ * @param filename file name
+ **/
+void append_content_disposition(std::string& out, Disposition disposition, std::string_view filename) {
+    out.append(disposition == Disposition::INLINE ? "inline" : "attachment");
+    out.append("; filename=\"");
+    bool plain = true;
+    for (char const CHARACTER : filename) {
+        auto const BYTE = static_cast<unsigned char>(CHARACTER);
+        if (BYTE < 0x20 || BYTE >= 0x7F) {
+            // Control characters would break the header, other bytes are not ASCII
+            out.push_back('_');
+            plain = false;
+            continue;
+        }
+        if (CHARACTER == '"' || CHARACTER == '\\') {
+            out.push_back('\\');
+        }
+        out.push_back(CHARACTER);
+    }
+    out.push_back('"');
+    if (!plain) {
+        out.append("; filename*=UTF-8''");
+        out.append(percent_encode(filename));
+    }
+}
+
+/**
+ * @brief Load overrides from a file
+ *
+ * @param file path
+ * @return true if the file could be read
+ **/
+auto MimeTypes::load(const std::string& file) -> bool {
+    std::ifstream input(file);
+    if (!input) {
+        return false;
+    }
+    std::string line;
+    std::size_t number = 0;
+    while (std::getline(input, line)) {
+        ++number;
+        line.erase(std::min(line.find('#'), line.size()));
+        std::istringstream words(line);
+        std::string word;
+        if (!(words >> word)) {
+            continue;
+        }
+        Disposition disposition = Disposition::ATTACHMENT;
+        bool const EXPLICIT = parse_disposition(word, disposition);
+        if (EXPLICIT && !(words >> word)) {
+            log_warn("%s:%zu: media type missing, line skipped\n", file.c_str(), number);
+            continue;
+        }
+        if (word.find('/') == std::string::npos) {
+            log_warn("%s:%zu: invalid media type \"%s\", line skipped\n", file.c_str(), number, word.c_str());
+            continue;
+        }
+        std::string const TYPE = word;
+        if (!EXPLICIT) {
+            disposition = default_disposition(TYPE);
+        }
+        while (words >> word) {
+            std::string_view const EXTENSION = word;
+            add(EXTENSION.starts_with('.') ? EXTENSION.substr(1) : EXTENSION, TYPE, disposition);
+        }
+    }
+    return !input.bad();
+}
+
+/**
+ * @brief Add or replace the media type of an extension
+ *
+ * @param extension extension without the dot
+ * @param type media type
+ * @param disposition disposition
+ **/
+void MimeTypes::add(std::string_view extension, std::string_view type, Disposition disposition) {
+    if (extension.empty() || extension.size() > MAX_EXTENSION_LENGTH) {
+        return;
+    }
+    std::string key(extension);
+    for (char& character : key) {
+        character = static_cast<char>(std::tolower(static_cast<unsigned char>(character)));
+    }
+    m_OVERRIDES.insert_or_assign(std::move(key), Override {std::string(type), disposition});
+}
+
+/**
+ * @brief Get the media type of a file
+ *
+ * @param name file name
+ * @return MimeType media type
+ **/
+auto MimeTypes::lookup(std::string_view name) const -> MimeType {
+    if (!m_OVERRIDES.empty()) {
+        std::array<char, MAX_EXTENSION_LENGTH> buffer {};
+        std::string_view const EXTENSION = lowercase_extension(name, buffer);
+        if (!EXTENSION.empty()) {
+            auto const IT = m_OVERRIDES.find(EXTENSION);
+            if (IT != m_OVERRIDES.end()) {
+                return {IT->second.type, IT->second.disposition};
+            }
+        }
+    }
+    return builtin_mime_type(name);
+}
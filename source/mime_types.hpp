@@ -0,0 +1,122 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+/**
+ * @brief How a browser should present a response
+ *
+ **/
+enum class Disposition : std::uint8_t
+{
+    INLINE,        // displayed or played in place, progressively where possible
+    ATTACHMENT     // saved to disk
+};
+
+/**
+ * @brief Media type of a file and how it is presented
+ *
+ **/
+struct MimeType {
+    std::string_view type = "application/octet-stream";
+    Disposition disposition = Disposition::ATTACHMENT;
+};
+
+/**
+ * @brief Get the media type of a file from the built-in extension table
+ *
+ * A compile-time perfect hash over a few hundred extensions: one lowercase
+ * copy of the extension into a stack buffer, two hashes and one comparison.
+ * Extensions are case-insensitive; unknown ones are application/octet-stream
+ * and attachments.
+ *
+ * @param name file name
+ * @return MimeType media type and disposition
+ **/
+auto builtin_mime_type(std::string_view name) -> MimeType;
+
+/**
+ * @brief Get the default disposition of a media type
+ *
+ * Text, images, audio, video, fonts, PDF, JSON, XML and JavaScript are
+ * shown inline; everything else is downloaded.
+ *
+ * @param type media type, parameters allowed
+ * @return Disposition disposition
+ **/
+auto disposition_of(std::string_view type) -> Disposition;
+
+/**
+ * @brief Append a Content-Disposition value
+ *
+ * The quoted filename is reduced to printable ASCII; names with other
+ * bytes also get the RFC 6266 filename* form, percent-encoded.
+ *
+ * @param out header value
+ * @param disposition inline or attachment
+ * @param filename file name offered to the client
+ **/
+void append_content_disposition(std::string& out, Disposition disposition, std::string_view filename);
+
+class MimeTypes {
+    /**
+     * @brief MimeTypes - the built-in table with overrides from a file
+     *
+     * Overrides use the mime.types format, "type ext...", one type per line
+     * and '#' comments, optionally prefixed with "inline" or "attachment"
+     * to replace the default disposition of the type. They are loaded
+     * before the server starts and only read afterwards.
+     **/
+
+  public:
+    /**
+     * @brief Load overrides from a file
+     *
+     * Malformed lines are logged and skipped.
+     *
+     * @param file path of the file
+     * @return true if the file could be read
+     **/
+    auto load(const std::string& file) -> bool;
+
+    /**
+     * @brief Add or replace the media type of an extension
+     *
+     * @param extension extension without the dot, any case
+     * @param type media type
+     * @param disposition disposition
+     **/
+    void add(std::string_view extension, std::string_view type, Disposition disposition);
+
+    /**
+     * @brief Get the media type of a file, overrides first
+     *
+     * @param name file name
+     * @return MimeType media type, valid as long as this object is unchanged
+     **/
+    auto lookup(std::string_view name) const -> MimeType;
+
+    /**
+     * @brief Get the number of overridden extensions
+     *
+     * @return std::size_t count
+     **/
+    auto size() const -> std::size_t { return m_OVERRIDES.size(); }
+
+  private:
+    struct Override {
+        std::string type;
+        Disposition disposition = Disposition::ATTACHMENT;
+    };
+
+    struct KeyHash {
+        using is_transparent = void;
+        auto operator()(std::string_view key) const -> std::size_t { return std::hash<std::string_view> {}(key); }
+    };
+
+    std::unordered_map<std::string, Override, KeyHash, std::equal_to<>> m_OVERRIDES;
+};
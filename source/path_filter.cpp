@@ -0,0 +1,348 @@
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "path_filter.hpp"
+
+#include "logger.hpp"
+
+/**
+ * @brief Anonymous namespace for helper functions
+ *
+ **/
+namespace {
+    /**
+     * @brief Bits per expected element, about 1% false positives with HASHES probes
+     *
+     **/
+    constexpr std::size_t BITS_PER_KEY = 10;
+
+    /**
+     * @brief Probes per key
+     *
+     **/
+    constexpr std::size_t HASHES = 7;
+
+    /**
+     * @brief Derive the two base hashes of a key for double hashing
+     *
+     * @param key key
+     * @return std::pair<std::uint64_t, std::uint64_t> first hash and odd step
+     **/
+    auto base_hashes(std::string_view key) -> std::pair<std::uint64_t, std::uint64_t> {
+        std::uint64_t const FIRST = std::hash<std::string_view> {}(key);
+        std::uint64_t step = FIRST * 0x9E3779B97F4A7C15ULL;
+        step ^= step >> 29;
+        return {FIRST, step | 1};
+    }
+
+    /**
+     * @brief Append an entry name to a directory key
+     *
+     * @param dir normalized directory
+     * @param name entry name
+     * @return std::string normalized child path
+     **/
+    auto join_key(const std::string& dir, std::string_view name) -> std::string {
+        std::string key;
+        key.reserve(dir.size() + name.size() + 1);
+        key.append(dir);
+        if (key.empty() || key.back() != '/') {
+            key.push_back('/');
+        }
+        key.append(name);
+        return key;
+    }
+}    // namespace
+
+/**
+ * @brief Construct a new PathFilter::Bloom object
+ *
+ * @param expected expected number of keys
+ **/
+PathFilter::Bloom::Bloom(std::size_t expected)
+    : capacity(expected)
+    , bit_count((expected * BITS_PER_KEY + 63) / 64 * 64)
+    , words(new std::atomic<std::uint64_t>[bit_count / 64]()) {}
+
+/**
+ * @brief Add a key
+ *
+ * @param key key
+ **/
+void PathFilter::Bloom::insert(std::string_view key) {
+    auto [hash, step] = base_hashes(key);
+    for (std::size_t i = 0; i < HASHES; ++i, hash += step) {
+        std::size_t const BIT = hash % bit_count;
+        words[BIT / 64].fetch_or(std::uint64_t {1} << (BIT % 64), std::memory_order_relaxed);
+    }
+    count.fetch_add(1, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Test a key
+ *
+ * @param key key
+ * @return true if the key may have been inserted
+ **/
+auto PathFilter::Bloom::may_contain(std::string_view key) const -> bool {
+    auto [hash, step] = base_hashes(key);
+    for (std::size_t i = 0; i < HASHES; ++i, hash += step) {
+        std::size_t const BIT = hash % bit_count;
+        if ((words[BIT / 64].load(std::memory_order_relaxed) & (std::uint64_t {1} << (BIT % 64))) == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Construct a new PathFilter::PathFilter object
+ *
+ * @param watcher inotify watcher
+ **/
+PathFilter::PathFilter(InotifyWatcher& watcher)
+    : m_WATCHER(watcher) {}
+
+/**
+ * @brief Destroy the PathFilter::PathFilter object
+ *
+ **/
+PathFilter::~PathFilter() {
+    stop();
+}
+
+/**
+ * @brief Start the background index
+ *
+ * @param root normalized root
+ **/
+void PathFilter::start(const std::string& root) {
+    if (!m_WATCHER.is_enabled() || m_THREAD.joinable()) {
+        return;
+    }
+    m_ROOT = root;
+    m_REBUILD = true;
+    m_THREAD = std::thread([this] { run(); });
+}
+
+/**
+ * @brief Stop the background index
+ *
+ **/
+void PathFilter::stop() {
+    {
+        std::lock_guard<std::mutex> const LOCK(m_QUEUE_MUTEX);
+        m_STOP = true;
+    }
+    m_QUEUE_CV.notify_all();
+    if (m_THREAD.joinable()) {
+        m_THREAD.join();
+    }
+}
+
+/**
+ * @brief Check whether a path is known not to exist
+ *
+ * @param key normalized path
+ * @return true if it definitely does not exist
+ **/
+auto PathFilter::is_missing(const std::string& key) const -> bool {
+    std::size_t parent_end = m_ROOT.size();
+    std::size_t pos = m_ROOT.size() + (m_ROOT.empty() || m_ROOT.back() != '/' ? 1 : 0);
+    if (m_ROOT.empty() || key.size() <= pos || key.compare(0, m_ROOT.size(), m_ROOT) != 0
+        || key[pos - 1] != '/')
+    {
+        return false;
+    }
+
+    // The filter is swapped under the exclusive lock, so it always matches the coverage read here
+    std::shared_lock<std::shared_mutex> const LOCK(m_COVERED_MUTEX);
+    std::shared_ptr<Bloom> const BLOOM = m_BLOOM.load();
+    if (!BLOOM) {
+        return false;
+    }
+
+    std::string_view const KEY = key;
+    while (true) {
+        std::size_t const SLASH = KEY.find('/', pos);
+        std::size_t const END = SLASH == std::string_view::npos ? KEY.size() : SLASH;
+
+        if (m_COVERED.find(KEY.substr(0, parent_end)) == m_COVERED.end()) {
+            return false;
+        }
+        if (!BLOOM->may_contain(KEY.substr(0, END))) {
+            // The filter may lag behind changes whose events are still queued
+            return m_WATCHER.is_settled();
+        }
+        if (SLASH == std::string_view::npos) {
+            return false;
+        }
+        parent_end = END;
+        pos = SLASH + 1;
+    }
+}
+
+/**
+ * @brief Record a created path
+ *
+ * @param key normalized path
+ **/
+void PathFilter::insert(std::string_view key) {
+    std::shared_ptr<Bloom> const BLOOM = m_BLOOM.load();
+    if (!BLOOM) {
+        return;
+    }
+    BLOOM->insert(key);
+    if (BLOOM->count.load(std::memory_order_relaxed) == BLOOM->capacity) {
+        request_rebuild();
+    }
+}
+
+/**
+ * @brief Apply an inotify event
+ *
+ * @param dir watched directory
+ * @param name entry name
+ * @param mask inotify mask
+ **/
+void PathFilter::on_event(const fs::path& dir, std::string_view name, std::uint32_t mask) {
+    if (!m_THREAD.joinable()) {
+        return;
+    }
+    if ((mask & InotifyWatcher::OVERFLOW_MASK) != 0) {
+        request_rebuild();
+        return;
+    }
+    if ((mask & InotifyWatcher::SELF_GONE_MASK) != 0) {
+        uncover_tree(dir.string());
+        return;
+    }
+    if ((mask & InotifyWatcher::CREATED_MASK) == 0 || name.empty()) {
+        return;
+    }
+
+    std::string child = join_key(dir.string(), name);
+    insert(child);
+
+    // A new directory may already have entries by the time it is watched, so it is walked
+    if ((mask & InotifyWatcher::ISDIR_MASK) != 0) {
+        {
+            std::lock_guard<std::mutex> const LOCK(m_QUEUE_MUTEX);
+            m_PENDING.push_back(std::move(child));
+        }
+        m_QUEUE_CV.notify_one();
+    }
+}
+
+/**
+ * @brief Indexing thread
+ *
+ **/
+void PathFilter::run() {
+    std::unique_lock<std::mutex> lock(m_QUEUE_MUTEX);
+    while (true) {
+        m_QUEUE_CV.wait(lock, [this] { return m_STOP || m_REBUILD || !m_PENDING.empty(); });
+        if (m_STOP) {
+            return;
+        }
+        bool const REBUILD = std::exchange(m_REBUILD, false);
+        std::vector<std::string> pending = std::exchange(m_PENDING, {});
+        lock.unlock();
+
+        if (REBUILD) {
+            std::shared_ptr<Bloom> const OLD = m_BLOOM.load();
+            std::size_t const EXPECTED = std::max(INITIAL_CAPACITY, OLD ? OLD->count.load() * 2 : 0);
+            auto bloom = std::make_shared<Bloom>(EXPECTED);
+            {
+                std::unique_lock<std::shared_mutex> const COVERED_LOCK(m_COVERED_MUTEX);
+                m_COVERED.clear();
+                m_BLOOM.store(bloom);
+            }
+            index_tree(m_ROOT, *bloom);
+            log_info("Indexed %zu paths below %s\n", bloom->count.load(), m_ROOT.c_str());
+        } else if (auto bloom = m_BLOOM.load()) {
+            for (const auto& dir : pending) {
+                index_tree(dir, *bloom);
+            }
+        }
+
+        lock.lock();
+    }
+}
+
+/**
+ * @brief Watch, index and cover a tree
+ *
+ * @param dir normalized directory
+ * @param bloom filter to fill
+ **/
+void PathFilter::index_tree(const std::string& dir, Bloom& bloom) {
+    std::vector<std::string> stack {dir};
+    while (!stack.empty() && !m_STOP) {
+        std::string const CURRENT = std::move(stack.back());
+        stack.pop_back();
+
+        // Watched before listing: an entry created meanwhile is either listed or reported
+        bool const WATCHED = m_WATCHER.add_watch(CURRENT);
+
+        boost::system::error_code ec;
+        fs::directory_iterator entry(CURRENT, ec);
+        for (; !ec && entry != fs::directory_iterator(); entry.increment(ec)) {
+            std::string child = join_key(CURRENT, entry->path().filename().string());
+            bloom.insert(child);
+
+            // Symbolic links are not followed: paths through them are simply never covered
+            boost::system::error_code status_ec;
+            if (entry->symlink_status(status_ec).type() == fs::directory_file) {
+                stack.push_back(std::move(child));
+            }
+        }
+
+        if (!ec && WATCHED) {
+            std::unique_lock<std::shared_mutex> const LOCK(m_COVERED_MUTEX);
+            m_COVERED.insert(CURRENT);
+        }
+    }
+
+    if (bloom.count.load(std::memory_order_relaxed) >= bloom.capacity) {
+        request_rebuild();
+    }
+}
+
+/**
+ * @brief Drop the coverage of a tree
+ *
+ * @param dir normalized directory
+ **/
+void PathFilter::uncover_tree(const std::string& dir) {
+    std::unique_lock<std::shared_mutex> const LOCK(m_COVERED_MUTEX);
+    for (auto it = m_COVERED.begin(); it != m_COVERED.end();) {
+        const std::string& key = *it;
+        bool const IN_TREE =
+            key.compare(0, dir.size(), dir) == 0 && (key.size() == dir.size() || key[dir.size()] == '/');
+        it = IN_TREE ? m_COVERED.erase(it) : std::next(it);
+    }
+}
+
+/**
+ * @brief Ask for a full rebuild
+ *
+ **/
+void PathFilter::request_rebuild() {
+    {
+        std::lock_guard<std::mutex> const LOCK(m_QUEUE_MUTEX);
+        m_REBUILD = true;
+    }
+    m_QUEUE_CV.notify_one();
+}
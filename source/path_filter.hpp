@@ -0,0 +1,167 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include "inotify_watcher.hpp"
+
+namespace fs = boost::filesystem;
+
+class PathFilter {
+    /**
+     * @brief PathFilter - negative lookups answered from memory
+     *
+     * A Bloom filter over every path below the served root, built by a
+     * background walk and kept current by the inotify watcher. A directory is
+     * "covered" once it is watched and all its entries are in the filter; a
+     * path whose parent is covered and which the filter has never seen
+     * definitely does not exist, so a 404 needs no syscall. Probes for deep
+     * nonexistent paths stop at the first missing component.
+     *
+     * Deleted entries stay in the filter (Bloom filters cannot forget), which
+     * only costs a stat(2) later. When the filter fills up or inotify
+     * overflows, coverage is dropped and the tree is indexed again.
+     *
+     * A negative answer is only given while the watcher is settled (no
+     * event waiting to be read or dispatched), so a file created outside
+     * the server is never reported missing: until its event has been
+     * applied, lookups fall back to stat(2).
+     **/
+
+  public:
+    /**
+     * @brief Construct a new Path Filter object
+     *
+     * Events must be forwarded to on_event() by the owner of the watcher.
+     *
+     * @param watcher watcher used to observe indexed directories
+     **/
+    explicit PathFilter(InotifyWatcher& watcher);
+
+    ~PathFilter();
+
+    PathFilter(const PathFilter&) = delete;
+    auto operator=(const PathFilter&) -> PathFilter& = delete;
+
+    /**
+     * @brief Start indexing a tree in the background
+     *
+     * Does nothing when inotify is unavailable; is_missing() then always
+     * returns false.
+     *
+     * @param root normalized root of the served tree
+     **/
+    void start(const std::string& root);
+
+    /**
+     * @brief Stop the indexing thread
+     *
+     **/
+    void stop();
+
+    /**
+     * @brief Check whether a path is known not to exist
+     *
+     * @param key normalized path
+     * @return true if the path definitely does not exist, false if it may
+     **/
+    auto is_missing(const std::string& key) const -> bool;
+
+    /**
+     * @brief Record a path which was just created
+     *
+     * @param key normalized path
+     **/
+    void insert(std::string_view key);
+
+    /**
+     * @brief Apply an inotify event
+     *
+     * @param dir watched directory
+     * @param name entry name
+     * @param mask inotify mask
+     **/
+    void on_event(const fs::path& dir, std::string_view name, std::uint32_t mask);
+
+  private:
+    /**
+     * @brief Expected number of paths of the first index
+     *
+     **/
+    static constexpr std::size_t INITIAL_CAPACITY = 1 << 20;
+
+    /**
+     * @brief Bit array with lock-free inserts and queries
+     *
+     **/
+    struct Bloom {
+        explicit Bloom(std::size_t expected);
+
+        void insert(std::string_view key);
+        auto may_contain(std::string_view key) const -> bool;
+
+        std::size_t capacity;
+        std::size_t bit_count;
+        std::atomic<std::size_t> count {0};
+        std::unique_ptr<std::atomic<std::uint64_t>[]> words;
+    };
+
+    struct KeyHash {
+        using is_transparent = void;
+        auto operator()(std::string_view key) const -> std::size_t { return std::hash<std::string_view> {}(key); }
+    };
+
+    /**
+     * @brief Indexing thread: full rebuilds and newly created directories
+     *
+     **/
+    void run();
+
+    /**
+     * @brief Watch, index and cover a directory tree
+     *
+     * @param dir normalized directory
+     * @param bloom filter to fill
+     **/
+    void index_tree(const std::string& dir, Bloom& bloom);
+
+    /**
+     * @brief Drop the coverage of a directory and everything below it
+     *
+     * @param dir normalized directory
+     **/
+    void uncover_tree(const std::string& dir);
+
+    /**
+     * @brief Ask the indexing thread to start over
+     *
+     **/
+    void request_rebuild();
+
+    InotifyWatcher& m_WATCHER;
+    std::string m_ROOT;
+    std::atomic<std::shared_ptr<Bloom>> m_BLOOM;
+
+    mutable std::shared_mutex m_COVERED_MUTEX;
+    std::unordered_set<std::string, KeyHash, std::equal_to<>> m_COVERED;
+
+    std::mutex m_QUEUE_MUTEX;
+    std::condition_variable m_QUEUE_CV;
+    std::vector<std::string> m_PENDING;
+    bool m_REBUILD = false;
+    std::atomic<bool> m_STOP {false};
+    std::thread m_THREAD;
+};
@@ -0,0 +1,726 @@
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "search_index.hpp"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <sys/stat.h>
+
+#include "logger.hpp"
+
+/**
+ * @brief Anonymous namespace for helper functions
+ *
+ **/
+namespace {
+    /**
+     * @brief Threads of a walk when none are configured, at most
+     *
+     **/
+    constexpr std::size_t MAX_WALK_THREADS = 8;
+
+    /**
+     * @brief Removed entries which are tolerated before the index is compacted
+     *
+     **/
+    constexpr std::size_t MIN_COMPACT_REMOVED = 4096;
+
+    /**
+     * @brief An entry of a directory read by a walk
+     *
+     **/
+    struct FoundEntry {
+        std::string name;
+        bool directory = false;
+        bool descend = false;    // a directory reached without a symbolic link
+    };
+
+    /**
+     * @brief Lowercase an ASCII letter, other bytes are kept
+     *
+     * @param character byte
+     * @return char folded byte
+     **/
+    auto fold(char character) -> char {
+        return character >= 'A' && character <= 'Z' ? static_cast<char>(character - 'A' + 'a') : character;
+    }
+
+    /**
+     * @brief Lowercase the ASCII letters of a text
+     *
+     * @param text text
+     * @return std::string folded text
+     **/
+    auto fold_text(std::string_view text) -> std::string {
+        std::string folded(text);
+        std::transform(folded.begin(), folded.end(), folded.begin(), fold);
+        return folded;
+    }
+
+    /**
+     * @brief Append the trigrams of a folded text
+     *
+     * @param grams receives the trigrams, three bytes packed into the low 24 bits
+     * @param folded folded text
+     **/
+    void append_trigrams(std::vector<std::uint32_t>& grams, std::string_view folded) {
+        for (std::size_t i = 0; i + 3 <= folded.size(); ++i) {
+            grams.push_back(static_cast<std::uint32_t>(static_cast<unsigned char>(folded[i])) << 16
+                            | static_cast<std::uint32_t>(static_cast<unsigned char>(folded[i + 1])) << 8
+                            | static_cast<std::uint32_t>(static_cast<unsigned char>(folded[i + 2])));
+        }
+    }
+
+    /**
+     * @brief Append the trigrams every match of a glob pattern contains
+     *
+     * Only runs of literal characters are used; wildcards and bracket
+     * expressions split them.
+     *
+     * @param grams receives the trigrams
+     * @param folded folded pattern
+     **/
+    void append_glob_trigrams(std::vector<std::uint32_t>& grams, std::string_view folded) {
+        std::string run;
+        for (std::size_t i = 0; i < folded.size(); ++i) {
+            char const CHARACTER = folded[i];
+            if (CHARACTER == '\\' && i + 1 < folded.size()) {
+                run.push_back(folded[++i]);
+            } else if (CHARACTER == '*' || CHARACTER == '?' || CHARACTER == '[') {
+                append_trigrams(grams, run);
+                run.clear();
+                if (CHARACTER == '[') {
+                    // Skip the bracket expression; a ']' right after '[' or '[!' belongs to it
+                    std::size_t const CLOSE = folded.find(']', std::min(i + 2, folded.size()));
+                    i = CLOSE == std::string_view::npos ? i : CLOSE;
+                }
+            } else {
+                run.push_back(CHARACTER);
+            }
+        }
+        append_trigrams(grams, run);
+    }
+
+    /**
+     * @brief Check a text contains a folded needle, ignoring ASCII case
+     *
+     * @param text text
+     * @param folded folded needle
+     * @return true if found
+     **/
+    auto contains_folded(std::string_view text, std::string_view folded) -> bool {
+        return std::search(text.begin(),
+                           text.end(),
+                           folded.begin(),
+                           folded.end(),
+                           [](char a, char b) { return fold(a) == b; })
+            != text.end();
+    }
+
+    /**
+     * @brief Append an entry name to a directory path
+     *
+     * @param dir directory
+     * @param name entry name
+     * @return std::string child path
+     **/
+    auto join_path(const std::string& dir, std::string_view name) -> std::string {
+        std::string path;
+        path.reserve(dir.size() + name.size() + 1);
+        path.append(dir);
+        if (path.empty() || path.back() != '/') {
+            path.push_back('/');
+        }
+        path.append(name);
+        return path;
+    }
+
+    /**
+     * @brief Read the entries of a directory
+     *
+     * The type comes from d_type where the filesystem reports it; symbolic
+     * links are indexed as what they point to, but never descended into.
+     *
+     * @param path directory
+     * @param found receives the entries
+     **/
+    void read_directory(const std::string& path, std::vector<FoundEntry>& found) {
+        found.clear();
+        DIR* handle = ::opendir(path.c_str());
+        if (handle == nullptr) {
+            return;
+        }
+        int const DIR_FD = ::dirfd(handle);
+        while (const dirent* entry = ::readdir(handle)) {
+            std::string_view const NAME = entry->d_name;
+            if (NAME == "." || NAME == "..") {
+                continue;
+            }
+            FoundEntry item {std::string(NAME), entry->d_type == DT_DIR, entry->d_type == DT_DIR};
+            if (entry->d_type == DT_UNKNOWN || entry->d_type == DT_LNK) {
+                struct stat entry_stat {};
+                if (::fstatat(DIR_FD, entry->d_name, &entry_stat, AT_SYMLINK_NOFOLLOW) == 0) {
+                    item.descend = S_ISDIR(entry_stat.st_mode);
+                    item.directory = item.descend
+                        || (S_ISLNK(entry_stat.st_mode)
+                            && ::fstatat(DIR_FD, entry->d_name, &entry_stat, 0) == 0
+                            && S_ISDIR(entry_stat.st_mode));
+                }
+            }
+            found.push_back(std::move(item));
+        }
+        ::closedir(handle);
+    }
+}    // namespace
+
+/**
+ * @brief Construct a new SearchIndex::SearchIndex object
+ *
+ * @param watcher inotify watcher
+ **/
+SearchIndex::SearchIndex(InotifyWatcher& watcher)
+    : m_WATCHER(watcher) {
+    m_ENTRIES.push_back(Entry {{}, ROOT_ID, 0, true, true});
+}
+
+/**
+ * @brief Destroy the SearchIndex::SearchIndex object
+ *
+ **/
+SearchIndex::~SearchIndex() {
+    stop();
+}
+
+/**
+ * @brief Start the background index
+ *
+ * @param root normalized root
+ * @param threads walking threads, 0 for the default
+ **/
+void SearchIndex::start(const std::string& root, std::size_t threads) {
+    if (!m_WATCHER.is_enabled() || m_THREAD.joinable()) {
+        return;
+    }
+    m_ROOT = root;
+    m_THREADS = threads != 0
+        ? threads
+        : std::clamp<std::size_t>(std::thread::hardware_concurrency(), 1, MAX_WALK_THREADS);
+    m_REBUILD = true;
+    m_THREAD = std::thread([this] { run(); });
+}
+
+/**
+ * @brief Stop the background index
+ *
+ **/
+void SearchIndex::stop() {
+    {
+        std::lock_guard<std::mutex> const LOCK(m_QUEUE_MUTEX);
+        m_STOP = true;
+    }
+    m_QUEUE_CV.notify_all();
+    if (m_THREAD.joinable()) {
+        m_THREAD.join();
+    }
+}
+
+/**
+ * @brief Get the number of entries
+ *
+ * @return std::size_t entries
+ **/
+auto SearchIndex::size() const -> std::size_t {
+    std::shared_lock<std::shared_mutex> const LOCK(m_MUTEX);
+    return m_ENTRIES.size();
+}
+
+/**
+ * @brief Find paths below a directory
+ *
+ * @param query search text
+ * @param scope directory relative to the root
+ * @param page requested page
+ * @param hits receives the hits
+ * @param next_cursor receives the cursor of the next page
+ * @return SearchStatus status
+ **/
+auto SearchIndex::search(std::string_view query,
+                         std::string_view scope,
+                         const ListingPage& page,
+                         std::vector<SearchHit>& hits,
+                         std::string& next_cursor) const -> SearchStatus {
+    hits.clear();
+    next_cursor.clear();
+    if (!m_READY) {
+        return SearchStatus::NOT_READY;
+    }
+
+    // The root itself is never a hit
+    std::uint32_t first = ROOT_ID + 1;
+    if (page.cursor) {
+        std::uint32_t last = 0;
+        auto const [END, ERROR] =
+            std::from_chars(page.cursor->data(), page.cursor->data() + page.cursor->size(), last);
+        if (ERROR != std::errc() || END != page.cursor->data() + page.cursor->size() || last == NO_ID) {
+            return SearchStatus::BAD_CURSOR;
+        }
+        first = std::max(first, last + 1);
+    }
+
+    bool const GLOB = query.find_first_of("*?[") != std::string_view::npos;
+    bool const PATH = query.find('/') != std::string_view::npos;
+    std::string const PATTERN(query);
+    std::string const FOLDED = fold_text(query);
+
+    // Paths are not indexed, only names narrow the candidates
+    std::vector<std::uint32_t> grams;
+    if (!PATH) {
+        if (GLOB) {
+            append_glob_trigrams(grams, FOLDED);
+        } else {
+            append_trigrams(grams, FOLDED);
+        }
+        std::sort(grams.begin(), grams.end());
+        grams.erase(std::unique(grams.begin(), grams.end()), grams.end());
+    }
+
+    std::shared_lock<std::shared_mutex> const LOCK(m_MUTEX);
+    std::uint32_t const SCOPE = find_directory(scope);
+    if (SCOPE == NO_ID) {
+        return SearchStatus::OK;
+    }
+
+    std::vector<const std::vector<std::uint32_t>*> lists;
+    for (std::uint32_t const GRAM : grams) {
+        auto const IT = m_POSTINGS.find(GRAM);
+        if (IT == m_POSTINGS.end()) {
+            return SearchStatus::OK;
+        }
+        lists.push_back(&IT->second);
+    }
+    std::sort(lists.begin(), lists.end(), [](const auto* a, const auto* b) { return a->size() < b->size(); });
+
+    std::string path;
+    auto matches = [&](std::uint32_t id) -> bool
+    {
+        if (!is_visible(id, SCOPE)) {
+            return false;
+        }
+        const Entry& entry = m_ENTRIES[id];
+        if (!PATH) {
+            return GLOB ? ::fnmatch(PATTERN.c_str(), entry.name.c_str(), FNM_CASEFOLD) == 0
+                        : contains_folded(entry.name, FOLDED);
+        }
+        path.clear();
+        append_path(path, id, SCOPE);
+        return GLOB ? ::fnmatch(PATTERN.c_str(), path.c_str(), FNM_CASEFOLD) == 0
+                    : contains_folded(path, FOLDED);
+    };
+
+    // Returns false once the page is full and one more hit proved there is a next page
+    std::size_t skip = page.offset;
+    std::uint32_t last_hit = NO_ID;
+    auto visit = [&](std::uint32_t id) -> bool
+    {
+        if (!matches(id)) {
+            return true;
+        }
+        if (skip > 0) {
+            --skip;
+            return true;
+        }
+        if (hits.size() == page.limit) {
+            next_cursor = std::to_string(last_hit);
+            return false;
+        }
+        SearchHit hit;
+        append_path(hit.path, id, ROOT_ID);
+        hit.directory = m_ENTRIES[id].directory;
+        hits.push_back(std::move(hit));
+        last_hit = id;
+        return true;
+    };
+
+    if (lists.empty()) {
+        for (std::uint32_t id = first; id < m_ENTRIES.size() && visit(id); ++id) {
+        }
+        return SearchStatus::OK;
+    }
+
+    // Every list is ascending, so each is only ever searched forward from where it was left
+    const std::vector<std::uint32_t>& smallest = *lists.front();
+    std::vector<std::vector<std::uint32_t>::const_iterator> positions;
+    for (std::size_t i = 1; i < lists.size(); ++i) {
+        positions.push_back(lists[i]->begin());
+    }
+    for (auto it = std::lower_bound(smallest.begin(), smallest.end(), first); it != smallest.end(); ++it) {
+        bool in_all = true;
+        for (std::size_t i = 0; i < positions.size(); ++i) {
+            const std::vector<std::uint32_t>& list = *lists[i + 1];
+            positions[i] = std::lower_bound(positions[i], list.end(), *it);
+            if (positions[i] == list.end()) {
+                return SearchStatus::OK;
+            }
+            if (*positions[i] != *it) {
+                in_all = false;
+                break;
+            }
+        }
+        if (in_all && !visit(*it)) {
+            break;
+        }
+    }
+    return SearchStatus::OK;
+}
+
+/**
+ * @brief Apply an inotify event
+ *
+ * @param dir watched directory
+ * @param name entry name
+ * @param mask inotify mask
+ **/
+void SearchIndex::on_event(const fs::path& dir, std::string_view name, std::uint32_t mask) {
+    if (!m_THREAD.joinable()) {
+        return;
+    }
+    if ((mask & InotifyWatcher::OVERFLOW_MASK) != 0) {
+        request(true);
+        return;
+    }
+    if (name.empty() || (mask & InotifyWatcher::SELF_GONE_MASK) != 0) {
+        return;
+    }
+
+    std::string const WATCHED = dir.string();
+    std::string const PREFIX = join_path(m_ROOT, "");
+    std::string_view relative;
+    if (WATCHED != m_ROOT) {
+        if (WATCHED.compare(0, PREFIX.size(), PREFIX) != 0) {
+            return;
+        }
+        relative = std::string_view(WATCHED).substr(PREFIX.size());
+    }
+
+    bool const IS_DIR = (mask & InotifyWatcher::ISDIR_MASK) != 0;
+    if ((mask & InotifyWatcher::CREATED_MASK) != 0) {
+        {
+            std::unique_lock<std::shared_mutex> const LOCK(m_MUTEX);
+            std::uint32_t const PARENT = find_directory(relative);
+            if (PARENT == NO_ID || insert(PARENT, name, IS_DIR) == NO_ID || !IS_DIR) {
+                return;
+            }
+        }
+        // A new directory may already have entries by the time it is watched, so it is walked
+        {
+            std::lock_guard<std::mutex> const LOCK(m_QUEUE_MUTEX);
+            m_PENDING.push_back(relative.empty() ? std::string(name)
+                                                 : join_path(std::string(relative), name));
+        }
+        m_QUEUE_CV.notify_one();
+    } else if ((mask & InotifyWatcher::REMOVED_MASK) != 0) {
+        bool compact_now = false;
+        {
+            std::unique_lock<std::shared_mutex> const LOCK(m_MUTEX);
+            std::uint32_t const PARENT = find_directory(relative);
+            auto const IT = PARENT == NO_ID ? m_CHILDREN.end() : m_CHILDREN.find(ChildKey {PARENT, name});
+            if (IT == m_CHILDREN.end() || !m_ENTRIES[IT->second].live) {
+                return;
+            }
+            m_ENTRIES[IT->second].live = false;
+            compact_now = ++m_REMOVED == std::max(MIN_COMPACT_REMOVED, m_ENTRIES.size() / 4);
+        }
+        if (compact_now) {
+            request(false);
+        }
+    }
+}
+
+/**
+ * @brief Indexing thread
+ *
+ **/
+void SearchIndex::run() {
+    std::unique_lock<std::mutex> lock(m_QUEUE_MUTEX);
+    while (true) {
+        m_QUEUE_CV.wait(lock, [this] { return m_STOP || m_REBUILD || m_COMPACT || !m_PENDING.empty(); });
+        if (m_STOP) {
+            return;
+        }
+        bool const REBUILD = std::exchange(m_REBUILD, false);
+        bool const COMPACT = std::exchange(m_COMPACT, false);
+        std::vector<std::string> pending = std::exchange(m_PENDING, {});
+        lock.unlock();
+
+        if (REBUILD) {
+            auto const START = std::chrono::steady_clock::now();
+            {
+                std::unique_lock<std::shared_mutex> const INDEX_LOCK(m_MUTEX);
+                m_ENTRIES[ROOT_ID].epoch = ++m_EPOCH;
+            }
+            walk({{ROOT_ID, m_ROOT}}, m_THREADS);
+            if (m_STOP) {
+                return;
+            }
+
+            // Entries the walk did not see, and events did not add meanwhile, are gone
+            std::size_t entries = 0;
+            {
+                std::unique_lock<std::shared_mutex> const INDEX_LOCK(m_MUTEX);
+                for (Entry& entry : m_ENTRIES) {
+                    if (entry.live && entry.epoch != m_EPOCH) {
+                        entry.live = false;
+                    }
+                }
+                compact();
+                entries = m_ENTRIES.size();
+            }
+            m_READY = true;
+            auto const ELAPSED = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - START);
+            log_info("Indexed %zu paths for search in %lld ms\n",
+                     entries,
+                     static_cast<long long>(ELAPSED.count()));
+        } else {
+            if (COMPACT) {
+                std::unique_lock<std::shared_mutex> const INDEX_LOCK(m_MUTEX);
+                compact();
+            }
+            std::vector<std::pair<std::uint32_t, std::string>> roots;
+            {
+                std::shared_lock<std::shared_mutex> const INDEX_LOCK(m_MUTEX);
+                for (const std::string& relative : pending) {
+                    std::uint32_t const ID = find_directory(relative);
+                    if (ID != NO_ID) {
+                        roots.emplace_back(ID, join_path(m_ROOT, relative));
+                    }
+                }
+            }
+            walk(std::move(roots), 1);
+        }
+
+        lock.lock();
+    }
+}
+
+/**
+ * @brief Walk trees into the index
+ *
+ * @param roots ids and paths of the directories
+ * @param threads walking threads
+ **/
+void SearchIndex::walk(std::vector<std::pair<std::uint32_t, std::string>> roots, std::size_t threads) {
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::size_t busy = 0;
+
+    auto work = [&]
+    {
+        std::vector<FoundEntry> found;
+        std::vector<std::pair<std::uint32_t, std::string>> subdirectories;
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            // Done once nothing is queued and no thread can queue more
+            changed.wait(lock, [&] { return m_STOP || !roots.empty() || busy == 0; });
+            if (m_STOP || roots.empty()) {
+                break;
+            }
+            auto [id, path] = std::move(roots.back());
+            roots.pop_back();
+            ++busy;
+            lock.unlock();
+
+            // Watched before reading: an entry created meanwhile is either read or reported
+            m_WATCHER.add_watch(path);
+            read_directory(path, found);
+            subdirectories.clear();
+            {
+                std::unique_lock<std::shared_mutex> const INDEX_LOCK(m_MUTEX);
+                for (const FoundEntry& entry : found) {
+                    std::uint32_t const CHILD = insert(id, entry.name, entry.directory);
+                    if (CHILD != NO_ID && entry.descend) {
+                        subdirectories.emplace_back(CHILD, join_path(path, entry.name));
+                    }
+                }
+            }
+
+            lock.lock();
+            --busy;
+            std::move(subdirectories.begin(), subdirectories.end(), std::back_inserter(roots));
+            changed.notify_all();
+        }
+        changed.notify_all();
+    };
+
+    std::vector<std::thread> helpers;
+    for (std::size_t i = 1; i < threads; ++i) {
+        helpers.emplace_back(work);
+    }
+    work();
+    for (auto& helper : helpers) {
+        helper.join();
+    }
+}
+
+/**
+ * @brief Add or refresh an entry
+ *
+ * @param parent parent directory
+ * @param name entry name
+ * @param directory whether it is a directory
+ * @return std::uint32_t id, NO_ID when full
+ **/
+auto SearchIndex::insert(std::uint32_t parent, std::string_view name, bool directory) -> std::uint32_t {
+    auto const IT = m_CHILDREN.find(ChildKey {parent, name});
+    if (IT != m_CHILDREN.end()) {
+        Entry& entry = m_ENTRIES[IT->second];
+        if (entry.live) {
+            entry.epoch = m_EPOCH;
+            entry.directory = directory;
+            return IT->second;
+        }
+        // A removed entry is never revived, the entries below it are gone too
+        m_CHILDREN.erase(IT);
+    }
+    if (m_ENTRIES.size() >= MAX_ENTRIES) {
+        log_once_warn("More than %zu paths below %s, the search index is incomplete\n",
+                      MAX_ENTRIES,
+                      m_ROOT.c_str());
+        return NO_ID;
+    }
+
+    auto const ID = static_cast<std::uint32_t>(m_ENTRIES.size());
+    m_ENTRIES.push_back(Entry {std::string(name), parent, m_EPOCH, directory, true});
+    m_CHILDREN.emplace(ChildKey {parent, m_ENTRIES.back().name}, ID);
+
+    std::vector<std::uint32_t> grams;
+    append_trigrams(grams, fold_text(name));
+    std::sort(grams.begin(), grams.end());
+    grams.erase(std::unique(grams.begin(), grams.end()), grams.end());
+    for (std::uint32_t const GRAM : grams) {
+        m_POSTINGS[GRAM].push_back(ID);
+    }
+    return ID;
+}
+
+/**
+ * @brief Find a directory by its relative path
+ *
+ * @param relative path relative to the root
+ * @return std::uint32_t id or NO_ID
+ **/
+auto SearchIndex::find_directory(std::string_view relative) const -> std::uint32_t {
+    std::uint32_t id = ROOT_ID;
+    while (!relative.empty()) {
+        std::size_t const SLASH = std::min(relative.find('/'), relative.size());
+        std::string_view const NAME = relative.substr(0, SLASH);
+        relative.remove_prefix(std::min(SLASH + 1, relative.size()));
+        if (NAME.empty() || NAME == ".") {
+            continue;
+        }
+        auto const IT = m_CHILDREN.find(ChildKey {id, NAME});
+        if (IT == m_CHILDREN.end() || !m_ENTRIES[IT->second].live || !m_ENTRIES[IT->second].directory) {
+            return NO_ID;
+        }
+        id = IT->second;
+    }
+    return id;
+}
+
+/**
+ * @brief Check an entry is live and below a directory
+ *
+ * @param id entry
+ * @param scope directory
+ * @return true if visible
+ **/
+auto SearchIndex::is_visible(std::uint32_t id, std::uint32_t scope) const -> bool {
+    bool below = scope == ROOT_ID;
+    for (std::uint32_t current = id;; current = m_ENTRIES[current].parent) {
+        if (!m_ENTRIES[current].live) {
+            return false;
+        }
+        below = below || (current == scope && current != id);
+        if (current == ROOT_ID) {
+            return below;
+        }
+    }
+}
+
+/**
+ * @brief Append the path of an entry
+ *
+ * @param out receives the path
+ * @param id entry
+ * @param base ancestor the path starts below
+ **/
+void SearchIndex::append_path(std::string& out, std::uint32_t id, std::uint32_t base) const {
+    std::size_t const START = out.size();
+    for (std::uint32_t current = id; current != base && current != ROOT_ID;
+         current = m_ENTRIES[current].parent)
+    {
+        if (out.size() > START) {
+            out += '/';
+        }
+        // Names are appended reversed and the whole path is turned around at the end
+        out.append(m_ENTRIES[current].name.rbegin(), m_ENTRIES[current].name.rend());
+    }
+    std::reverse(out.begin() + static_cast<std::ptrdiff_t>(START), out.end());
+}
+
+/**
+ * @brief Drop removed entries from the lookup maps
+ *
+ **/
+void SearchIndex::compact() {
+    // Parents have smaller ids than their entries, so one pass settles every ancestry
+    std::vector<bool> visible(m_ENTRIES.size());
+    for (std::size_t id = 0; id < m_ENTRIES.size(); ++id) {
+        Entry& entry = m_ENTRIES[id];
+        visible[id] = entry.live && (id == ROOT_ID || visible[entry.parent]);
+        if (visible[id] || entry.name.empty()) {
+            continue;
+        }
+        auto const IT = m_CHILDREN.find(ChildKey {entry.parent, entry.name});
+        if (IT != m_CHILDREN.end() && IT->second == id) {
+            m_CHILDREN.erase(IT);
+        }
+        entry.live = false;
+        std::string().swap(entry.name);
+    }
+
+    for (auto it = m_POSTINGS.begin(); it != m_POSTINGS.end();) {
+        std::erase_if(it->second, [&visible](std::uint32_t id) { return !visible[id]; });
+        it = it->second.empty() ? m_POSTINGS.erase(it) : std::next(it);
+    }
+    m_REMOVED = 0;
+}
+
+/**
+ * @brief Wake the indexing thread
+ *
+ * @param rebuild walk the whole tree again
+ **/
+void SearchIndex::request(bool rebuild) {
+    {
+        std::lock_guard<std::mutex> const LOCK(m_QUEUE_MUTEX);
+        (rebuild ? m_REBUILD : m_COMPACT) = true;
+    }
+    m_QUEUE_CV.notify_one();
+}
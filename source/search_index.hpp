@@ -0,0 +1,275 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include "http_utils.hpp"
+#include "inotify_watcher.hpp"
+
+namespace fs = boost::filesystem;
+
+/**
+ * @brief One path found by a search
+ *
+ **/
+struct SearchHit {
+    std::string path;    // relative to the served root, '/' separated
+    bool directory = false;
+};
+
+/**
+ * @brief Outcome of a search
+ *
+ **/
+enum class SearchStatus : std::uint8_t
+{
+    OK,
+    NOT_READY,    // the first index of the tree is still being built
+    BAD_CURSOR    // the cursor was not produced by this index
+};
+
+class SearchIndex {
+    /**
+     * @brief SearchIndex - every path below the served root, searchable by name
+     *
+     * The tree is held as entries (a name and the id of the parent
+     * directory) numbered in the order they were found, with a trigram
+     * index over the lowercased names: the posting list of a trigram holds
+     * the ids of every name containing it, in ascending order. A query
+     * intersects the lists of its trigrams, smallest first, and checks only
+     * the surviving candidates. Ids are never reused, so a cursor naming
+     * the last id of a page stays valid while paths come and go.
+     *
+     * The first index is built by a parallel walk of the tree. Every walked
+     * directory is watched, and inotify events then add and remove entries
+     * as they happen. A removed directory only loses its own entry: entries
+     * below it are recognised as gone through their ancestry, and dropped
+     * for good when the index is compacted. After an inotify overflow the
+     * tree is walked again into the same index, and entries the walk did
+     * not see are removed afterwards.
+     *
+     * Symbolic links are indexed but not followed.
+     **/
+
+  public:
+    /**
+     * @brief Most entries the index holds; larger trees are indexed in part
+     *
+     **/
+    static constexpr std::size_t MAX_ENTRIES = std::size_t {1} << 24;
+
+    /**
+     * @brief Construct a new Search Index object
+     *
+     * Events must be forwarded to on_event() by the owner of the watcher.
+     *
+     * @param watcher watcher used to observe indexed directories
+     **/
+    explicit SearchIndex(InotifyWatcher& watcher);
+
+    ~SearchIndex();
+
+    SearchIndex(const SearchIndex&) = delete;
+    auto operator=(const SearchIndex&) -> SearchIndex& = delete;
+
+    /**
+     * @brief Start indexing a tree in the background
+     *
+     * Does nothing when inotify is unavailable, as the index could not be
+     * kept current; is_enabled() then returns false.
+     *
+     * @param root normalized root of the served tree
+     * @param threads threads of the initial walk (0 means one per hardware thread, at most 8)
+     **/
+    void start(const std::string& root, std::size_t threads);
+
+    /**
+     * @brief Stop the indexing thread
+     *
+     **/
+    void stop();
+
+    /**
+     * @brief Check whether the index was started
+     *
+     * @return true if searches are answered
+     **/
+    auto is_enabled() const -> bool { return m_THREAD.joinable(); }
+
+    /**
+     * @brief Get the number of entries of the index, removed ones included until compaction
+     *
+     * @return std::size_t entries
+     **/
+    auto size() const -> std::size_t;
+
+    /**
+     * @brief Find paths below a directory
+     *
+     * A query without '/' is matched against entry names, one with '/'
+     * against the path relative to @p scope. A query containing '*', '?'
+     * or '[' is a glob pattern (fnmatch(3), '*' also matching '/') which
+     * must match the whole name or path; any other query is a substring.
+     * Both ignore ASCII case. Hits come in index order.
+     *
+     * @param query search text
+     * @param scope directory relative to the root, "" for the root
+     * @param page offset, limit and cursor of the requested page
+     * @param hits receives the hits of the page
+     * @param next_cursor receives the cursor of the next page, empty on the last page
+     * @return SearchStatus OK, or why there are no hits
+     **/
+    auto search(std::string_view query,
+                std::string_view scope,
+                const ListingPage& page,
+                std::vector<SearchHit>& hits,
+                std::string& next_cursor) const -> SearchStatus;
+
+    /**
+     * @brief Apply an inotify event
+     *
+     * @param dir watched directory
+     * @param name entry name
+     * @param mask inotify mask
+     **/
+    void on_event(const fs::path& dir, std::string_view name, std::uint32_t mask);
+
+  private:
+    /**
+     * @brief Id of the root directory
+     *
+     **/
+    static constexpr std::uint32_t ROOT_ID = 0;
+
+    /**
+     * @brief Id standing for "no such entry"
+     *
+     **/
+    static constexpr std::uint32_t NO_ID = 0xFFFFFFFF;
+
+    /**
+     * @brief A file or directory of the tree
+     *
+     **/
+    struct Entry {
+        std::string name;
+        std::uint32_t parent = ROOT_ID;
+        std::uint32_t epoch = 0;    // walk which last saw the entry
+        bool directory = false;
+        bool live = true;
+    };
+
+    /**
+     * @brief Key of an entry by its parent and name; the name views the entry's own string
+     *
+     **/
+    struct ChildKey {
+        std::uint32_t parent;
+        std::string_view name;
+
+        auto operator==(const ChildKey& other) const -> bool = default;
+    };
+
+    struct ChildHash {
+        auto operator()(const ChildKey& key) const -> std::size_t {
+            return std::hash<std::string_view> {}(key.name) * 31 + key.parent;
+        }
+    };
+
+    /**
+     * @brief Indexing thread: walks of new directories and rebuilds
+     *
+     **/
+    void run();
+
+    /**
+     * @brief Walk directory trees into the index
+     *
+     * @param roots ids and paths of the directories to walk
+     * @param threads walking threads
+     **/
+    void walk(std::vector<std::pair<std::uint32_t, std::string>> roots, std::size_t threads);
+
+    /**
+     * @brief Add an entry, or mark an existing one as seen; the caller holds the lock
+     *
+     * @param parent id of the parent directory
+     * @param name entry name
+     * @param directory whether the entry is a directory
+     * @return std::uint32_t id of the entry, NO_ID when the index is full
+     **/
+    auto insert(std::uint32_t parent, std::string_view name, bool directory) -> std::uint32_t;
+
+    /**
+     * @brief Find the id of a directory; the caller holds the lock
+     *
+     * @param relative path relative to the root, "" for the root
+     * @return std::uint32_t id of a live directory, NO_ID if unknown
+     **/
+    auto find_directory(std::string_view relative) const -> std::uint32_t;
+
+    /**
+     * @brief Check an entry and its ancestors are present; the caller holds the lock
+     *
+     * @param id entry
+     * @param scope directory the entry must lie below
+     * @return true if the entry is live and below @p scope
+     **/
+    auto is_visible(std::uint32_t id, std::uint32_t scope) const -> bool;
+
+    /**
+     * @brief Append the path of an entry relative to a directory; the caller holds the lock
+     *
+     * @param out receives the path
+     * @param id entry
+     * @param base ancestor directory the path starts below
+     **/
+    void append_path(std::string& out, std::uint32_t id, std::uint32_t base) const;
+
+    /**
+     * @brief Drop removed entries from the lookup maps; the caller holds the lock
+     *
+     **/
+    void compact();
+
+    /**
+     * @brief Wake the indexing thread for a rebuild or a compaction
+     *
+     * @param rebuild walk the whole tree again rather than only compact
+     **/
+    void request(bool rebuild);
+
+    InotifyWatcher& m_WATCHER;
+    std::string m_ROOT;
+    std::size_t m_THREADS = 0;
+
+    mutable std::shared_mutex m_MUTEX;
+    std::deque<Entry> m_ENTRIES;
+    std::unordered_map<ChildKey, std::uint32_t, ChildHash> m_CHILDREN;
+    std::unordered_map<std::uint32_t, std::vector<std::uint32_t>> m_POSTINGS;
+    std::uint32_t m_EPOCH = 0;
+    std::size_t m_REMOVED = 0;
+    std::atomic<bool> m_READY {false};
+
+    std::mutex m_QUEUE_MUTEX;
+    std::condition_variable m_QUEUE_CV;
+    std::vector<std::string> m_PENDING;
+    bool m_REBUILD = false;
+    bool m_COMPACT = false;
+    std::atomic<bool> m_STOP {false};
+    std::thread m_THREAD;
+};
@@ -1,20 +1,46 @@
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <charconv>
+#include <csignal>
 #include <cstddef>
 #include <cstdint>
+#include <cstring>
 #include <ctime>
 #include <exception>
-#include <fstream>
+#include <functional>
 #include <iostream>
+#include <memory>
+#include <optional>
+#include <random>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <utility>
 #include <vector>
 
 #include "server.hpp"
 
+#include <boost/algorithm/string/case_conv.hpp>
 #include <boost/algorithm/string/predicate.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/strand.hpp>
 #include <boost/beast/core.hpp>
-#include <boost/range/algorithm/sort.hpp>
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
 
+#ifdef HTTPFILESERVER_HAVE_NUMA
+#    include <numa.h>
+#endif
+
+#include "archive.hpp"
+#include "digest.hpp"
 #include "logger.hpp"
+#include "session.hpp"
 #include "tracelogger.hpp"
 
 /**
@@ -23,40 +49,10 @@
  **/
 namespace {
     /**
-     * @brief Get the file type style object
-     *
-     * @param path
-     * @return std::string
-     **/
-    auto get_file_type_style(const fs::path& path) -> std::string {
-        if (fs::is_directory(path)) {
-            return "font-weight: bold; color: #2196F3;";
-        }
-        if (path.extension() == ".mp4" || path.extension() == ".mp3" || path.extension() == ".jpg"
-            || path.extension() == ".jpeg" || path.extension() == ".png" || path.extension() == ".gif"
-            || path.extension() == ".avi" || path.extension() == ".mov" || path.extension() == ".wav")
-        {
-            return "color: #9C27B0;";
-        }
-        if (path.extension() == ".exe" || path.extension() == ".bat" || path.extension() == ".msi"
-            || path.extension() == ".sh")
-        {
-            return "color: #FF9800;";
-        } else if (path.extension() == ".zip" || path.extension() == ".tar" || path.extension() == ".gz"
-                   || path.extension() == ".rar" || path.extension() == ".7z")
-        {
-            return "color: #4CAF50;";
-        }
-        return "color: #FFFFFF;";
-    }
-
-    /**
-     * @brief Construct CSS Styles
+     * @brief CSS of the listing pages
      *
-     * @return std::string
      **/
-    auto construct_css_styles() -> std::string {
-        std::string const STYLES = R"(
+    constexpr std::string_view LISTING_STYLES = R"(
 <style>
     * {
         box-sizing: border-box;
@@ -117,328 +113,2722 @@ namespace {
         color: #AAAAAA;
     }
     .name-col {
-        width: 25%;
+        width: 20%;
     }
     .link-col {
-        width: 55%;
+        width: 35%;
     }
     .date-col {
-        width: 20%;
+        width: 15%;
+    }
+    .digest-col {
+        width: 30%;
+        font-family: monospace;
+        font-size: 11px;
+        word-break: break-all;
     }
 </style>
         )";
 
-        return STYLES;
-    }
-}    // namespace
-
-/**
- * @brief Construct a new SHServer::SHServer object
- *
- * @param root_path root path
- * @param port server port
- **/
-SHServer::SHServer(fs::path& root_path, std::uint16_t& port)
-    : m_ROOT_PATH(root_path)
-    , m_PORT(port) {
-    LOG_TRACE
-
-    run_server();
-}
+    /**
+     * @brief Length of an asctime() date without the trailing newline
+     *
+     **/
+    constexpr std::size_t TIME_LENGTH = 24;
 
-/**
- * @brief Generate file list
- *
- * @param current_path current path
- * @return std::string html page
- **/
-auto SHServer::generate_file_list(const fs::path& current_path) -> std::string {
-    LOG_TRACE
+    /**
+     * @brief Append a timestamp formatted the way asctime() does, without the trailing newline
+     *
+     * localtime_r is only called for the first timestamp of an hour: each
+     * thread keeps the formatted date of the last hour it saw and patches
+     * minutes and seconds in, so the dates of a listing cost a copy each.
+     * UTC offsets change on a whole local hour in practically every zone,
+     * which keeps the patched dates exact. Years outside 1000-9999, which do not
+     * fit the cached layout, are formatted in full.
+     *
+     * @param out string the date is appended to
+     * @param time timestamp
+     **/
+    void append_time(std::string& out, std::time_t time) {
+        struct HourCache {
+            std::time_t start = 0;
+            bool valid = false;
+            std::array<char, TIME_LENGTH> text {};
+        };
+        thread_local HourCache cache;
 
-    std::string const BASE_LINK = fs::relative(current_path, m_ROOT_PATH).string();
-    log_debug("Generate file list HTML page for: %s\n", BASE_LINK.c_str());
+        if (!cache.valid || time < cache.start || time >= cache.start + 3600) {
+            std::tm local_tm {};
+            localtime_r(&time, &local_tm);
+            char buffer[32];
+            asctime_r(&local_tm, buffer);
+            if (local_tm.tm_year + 1900 < 1000 || local_tm.tm_year + 1900 > 9999) {
+                out.append(buffer, std::strlen(buffer) - 1);
+                return;
+            }
+            std::copy_n(buffer, TIME_LENGTH, cache.text.begin());
+            cache.start = time - local_tm.tm_min * 60 - local_tm.tm_sec;
+            cache.valid = true;
+        }
 
-    std::string const STYLES = construct_css_styles();
+        // "Www Mmm dd hh:mm:ss yyyy": minutes at 14, seconds at 17
+        auto const OFFSET = static_cast<int>(time - cache.start);
+        std::array<char, TIME_LENGTH> text = cache.text;
+        text[14] = static_cast<char>('0' + OFFSET / 600);
+        text[15] = static_cast<char>('0' + OFFSET / 60 % 10);
+        text[17] = static_cast<char>('0' + OFFSET % 60 / 10);
+        text[18] = static_cast<char>('0' + OFFSET % 10);
+        out.append(text.data(), text.size());
+    }
 
-    std::string html = "<html>" + STYLES + "<body><h1>Files in: " + BASE_LINK + "</h1><br><hr><br>";
+    /**
+     * @brief Format a timestamp the way asctime() does, without the trailing newline
+     *
+     * @param time timestamp
+     * @return std::string formatted date
+     **/
+    auto format_time(std::time_t time) -> std::string {
+        std::string date_str;
+        date_str.reserve(TIME_LENGTH);
+        append_time(date_str, time);
+        return date_str;
+    }
 
-    if (current_path != m_ROOT_PATH) {
-        fs::path const PARENT_PATH = current_path.parent_path();
-        std::string const PARENT_LINK = fs::relative(PARENT_PATH, m_ROOT_PATH).string();
-        html += "<a class='parent' href=\"" + PARENT_LINK + "\">Back to Parent Directory</a><br><br>";
+    /**
+     * @brief Append a number in decimal
+     *
+     * @param out target string
+     * @param value number
+     **/
+    template<typename Integer>
+    void append_decimal(std::string& out, Integer value) {
+        char buffer[24];
+        auto const [ptr, ec] = std::to_chars(buffer, buffer + sizeof(buffer), value);
+        out.append(buffer, ptr);
     }
 
-    std::vector<std::pair<fs::path, std::time_t>> entries;
+    /**
+     * @brief Kinds of files the listing colours differently
+     *
+     **/
+    enum class FileCategory : std::uint8_t
+    {
+        OTHER,
+        MEDIA,
+        EXECUTABLE,
+        ARCHIVE
+    };
 
-    size_t dir_count = 0;
-    size_t file_count = 0;
+    /**
+     * @brief An extension with a colour of its own
+     *
+     **/
+    struct ExtensionCategory {
+        std::string_view extension;
+        FileCategory category = FileCategory::OTHER;
+    };
 
-    for (const auto& entry : fs::directory_iterator(current_path)) {
-        entries.emplace_back(entry.path(), fs::last_write_time(entry));
-        if (fs::is_directory(entry)) {
-            dir_count++;
-        } else {
-            file_count++;
-        }
-    }
-
-    boost::range::sort(entries,
-                       [](const auto& a, const auto& b)
-                       {
-                           if (fs::is_directory(a.first) && !fs::is_directory(b.first)) {
-                               return true;
-                           }
-                           if (!fs::is_directory(a.first) && fs::is_directory(b.first)) {
-                               return false;
-                           }
-                           return a.first.filename() < b.first.filename();
-                       });
-
-    html += "<h2>Summary Information</h2>";
-    html += "<p>Total Directories: " + std::to_string(dir_count) + "</p>";
-    html += "<p>Total Files: " + std::to_string(file_count) + "</p>";
-    html += "<hr>";
-
-    std::time_t const CURRENT_TIME = std::time(nullptr);
-    std::string current_time_str = std::asctime(std::localtime(&CURRENT_TIME));
-    current_time_str.erase(current_time_str.length() - 1);
-    html += "<p>Current Server Time: " + current_time_str + "</p>";
-    html += "<hr>";
-
-    html +=
-        "<table><tr><th>N</th><th class='name-col'>NAME</th><th class='link-col'>LINK</th><th "
-        "class='date-col'>DATE</th></tr>";
-
-    int index = 1;
-    for (const auto& entry : entries) {
-        std::string const NAME = entry.first.filename().string();
-        std::string const LINK = fs::relative(entry.first, m_ROOT_PATH).string();
-        std::time_t const MOD_TIME = entry.second;
-        std::string date_str = std::asctime(std::localtime(&MOD_TIME));
-        date_str.erase(date_str.length() - 1);
-
-        html += "<tr>";
-        html += "<td>" + std::to_string(index++) + "</td>";
-        html += "<td class='name-col' style='" + get_file_type_style(entry.first) + "'>" + NAME
-            + (fs::is_directory(entry.first) ? "/" : "") + "</td>";
-        html += "<td class='link-col'><a href=\"" + LINK + "\">" + NAME + "</a></td>";
-        html += "<td class='date-col'>" + date_str + "</td>";
-        html += "</tr>";
-    }
-
-    html += "</table><br><hr><br>";
-    html +=
-        "<p class='footer'>For more, visit <a href='https://github.com/alexeev-prog/http-fileserver-cpp'>the "
-        "repository</a>. &copy; 2025 Alexeev Bronislaw</p>";
-    html += "</body></html>";
+    constexpr std::array<ExtensionCategory, 18> EXTENSION_CATEGORIES = {{
+        {".mp4", FileCategory::MEDIA},
+        {".mp3", FileCategory::MEDIA},
+        {".jpg", FileCategory::MEDIA},
+        {".jpeg", FileCategory::MEDIA},
+        {".png", FileCategory::MEDIA},
+        {".gif", FileCategory::MEDIA},
+        {".avi", FileCategory::MEDIA},
+        {".mov", FileCategory::MEDIA},
+        {".wav", FileCategory::MEDIA},
+        {".exe", FileCategory::EXECUTABLE},
+        {".bat", FileCategory::EXECUTABLE},
+        {".msi", FileCategory::EXECUTABLE},
+        {".sh", FileCategory::EXECUTABLE},
+        {".zip", FileCategory::ARCHIVE},
+        {".tar", FileCategory::ARCHIVE},
+        {".gz", FileCategory::ARCHIVE},
+        {".rar", FileCategory::ARCHIVE},
+        {".7z", FileCategory::ARCHIVE},
+    }};
 
-    return html;
-}
+    /**
+     * @brief Slots of the extension table, a power of two
+     *
+     **/
+    constexpr std::size_t EXTENSION_SLOTS = 64;
 
-/**
- * @brief Process the HTTP request by routing it to the appropriate handler.
- *
- * This function coordinates the handling of HTTP requests and sends corresponding responses based on the type
- * of request.
- *
- * @param root_path The root directory where files are served from.
- * @param req The HTTP request object.
- * @param res The HTTP response object.
- * @param socket The TCP socket for communication.
- */
-void SHServer::handle_request(const fs::path& root_path,
-                              http::request<http::string_body>& req,
-                              http::response<http::string_body>& res,
-                              tcp::socket& socket) {
-    LOG_TRACE
+    /**
+     * @brief Longest extension in EXTENSION_CATEGORIES
+     *
+     **/
+    constexpr std::size_t MAX_EXTENSION_LENGTH = 5;
 
-    std::string const target = std::string(req.target());
-    log_info("Handle request for target: %s\n", target.c_str());
+    /**
+     * @brief Seeded FNV-1a hash of an extension, reduced to a table slot
+     *
+     * @param extension extension with its dot
+     * @param seed hash seed
+     * @return std::size_t slot
+     **/
+    constexpr auto extension_slot(std::string_view extension, std::uint32_t seed) -> std::size_t {
+        std::uint32_t hash = seed;
+        for (char const CHARACTER : extension) {
+            hash = (hash ^ static_cast<unsigned char>(CHARACTER)) * 16777619U;
+        }
+        return (hash >> 16) & (EXTENSION_SLOTS - 1);
+    }
 
-    if (target.empty() || target == "/") {
-        SHServer::handle_root_request(root_path, res);
-    } else {
-        fs::path const file_path = sanitize_target(root_path, target);
-        if (fs::is_directory(file_path)) {
-            handle_directory_request(file_path, res);
-        } else if (!fs::exists(file_path) || !fs::is_regular_file(file_path)) {
-            handle_not_found(file_path, res);
-        } else {
-            handle_file_request(file_path, res, socket);
+    /**
+     * @brief Find the first seed which maps every known extension to its own slot
+     *
+     * @return std::uint32_t seed of a perfect hash
+     **/
+    constexpr auto find_extension_seed() -> std::uint32_t {
+        for (std::uint32_t seed = 2166136261U;; ++seed) {
+            std::array<bool, EXTENSION_SLOTS> used {};
+            bool collision = false;
+            for (const ExtensionCategory& entry : EXTENSION_CATEGORIES) {
+                std::size_t const SLOT = extension_slot(entry.extension, seed);
+                collision = collision || used[SLOT];
+                used[SLOT] = true;
+            }
+            if (!collision) {
+                return seed;
+            }
         }
     }
-}
 
-/**
- * @brief Handle requests for the root directory.
- *
- * @param root_path The root directory.
- * @param res The HTTP response object.
- */
-void SHServer::handle_root_request(const fs::path& root_path, http::response<http::string_body>& res) {
-    res.result(http::status::ok);
-    res.body() = generate_file_list(root_path);
-    res.set(http::field::content_type, "text/html");
-}
+    constexpr std::uint32_t EXTENSION_SEED = find_extension_seed();
 
-/**
- * @brief Sanitize the target path for secure access.
- *
- * @param root_path The root directory.
- * @param target The target path from the request.
- * @return The sanitized file path.
- */
-auto SHServer::sanitize_target(const fs::path& root_path, const std::string& target) -> fs::path {
-    std::string const sanitized_target = target.substr(1);    // Remove leading '/'
-    return root_path / sanitized_target;
-}
+    /**
+     * @brief Perfect hash table of EXTENSION_CATEGORIES, built at compile time
+     *
+     **/
+    constexpr auto EXTENSION_TABLE = []
+    {
+        std::array<ExtensionCategory, EXTENSION_SLOTS> table {};
+        for (const ExtensionCategory& entry : EXTENSION_CATEGORIES) {
+            table[extension_slot(entry.extension, EXTENSION_SEED)] = entry;
+        }
+        return table;
+    }();
 
-/**
- * @brief Handle requests for a directory.
- *
- * @param file_path The path to the directory.
- * @param res The HTTP response object.
- */
-void SHServer::handle_directory_request(const fs::path& file_path, http::response<http::string_body>& res) {
-    res.result(http::status::ok);
-    res.body() = generate_file_list(file_path);
-    res.set(http::field::content_type, "text/html");
-}
+    /**
+     * @brief Classify a file by the extension of its name
+     *
+     * One hash and at most one comparison; extensions are case-sensitive.
+     *
+     * @param name file name
+     * @return FileCategory category
+     **/
+    constexpr auto categorize_file(std::string_view name) -> FileCategory {
+        std::size_t const DOT = name.rfind('.');
+        if (DOT == std::string_view::npos || name.size() - DOT > MAX_EXTENSION_LENGTH) {
+            return FileCategory::OTHER;
+        }
+        std::string_view const EXTENSION = name.substr(DOT);
+        const ExtensionCategory& slot = EXTENSION_TABLE[extension_slot(EXTENSION, EXTENSION_SEED)];
+        return slot.extension == EXTENSION ? slot.category : FileCategory::OTHER;
+    }
 
-/**
- * @brief Handle requests for non-existing files.
- *
- * @param file_path The path that does not exist.
- * @param res The HTTP response object.
- */
-void SHServer::handle_not_found(const fs::path& file_path, http::response<http::string_body>& res) {
-    log_debug("File path %s does not exist\n", file_path.c_str());
-    res.result(http::status::not_found);
-    res.body() = "File not found";
-}
+    static_assert(categorize_file("movie.mp4") == FileCategory::MEDIA);
+    static_assert(categorize_file("setup.sh") == FileCategory::EXECUTABLE);
+    static_assert(categorize_file("backup.tar.gz") == FileCategory::ARCHIVE);
+    static_assert(categorize_file("notes.txt") == FileCategory::OTHER);
 
-/**
- * @brief Handle requests for regular files.
- *
- * @param file_path The path to the file.
- * @param res The HTTP response object.
- * @param socket The TCP socket for communication.
- */
-void SHServer::handle_file_request(const fs::path& file_path,
-                                   http::response<http::string_body>& res,
-                                   tcp::socket& socket) {
-    log_debug("Attempting to open file: %s\n", file_path.c_str());
+    /**
+     * @brief Convert a Beast string view into a std::string_view
+     *
+     * @param value Beast string view (header value)
+     * @return std::string_view the same characters
+     **/
+    auto to_string_view(beast::string_view value) -> std::string_view {
+        return {value.data(), value.size()};
+    }
 
-    std::ifstream file(file_path.string(), std::ios::binary);
-    if (!file) {
-        log_debug("Failed to open file: %s\n", file_path.c_str());
-        res.result(http::status::internal_server_error);
-        res.body() = "Failed to open file";
-        return;
+    /**
+     * @brief Convert a std::string_view into a Beast string view
+     *
+     * @param value characters
+     * @return beast::string_view the same characters
+     **/
+    auto to_beast_view(std::string_view value) -> beast::string_view {
+        return {value.data(), value.size()};
     }
 
-    configure_response_for_file(file_path, res);
-    send_file_content(file, res, socket);
-}
+    /**
+     * @brief Generate a multipart boundary
+     *
+     * @return std::string random boundary, unlikely to occur in any file
+     **/
+    auto make_boundary() -> std::string {
+        thread_local std::mt19937_64 generator {std::random_device {}()};
 
-/**
+        static constexpr char HEX_DIGITS[] = "0123456789abcdef";
+        std::string boundary = "SHServer-";
+        for (int i = 0; i < 2; ++i) {
+            std::uint64_t value = generator();
+            for (int digit = 0; digit < 16; ++digit) {
+                boundary += HEX_DIGITS[value & 0xF];
+                value >>= 4;
+            }
+        }
+        return boundary;
+    }
 
- * @brief Configure the HTTP response for a file download.
- *
- * @param file_path The path of the file being requested.
- * @param res The HTTP response object.
- */
-void SHServer::configure_response_for_file(const fs::path& file_path,
-                                           http::response<http::string_body>& res) {
-    res.result(http::status::ok);
-    res.set(http::field::content_type, "application/octet-stream");
-    res.set(http::field::content_disposition,
-            "attachment; filename=\"" + file_path.filename().string() + "\"");
-}
+    /**
+     * @brief Check an If-Range precondition
+     *
+     * A Range header is only honoured when If-Range is absent or still
+     * matches the current representation. Entity tags are compared strongly,
+     * so a weak tag never matches.
+     *
+     * @param if_range value of the If-Range header
+     * @param etag current entity tag of the file
+     * @param mtime modification time of the file
+     * @return true if the ranges may be served
+     **/
+    auto if_range_matches(std::string_view if_range, std::string_view etag, std::time_t mtime) -> bool {
+        if (if_range.empty()) {
+            return true;
+        }
+        if (if_range.front() == '"' || if_range.substr(0, 2) == "W/") {
+            return if_range == etag;
+        }
+        auto const DATE = parse_http_date(if_range);
+        return DATE && *DATE == mtime;
+    }
 
-/**
- * @brief Send the content of the file in chunks through the socket.
- *
- * @param file The input file stream.
- * @param res The HTTP response object.
- * @param socket The TCP socket for communication.
- */
-void SHServer::send_file_content(std::ifstream& file,
-                                 http::response<http::string_body>& res,
-                                 tcp::socket& socket) {
-    constexpr size_t buffer_size = 8192;
-    char buffer[buffer_size];
-    log_debug("Open buffer (%zu) for file transfer\n", buffer_size);
+    /**
+     * @brief A directory entry as shown in a listing
+     *
+     **/
+    struct ListingEntry {
+        std::string name;
+        std::time_t mtime;
+        bool is_dir;
+        std::uint64_t size = 0;
+        std::uint64_t inode = 0;
+        std::int64_t mtime_ns = 0;
+        std::optional<Sha256Digest> digest = std::nullopt;
+        bool is_link = false;
+    };
 
-    try {
-        while (file) {
-            file.read(buffer, buffer_size);
-            std::streamsize const bytes_read = file.gcount();
+    /**
+     * @brief Take the metadata of an entry from its stat(2) result
+     *
+     * @param entry entry
+     * @param entry_stat result of stat
+     **/
+    void apply_stat(ListingEntry& entry, const struct stat& entry_stat) {
+        entry.mtime = entry_stat.st_mtime;
+        entry.is_dir = S_ISDIR(entry_stat.st_mode);
+        entry.size = static_cast<std::uint64_t>(entry_stat.st_size);
+        entry.inode = static_cast<std::uint64_t>(entry_stat.st_ino);
+        entry.mtime_ns = static_cast<std::int64_t>(entry_stat.st_mtim.tv_sec) * 1000000000
+            + entry_stat.st_mtim.tv_nsec;
+    }
 
-            if (bytes_read > 0) {
-                res.body() = std::string(buffer, buffer + bytes_read);
-                http::write(socket, res);
-            }
+    /**
+     * @brief Order of a listing: directories first, then by name
+     *
+     * @param a entry
+     * @param b entry
+     * @return true if a is listed before b
+     **/
+    auto listing_before(const ListingEntry& a, const ListingEntry& b) -> bool {
+        if (a.is_dir != b.is_dir) {
+            return a.is_dir;
         }
-    } catch (const std::exception& e) {
-        log_error("Error reading or sending file: %s\n", e.what());
-        res.result(http::status::internal_server_error);
-        res.body() = "Error reading or sending file: " + std::string(e.what());
+        return a.name < b.name;
     }
-}
 
-/**
- * @brief Run HTTP Server
- *
- **/
-void SHServer::run_server() {
-    LOG_TRACE
+    /**
+     * @brief Accumulates the validators of a directory listing
+     *
+     * The listing shows every entry's name, type, date and digest, and its
+     * JSON records also the size and the exact mtime, so the tag folds those into
+     * an FNV-1a hash together with the directory's own inode. It is weak
+     * because the rendered page also carries the current server time.
+     * Last-Modified is the newest of the directory and its entries.
+     **/
+    struct ListingValidator {
+        static constexpr std::uint64_t FNV_OFFSET = 14695981039346656037ULL;
+        static constexpr std::uint64_t FNV_PRIME = 1099511628211ULL;
 
-    try {
-        net::io_context ioc;
+        std::uint64_t hash = FNV_OFFSET;
+        std::time_t last_modified = 0;
 
-        tcp::acceptor acceptor(ioc, {tcp::v4(), m_PORT});
-        std::cout << "Localhost Server started at port " << m_PORT << "\n";
+        void fold(const void* data, std::size_t size) {
+            const auto* bytes = static_cast<const unsigned char*>(data);
+            for (std::size_t i = 0; i < size; ++i) {
+                hash = (hash ^ bytes[i]) * FNV_PRIME;
+            }
+        }
 
-        log_info("HTTP Fileserver started at 127.0.0.1:%d\n", m_PORT);
+        void add(const ListingEntry& entry) {
+            fold(entry.name.c_str(), entry.name.size() + 1);
+            fold(&entry.mtime, sizeof(entry.mtime));
+            fold(&entry.is_dir, sizeof(entry.is_dir));
+            fold(&entry.size, sizeof(entry.size));
+            fold(&entry.mtime_ns, sizeof(entry.mtime_ns));
+            if (entry.digest) {
+                fold(entry.digest->data(), entry.digest->size());
+            }
+            last_modified = std::max(last_modified, entry.mtime);
+        }
 
-        while (true) {
-            tcp::socket socket(ioc);
+        auto etag(std::uint64_t inode, std::size_t entry_count) const -> std::string {
+            return make_etag(inode, entry_count, static_cast<std::int64_t>(hash), true);
+        }
+    };
 
-            acceptor.accept(socket);
+    /**
+     * @brief The entries of a directory with their totals
+     *
+     **/
+    struct DirectoryScan {
+        std::vector<ListingEntry> entries;
+        std::size_t dir_count = 0;
+        std::size_t file_count = 0;
+        struct stat dir_stat {};
+    };
 
-            beast::flat_buffer buffer;
-            http::request<http::string_body> req;
-            http::response<http::string_body> res;
+    /**
+     * @brief Read the entries of a directory
+     *
+     * The type of an entry comes from d_type where the filesystem reports
+     * it, so without @p with_stat only symlinks and entries of unknown type
+     * cost a stat(2). With @p with_stat every entry is stat'ed exactly once.
+     * Entries which cannot be stat'ed are listed as empty files dated 0.
+     *
+     * @param dir directory
+     * @param with_stat whether modification times and sizes are needed
+     * @return DirectoryScan entries in directory order
+     **/
+    auto scan_directory(const fs::path& dir, bool with_stat) -> DirectoryScan {
+        DirectoryScan scan;
+        DIR* handle = ::opendir(dir.c_str());
+        if (handle == nullptr) {
+            log_error("Cannot open directory %s: %s\n", dir.c_str(), std::strerror(errno));
+            return scan;
+        }
+        int const DIR_FD = ::dirfd(handle);
+        ::fstat(DIR_FD, &scan.dir_stat);
 
-            try {
-                http::read(socket, buffer, req);
-            } catch (const boost::system::system_error& e) {
-                if (e.code() == boost::beast::http::error::end_of_stream) {
-                    log_error("Client disconnected: %s\n", e.what());
-                    std::cerr << "Client disconnected: " << e.what() << "\n";
-                    continue;
-                }
-                std::cerr << "Error: " << e.what() << "\n";
-                log_error("Error: %s\n", e.what());
+        while (const dirent* entry = ::readdir(handle)) {
+            std::string_view const NAME = entry->d_name;
+            if (NAME == "." || NAME == "..") {
                 continue;
             }
-
-            handle_request(m_ROOT_PATH, req, res, socket);
-
-            try {
-                http::write(socket, res);
-            } catch (const boost::system::system_error& e) {
-                if (e.code() == boost::asio::error::broken_pipe) {
-                    log_error("Client disconnected: %s", e.what());
-                    std::cerr << "Client disconnected: " << e.what() << "\n";
+            ListingEntry item {std::string(NAME), 0, entry->d_type == DT_DIR};
+            item.is_link = entry->d_type == DT_LNK;
+            if (entry->d_type == DT_UNKNOWN) {
+                struct stat link_stat {};
+                item.is_link = ::fstatat(DIR_FD, entry->d_name, &link_stat, AT_SYMLINK_NOFOLLOW) == 0
+                    && S_ISLNK(link_stat.st_mode);
+            }
+            if (with_stat || entry->d_type == DT_UNKNOWN || entry->d_type == DT_LNK) {
+                struct stat entry_stat {};
+                if (::fstatat(DIR_FD, entry->d_name, &entry_stat, 0) == 0) {
+                    apply_stat(item, entry_stat);
                 } else {
-                    log_error("Error: %s\n", e.what());
-                    std::cerr << "Error: " << e.what() << "\n";
+                    item.is_dir = false;
                 }
             }
+            if (item.is_dir) {
+                scan.dir_count++;
+            } else {
+                scan.file_count++;
+            }
+            scan.entries.push_back(std::move(item));
+        }
+        ::closedir(handle);
+        return scan;
+    }
+
+    /**
+     * @brief Look up the digest of a stat'ed file entry
+     *
+     * @param digests digest index
+     * @param dir_key normalized directory of the entry
+     * @param entry entry, its digest is set when known
+     **/
+    void lookup_digest(DigestIndex& digests, const std::string& dir_key, ListingEntry& entry) {
+        if (entry.is_dir || entry.inode == 0) {
+            return;
+        }
+        entry.digest = digests.lookup(dir_key + "/" + entry.name, entry.size, entry.mtime_ns, entry.inode);
+    }
+
+    /**
+     * @brief Look up the digests of the file entries of a scan with stat
+     *
+     * @param digests digest index
+     * @param dir directory
+     * @param scan entries
+     **/
+    void attach_digests(DigestIndex& digests, const fs::path& dir, DirectoryScan& scan) {
+        if (!digests.is_enabled()) {
+            return;
+        }
+        std::string const DIR_KEY = normalize_path(dir);
+        for (ListingEntry& entry : scan.entries) {
+            lookup_digest(digests, DIR_KEY, entry);
         }
-    } catch (std::exception const& e) {
-        std::cerr << "Error: " << e.what() << "\n";
     }
+
+    /**
+     * @brief Header row of the listing table
+     *
+     **/
+    constexpr std::string_view LISTING_TABLE_HEAD =
+        "<table><tr><th>N</th><th class='name-col'>NAME</th><th class='link-col'>LINK</th><th "
+        "class='date-col'>DATE</th><th class='digest-col'>SHA-256</th></tr>";
+
+    /**
+     * @brief End of a listing page after the table
+     *
+     **/
+    constexpr std::string_view LISTING_FOOTER =
+        "<br><hr><br><p class='footer'>For more, visit <a "
+        "href='https://github.com/alexeev-prog/http-fileserver-cpp'>the repository</a>. &copy; 2025 Alexeev "
+        "Bronislaw</p></body></html>";
+
+    /**
+     * @brief Get the prefix of the links of a directory's entries
+     *
+     * @param dir directory
+     * @param root served root
+     * @return std::string path of the directory relative to the root with a trailing slash, "" for the root
+     **/
+    auto listing_link_prefix(const fs::path& dir, const fs::path& root) -> std::string {
+        if (dir == root) {
+            return {};
+        }
+        return fs::relative(dir, root).string() + "/";
+    }
+
+    /**
+     * @brief Append a path relative to the root as an absolute link target
+     *
+     * @param out body
+     * @param path path relative to the root, '/' separated
+     **/
+    void append_path_link(std::string& out, std::string_view path) {
+        while (!path.empty()) {
+            std::size_t const SLASH = std::min(path.find('/'), path.size());
+            out += '/';
+            append_percent_encoded(out, path.substr(0, SLASH));
+            path.remove_prefix(std::min(SLASH + 1, path.size()));
+        }
+    }
+
+    /**
+     * @brief Get the link target of a directory, the prefix of its entries' links
+     *
+     * @param dir directory
+     * @param root served root
+     * @return std::string absolute, percent-encoded path of the directory with a trailing slash
+     **/
+    auto listing_href_prefix(const fs::path& dir, const fs::path& root) -> std::string {
+        std::string href;
+        append_path_link(href, listing_link_prefix(dir, root));
+        href += '/';
+        return href;
+    }
+
+    /**
+     * @brief Append a listing page up to the server time
+     *
+     * @param html page
+     * @param dir directory
+     * @param root served root
+     * @param scan entries of the directory
+     **/
+    void append_listing_head(std::string& html,
+                             const fs::path& dir,
+                             const fs::path& root,
+                             const DirectoryScan& scan) {
+        std::string const BASE_LINK = fs::relative(dir, root).string();
+        log_debug("Generate file list HTML page for: %s\n", BASE_LINK.c_str());
+
+        html += "<html>";
+        html += LISTING_STYLES;
+        html += "<body><h1>Files in: ";
+        append_html_escaped(html, BASE_LINK);
+        html += "</h1><br><hr><br>";
+
+        if (dir != root) {
+            html += "<a class='parent' href=\"";
+            html += listing_href_prefix(dir.parent_path(), root);
+            html += "\">Back to Parent Directory</a><br><br>";
+        }
+
+        html += "<h2>Summary Information</h2><p>Total Directories: ";
+        append_decimal(html, scan.dir_count);
+        html += "</p><p>Total Files: ";
+        append_decimal(html, scan.file_count);
+        html += "</p><hr><p>Current Server Time: ";
+    }
+
+    /**
+     * @brief Static fragments of a listing row, around the values of an entry
+     *
+     **/
+    constexpr std::string_view ROW_OPEN = "<tr><td>";
+    constexpr std::string_view ROW_STYLE = "</td><td class='name-col' style='";
+    constexpr std::string_view ROW_NAME = "'>";
+    constexpr std::string_view ROW_LINK = "</td><td class='link-col'><a href=\"";
+    constexpr std::string_view ROW_LINK_TEXT = "\">";
+    constexpr std::string_view ROW_DATE = "</a></td><td class='date-col'>";
+    constexpr std::string_view ROW_DIGEST = "</td><td class='digest-col'>";
+    constexpr std::string_view ROW_CLOSE = "</td></tr>";
+
+    /**
+     * @brief Bytes of a row besides the name and the link prefix, an upper bound
+     *
+     **/
+    constexpr std::size_t ROW_OVERHEAD = ROW_OPEN.size() + ROW_STYLE.size() + ROW_NAME.size()
+        + ROW_LINK.size() + ROW_LINK_TEXT.size() + ROW_DATE.size() + ROW_DIGEST.size() + ROW_CLOSE.size()
+        + 64 /* style */ + 20 /* row number */ + 1 /* slash */ + TIME_LENGTH + 64 /* digest */;
+
+    /**
+     * @brief Append one table row of a listing
+     *
+     * Only appends to @p html: with enough capacity reserved a row costs no
+     * allocation.
+     *
+     * @param html page
+     * @param index row number shown in the first column
+     * @param entry entry
+     * @param link_prefix prefix of the entry links, see listing_href_prefix()
+     **/
+    void append_listing_row(std::string& html,
+                            std::size_t index,
+                            const ListingEntry& entry,
+                            std::string_view link_prefix) {
+        html += ROW_OPEN;
+        append_decimal(html, index);
+        html += ROW_STYLE;
+        html += get_file_type_style(entry.name, entry.is_dir);
+        html += ROW_NAME;
+        append_html_escaped(html, entry.name);
+        if (entry.is_dir) {
+            html += '/';
+        }
+        html += ROW_LINK;
+        html += link_prefix;
+        append_percent_encoded(html, entry.name);
+        html += ROW_LINK_TEXT;
+        append_html_escaped(html, entry.name);
+        html += ROW_DATE;
+        append_time(html, entry.mtime);
+        html += ROW_DIGEST;
+        if (entry.digest) {
+            append_hex(html, digest_bytes(*entry.digest));
+        }
+        html += ROW_CLOSE;
+    }
+
+    /**
+     * @brief Append a run of table rows, reserving their size once
+     *
+     * @param html page
+     * @param entries sorted entries
+     * @param first index of the first row
+     * @param last index past the last row
+     * @param row_base row number of the entry before @p first
+     * @param link_prefix prefix of the entry links
+     **/
+    void append_listing_rows(std::string& html,
+                             const std::vector<ListingEntry>& entries,
+                             std::size_t first,
+                             std::size_t last,
+                             std::size_t row_base,
+                             std::string_view link_prefix) {
+        std::size_t size = html.size();
+        for (std::size_t i = first; i < last; ++i) {
+            size += ROW_OVERHEAD + link_prefix.size() + 3 * entries[i].name.size();
+        }
+        html.reserve(size);
+
+        for (std::size_t i = first; i < last; ++i) {
+            append_listing_row(html, row_base + i + 1, entries[i], link_prefix);
+        }
+    }
+
+    /**
+     * @brief Encode the position after an entry as a pagination cursor
+     *
+     * @param entry last entry of a page
+     * @return std::string cursor, "d" or "f" followed by the name
+     **/
+    auto make_listing_cursor(const ListingEntry& entry) -> std::string {
+        return (entry.is_dir ? "d" : "f") + entry.name;
+    }
+
+    /**
+     * @brief Decode a pagination cursor
+     *
+     * @param cursor cursor from the query string
+     * @return std::optional<ListingEntry> the entry the page follows, empty if malformed
+     **/
+    auto parse_listing_cursor(std::string_view cursor) -> std::optional<ListingEntry> {
+        if (cursor.size() < 2 || (cursor.front() != 'd' && cursor.front() != 'f')) {
+            return std::nullopt;
+        }
+        return ListingEntry {std::string(cursor.substr(1)), 0, cursor.front() == 'd'};
+    }
+
+    /**
+     * @brief Append the NDJSON record of an entry
+     *
+     * Files carry the same strong ETag a request for the file would get,
+     * and their SHA-256 once it is known.
+     *
+     * @param out records
+     * @param entry entry
+     * @param etag scratch string, reused across calls
+     **/
+    void append_listing_record(std::string& out, const ListingEntry& entry, std::string& etag) {
+        out += "{\"name\":";
+        append_json_string(out, entry.name);
+        if (entry.is_dir) {
+            out += ",\"type\":\"directory\",\"mtime\":";
+            append_decimal(out, static_cast<std::int64_t>(entry.mtime));
+        } else {
+            out += ",\"type\":\"file\",\"size\":";
+            append_decimal(out, entry.size);
+            out += ",\"mtime\":";
+            append_decimal(out, static_cast<std::int64_t>(entry.mtime));
+            out += ",\"etag\":";
+            etag.clear();
+            append_etag(etag, entry.inode, entry.size, entry.mtime_ns);
+            append_json_string(out, etag);
+            if (entry.digest) {
+                out += ",\"sha256\":\"";
+                append_hex(out, digest_bytes(*entry.digest));
+                out += '"';
+            }
+        }
+        out += "}\n";
+    }
+
+    /**
+     * @brief Sort the entries of a scan and start its listing
+     *
+     * Computes the validators, the head and the NDJSON records; the tail is
+     * left open at the first row of the table.
+     *
+     * @param dir directory
+     * @param root served root
+     * @param scan entries, sorted in place
+     * @return std::shared_ptr<DirectoryListing> listing without rows
+     **/
+    auto begin_listing(const fs::path& dir, const fs::path& root, DirectoryScan& scan)
+        -> std::shared_ptr<DirectoryListing> {
+        auto listing = std::make_shared<DirectoryListing>();
+
+        ListingValidator validator;
+        validator.last_modified = scan.dir_stat.st_mtime;
+        for (const ListingEntry& entry : scan.entries) {
+            validator.add(entry);
+        }
+        listing->etag = validator.etag(static_cast<std::uint64_t>(scan.dir_stat.st_ino), scan.entries.size());
+        listing->last_modified = validator.last_modified;
+
+        std::sort(scan.entries.begin(), scan.entries.end(), listing_before);
+
+        append_listing_head(listing->head, dir, root, scan);
+
+        std::string etag;
+        listing->records.reserve(scan.entries.size() * 128);
+        for (const ListingEntry& entry : scan.entries) {
+            append_listing_record(listing->records, entry, etag);
+            // Linked directories are listed but not walked into: a link to an ancestor would loop
+            if (entry.is_dir && !entry.is_link) {
+                listing->subdirectories.push_back(entry.name);
+            }
+        }
+        listing->records.shrink_to_fit();
+
+        listing->tail = "</p><hr>";
+        listing->tail += LISTING_TABLE_HEAD;
+        return listing;
+    }
+
+    /**
+     * @brief Render the rows and the end of a listing started by begin_listing()
+     *
+     * @param listing listing
+     * @param entries sorted entries
+     * @param link_prefix prefix of the entry links
+     **/
+    void finish_listing(DirectoryListing& listing,
+                        const std::vector<ListingEntry>& entries,
+                        std::string_view link_prefix) {
+        append_listing_rows(listing.tail, entries, 0, entries.size(), 0, link_prefix);
+        listing.tail += "</table>";
+        listing.tail += LISTING_FOOTER;
+        listing.tail.shrink_to_fit();
+    }
+
+    /**
+     * @brief A large listing rendered while it is sent
+     *
+     * Every piece carries ROWS_PER_CHUNK rows, so the first bytes leave
+     * after the scan and the sort instead of after the whole page is built.
+     * When the listing can be cached the rendered tail is kept and handed
+     * to the completion callback; otherwise rows are rendered straight into
+     * the caller's reusable buffer and nothing of the page is kept.
+     **/
+    class ListingStream : public BodyStream {
+      public:
+        /**
+         * @brief Table rows per piece
+         *
+         **/
+        static constexpr std::size_t ROWS_PER_CHUNK = 512;
+
+        using Completion = std::function<void(std::shared_ptr<const DirectoryListing>)>;
+
+        ListingStream(std::vector<ListingEntry> entries,
+                      std::string link_prefix,
+                      std::shared_ptr<DirectoryListing> listing,
+                      Completion on_complete)
+            : m_ENTRIES(std::move(entries))
+            , m_LINK_PREFIX(std::move(link_prefix))
+            , m_LISTING(std::move(listing))
+            , m_ON_COMPLETE(std::move(on_complete)) {}
+
+        auto next(std::string& out) -> bool override {
+            if (!m_STARTED) {
+                m_STARTED = true;
+                out += m_LISTING->head;
+                append_time(out, std::time(nullptr));
+                if (!m_ON_COMPLETE) {
+                    out += m_LISTING->tail;
+                    m_LISTING->tail.clear();
+                }
+            }
+
+            // Rows go straight into the caller's buffer unless the page is kept for the cache
+            std::string& target = m_ON_COMPLETE ? m_LISTING->tail : out;
+            std::size_t const END = std::min(m_NEXT + ROWS_PER_CHUNK, m_ENTRIES.size());
+            append_listing_rows(target, m_ENTRIES, m_NEXT, END, 0, m_LINK_PREFIX);
+            m_NEXT = END;
+            bool const DONE = m_NEXT == m_ENTRIES.size();
+            if (DONE) {
+                target += "</table>";
+                target += LISTING_FOOTER;
+            }
+
+            if (m_ON_COMPLETE) {
+                out.append(m_LISTING->tail, m_SENT, std::string::npos);
+                m_SENT = m_LISTING->tail.size();
+                if (DONE) {
+                    m_LISTING->tail.shrink_to_fit();
+                    std::exchange(m_ON_COMPLETE, nullptr)(std::move(m_LISTING));
+                }
+            }
+            return !DONE;
+        }
+
+      private:
+        std::vector<ListingEntry> m_ENTRIES;
+        std::string m_LINK_PREFIX;
+        std::shared_ptr<DirectoryListing> m_LISTING;
+        Completion m_ON_COMPLETE;
+        std::size_t m_NEXT = 0;
+        std::size_t m_SENT = 0;
+        bool m_STARTED = false;
+    };
+
+    /**
+     * @brief Append the records of one directory in a JSON listing format
+     *
+     * @param out body
+     * @param records NDJSON records of the directory
+     * @param dir path of the directory relative to the listed one
+     * @param recursive whether every record names its directory
+     * @param format JSON or NDJSON
+     * @param first true until the first element of a JSON array is written
+     **/
+    void append_records(std::string& out,
+                        std::string_view records,
+                        std::string_view dir,
+                        bool recursive,
+                        ListingFormat format,
+                        bool& first) {
+        if (format == ListingFormat::NDJSON && !recursive) {
+            out += records;
+            return;
+        }
+        while (!records.empty()) {
+            std::size_t const END = records.find('\n');
+            std::string_view const RECORD = records.substr(0, END);
+            records = END == std::string_view::npos ? std::string_view {} : records.substr(END + 1);
+
+            if (format == ListingFormat::JSON) {
+                out += first ? "[\n" : ",\n";
+                first = false;
+            }
+            if (recursive) {
+                out += "{\"dir\":";
+                append_json_string(out, dir);
+                out += ',';
+                out += RECORD.substr(1);
+            } else {
+                out += RECORD;
+            }
+            if (format == ListingFormat::NDJSON) {
+                out += '\n';
+            }
+        }
+    }
+
+    /**
+     * @brief Close a JSON array started by append_records()
+     *
+     * @param out body
+     * @param format JSON or NDJSON
+     * @param first whether no element was written
+     **/
+    void finish_records(std::string& out, ListingFormat format, bool first) {
+        if (format == ListingFormat::JSON) {
+            out += first ? "[]\n" : "\n]\n";
+        }
+    }
+
+    /**
+     * @brief The records of a directory tree, one directory per piece
+     *
+     * Walks the tree depth first in listing order. Every directory comes
+     * from the loader, so the walk shares the listing cache with the HTML
+     * pages and a repeated walk of an unchanged tree costs no syscalls.
+     **/
+    class RecordStream : public BodyStream {
+      public:
+        using Loader = std::function<std::shared_ptr<const DirectoryListing>(const fs::path&)>;
+
+        RecordStream(Loader load, const fs::path& dir, std::size_t max_depth, ListingFormat format)
+            : m_LOAD(std::move(load))
+            , m_MAX_DEPTH(max_depth)
+            , m_FORMAT(format) {
+            m_PENDING.push_back({dir, {}, 0});
+        }
+
+        auto next(std::string& out) -> bool override {
+            if (m_PENDING.empty()) {
+                finish_records(out, m_FORMAT, m_FIRST);
+                return false;
+            }
+            Pending const ITEM = std::move(m_PENDING.back());
+            m_PENDING.pop_back();
+
+            auto const LISTING = m_LOAD(ITEM.path);
+            append_records(out, LISTING->records, ITEM.relative, true, m_FORMAT, m_FIRST);
+
+            // Pushed in reverse, so subdirectories are visited in listing order
+            if (ITEM.depth < m_MAX_DEPTH) {
+                for (auto it = LISTING->subdirectories.rbegin(); it != LISTING->subdirectories.rend(); ++it) {
+                    std::string relative = ITEM.relative.empty() ? *it : ITEM.relative + "/" + *it;
+                    m_PENDING.push_back({ITEM.path / *it, std::move(relative), ITEM.depth + 1});
+                }
+            }
+
+            if (m_PENDING.empty()) {
+                finish_records(out, m_FORMAT, m_FIRST);
+                return false;
+            }
+            return true;
+        }
+
+      private:
+        struct Pending {
+            fs::path path;
+            std::string relative;
+            std::size_t depth;
+        };
+
+        Loader m_LOAD;
+        std::size_t m_MAX_DEPTH;
+        ListingFormat m_FORMAT;
+        std::vector<Pending> m_PENDING;
+        bool m_FIRST = true;
+    };
+
+    /**
+     * @brief The hits of a search, a run of rows or records per piece
+     *
+     * HTML hits are rendered as rows of a table between a prepared head
+     * and tail; JSON and NDJSON hits as records with their path and type.
+     **/
+    class SearchStream : public BodyStream {
+      public:
+        /**
+         * @brief Hits rendered per piece
+         *
+         **/
+        static constexpr std::size_t HITS_PER_CHUNK = 512;
+
+        SearchStream(std::vector<SearchHit> hits,
+                     ListingFormat format,
+                     std::size_t first_row,
+                     std::string head,
+                     std::string tail)
+            : m_HITS(std::move(hits))
+            , m_FORMAT(format)
+            , m_FIRST_ROW(first_row)
+            , m_HEAD(std::move(head))
+            , m_TAIL(std::move(tail)) {}
+
+        auto next(std::string& out) -> bool override {
+            out += std::exchange(m_HEAD, {});
+            std::size_t const END = std::min(m_NEXT + HITS_PER_CHUNK, m_HITS.size());
+            for (; m_NEXT < END; ++m_NEXT) {
+                const SearchHit& hit = m_HITS[m_NEXT];
+                if (m_FORMAT == ListingFormat::HTML) {
+                    append_row(out, m_FIRST_ROW + m_NEXT, hit);
+                    continue;
+                }
+                if (m_FORMAT == ListingFormat::JSON) {
+                    out += m_FIRST ? "[\n" : ",\n";
+                    m_FIRST = false;
+                }
+                out += "{\"path\":";
+                append_json_string(out, hit.path);
+                out += hit.directory ? ",\"type\":\"directory\"}" : ",\"type\":\"file\"}";
+                if (m_FORMAT == ListingFormat::NDJSON) {
+                    out += '\n';
+                }
+            }
+            if (m_NEXT < m_HITS.size()) {
+                return true;
+            }
+            if (m_FORMAT == ListingFormat::HTML) {
+                out += m_TAIL;
+            } else {
+                finish_records(out, m_FORMAT, m_FIRST);
+            }
+            return false;
+        }
+
+      private:
+        static void append_row(std::string& out, std::size_t index, const SearchHit& hit) {
+            std::string_view const NAME = std::string_view(hit.path).substr(hit.path.rfind('/') + 1);
+            out += "<tr><td>";
+            append_decimal(out, index);
+            out += "</td><td class='link-col' style='";
+            out += get_file_type_style(NAME, hit.directory);
+            out += "'><a href=\"";
+            append_path_link(out, hit.path);
+            out += "\">";
+            append_html_escaped(out, hit.path);
+            if (hit.directory) {
+                out += '/';
+            }
+            out += hit.directory ? "</a></td><td class='date-col'>directory</td></tr>"
+                                 : "</a></td><td class='date-col'>file</td></tr>";
+        }
+
+        std::vector<SearchHit> m_HITS;
+        ListingFormat m_FORMAT;
+        std::size_t m_FIRST_ROW;
+        std::string m_HEAD;
+        std::string m_TAIL;
+        std::size_t m_NEXT = 0;
+        bool m_FIRST = true;
+    };
+
+    /**
+     * @brief Attach validators to a response and answer 304 when they match
+     *
+     * @param req request with the conditional headers
+     * @param res response to populate
+     * @param etag current entity tag
+     * @param last_modified current modification time
+     * @return true if the response became 304 Not Modified
+     **/
+    auto answer_not_modified(const ArenaRequest& req,
+                             ArenaResponse& res,
+                             const std::string& etag,
+                             std::time_t last_modified) -> bool {
+        res.set(http::field::etag, etag);
+        res.set(http::field::last_modified, format_http_date(last_modified));
+
+        if (!is_not_modified(to_string_view(req[http::field::if_none_match]),
+                             to_string_view(req[http::field::if_modified_since]),
+                             etag,
+                             last_modified))
+        {
+            return false;
+        }
+
+        res.result(http::status::not_modified);
+        return true;
+    }
+
+    /**
+     * @brief Extensions of text formats worth compressing on the fly
+     *
+     **/
+    constexpr std::array<std::string_view, 26> COMPRESSIBLE_EXTENSIONS = {
+        ".txt", ".html", ".htm", ".css", ".js",  ".mjs", ".json", ".xml",  ".svg", ".md",  ".csv", ".tsv", ".log",
+        ".ini", ".yaml", ".yml", ".toml", ".c",  ".h",   ".cpp",  ".hpp", ".py",  ".sh",  ".map", ".rst", ".tex"};
+
+    /**
+     * @brief Check whether a file is a text format worth compressing
+     *
+     * @param file_path file path
+     * @return true if the extension is a known text format
+     **/
+    auto is_compressible(const fs::path& file_path) -> bool {
+        std::string const EXTENSION = boost::algorithm::to_lower_copy(file_path.extension().string());
+        return std::find(COMPRESSIBLE_EXTENSIONS.begin(), COMPRESSIBLE_EXTENSIONS.end(), EXTENSION)
+            != COMPRESSIBLE_EXTENSIONS.end();
+    }
+
+    /**
+     * @brief Check whether changes to a file are reported on its own directory
+     *
+     * inotify reports a write on the directory the bytes were written
+     * through: for a symbolic link that is the target's directory, for a
+     * file with several hard links possibly another one.
+     *
+     * @param file_path file path
+     * @return true if the path names a regular file with a single link
+     **/
+    auto is_watchable_file(const fs::path& file_path) -> bool {
+        struct stat file_stat {};
+        return ::lstat(file_path.c_str(), &file_stat) == 0 && S_ISREG(file_stat.st_mode)
+            && file_stat.st_nlink == 1;
+    }
+
+    /**
+     * @brief Resolve the worker thread count
+     *
+     * @param threads requested number of threads, 0 for one per hardware thread
+     * @return std::size_t number of threads to run
+     **/
+    auto resolve_thread_count(std::size_t threads) -> std::size_t {
+        if (threads != 0) {
+            return threads;
+        }
+        std::size_t const HW_THREADS = std::thread::hardware_concurrency();
+        return HW_THREADS == 0 ? 1 : HW_THREADS;
+    }
+
+    /**
+     * @brief SO_REUSEPORT socket option, which Asio does not name
+     *
+     **/
+    using reuse_port = net::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+
+    /**
+     * @brief List the CPUs the process may run on
+     *
+     * @return std::vector<int> CPU numbers, empty if the affinity is unknown
+     **/
+    auto allowed_cpus() -> std::vector<int> {
+        std::vector<int> cpus;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (::sched_getaffinity(0, sizeof(set), &set) != 0) {
+            return cpus;
+        }
+        for (std::size_t cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (CPU_ISSET(cpu, &set)) {
+                cpus.push_back(static_cast<int>(cpu));
+            }
+        }
+        return cpus;
+    }
+
+    /**
+     * @brief Pin the calling thread to a CPU and prefer memory of its NUMA node
+     *
+     * @param cpu CPU number
+     * @return true if the thread was pinned
+     **/
+    auto pin_current_thread(int cpu) -> bool {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(static_cast<std::size_t>(cpu), &set);
+        if (::pthread_setaffinity_np(::pthread_self(), sizeof(set), &set) != 0) {
+            return false;
+        }
+#ifdef HTTPFILESERVER_HAVE_NUMA
+        if (::numa_available() != -1) {
+            int const NODE = ::numa_node_of_cpu(cpu);
+            if (NODE >= 0) {
+                ::numa_set_preferred(NODE);
+            }
+        }
+#endif
+        return true;
+    }
+}    // namespace
+
+/**
+ * @brief Get the file type style object
+ *
+ * @param name entry name
+ * @param is_dir whether the entry is a directory
+ * @return std::string_view inline CSS of the entry
+ **/
+auto get_file_type_style(std::string_view name, bool is_dir) -> std::string_view {
+    if (is_dir) {
+        return "font-weight: bold; color: #2196F3;";
+    }
+    switch (categorize_file(name)) {
+        case FileCategory::MEDIA:
+            return "color: #9C27B0;";
+        case FileCategory::EXECUTABLE:
+            return "color: #FF9800;";
+        case FileCategory::ARCHIVE:
+            return "color: #4CAF50;";
+        default:
+            return "color: #FFFFFF;";
+    }
+}
+
+/**
+ * @brief Construct a new SHServer::SHServer object
+ *
+ * @param root_path root path
+ * @param port server port
+ * @param threads number of worker threads
+ **/
+SHServer::SHServer(fs::path& root_path, std::uint16_t& port, std::size_t threads)
+    : m_ROOT_PATH(root_path)
+    , m_PORT(port)
+    , m_DEFAULT_IOC(static_cast<int>(resolve_thread_count(threads)))
+    , m_THREADS(resolve_thread_count(threads))
+    , m_ACCEPTOR(m_DEFAULT_IOC)
+    , m_SIGNALS(m_DEFAULT_IOC)
+    , m_URING(m_DEFAULT_IOC)
+    , m_WATCHER(m_DEFAULT_IOC)
+    , m_LISTING_CACHE(m_WATCHER.is_enabled() ? DEFAULT_LISTING_CACHE_BYTES : 0)
+    , m_STAT_CACHE(DEFAULT_STAT_CACHE_TTL, DEFAULT_STAT_CACHE_ENTRIES)
+    , m_PATH_FILTER(m_WATCHER)
+    , m_SEARCH(m_WATCHER)
+    , m_FILE_CACHE(m_WATCHER.is_enabled() ? DEFAULT_FILE_CACHE_BYTES : 0, DEFAULT_FILE_CACHE_MAX_FILE)
+    , m_VARIANT_CACHE(DEFAULT_VARIANT_CACHE_BYTES) {
+    LOG_TRACE
+
+    m_WATCHER.subscribe(
+        [this](const fs::path& dir, std::string_view name, std::uint32_t mask)
+        {
+            m_PATH_FILTER.on_event(dir, name, mask);
+            m_DIGESTS.on_event(dir, name, mask);
+            m_SEARCH.on_event(dir, name, mask);
+
+            if ((mask & InotifyWatcher::OVERFLOW_MASK) != 0) {
+                m_LISTING_CACHE.clear();
+                m_STAT_CACHE.clear();
+                m_FILE_CACHE.clear();
+            } else if ((mask & InotifyWatcher::SELF_GONE_MASK) != 0) {
+                m_LISTING_CACHE.invalidate_tree(dir.string());
+                m_STAT_CACHE.clear();
+                m_FILE_CACHE.clear();
+            } else {
+                m_LISTING_CACHE.invalidate_changed(dir.string());
+                m_STAT_CACHE.invalidate(dir.string());
+                if (!name.empty()) {
+                    std::string const ENTRY = (dir / std::string(name)).string();
+                    m_STAT_CACHE.invalidate(ENTRY);
+                    m_FILE_CACHE.invalidate(ENTRY);
+                }
+            }
+        });
+}
+
+/**
+ * @brief Generate file list
+ *
+ * @param current_path current path
+ * @return std::string html page
+ **/
+auto SHServer::generate_file_list(const fs::path& current_path) -> std::string {
+    LOG_TRACE
+
+    return render_listing(*get_listing(current_path));
+}
+
+/**
+ * @brief Get a directory listing through the listing cache
+ *
+ * @param current_path directory
+ * @return std::shared_ptr<const DirectoryListing> listing
+ **/
+auto SHServer::get_listing(const fs::path& current_path) -> std::shared_ptr<const DirectoryListing> {
+    std::optional<std::uint64_t> epoch;
+    if (auto listing = lookup_listing(current_path, epoch)) {
+        return listing;
+    }
+
+    auto listing = build_listing(current_path);
+    if (epoch) {
+        m_LISTING_CACHE.insert(normalize_path(current_path), listing, *epoch);
+    }
+    return listing;
+}
+
+/**
+ * @brief Look a directory listing up in the listing cache
+ *
+ * @param current_path directory
+ * @param epoch set on a cacheable miss
+ * @return std::shared_ptr<const DirectoryListing> listing, nullptr on a miss
+ **/
+auto SHServer::lookup_listing(const fs::path& current_path, std::optional<std::uint64_t>& epoch)
+    -> std::shared_ptr<const DirectoryListing> {
+    epoch.reset();
+    if (!m_LISTING_CACHE.is_enabled()) {
+        return nullptr;
+    }
+
+    std::string const KEY = normalize_path(current_path);
+    auto listing = m_LISTING_CACHE.find(KEY);
+    m_METRICS.count_cache(CacheKind::LISTING, listing != nullptr);
+    if (listing) {
+        log_debug("Listing cache hit: %s\n", KEY.c_str());
+        return listing;
+    }
+
+    // Without a watch the entry could never be invalidated, so it is not cached
+    if (m_WATCHER.add_watch(KEY)) {
+        epoch = m_LISTING_CACHE.epoch(KEY);
+    }
+    return nullptr;
+}
+
+/**
+ * @brief Build a directory listing
+ *
+ * @param current_path directory
+ * @return std::shared_ptr<const DirectoryListing> listing
+ **/
+auto SHServer::build_listing(const fs::path& current_path) -> std::shared_ptr<const DirectoryListing> {
+    LOG_TRACE
+
+    // Every entry is stat'ed exactly once; the sort and the renderer reuse the result
+    DirectoryScan scan = scan_directory(current_path, true);
+    attach_digests(m_DIGESTS, current_path, scan);
+    auto listing = begin_listing(current_path, m_ROOT_PATH, scan);
+
+    finish_listing(*listing, scan.entries, listing_href_prefix(current_path, m_ROOT_PATH));
+    return listing;
+}
+
+/**
+ * @brief Render a listing page
+ *
+ * @param listing listing
+ * @return std::string html page
+ **/
+auto SHServer::render_listing(const DirectoryListing& listing) -> std::string {
+    std::string html;
+    html.reserve(listing.head.size() + TIME_LENGTH + listing.tail.size());
+    html += listing.head;
+    append_time(html, std::time(nullptr));
+    html += listing.tail;
+    return html;
+}
+
+/**
+ * @brief Process the HTTP request by routing it to the appropriate handler.
+ *
+ * This function coordinates the handling of HTTP requests and sends corresponding responses based on the type
+ * of request.
+ *
+ * @param root_path The root directory where files are served from.
+ * @param req The HTTP request object.
+ * @param res The HTTP response object.
+ * @param file The file body of the response.
+ * @return Route The handler which answered.
+ */
+auto SHServer::handle_request(const fs::path& root_path,
+                              ArenaRequest& req,
+                              ArenaResponse& res,
+                              FileTransfer& file) -> Route {
+    LOG_TRACE
+
+    std::string_view const target = to_string_view(req.target());
+    log_info("Handle request for target: %.*s\n", static_cast<int>(target.size()), target.data());
+
+    if (target == "/__metrics") {
+        res.result(http::status::ok);
+        res.set(http::field::content_type, "text/plain; version=0.0.4");
+        res.set(http::field::cache_control, "no-store");
+        m_METRICS.render(res.body());
+        return Route::INTERNAL;
+    }
+
+#ifdef HTTPFILESERVER_TRACING
+    // Recorded spans, for chrome://tracing or Perfetto
+    if (target == "/__trace") {
+        res.result(http::status::ok);
+        res.set(http::field::content_type, "application/json");
+        res.set(http::field::cache_control, "no-store");
+        TraceLogger::export_chrome_trace(res.body());
+        return Route::INTERNAL;
+    }
+#endif
+
+    auto const RESOLVE_START = std::chrono::steady_clock::now();
+    fs::path const file_path = sanitize_target(root_path, target);
+    if (file_path == root_path) {
+        m_METRICS.record_latency(Phase::RESOLVE, std::chrono::steady_clock::now() - RESOLVE_START);
+        SHServer::handle_root_request(req, root_path, res, file);
+        return Route::ROOT;
+    }
+
+    // A hot file is answered from memory before anything else looks at the filesystem
+    if (m_FILE_CACHE.is_enabled()) {
+        auto cached = m_FILE_CACHE.find(normalize_path(file_path));
+        m_METRICS.count_cache(CacheKind::HOT_FILE, cached != nullptr);
+        if (cached) {
+            m_METRICS.record_latency(Phase::RESOLVE, std::chrono::steady_clock::now() - RESOLVE_START);
+            handle_cached_file_request(req, file_path, std::move(cached), res, file);
+            return Route::STATIC_FILE;
+        }
+    }
+
+    // One cached lookup decides the dispatch; most 404s never reach stat(2)
+    FileKind const KIND = resolve_path(file_path).kind;
+    m_METRICS.record_latency(Phase::RESOLVE, std::chrono::steady_clock::now() - RESOLVE_START);
+    switch (KIND) {
+        case FileKind::DIRECTORY:
+            handle_directory_request(req, file_path, res, file);
+            return Route::DIRECTORY;
+        case FileKind::REGULAR:
+            handle_file_request(req, file_path, res, file);
+            return Route::STATIC_FILE;
+        default:
+            handle_not_found(file_path, res);
+            return Route::NOT_FOUND;
+    }
+}
+
+/**
+ * @brief Start a PUT or POST upload.
+ *
+ * @param req The request header.
+ * @param content_length The Content-Length of the body, if any.
+ * @param res The HTTP response, populated when the upload is refused.
+ * @return std::unique_ptr<Upload> The upload, or nullptr if refused.
+ */
+auto SHServer::begin_upload(const ArenaRequestHeader& req,
+                            std::optional<std::uint64_t> content_length,
+                            ArenaResponse& res) -> std::unique_ptr<Upload> {
+    LOG_TRACE
+
+    auto const REFUSE = [&res](http::status status, std::string_view reason) -> std::unique_ptr<Upload>
+    {
+        res.result(status);
+        res.body() = reason;
+        return nullptr;
+    };
+
+    if (m_UPLOAD_LIMIT == 0) {
+        res.set(http::field::allow, "GET, HEAD");
+        return REFUSE(http::status::method_not_allowed, "Uploads are disabled");
+    }
+    if (content_length && *content_length > m_UPLOAD_LIMIT) {
+        return REFUSE(http::status::payload_too_large, "The upload exceeds the size limit");
+    }
+
+    fs::path const PATH = sanitize_target(m_ROOT_PATH, to_string_view(req.target()));
+    if (PATH.empty()) {
+        return REFUSE(http::status::bad_request, "Invalid target");
+    }
+    struct stat target_stat {};
+    bool const IS_DIRECTORY = ::stat(PATH.c_str(), &target_stat) == 0 && S_ISDIR(target_stat.st_mode);
+
+    auto upload = std::make_unique<Upload>();
+    if (req.method() == http::verb::post) {
+        if (!IS_DIRECTORY) {
+            return REFUSE(http::status::not_found, "Forms are uploaded to an existing directory");
+        }
+        auto const BOUNDARY = parse_multipart_boundary(to_string_view(req[http::field::content_type]));
+        if (!BOUNDARY) {
+            return REFUSE(http::status::unsupported_media_type, "Forms must be multipart/form-data");
+        }
+        upload->open_form(PATH, *BOUNDARY);
+        return upload;
+    }
+
+    if (IS_DIRECTORY) {
+        res.set(http::field::allow, "GET, HEAD, POST");
+        return REFUSE(http::status::method_not_allowed, "The target is a directory");
+    }
+
+    // Content-Digest names the body; without a content coding Repr-Digest is the same
+    std::optional<Sha256Digest> expected;
+    for (auto const FIELD : {"Content-Digest", "Repr-Digest"}) {
+        if (!expected && req.count(FIELD) != 0) {
+            expected = parse_sha256_field(to_string_view(req[FIELD]));
+        }
+    }
+    if (req.count("X-Checksum-Sha256") != 0) {
+        expected = parse_sha256_hex(to_string_view(req["X-Checksum-Sha256"]));
+        if (!expected) {
+            return REFUSE(http::status::bad_request, "Malformed X-Checksum-Sha256");
+        }
+    }
+
+    // Missing parent directories are created, and become visible like the file itself
+    std::vector<fs::path> created;
+    boost::system::error_code ec;
+    for (fs::path dir = PATH.parent_path(); !fs::exists(dir, ec) && !ec; dir = dir.parent_path()) {
+        created.push_back(dir);
+    }
+    fs::create_directories(PATH.parent_path(), ec);
+    if (ec) {
+        log_debug("Cannot create the parents of %s: %s\n", PATH.c_str(), ec.message().c_str());
+        return ec == boost::system::errc::permission_denied
+            ? REFUSE(http::status::forbidden, "The target cannot be written")
+            : REFUSE(http::status::conflict, "A parent of the target is not a directory");
+    }
+    for (auto it = created.rbegin(); it != created.rend(); ++it) {
+        invalidate_created(*it);
+    }
+
+    if (!upload->open_file(PATH, content_length, expected)) {
+        return REFUSE(upload->status(), upload->reason());
+    }
+    return upload;
+}
+
+/**
+ * @brief Finish an upload, or answer its failure.
+ *
+ * @param upload The upload.
+ * @param req The request header.
+ * @param res The HTTP response.
+ */
+void SHServer::finish_upload(Upload& upload,
+                             const ArenaRequestHeader& req,
+                             ArenaResponse& res) {
+    LOG_TRACE
+
+    upload.commit();
+    // Files of a form stored before a later part failed stay in place
+    for (const UploadedFile& stored : upload.files()) {
+        invalidate_created(stored.path);
+        log_info("Stored upload %s (%llu bytes)\n",
+                 stored.path.c_str(),
+                 static_cast<unsigned long long>(stored.size));
+    }
+
+    if (upload.failed()) {
+        log_info("Upload to %s failed: %s\n", std::string(req.target()).c_str(), upload.reason().c_str());
+        res.result(upload.status());
+        res.body() = upload.reason();
+        return;
+    }
+
+    if (req.method() == http::verb::put) {
+        const UploadedFile& stored = upload.files().front();
+        res.result(stored.replaced ? http::status::no_content : http::status::created);
+        res.set(http::field::etag, make_etag(stored.inode, stored.size, stored.mtime_ns));
+        if (!stored.replaced) {
+            std::string_view const TARGET = to_string_view(req.target());
+            res.set(http::field::location, to_beast_view(TARGET.substr(0, TARGET.find('?'))));
+        }
+        return;
+    }
+
+    std::string& body = res.body();
+    body += '[';
+    for (const UploadedFile& stored : upload.files()) {
+        if (body.size() > 1) {
+            body += ',';
+        }
+        body += "{\"name\":";
+        append_json_string(body, stored.path.filename().native());
+        body += ",\"size\":";
+        append_decimal(body, stored.size);
+        body += ",\"etag\":";
+        append_json_string(body, make_etag(stored.inode, stored.size, stored.mtime_ns));
+        body += '}';
+    }
+    body += "]\n";
+    res.result(http::status::created);
+    res.set(http::field::content_type, "application/json");
+}
+
+/**
+ * @brief Make a created path visible to the caches.
+ *
+ * @param path The created or replaced path.
+ */
+void SHServer::invalidate_created(const fs::path& path) {
+    std::string const KEY = normalize_path(path);
+    std::string const PARENT = normalize_path(path.parent_path());
+    m_PATH_FILTER.insert(KEY);
+    m_STAT_CACHE.invalidate(KEY);
+    m_STAT_CACHE.invalidate(PARENT);
+    m_FILE_CACHE.invalidate(KEY);
+    m_LISTING_CACHE.invalidate(PARENT);
+}
+
+/**
+ * @brief Handle requests for the root directory.
+ *
+ * @param req The HTTP request object.
+ * @param root_path The root directory.
+ * @param res The HTTP response object.
+ * @param file The body of the response, a stream for large listings.
+ */
+void SHServer::handle_root_request(const ArenaRequest& req,
+                                   const fs::path& root_path,
+                                   ArenaResponse& res,
+                                   FileTransfer& file) {
+    handle_directory_request(req, root_path, res, file);
+}
+
+/**
+ * @brief Sanitize the target path for secure access.
+ *
+ * @param root_path The root directory.
+ * @param target The target path from the request.
+ * @return The sanitized file path.
+ */
+auto SHServer::sanitize_target(const fs::path& root_path, std::string_view target) -> fs::path {
+    auto const RELATIVE = normalize_target(target);
+    if (!RELATIVE) {
+        log_debug("Rejected target: %.*s\n", static_cast<int>(target.size()), target.data());
+        return {};
+    }
+    if (RELATIVE->empty()) {
+        return root_path;
+    }
+    return root_path / *RELATIVE;
+}
+
+/**
+ * @brief Resolve a path through the negative filter and the stat cache.
+ *
+ * @param path The path to resolve.
+ * @return FileInfo The type and metadata of the path.
+ */
+auto SHServer::resolve_path(const fs::path& path) -> FileInfo {
+    std::string const KEY = normalize_path(path);
+    if (m_PATH_FILTER.is_missing(KEY)) {
+        return {};
+    }
+    return m_STAT_CACHE.lookup(KEY);
+}
+
+/**
+ * @brief Handle requests for a directory.
+ *
+ * @param req The HTTP request object.
+ * @param file_path The path to the directory.
+ * @param res The HTTP response object.
+ * @param file The body of the response, a stream for large listings.
+ */
+void SHServer::handle_directory_request(const ArenaRequest& req,
+                                        const fs::path& file_path,
+                                        ArenaResponse& res,
+                                        FileTransfer& file) {
+    LOG_TRACE
+
+    auto const ARCHIVE = parse_archive_format(to_string_view(req.target()));
+    if (!ARCHIVE) {
+        res.result(http::status::bad_request);
+        res.body() = "Unsupported archive format";
+        return;
+    }
+    if (*ARCHIVE != ArchiveFormat::NONE) {
+        respond_with_archive(req, file_path, *ARCHIVE, res, file);
+        return;
+    }
+    if (auto const QUERY = query_parameter(to_string_view(req.target()), "search")) {
+        respond_with_search(req, file_path, *QUERY, res, file);
+        return;
+    }
+
+    respond_with_listing(req, file_path, res, file);
+}
+
+/**
+ * @brief Answer a request with an archive of a directory tree.
+ *
+ * @param req The HTTP request object.
+ * @param dir_path The path to the directory.
+ * @param format The archive format.
+ * @param res The HTTP response object.
+ * @param file The body of the response.
+ */
+void SHServer::respond_with_archive(const ArenaRequest& req,
+                                    const fs::path& dir_path,
+                                    ArchiveFormat format,
+                                    ArenaResponse& res,
+                                    FileTransfer& file) {
+    PhaseTimer const TIMER(m_METRICS, Phase::LISTING);
+
+    // The archive unpacks into one directory named like the one requested
+    std::string top = dir_path.filename().string();
+    if (top.empty() || top == "." || top == "/") {
+        top = "archive";
+    }
+
+    std::vector<ArchiveEntry> entries;
+    if (!scan_archive(dir_path, top, MAX_ARCHIVE_ENTRIES, entries)) {
+        log_warn("Refusing to archive %s: more than %zu entries\n", dir_path.c_str(), MAX_ARCHIVE_ENTRIES);
+        res.result(http::status::forbidden);
+        res.body() = "The directory has too many entries to archive";
+        return;
+    }
+
+    // Only a chunked body can carry a deflated zip, whose length is unknown up front
+    if (format == ArchiveFormat::ZIP_DEFLATE && (req.version() < 11 || req.method() == http::verb::head)) {
+        format = ArchiveFormat::ZIP;
+    }
+
+    bool const IS_TAR = format == ArchiveFormat::TAR;
+    std::string disposition;
+    append_content_disposition(disposition, Disposition::ATTACHMENT, top + (IS_TAR ? ".tar" : ".zip"));
+    res.set(http::field::content_type, IS_TAR ? "application/x-tar" : "application/zip");
+    res.set(http::field::content_disposition, disposition);
+
+    if (format == ArchiveFormat::ZIP_DEFLATE) {
+        res.result(http::status::ok);
+        file.attach_stream(std::make_shared<ZipDeflateStream>(dir_path, std::move(top), std::move(entries)));
+        return;
+    }
+
+    auto layout = std::make_shared<ArchiveLayout>(dir_path, std::move(top), std::move(entries), format);
+    std::string const ETAG = layout->etag();
+    std::time_t const LAST_MODIFIED = layout->last_modified();
+    if (answer_not_modified(req, res, ETAG, LAST_MODIFIED)) {
+        return;
+    }
+
+    res.result(http::status::ok);
+    res.set(http::field::accept_ranges, "bytes");
+    file.attach_source(std::move(layout), LAST_MODIFIED);
+    finish_file_response(req, dir_path, res, file, ETAG);
+}
+
+/**
+ * @brief Answer a request with the listing of a directory.
+ *
+ * @param req The HTTP request object.
+ * @param dir_path The path to the directory.
+ * @param res The HTTP response object.
+ * @param file The body of the response, a stream for large listings.
+ */
+void SHServer::respond_with_listing(const ArenaRequest& req,
+                                    const fs::path& dir_path,
+                                    ArenaResponse& res,
+                                    FileTransfer& file) {
+    PhaseTimer const TIMER(m_METRICS, Phase::LISTING);
+
+    ListingFormat const FORMAT =
+        parse_listing_format(to_string_view(req.target()), to_string_view(req[http::field::accept]));
+    if (FORMAT != ListingFormat::HTML) {
+        respond_with_listing_records(req, dir_path, FORMAT, res, file);
+        return;
+    }
+
+    if (auto const PAGE = parse_listing_page(to_string_view(req.target()))) {
+        respond_with_listing_page(req, dir_path, *PAGE, res);
+        return;
+    }
+
+    std::optional<std::uint64_t> epoch;
+    auto listing = lookup_listing(dir_path, epoch);
+    if (!listing) {
+        DirectoryScan scan = scan_directory(dir_path, true);
+        attach_digests(m_DIGESTS, dir_path, scan);
+        auto fresh = begin_listing(dir_path, m_ROOT_PATH, scan);
+        std::string const LINK_PREFIX = listing_href_prefix(dir_path, m_ROOT_PATH);
+
+        // A large listing goes out chunked while it renders; HTTP/1.0 and HEAD get the whole page
+        if (scan.entries.size() >= LISTING_STREAM_THRESHOLD && req.version() >= 11
+            && req.method() != http::verb::head)
+        {
+            if (answer_not_modified(req, res, fresh->etag, fresh->last_modified)) {
+                return;
+            }
+            ListingStream::Completion on_complete;
+            if (epoch) {
+                on_complete = [this, KEY = normalize_path(dir_path), EPOCH = *epoch](auto built)
+                { m_LISTING_CACHE.insert(KEY, std::move(built), EPOCH); };
+            }
+            res.result(http::status::ok);
+            res.set(http::field::content_type, "text/html");
+            res.set(http::field::vary, "Accept, Accept-Encoding");
+            file.attach_stream(std::make_shared<ListingStream>(
+                std::move(scan.entries), LINK_PREFIX, std::move(fresh), std::move(on_complete)));
+            return;
+        }
+
+        finish_listing(*fresh, scan.entries, LINK_PREFIX);
+        if (epoch) {
+            m_LISTING_CACHE.insert(normalize_path(dir_path), fresh, *epoch);
+        }
+        listing = std::move(fresh);
+    }
+
+    ContentCoding coding = ContentCoding::IDENTITY;
+    std::string_view const ACCEPT = to_string_view(req[http::field::accept_encoding]);
+    float best = 0.0F;
+    for (ContentCoding const CANDIDATE : {ContentCoding::GZIP, ContentCoding::DEFLATE}) {
+        float const QUALITY = encoding_quality(ACCEPT, coding_name(CANDIDATE));
+        if (QUALITY > best) {
+            best = QUALITY;
+            coding = CANDIDATE;
+        }
+    }
+
+    res.set(http::field::vary, "Accept, Accept-Encoding");
+
+    std::shared_ptr<const CompressedVariant> variant;
+    if (coding != ContentCoding::IDENTITY) {
+        std::string const KEY = VariantCache::make_key(normalize_path(dir_path), listing->etag, coding);
+        variant = m_VARIANT_CACHE.find(KEY);
+        m_METRICS.count_cache(CacheKind::VARIANT, variant != nullptr);
+        if (!variant) {
+            auto fresh = std::make_shared<CompressedVariant>();
+            fresh->coding = coding;
+            fresh->page = make_deflate_template(coding, listing->head, listing->tail);
+            m_VARIANT_CACHE.insert(KEY, fresh);
+            variant = std::move(fresh);
+        }
+        if (!variant->page) {
+            variant.reset();
+        }
+    }
+
+    std::string const ETAG =
+        variant ? make_variant_etag(listing->etag, coding_name(coding)) : listing->etag;
+    if (answer_not_modified(req, res, ETAG, listing->last_modified)) {
+        return;
+    }
+
+    res.result(http::status::ok);
+    res.set(http::field::content_type, "text/html");
+    if (variant) {
+        // Only the server time is new, it is spliced into the compressed page as a stored block
+        res.body() = render_deflate_template(*variant->page, format_time(std::time(nullptr)));
+        res.set(http::field::content_encoding, to_beast_view(coding_name(coding)));
+    } else {
+        res.body() = render_listing(*listing);
+    }
+}
+
+/**
+ * @brief Answer a request with one page of a directory listing.
+ *
+ * @param req The HTTP request object.
+ * @param dir_path The path to the directory.
+ * @param page The requested page.
+ * @param res The HTTP response object.
+ */
+void SHServer::respond_with_listing_page(const ArenaRequest& req,
+                                         const fs::path& dir_path,
+                                         const ListingPage& page,
+                                         ArenaResponse& res) {
+    LOG_TRACE
+
+    DirectoryScan scan = scan_directory(dir_path, false);
+    auto first = scan.entries.begin();
+    auto last = scan.entries.end();
+
+    // Entries up to the cursor are moved out of the way, only the rest competes for the page
+    if (auto const AFTER = page.cursor ? parse_listing_cursor(*page.cursor) : std::nullopt) {
+        last = std::partition(
+            first, last, [&](const ListingEntry& entry) { return listing_before(*AFTER, entry); });
+    }
+    auto const AVAILABLE = static_cast<std::size_t>(last - first);
+    std::size_t const SKIPPED = scan.entries.size() - AVAILABLE;
+    std::size_t const BEGIN = std::min(page.offset, AVAILABLE);
+    std::size_t const END = BEGIN + std::min(page.limit, AVAILABLE - BEGIN);
+
+    // Only the entries up to the end of the page are ordered, and only the page is stat'ed
+    std::partial_sort(first, first + static_cast<std::ptrdiff_t>(END), last, listing_before);
+
+    ListingValidator validator;
+    validator.last_modified = scan.dir_stat.st_mtime;
+    validator.fold(&scan.dir_stat.st_mtime, sizeof(scan.dir_stat.st_mtime));
+    std::string const DIR_KEY = m_DIGESTS.is_enabled() ? normalize_path(dir_path) : std::string {};
+    for (std::size_t i = BEGIN; i < END; ++i) {
+        ListingEntry& entry = scan.entries[i];
+        struct stat entry_stat {};
+        if (::stat((dir_path / entry.name).c_str(), &entry_stat) == 0) {
+            apply_stat(entry, entry_stat);
+            if (m_DIGESTS.is_enabled()) {
+                lookup_digest(m_DIGESTS, DIR_KEY, entry);
+            }
+        }
+        validator.add(entry);
+    }
+
+    res.set(http::field::vary, "Accept");
+
+    std::string const NEXT_CURSOR =
+        END < AVAILABLE ? percent_encode(make_listing_cursor(scan.entries[END - 1])) : std::string {};
+    if (!NEXT_CURSOR.empty()) {
+        res.set(http::field::link,
+                "<?cursor=" + NEXT_CURSOR + "&limit=" + std::to_string(page.limit) + ">; rel=\"next\"");
+    }
+
+    std::string const ETAG =
+        validator.etag(static_cast<std::uint64_t>(scan.dir_stat.st_ino), scan.entries.size());
+    if (answer_not_modified(req, res, ETAG, validator.last_modified)) {
+        return;
+    }
+
+    std::string html;
+    append_listing_head(html, dir_path, m_ROOT_PATH, scan);
+    append_time(html, std::time(nullptr));
+    if (BEGIN == END) {
+        html += "</p><hr><p>No entries on this page, ";
+        append_decimal(html, scan.entries.size());
+        html += " in total</p>";
+    } else {
+        html += "</p><hr><p>Entries ";
+        append_decimal(html, SKIPPED + BEGIN + 1);
+        html += " to ";
+        append_decimal(html, SKIPPED + END);
+        html += " of ";
+        append_decimal(html, scan.entries.size());
+        html += "</p>";
+    }
+    html += LISTING_TABLE_HEAD;
+    append_listing_rows(html, scan.entries, BEGIN, END, SKIPPED, listing_href_prefix(dir_path, m_ROOT_PATH));
+    html += "</table>";
+    if (!NEXT_CURSOR.empty()) {
+        html += "<br><a class='parent' href=\"?cursor=" + NEXT_CURSOR
+            + "&amp;limit=" + std::to_string(page.limit) + "\">Next page</a>";
+    }
+    html += LISTING_FOOTER;
+
+    res.result(http::status::ok);
+    res.set(http::field::content_type, "text/html");
+    res.body() = std::move(html);
+}
+
+/**
+ * @brief Answer a request with the JSON or NDJSON records of a directory.
+ *
+ * @param req The HTTP request object.
+ * @param dir_path The path to the directory.
+ * @param format JSON or NDJSON.
+ * @param res The HTTP response object.
+ * @param file The body of the response, a stream for recursive listings.
+ */
+void SHServer::respond_with_listing_records(const ArenaRequest& req,
+                                            const fs::path& dir_path,
+                                            ListingFormat format,
+                                            ArenaResponse& res,
+                                            FileTransfer& file) {
+    LOG_TRACE
+
+    std::size_t const DEPTH = parse_listing_depth(to_string_view(req.target()));
+
+    // Records are always sent uncompressed, only the format is negotiated
+    res.set(http::field::vary, "Accept");
+    res.set(http::field::content_type,
+            format == ListingFormat::JSON ? "application/json" : "application/x-ndjson");
+
+    if (DEPTH == 0) {
+        auto const LISTING = get_listing(dir_path);
+        std::string const ETAG =
+            make_variant_etag(LISTING->etag, format == ListingFormat::JSON ? "json" : "ndjson");
+        if (answer_not_modified(req, res, ETAG, LISTING->last_modified)) {
+            return;
+        }
+        res.result(http::status::ok);
+        bool first = true;
+        append_records(res.body(), LISTING->records, {}, false, format, first);
+        finish_records(res.body(), format, first);
+        return;
+    }
+
+    // A tree has no cheap validator: it is walked while it is sent, without ETag. A HEAD never walks it
+    res.result(http::status::ok);
+    auto stream = std::make_shared<RecordStream>(
+        [this](const fs::path& dir) { return get_listing(dir); }, dir_path, DEPTH, format);
+    if (req.version() >= 11 || req.method() == http::verb::head) {
+        file.attach_stream(std::move(stream));
+        return;
+    }
+    while (stream->next(res.body())) {
+    }
+}
+
+/**
+ * @brief Answer a request with the paths below a directory matching a query.
+ *
+ * @param req The HTTP request object.
+ * @param dir_path The path to the directory searched below.
+ * @param query The search text.
+ * @param res The HTTP response object.
+ * @param file The body of the response, a stream for large pages.
+ */
+void SHServer::respond_with_search(const ArenaRequest& req,
+                                   const fs::path& dir_path,
+                                   std::string_view query,
+                                   ArenaResponse& res,
+                                   FileTransfer& file) {
+    PhaseTimer const TIMER(m_METRICS, Phase::LISTING);
+
+    if (!m_SEARCH.is_enabled()) {
+        res.result(http::status::not_implemented);
+        res.body() = "Search is not available";
+        return;
+    }
+
+    ListingPage const PAGE = parse_listing_page(to_string_view(req.target())).value_or(ListingPage {});
+    std::string scope = listing_link_prefix(dir_path, m_ROOT_PATH);
+    if (!scope.empty()) {
+        scope.pop_back();
+    }
+
+    std::vector<SearchHit> hits;
+    std::string next_cursor;
+    switch (m_SEARCH.search(query, scope, PAGE, hits, next_cursor)) {
+        case SearchStatus::NOT_READY:
+            res.result(http::status::service_unavailable);
+            res.set(http::field::retry_after, "1");
+            res.body() = "The search index is being built";
+            return;
+        case SearchStatus::BAD_CURSOR:
+            res.result(http::status::bad_request);
+            res.body() = "Malformed search cursor";
+            return;
+        case SearchStatus::OK:
+            break;
+    }
+
+    ListingFormat const FORMAT =
+        parse_listing_format(to_string_view(req.target()), to_string_view(req[http::field::accept]));
+    res.result(http::status::ok);
+    res.set(http::field::vary, "Accept");
+
+    // The query goes back into the links, so they also page through the same search
+    std::string next_page;
+    if (!next_cursor.empty()) {
+        next_page = "?search=" + percent_encode(query) + "&cursor=" + next_cursor + "&limit="
+            + std::to_string(PAGE.limit);
+        res.set(http::field::link, "<" + next_page + ">; rel=\"next\"");
+    }
+
+    std::string head;
+    std::string tail;
+    if (FORMAT == ListingFormat::HTML) {
+        res.set(http::field::content_type, "text/html");
+        head += "<html>";
+        head += LISTING_STYLES;
+        head += "<body><h1>Search for: ";
+        append_html_escaped(head, query);
+        head += "</h1><br><hr><br><a class='parent' href=\"?\">Back to the Directory</a><br><br><p>";
+        if (hits.empty()) {
+            head += "No matches on this page";
+        } else {
+            head += "Matches ";
+            append_decimal(head, PAGE.offset + 1);
+            head += " to ";
+            append_decimal(head, PAGE.offset + hits.size());
+        }
+        head += "</p><table><tr><th>N</th><th class='link-col'>PATH</th><th class='date-col'>TYPE</th></tr>";
+
+        tail += "</table>";
+        if (!next_page.empty()) {
+            tail += "<br><a class='parent' href=\"";
+            append_html_escaped(tail, next_page);
+            tail += "\">Next page</a>";
+        }
+        tail += LISTING_FOOTER;
+    } else {
+        res.set(http::field::content_type,
+                FORMAT == ListingFormat::JSON ? "application/json" : "application/x-ndjson");
+    }
+
+    // A large page goes out chunked while it renders; HTTP/1.0 and HEAD get the whole page
+    bool const STREAM = hits.size() > SearchStream::HITS_PER_CHUNK && req.version() >= 11
+        && req.method() != http::verb::head;
+    auto stream = std::make_shared<SearchStream>(
+        std::move(hits), FORMAT, PAGE.offset + 1, std::move(head), std::move(tail));
+    if (STREAM) {
+        file.attach_stream(std::move(stream));
+        return;
+    }
+    while (stream->next(res.body())) {
+    }
+}
+
+/**
+ * @brief Handle requests for non-existing files.
+ *
+ * @param file_path The path that does not exist.
+ * @param res The HTTP response object.
+ */
+void SHServer::handle_not_found(const fs::path& file_path, ArenaResponse& res) {
+    log_debug("File path %s does not exist\n", file_path.c_str());
+    res.result(http::status::not_found);
+    res.body() = "File not found";
+}
+
+/**
+ * @brief Handle requests for regular files.
+ *
+ * @param req The HTTP request.
+ * @param file_path The path to the file.
+ * @param res The HTTP response object.
+ * @param file The file body of the response.
+ */
+void SHServer::handle_file_request(const ArenaRequest& req,
+                                   const fs::path& file_path,
+                                   ArenaResponse& res,
+                                   FileTransfer& file) {
+    LOG_TRACE
+
+    FileInfo const INFO = resolve_path(file_path);
+
+    res.set(http::field::vary, "Accept-Encoding");
+    EncodingChoice const CHOICE = negotiate_file_encoding(req, file_path, INFO.size);
+    if (!CHOICE.sibling.empty()) {
+        handle_precompressed_request(req, file_path, CHOICE, res, file);
+        return;
+    }
+    if (CHOICE.coding != ContentCoding::IDENTITY && INFO.kind == FileKind::REGULAR
+        && respond_with_compressed(req,
+                                   file_path,
+                                   CHOICE.coding,
+                                   make_etag(INFO.inode, INFO.size, INFO.mtime_ns),
+                                   INFO.mtime,
+                                   nullptr,
+                                   res,
+                                   file))
+    {
+        return;
+    }
+
+    // Revalidation is answered from metadata alone, the file is never opened for a 304
+    if (INFO.kind == FileKind::REGULAR
+        && answer_not_modified(req, res, make_etag(INFO.inode, INFO.size, INFO.mtime_ns), INFO.mtime))
+    {
+        log_debug("Not modified: %s\n", file_path.c_str());
+        return;
+    }
+
+    // The watch and the epoch come first, so a change after this point cannot leave a stale copy behind
+    std::string const KEY = normalize_path(file_path);
+    bool const CACHEABLE = INFO.kind == FileKind::REGULAR && m_FILE_CACHE.accepts(INFO.size)
+        && is_watchable_file(file_path) && m_WATCHER.add_watch(normalize_path(file_path.parent_path()));
+    std::uint64_t const EPOCH = CACHEABLE ? m_FILE_CACHE.epoch(KEY) : 0;
+
+    log_debug("Attempting to open file: %s\n", file_path.c_str());
+
+    beast::error_code ec;
+    if (!file.open(file_path, ec)) {
+        log_debug("Failed to open file: %s (%s)\n", file_path.c_str(), ec.message().c_str());
+        res.result(http::status::internal_server_error);
+        res.body() = "Failed to open file";
+        return;
+    }
+
+    // The validators describe what is actually sent, so they come from the opened file
+    std::string const ETAG = make_etag(file.inode(), file.size(), file.mtime_ns());
+
+    configure_response_for_file(file_path, res);
+    res.set(http::field::accept_ranges, "bytes");
+    res.set(http::field::etag, ETAG);
+    res.set(http::field::last_modified, format_http_date(file.mtime()));
+    set_digest_fields(KEY, file.size(), file.mtime_ns(), file.inode(), res);
+
+    if (CACHEABLE && m_FILE_CACHE.accepts(file.size())) {
+        auto cached = std::make_shared<CachedFile>();
+        if (file.read_all(cached->body, ec)) {
+            cached->content_type = std::string(res[http::field::content_type]);
+            cached->content_disposition = std::string(res[http::field::content_disposition]);
+            cached->etag = ETAG;
+            cached->last_modified = std::string(res[http::field::last_modified]);
+            cached->inode = file.inode();
+            cached->mtime_ns = file.mtime_ns();
+            cached->mtime = file.mtime();
+            m_FILE_CACHE.insert(KEY, std::move(cached), EPOCH);
+        }
+    }
+
+    finish_file_response(req, file_path, res, file, ETAG);
+}
+
+/**
+ * @brief Handle requests for files held by the hot-file cache.
+ *
+ * @param req The HTTP request.
+ * @param file_path The path to the file.
+ * @param cached The cached file.
+ * @param res The HTTP response object.
+ * @param file The file body of the response.
+ */
+void SHServer::handle_cached_file_request(const ArenaRequest& req,
+                                          const fs::path& file_path,
+                                          std::shared_ptr<const CachedFile> cached,
+                                          ArenaResponse& res,
+                                          FileTransfer& file) {
+    LOG_TRACE
+
+    log_debug("Hot file cache hit: %s\n", file_path.c_str());
+
+    res.set(http::field::vary, "Accept-Encoding");
+    EncodingChoice const CHOICE = negotiate_file_encoding(req, file_path, cached->body.size());
+    if (!CHOICE.sibling.empty()) {
+        handle_precompressed_request(req, file_path, CHOICE, res, file);
+        return;
+    }
+    if (CHOICE.coding != ContentCoding::IDENTITY
+        && respond_with_compressed(
+            req, file_path, CHOICE.coding, cached->etag, cached->mtime, cached.get(), res, file))
+    {
+        return;
+    }
+
+    res.set(http::field::etag, cached->etag);
+    res.set(http::field::last_modified, cached->last_modified);
+    if (is_not_modified(to_string_view(req[http::field::if_none_match]),
+                        to_string_view(req[http::field::if_modified_since]),
+                        cached->etag,
+                        cached->mtime))
+    {
+        res.result(http::status::not_modified);
+        return;
+    }
+
+    res.result(http::status::ok);
+    res.set(http::field::content_type, cached->content_type);
+    res.set(http::field::content_disposition, cached->content_disposition);
+    res.set("X-Content-Type-Options", "nosniff");
+    res.set(http::field::accept_ranges, "bytes");
+    set_digest_fields(normalize_path(file_path), cached->body.size(), cached->mtime_ns, cached->inode, res);
+
+    std::uint64_t const INODE = cached->inode;
+    std::int64_t const MTIME_NS = cached->mtime_ns;
+    std::time_t const MTIME = cached->mtime;
+    std::string const ETAG = cached->etag;
+
+    // The aliasing pointer keeps the whole entry alive for as long as the body is being sent
+    const std::string& body = cached->body;
+    file.attach(std::shared_ptr<const std::string>(std::move(cached), &body), INODE, MTIME_NS, MTIME);
+
+    finish_file_response(req, file_path, res, file, ETAG);
+}
+
+/**
+ * @brief Pick the representation of a file for the request's Accept-Encoding.
+ *
+ * @param req The HTTP request.
+ * @param file_path The path to the file.
+ * @param size The size of the file.
+ * @return EncodingChoice The chosen coding and, for precompressed files, the sibling.
+ */
+auto SHServer::negotiate_file_encoding(const ArenaRequest& req,
+                                       const fs::path& file_path,
+                                       std::uint64_t size) -> EncodingChoice {
+    EncodingChoice choice;
+
+    std::string_view const ACCEPT = to_string_view(req[http::field::accept_encoding]);
+    if (ACCEPT.empty()) {
+        return choice;
+    }
+
+    // Candidates in order of preference: ties go to the earlier one, so stored siblings beat CPU work
+    float best = 0.0F;
+    for (auto const& [coding, extension] : {std::pair {ContentCoding::ZSTD, ".zst"}, std::pair {ContentCoding::GZIP, ".gz"}}) {
+        float const QUALITY = encoding_quality(ACCEPT, coding_name(coding));
+        if (QUALITY <= best) {
+            continue;
+        }
+        fs::path sibling = file_path;
+        sibling += extension;
+        FileInfo const INFO = resolve_path(sibling);
+        if (INFO.kind == FileKind::REGULAR) {
+            best = QUALITY;
+            choice = {coding, std::move(sibling), INFO};
+        }
+    }
+
+    if (size < MIN_COMPRESS_SIZE || size > MAX_COMPRESS_SIZE || !is_compressible(file_path)) {
+        return choice;
+    }
+    for (ContentCoding const CODING : {ContentCoding::ZSTD, ContentCoding::GZIP, ContentCoding::DEFLATE}) {
+        float const QUALITY = encoding_quality(ACCEPT, coding_name(CODING));
+        if (QUALITY > best && can_compress(CODING)) {
+            best = QUALITY;
+            choice = {CODING, {}, {}};
+        }
+    }
+    return choice;
+}
+
+/**
+ * @brief Serve a precompressed sibling of a file.
+ *
+ * @param req The HTTP request.
+ * @param file_path The path to the requested file.
+ * @param choice The negotiated coding and sibling.
+ * @param res The HTTP response object.
+ * @param file The file body of the response.
+ */
+void SHServer::handle_precompressed_request(const ArenaRequest& req,
+                                            const fs::path& file_path,
+                                            const EncodingChoice& choice,
+                                            ArenaResponse& res,
+                                            FileTransfer& file) {
+    const FileInfo& info = choice.sibling_info;
+    if (answer_not_modified(req, res, make_etag(info.inode, info.size, info.mtime_ns), info.mtime)) {
+        return;
+    }
+
+    beast::error_code ec;
+    if (!file.open(choice.sibling, ec)) {
+        log_debug("Failed to open file: %s (%s)\n", choice.sibling.c_str(), ec.message().c_str());
+        res.result(http::status::internal_server_error);
+        res.body() = "Failed to open file";
+        return;
+    }
+    log_debug("Serving precompressed %s\n", choice.sibling.c_str());
+
+    std::string const ETAG = make_etag(file.inode(), file.size(), file.mtime_ns());
+
+    configure_response_for_file(file_path, res);
+    res.set(http::field::content_encoding, to_beast_view(coding_name(choice.coding)));
+    res.set(http::field::accept_ranges, "bytes");
+    res.set(http::field::etag, ETAG);
+    res.set(http::field::last_modified, format_http_date(file.mtime()));
+
+    finish_file_response(req, file_path, res, file, ETAG);
+}
+
+/**
+ * @brief Serve a dynamically compressed variant of a file.
+ *
+ * @param req The HTTP request.
+ * @param file_path The path to the file.
+ * @param coding The negotiated coding.
+ * @param etag The entity tag of the uncompressed file.
+ * @param mtime The modification time of the file.
+ * @param cached The hot-file cache entry of the file, or nullptr to read it from disk.
+ * @param res The HTTP response object.
+ * @param file The file body of the response.
+ * @return true if the response is complete, false if the file must be sent uncompressed.
+ */
+auto SHServer::respond_with_compressed(const ArenaRequest& req,
+                                       const fs::path& file_path,
+                                       ContentCoding coding,
+                                       const std::string& etag,
+                                       std::time_t mtime,
+                                       const CachedFile* cached,
+                                       ArenaResponse& res,
+                                       FileTransfer& file) -> bool {
+    std::string const KEY = VariantCache::make_key(normalize_path(file_path), etag, coding);
+    auto variant = m_VARIANT_CACHE.find(KEY);
+    m_METRICS.count_cache(CacheKind::VARIANT, variant != nullptr);
+
+    if (!variant) {
+        auto fresh = std::make_shared<CompressedVariant>();
+        fresh->coding = coding;
+
+        std::string content;
+        if (cached == nullptr) {
+            beast::error_code ec;
+            if (!file.open(file_path, ec)) {
+                return false;
+            }
+            // A file changed since it was stat'ed is compressed under its new tag on the next request
+            bool const SAME_VERSION = make_etag(file.inode(), file.size(), file.mtime_ns()) == etag;
+            bool const READ = SAME_VERSION && file.read_all(content, ec);
+            file.close();
+            if (!READ) {
+                return false;
+            }
+        }
+        std::string_view const SOURCE = cached != nullptr ? std::string_view(cached->body) : content;
+
+        if (!compress(SOURCE, coding, fresh->body) || fresh->body.size() >= SOURCE.size()) {
+            fresh->body.clear();
+            fresh->body.shrink_to_fit();
+            fresh->incompressible = true;
+        }
+        log_debug("Compressed %s with %s: %zu -> %zu bytes\n",
+                  file_path.c_str(),
+                  std::string(coding_name(coding)).c_str(),
+                  SOURCE.size(),
+                  fresh->body.size());
+
+        m_VARIANT_CACHE.insert(KEY, fresh);
+        variant = std::move(fresh);
+    }
+
+    if (variant->incompressible) {
+        return false;
+    }
+
+    std::string const ETAG = make_variant_etag(etag, coding_name(coding));
+    if (answer_not_modified(req, res, ETAG, mtime)) {
+        return true;
+    }
+
+    configure_response_for_file(file_path, res);
+    res.set(http::field::content_encoding, to_beast_view(coding_name(coding)));
+    res.set(http::field::accept_ranges, "bytes");
+
+    const std::string& body = variant->body;
+    file.attach(std::shared_ptr<const std::string>(std::move(variant), &body), 0, 0, mtime);
+
+    finish_file_response(req, file_path, res, file, ETAG);
+    return true;
+}
+
+/**
+ * @brief Set the digest fields of a file response
+ *
+ * @param key normalized path
+ * @param size size of the file sent
+ * @param mtime_ns modification time of the file sent
+ * @param inode inode of the file sent
+ * @param res response
+ **/
+void SHServer::set_digest_fields(const std::string& key,
+                                 std::uint64_t size,
+                                 std::int64_t mtime_ns,
+                                 std::uint64_t inode,
+                                 ArenaResponse& res) {
+    if (!m_DIGESTS.is_enabled()) {
+        return;
+    }
+    auto const DIGEST = m_DIGESTS.lookup(key, size, mtime_ns, inode);
+    if (!DIGEST) {
+        return;
+    }
+    std::string field = "sha-256=:";
+    append_base64(field, digest_bytes(*DIGEST));
+    field += ':';
+    res.set("Repr-Digest", field);
+
+    // RFC 3230 spells the same value without the byte-sequence colons
+    field.replace(0, 9, "SHA-256=");
+    field.pop_back();
+    res.set("Digest", field);
+}
+
+/**
+ * @brief Apply Range/If-Range to a file response and set its length.
+ *
+ * @param req The HTTP request.
+ * @param file_path The path to the file.
+ * @param res The HTTP response object.
+ * @param file The attached file body.
+ * @param etag The entity tag of the file.
+ */
+void SHServer::finish_file_response(const ArenaRequest& req,
+                                    const fs::path& file_path,
+                                    ArenaResponse& res,
+                                    FileTransfer& file,
+                                    const std::string& etag) {
+    std::string_view const RANGE = to_string_view(req[http::field::range]);
+    if (!RANGE.empty() && if_range_matches(to_string_view(req[http::field::if_range]), etag, file.mtime())) {
+        std::vector<ByteRange> ranges;
+        switch (parse_range_header(RANGE, file.size(), ranges)) {
+            case RangeResult::SATISFIABLE:
+                // A body spread over many files has no multipart form, several ranges get all of it
+                if (ranges.size() > 1 && file.has_source()) {
+                    break;
+                }
+                configure_response_for_ranges(ranges, res, file);
+                break;
+            case RangeResult::UNSATISFIABLE:
+                log_debug("Unsatisfiable range for %s: %s\n", file_path.c_str(), std::string(RANGE).c_str());
+                res.result(http::status::range_not_satisfiable);
+                res.set(http::field::content_range, "bytes */" + std::to_string(file.size()));
+                file.close();
+                return;
+            case RangeResult::IGNORED:
+                break;
+        }
+    }
+
+    res.content_length(file.content_length());
+}
+
+/**
+ * @brief Restrict a file response to byte ranges.
+ *
+ * @param ranges The satisfiable ranges.
+ * @param res The HTTP response object.
+ * @param file The opened file body.
+ */
+void SHServer::configure_response_for_ranges(const std::vector<ByteRange>& ranges,
+                                             ArenaResponse& res,
+                                             FileTransfer& file) {
+    std::string const TOTAL = "/" + std::to_string(file.size());
+    auto content_range = [&TOTAL](const ByteRange& range)
+    {
+        return "bytes " + std::to_string(range.offset) + "-" + std::to_string(range.offset + range.length - 1)
+            + TOTAL;
+    };
+
+    res.result(http::status::partial_content);
+
+    if (ranges.size() == 1) {
+        res.set(http::field::content_range, content_range(ranges.front()));
+        file.select(ranges.front().offset, ranges.front().length);
+        return;
+    }
+
+    std::string const BOUNDARY = make_boundary();
+    std::string const PART_TYPE = std::string(res[http::field::content_type]);
+
+    file.clear_parts();
+    for (const auto& range : ranges) {
+        file.add_part("\r\n--" + BOUNDARY + "\r\nContent-Type: " + PART_TYPE
+                          + "\r\nContent-Range: " + content_range(range) + "\r\n\r\n",
+                      range.offset,
+                      range.length);
+    }
+    file.add_part("\r\n--" + BOUNDARY + "--\r\n", 0, 0);
+
+    res.set(http::field::content_type, "multipart/byteranges; boundary=" + BOUNDARY);
+}
+
+/**
+ * @brief Configure the HTTP response for a file.
+ *
+ * @param file_path The path of the file being requested.
+ * @param res The HTTP response object.
+ */
+void SHServer::configure_response_for_file(const fs::path& file_path,
+                                           ArenaResponse& res) {
+    std::string_view const NAME = file_path.filename().native();
+    MimeType const MIME = m_MIME_TYPES.lookup(NAME);
+
+    std::string disposition;
+    append_content_disposition(disposition, MIME.disposition, NAME);
+
+    res.result(http::status::ok);
+    res.set(http::field::content_type, to_beast_view(MIME.type));
+    res.set(http::field::content_disposition, disposition);
+    res.set("X-Content-Type-Options", "nosniff");
+}
+
+/**
+ * @brief Switch file bodies to io_uring
+ *
+ * @return true if enabled
+ **/
+auto SHServer::enable_io_uring() -> bool {
+    return m_URING.enable();
+}
+
+/**
+ * @brief Load media type overrides
+ *
+ * @param file path of a mime.types style file
+ * @return true if the file could be read
+ **/
+auto SHServer::load_mime_types(const std::string& file) -> bool {
+    if (!m_MIME_TYPES.load(file)) {
+        return false;
+    }
+    log_info("Loaded %zu media type overrides from %s\n", m_MIME_TYPES.size(), file.c_str());
+    return true;
+}
+
+/**
+ * @brief Accept uploads
+ *
+ * @param limit largest body in bytes, 0 for the default
+ **/
+void SHServer::enable_uploads(std::uint64_t limit) {
+    m_UPLOAD_LIMIT = limit == 0 ? DEFAULT_UPLOAD_LIMIT : limit;
+}
+
+/**
+ * @brief Keep SHA-256 digests of the served files
+ *
+ * @param store store file, empty for none
+ * @param threads hashing threads, 0 for the default
+ * @param rate bytes per second, 0 for unlimited
+ **/
+void SHServer::enable_digests(std::string store, std::size_t threads, std::uint64_t rate) {
+    m_DIGESTS.configure(std::move(store), threads, rate);
+
+    // Cached pages of a directory show its digests as they were, so they are rebuilt
+    m_DIGESTS.set_listener([this](const std::string& dir) { m_LISTING_CACHE.invalidate(dir); });
+}
+
+/**
+ * @brief Switch to SO_REUSEPORT acceptor shards
+ *
+ * @param shards number of shards, 0 for one per hardware thread
+ * @param pin_threads pin shard threads to CPUs
+ **/
+void SHServer::enable_sharding(std::size_t shards, bool pin_threads) {
+    m_SHARD_COUNT = resolve_thread_count(shards);
+    m_PIN_THREADS = pin_threads;
+}
+
+/**
+ * @brief Run HTTP Server
+ *
+ **/
+void SHServer::run_server() {
+    LOG_TRACE
+
+    try {
+        tcp::endpoint const ENDPOINT {tcp::v4(), m_PORT};
+
+        if (m_SHARD_COUNT == 0) {
+            m_ACCEPTOR.open(ENDPOINT.protocol());
+            m_ACCEPTOR.set_option(net::socket_base::reuse_address(true));
+            m_ACCEPTOR.bind(ENDPOINT);
+            m_ACCEPTOR.listen(net::socket_base::max_listen_connections);
+        } else {
+            open_shards(ENDPOINT);
+        }
+        std::cout << "Localhost Server started at port " << m_PORT << "\n";
+
+        if (m_SHARD_COUNT == 0) {
+            log_info("HTTP Fileserver started at 127.0.0.1:%d with %zu worker threads\n", m_PORT, m_THREADS);
+        } else {
+            log_info("HTTP Fileserver started at 127.0.0.1:%d with %zu acceptor shards%s\n",
+                     m_PORT,
+                     m_SHARD_COUNT,
+                     m_PIN_THREADS ? " (pinned)" : "");
+        }
+
+        // sendfile(2) has no MSG_NOSIGNAL, a vanished client must not kill the process
+        std::signal(SIGPIPE, SIG_IGN);
+
+        m_SIGNALS.add(SIGINT);
+        m_SIGNALS.add(SIGTERM);
+        m_SIGNALS.async_wait([this](beast::error_code const&, int) { stop_server(); });
+
+        m_URING.start();
+        m_WATCHER.start();
+        m_PATH_FILTER.start(normalize_path(m_ROOT_PATH));
+        m_DIGESTS.start(normalize_path(m_ROOT_PATH));
+        m_SEARCH.start(normalize_path(m_ROOT_PATH), 0);
+
+        std::vector<std::thread> workers;
+        if (m_SHARD_COUNT == 0) {
+            do_accept(m_ACCEPTOR);
+
+            workers.reserve(m_THREADS - 1);
+            for (std::size_t i = 1; i < m_THREADS; ++i) {
+                workers.emplace_back([this] { m_DEFAULT_IOC.run(); });
+            }
+        } else {
+            std::vector<int> const CPUS = m_PIN_THREADS ? allowed_cpus() : std::vector<int> {};
+            workers.reserve(m_SHARDS.size());
+            for (std::size_t i = 0; i < m_SHARDS.size(); ++i) {
+                AcceptorShard& shard = *m_SHARDS[i];
+                do_accept(shard.acceptor);
+
+                int const CPU = CPUS.empty() ? -1 : CPUS[i % CPUS.size()];
+                workers.emplace_back(
+                    [&shard, CPU]
+                    {
+                        if (CPU != -1 && !pin_current_thread(CPU)) {
+                            log_once_warn("Cannot pin shard threads to CPUs\n");
+                        }
+                        shard.ioc.run();
+                    });
+            }
+        }
+        m_DEFAULT_IOC.run();
+
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        m_PATH_FILTER.stop();
+        m_DIGESTS.stop();
+        m_SEARCH.stop();
+    } catch (std::exception const& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+    }
+}
+
+/**
+ * @brief Open the shard acceptors
+ *
+ * @param endpoint listening address
+ **/
+void SHServer::open_shards(const tcp::endpoint& endpoint) {
+    m_SHARDS.clear();
+    for (std::size_t i = 0; i < m_SHARD_COUNT; ++i) {
+        auto shard = std::make_unique<AcceptorShard>();
+        shard->acceptor.open(endpoint.protocol());
+        shard->acceptor.set_option(net::socket_base::reuse_address(true));
+        shard->acceptor.set_option(reuse_port(true));
+        shard->acceptor.bind(endpoint);
+        shard->acceptor.listen(net::socket_base::max_listen_connections);
+        m_SHARDS.push_back(std::move(shard));
+    }
+}
+
+/**
+ * @brief Stop HTTP Server
+ *
+ **/
+void SHServer::stop_server() {
+    for (auto& shard : m_SHARDS) {
+        net::post(shard->ioc,
+                  [&shard = *shard]
+                  {
+                      beast::error_code ec;
+                      shard.acceptor.close(ec);
+                      shard.ioc.stop();
+                  });
+    }
+
+    net::post(m_ACCEPTOR.get_executor(),
+              [this]
+              {
+                  beast::error_code ec;
+                  m_ACCEPTOR.close(ec);
+                  m_DEFAULT_IOC.stop();
+              });
+}
+
+/**
+ * @brief Queue an asynchronous accept
+ *
+ * @param acceptor listening socket
+ **/
+void SHServer::do_accept(tcp::acceptor& acceptor) {
+    acceptor.async_accept(net::make_strand(acceptor.get_executor()),
+                          beast::bind_front_handler(&SHServer::on_accept, this, std::ref(acceptor)));
+}
+
+/**
+ * @brief Start a session for the accepted socket
+ *
+ * @param acceptor listening socket
+ * @param ec error code
+ * @param socket accepted socket
+ **/
+void SHServer::on_accept(tcp::acceptor& acceptor, beast::error_code ec, tcp::socket socket) {
+    if (ec == net::error::operation_aborted) {
+        return;
+    }
+
+    if (ec) {
+        log_error("Accept error: %s\n", ec.message().c_str());
+    } else {
+        // Header and body leave in separate writes; Nagle would hold the body back for the client's delayed ACK
+        beast::error_code option_ec;
+        socket.set_option(tcp::no_delay(true), option_ec);
+        std::make_shared<SHSession>(std::move(socket), *this)->run();
+    }
+
+    do_accept(acceptor);
 }
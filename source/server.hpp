@@ -1,68 +1,297 @@
 #pragma once
 
+#include <chrono>
+#include <cstddef>
 #include <cstdint>
+#include <memory>
+#include <optional>
 #include <string>
+#include <string_view>
+#include <vector>
 
+#include <boost/asio/io_context.hpp>
 #include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/signal_set.hpp>
+#include <boost/beast/core/error.hpp>
 #include <boost/beast/http.hpp>
 #include <boost/filesystem.hpp>
 
+#include "arena.hpp"
+#include "compression.hpp"
+#include "digest_index.hpp"
+#include "file_transfer.hpp"
+#include "hot_file_cache.hpp"
+#include "http_utils.hpp"
+#include "inotify_watcher.hpp"
+#include "listing_cache.hpp"
+#include "metrics.hpp"
+#include "mime_types.hpp"
+#include "path_filter.hpp"
+#include "search_index.hpp"
+#include "stat_cache.hpp"
+#include "upload.hpp"
+#include "uring_backend.hpp"
+#include "variant_cache.hpp"
+
 namespace beast = boost::beast;
 namespace http = beast::http;
 namespace net = boost::asio;
 namespace fs = boost::filesystem;
 using tcp = boost::asio::ip::tcp;
 
+/**
+ * @brief The representation chosen for a file request
+ *
+ * A non-empty sibling means a precompressed file (e.g. "foo.gz") is sent;
+ * otherwise a coding other than IDENTITY means dynamic compression.
+ */
+struct EncodingChoice {
+    ContentCoding coding = ContentCoding::IDENTITY;
+    fs::path sibling;
+    FileInfo sibling_info;
+};
+
+/**
+ * @brief Get the inline CSS of an entry in a directory listing
+ *
+ * The extension is looked up in a perfect hash table built at compile
+ * time, and the style comes from static storage.
+ *
+ * @param name The name of the entry, its extension picks the color.
+ * @param is_dir Whether the entry is a directory.
+ * @return std::string_view The style attribute value.
+ */
+auto get_file_type_style(std::string_view name, bool is_dir) -> std::string_view;
+
+/**
+ * @brief A listening socket with its own single-threaded io_context
+ *
+ * In sharded mode every shard binds the server port with SO_REUSEPORT, so
+ * the kernel spreads new connections across the shards; a connection then
+ * lives on the thread of the shard which accepted it.
+ */
+struct AcceptorShard {
+    AcceptorShard()
+        : ioc(1)
+        , acceptor(ioc) {}
+
+    net::io_context ioc;
+    tcp::acceptor acceptor;
+};
+
 class SHServer {
   public:
     /**
      * @brief Construct a new SHServer instance.
      *
      * This constructor initializes the server with a specified root path
-     * for serving files and a port number for accepting incoming connections.
+     * for serving files, a port number for accepting incoming connections and
+     * the number of worker threads that run the I/O context. The server does
+     * not start listening until run_server() is called.
      *
      * @param root_path Reference to the root path from which files will be served.
      * @param port Reference to the server port for handling requests.
+     * @param threads Number of worker threads (0 means one per hardware thread).
+     */
+    SHServer(fs::path& root_path, std::uint16_t& port, std::size_t threads = 0);
+
+    /**
+     * @brief Default memory budget of the listing cache
+     *
+     */
+    static constexpr std::size_t DEFAULT_LISTING_CACHE_BYTES = 64 * 1024 * 1024;
+
+    /**
+     * @brief Lifetime of a cached stat result
+     *
+     * Bounds staleness for directories inotify does not watch; watched ones
+     * are invalidated as soon as they change.
+     */
+    static constexpr std::chrono::milliseconds DEFAULT_STAT_CACHE_TTL {1000};
+
+    /**
+     * @brief Maximum number of cached stat results
+     *
+     */
+    static constexpr std::size_t DEFAULT_STAT_CACHE_ENTRIES = 64 * 1024;
+
+    /**
+     * @brief Default memory budget of the hot-file cache
+     *
+     */
+    static constexpr std::size_t DEFAULT_FILE_CACHE_BYTES = 64 * 1024 * 1024;
+
+    /**
+     * @brief Largest file kept in the hot-file cache
+     *
+     * Bigger files are cheaper to sendfile() than to hold in memory.
+     */
+    static constexpr std::uint64_t DEFAULT_FILE_CACHE_MAX_FILE = 256 * 1024;
+
+    /**
+     * @brief Default memory budget of the compressed-variant cache
+     *
+     */
+    static constexpr std::size_t DEFAULT_VARIANT_CACHE_BYTES = 32 * 1024 * 1024;
+
+    /**
+     * @brief Default size limit of an upload
+     *
+     */
+    static constexpr std::uint64_t DEFAULT_UPLOAD_LIMIT = 16ULL * 1024 * 1024 * 1024;
+
+    /**
+     * @brief Smallest file compressed on the fly
+     *
+     * Below this the coding overhead eats most of the gain.
      */
-    SHServer(fs::path& root_path, std::uint16_t& port);
+    static constexpr std::uint64_t MIN_COMPRESS_SIZE = 256;
+
+    /**
+     * @brief Largest file compressed on the fly
+     *
+     * Dynamic compression holds the whole file in memory; bigger files are
+     * sent as they are unless a precompressed sibling exists.
+     */
+    static constexpr std::uint64_t MAX_COMPRESS_SIZE = 8 * 1024 * 1024;
+
+    /**
+     * @brief Entries from which an uncached listing is streamed instead of built
+     *
+     **/
+    static constexpr std::size_t LISTING_STREAM_THRESHOLD = 4096;
 
     /**
      * @brief Generate a list of files in the specified directory.
      *
-     * This function scans the current path and creates an HTML page that
-     * lists all accessible files and directories.
+     * This function creates an HTML page that lists all accessible files and
+     * directories of the current path, from the listing cache when possible.
      *
      * @param current_path The path of the directory to scan.
      * @return std::string An HTML formatted string representing the list of files.
      */
     auto generate_file_list(const fs::path& current_path) -> std::string;
 
+    /**
+     * @brief Get the listing of a directory, from the cache when possible.
+     *
+     * On a miss the directory is watched through inotify, listed and the
+     * result cached, so later requests skip the walk, the stat calls, the
+     * sort and the rendering until the directory changes.
+     *
+     * @param current_path The path of the directory.
+     * @return std::shared_ptr<const DirectoryListing> The rendered listing.
+     */
+    auto get_listing(const fs::path& current_path) -> std::shared_ptr<const DirectoryListing>;
+
+    /**
+     * @brief Look the listing of a directory up in the listing cache.
+     *
+     * On a miss the directory is watched through inotify and @p epoch is
+     * set, so a listing built from now on may be inserted with it.
+     *
+     * @param current_path The path of the directory.
+     * @param epoch Set to the cache epoch on a miss which may be cached, reset otherwise.
+     * @return std::shared_ptr<const DirectoryListing> The cached listing, nullptr on a miss.
+     */
+    auto lookup_listing(const fs::path& current_path, std::optional<std::uint64_t>& epoch)
+        -> std::shared_ptr<const DirectoryListing>;
+
+    /**
+     * @brief Walk, sort and render a directory listing.
+     *
+     * @param current_path The path of the directory to scan.
+     * @return std::shared_ptr<const DirectoryListing> The rendered listing and its validators.
+     */
+    auto build_listing(const fs::path& current_path) -> std::shared_ptr<const DirectoryListing>;
+
+    /**
+     * @brief Assemble the HTML page of a listing with the current server time.
+     *
+     * @param listing The rendered listing.
+     * @return std::string The HTML page.
+     */
+    static auto render_listing(const DirectoryListing& listing) -> std::string;
+
     /**
      * @brief Handle an incoming HTTP request.
      *
      * This function processes the HTTP request, determines the appropriate
      * response, and routes it to the relevant handler based on the request target.
+     * File responses leave the body empty and attach the file to @p file instead,
+     * the session then sends it after the header.
+     * /__metrics is answered with the server metrics in the Prometheus text
+     * format before the filesystem is consulted.
      *
      * @param root_path The root path for serving files.
      * @param req The HTTP request to handle.
      * @param res The HTTP response to populate.
-     * @param socket The TCP socket used for communication.
+     * @param file The file body of the response, opened for file requests.
+     * @return Route The handler which answered, for the metrics.
+     */
+    auto handle_request(const fs::path& root_path,
+                        ArenaRequest& req,
+                        ArenaResponse& res,
+                        FileTransfer& file) -> Route;
+
+    /**
+     * @brief Start a PUT or POST upload once its header is read.
+     *
+     * PUT stores the body as the target file, creating missing parent
+     * directories; POST to a directory stores every file of a
+     * multipart/form-data body in it. Requests which cannot be accepted
+     * (uploads disabled, too large, bad target, bad checksum header) get
+     * their error response before any of the body is read.
+     *
+     * @param req The request header.
+     * @param content_length The Content-Length of the body, if any.
+     * @param res The HTTP response, populated when the upload is refused.
+     * @return std::unique_ptr<Upload> The upload to stream the body into, or nullptr if refused.
+     */
+    auto begin_upload(const ArenaRequestHeader& req,
+                      std::optional<std::uint64_t> content_length,
+                      ArenaResponse& res) -> std::unique_ptr<Upload>;
+
+    /**
+     * @brief Finish an upload once its body is read, or answer its failure.
+     *
+     * Created files answer 201 and replaced ones 204, with the ETag of the
+     * new file; a form upload answers 201 with the stored files as JSON.
+     *
+     * @param upload The upload, failed or with its whole body written.
+     * @param req The request header.
+     * @param res The HTTP response to populate.
+     */
+    void finish_upload(Upload& upload,
+                       const ArenaRequestHeader& req,
+                       ArenaResponse& res);
+
+    /**
+     * @brief Make a path created by the server visible to the caches at once.
+     *
+     * The inotify events follow a few milliseconds later; until then a
+     * request for the new file must not be answered from stale state.
+     *
+     * @param path The created or replaced path.
      */
-    void handle_request(const fs::path& root_path,
-                        http::request<http::string_body>& req,
-                        http::response<http::string_body>& res,
-                        tcp::socket& socket);
+    void invalidate_created(const fs::path& path);
 
     /**
      * @brief Handle requests for the root directory.
      *
      * This function generates a file listing for the root path and populates
-     * the response accordingly.
+     * the response accordingly. The listing carries a weak ETag and
+     * Last-Modified, and conditional requests are answered with 304.
      *
+     * @param req The HTTP request, consulted for conditional headers.
      * @param root_path The root directory to list.
      * @param res The HTTP response object to populate.
+     * @param file The body of the response, a stream for large listings.
      */
-    void handle_root_request(const fs::path& root_path, http::response<http::string_body>& res);
+    void handle_root_request(const ArenaRequest& req,
+                             const fs::path& root_path,
+                             ArenaResponse& res,
+                             FileTransfer& file);
 
     /**
      * @brief Sanitize the target path to ensure secure access.
@@ -70,22 +299,157 @@ class SHServer {
      * This function cleans up the request target path to prevent directory
      * traversal attacks and ensures that the resulting path is valid.
      *
+     * The query string is dropped, escapes are decoded and "." / ".."
+     * segments are resolved; a target which would leave the root yields an
+     * empty path, which never resolves.
+     *
      * @param root_path The root path for serving files.
      * @param target The target path from the request.
-     * @return fs::path The sanitized path for safe handling.
+     * @return fs::path The sanitized path for safe handling, root_path itself for the root.
      */
-    auto sanitize_target(const fs::path& root_path, const std::string& target) -> fs::path;
+    auto sanitize_target(const fs::path& root_path, std::string_view target) -> fs::path;
+
+    /**
+     * @brief Resolve the type and metadata of a path.
+     *
+     * Paths the negative filter knows to be missing are answered without a
+     * syscall; everything else goes through the stat cache.
+     *
+     * @param path The path to resolve.
+     * @return FileInfo The type, size, mtime and inode of the path.
+     */
+    auto resolve_path(const fs::path& path) -> FileInfo;
 
     /**
      * @brief Handle requests for directories.
      *
      * This function generates a response that lists the contents of a directory
-     * if the requested path points to a directory.
+     * if the requested path points to a directory. The listing carries a weak
+     * ETag and Last-Modified, and conditional requests are answered with 304.
+     * A target with an archive parameter (see parse_archive_format()) gets
+     * the whole tree as a tar or zip download instead.
      *
+     * @param req The HTTP request, consulted for conditional headers.
      * @param file_path The path to the directory.
      * @param res The HTTP response object to populate.
+     * @param file The body of the response, a stream for large listings.
+     */
+    void handle_directory_request(const ArenaRequest& req,
+                                  const fs::path& file_path,
+                                  ArenaResponse& res,
+                                  FileTransfer& file);
+
+    /**
+     * @brief Answer a request with an archive of a directory tree.
+     *
+     * The archive is built while it is sent, without temporary files; see
+     * ArchiveLayout and ZipDeflateStream. Tar and stored zip archives have a
+     * deterministic layout, so they carry a Content-Length, a strong ETag
+     * and answer single ranges, which lets an interrupted download resume.
+     * Deflated zips go out chunked; HTTP/1.0 clients and HEAD requests get
+     * the stored variant instead. Trees of more than MAX_ARCHIVE_ENTRIES
+     * entries are refused with 403.
+     *
+     * @param req The HTTP request, consulted for validators and ranges.
+     * @param dir_path The path to the directory.
+     * @param format The archive format, not NONE.
+     * @param res The HTTP response object to populate.
+     * @param file The body of the response.
+     */
+    void respond_with_archive(const ArenaRequest& req,
+                              const fs::path& dir_path,
+                              ArchiveFormat format,
+                              ArenaResponse& res,
+                              FileTransfer& file);
+
+    /**
+     * @brief Answer a request with the listing of a directory.
+     *
+     * Listings are compressed with gzip or deflate when the client accepts
+     * it. The compressed page is cached per listing version with the server
+     * time left out, so a request only splices the time in.
+     *
+     * An uncached listing of LISTING_STREAM_THRESHOLD entries or more is
+     * rendered while it is sent, as a chunked HTTP/1.1 response without
+     * compression; the finished page is cached for the next request. A
+     * target with offset, limit or cursor parameters gets a single page,
+     * and one asking for JSON or NDJSON (see parse_listing_format()) gets
+     * the records of the entries instead of HTML.
+     *
+     * @param req The HTTP request, consulted for validators and Accept-Encoding.
+     * @param dir_path The path to the directory.
+     * @param res The HTTP response object to populate.
+     * @param file The body of the response, a stream for large listings.
+     */
+    void respond_with_listing(const ArenaRequest& req,
+                              const fs::path& dir_path,
+                              ArenaResponse& res,
+                              FileTransfer& file);
+
+    /**
+     * @brief Answer a request with one page of a directory listing.
+     *
+     * The entries are read without stat(2) where the filesystem reports
+     * their type; a cursor partitions away everything up to it and a partial
+     * sort orders only the entries up to the end of the page, so only the
+     * page is stat'ed and rendered. A following page is announced with
+     * Link: rel="next" and a cursor, which stays valid while entries are
+     * added or removed in front of it. Pages are not cached.
+     *
+     * @param req The HTTP request, consulted for conditional headers.
+     * @param dir_path The path to the directory.
+     * @param page The requested page.
+     * @param res The HTTP response object to populate.
+     */
+    void respond_with_listing_page(const ArenaRequest& req,
+                                   const fs::path& dir_path,
+                                   const ListingPage& page,
+                                   ArenaResponse& res);
+
+    /**
+     * @brief Answer a request with the entries of a directory as JSON or NDJSON.
+     *
+     * Every entry is one object with its name, type ("file" or "directory"),
+     * mtime in seconds since the epoch and, for files, size and the ETag a
+     * request for the file would get. The records are rendered with the
+     * cached listing, so they share its cache entry and its invalidation.
+     * With a depth (see parse_listing_depth()) the tree below the directory
+     * is walked depth first and streamed chunked, one directory per chunk,
+     * and every record also names its directory relative to the listed one.
+     * Symbolically linked directories are listed but not walked into, so a
+     * link to an ancestor cannot repeat the tree.
+     *
+     * @param req The HTTP request, consulted for validators and the depth.
+     * @param dir_path The path to the directory.
+     * @param format JSON (one array) or NDJSON (one object per line).
+     * @param res The HTTP response object to populate.
+     * @param file The body of the response, a stream for recursive listings.
+     */
+    void respond_with_listing_records(const ArenaRequest& req,
+                                      const fs::path& dir_path,
+                                      ListingFormat format,
+                                      ArenaResponse& res,
+                                      FileTransfer& file);
+
+    /**
+     * @brief Answer a request with the paths below a directory matching a query.
+     *
+     * Searches m_SEARCH rather than the filesystem; see SearchIndex::search()
+     * for what a query matches. The hits are paged like a listing, and the
+     * next page is named by an opaque cursor in a Link header. Large pages
+     * are streamed chunked.
+     *
+     * @param req The HTTP request, consulted for the page and the format.
+     * @param dir_path The path to the directory searched below.
+     * @param query The search text.
+     * @param res The HTTP response object to populate.
+     * @param file The body of the response, a stream for large pages.
      */
-    void handle_directory_request(const fs::path& file_path, http::response<http::string_body>& res);
+    void respond_with_search(const ArenaRequest& req,
+                             const fs::path& dir_path,
+                             std::string_view query,
+                             ArenaResponse& res,
+                             FileTransfer& file);
 
     /**
      * @brief Handle requests for files that do not exist.
@@ -96,54 +460,272 @@ class SHServer {
      * @param file_path The path that was requested but not found.
      * @param res The HTTP response object to populate.
      */
-    void handle_not_found(const fs::path& file_path, http::response<http::string_body>& res);
+    void handle_not_found(const fs::path& file_path, ArenaResponse& res);
 
     /**
-
      * @brief Handle requests for regular files.
      *
-     * This function prepares the response for a file download, including
-     * setting the appropriate headers.
+     * This function opens the file for a zero-copy transfer and prepares the
+     * response header, including the Content-Length of the body and the
+     * ETag/Last-Modified validators. If-None-Match/If-Modified-Since are
+     * answered with 304 from cached metadata, without opening the file. Range and
+     * If-Range requests are answered with 206 Partial Content (a single part
+     * or multipart/byteranges) or 416 Range Not Satisfiable. Small files are
+     * also read into the hot-file cache for later requests, unless they are
+     * symbolic or hard links, whose changes the watcher may not see.
+     *
+     * @param req The HTTP request, consulted for Range/If-Range.
+     * @param file_path The path to the file being requested.
+     * @param res The HTTP response object to populate.
+     * @param file The file body to attach the opened file to.
+     */
+    void handle_file_request(const ArenaRequest& req,
+                             const fs::path& file_path,
+                             ArenaResponse& res,
+                             FileTransfer& file);
+
+    /**
+     * @brief Handle requests for files held by the hot-file cache.
+     *
+     * Serves the content and header values stored in the cache, including
+     * 304 and Range responses, without touching the filesystem.
+     *
+     * @param req The HTTP request, consulted for validators and Range/If-Range.
+     * @param file_path The path to the file being requested.
+     * @param cached The cached content and header values.
+     * @param res The HTTP response object to populate.
+     * @param file The file body to attach the cached content to.
+     */
+    void handle_cached_file_request(const ArenaRequest& req,
+                                    const fs::path& file_path,
+                                    std::shared_ptr<const CachedFile> cached,
+                                    ArenaResponse& res,
+                                    FileTransfer& file);
+
+    /**
+     * @brief Pick the representation of a file for the request's Accept-Encoding.
+     *
+     * Precompressed "foo.zst" / "foo.gz" siblings are preferred; text files
+     * between MIN_COMPRESS_SIZE and MAX_COMPRESS_SIZE are compressed on the
+     * fly (gzip, deflate, and zstd when built with libzstd). The client's
+     * q-values decide between candidates.
+     *
+     * @param req The HTTP request, consulted for Accept-Encoding.
+     * @param file_path The path to the file being requested.
+     * @param size The size of the file.
+     * @return EncodingChoice The chosen representation.
+     */
+    auto negotiate_file_encoding(const ArenaRequest& req,
+                                 const fs::path& file_path,
+                                 std::uint64_t size) -> EncodingChoice;
+
+    /**
+     * @brief Serve a precompressed sibling of a file.
+     *
+     * @param req The HTTP request, consulted for validators and Range/If-Range.
+     * @param file_path The path to the file being requested.
+     * @param choice The negotiated coding and sibling.
+     * @param res The HTTP response object to populate.
+     * @param file The file body to attach the sibling to.
+     */
+    void handle_precompressed_request(const ArenaRequest& req,
+                                      const fs::path& file_path,
+                                      const EncodingChoice& choice,
+                                      ArenaResponse& res,
+                                      FileTransfer& file);
+
+    /**
+     * @brief Serve a dynamically compressed variant of a file.
+     *
+     * The variant comes from the variant cache, or is compressed from the
+     * hot-file cache entry or the file and then cached.
      *
+     * @param req The HTTP request, consulted for validators and Range/If-Range.
      * @param file_path The path to the file being requested.
+     * @param coding The negotiated coding.
+     * @param etag The entity tag of the uncompressed file.
+     * @param mtime The modification time of the file.
+     * @param cached The hot-file cache entry of the file, nullptr to read the file.
      * @param res The HTTP response object to populate.
-     * @param socket The TCP socket used for sending the file content.
+     * @param file The file body to attach the variant to.
+     * @return true if the response is complete, false if the file does not
+     *         compress and must be sent as it is.
+     */
+    auto respond_with_compressed(const ArenaRequest& req,
+                                 const fs::path& file_path,
+                                 ContentCoding coding,
+                                 const std::string& etag,
+                                 std::time_t mtime,
+                                 const CachedFile* cached,
+                                 ArenaResponse& res,
+                                 FileTransfer& file) -> bool;
+
+    /**
+     * @brief Set the digest fields of an identity file response, if the digest is known.
+     *
+     * Both Repr-Digest (RFC 9530) and the older Digest (RFC 3230) are set;
+     * they describe the whole file, also on a 206 response.
+     *
+     * @param key The normalized path of the file.
+     * @param size The size of the file being sent.
+     * @param mtime_ns The modification time of the file being sent, in nanoseconds.
+     * @param inode The inode of the file being sent.
+     * @param res The HTTP response object to modify.
+     */
+    void set_digest_fields(const std::string& key,
+                           std::uint64_t size,
+                           std::int64_t mtime_ns,
+                           std::uint64_t inode,
+                           ArenaResponse& res);
+
+    /**
+     * @brief Apply Range/If-Range to a file response and set its length.
+     *
+     * @param req The HTTP request, consulted for Range/If-Range.
+     * @param file_path The path to the file being requested, for logging.
+     * @param res The HTTP response object to modify.
+     * @param file The attached file body.
+     * @param etag The entity tag the If-Range validator is compared with.
      */
-    void handle_file_request(const fs::path& file_path,
-                             http::response<http::string_body>& res,
-                             tcp::socket& socket);
+    void finish_file_response(const ArenaRequest& req,
+                              const fs::path& file_path,
+                              ArenaResponse& res,
+                              FileTransfer& file,
+                              const std::string& etag);
 
     /**
-     * @brief Configure the HTTP response for a file download.
+     * @brief Restrict a file response to the requested byte ranges.
      *
-     * This function sets the necessary headers for the given file, such as
-     * the content type and disposition.
+     * @param ranges The satisfiable ranges of the file, in request order.
+     * @param res The HTTP response object to modify.
+     * @param file The opened file body.
+     */
+    void configure_response_for_ranges(const std::vector<ByteRange>& ranges,
+                                       ArenaResponse& res,
+                                       FileTransfer& file);
+
+    /**
+     * @brief Configure the HTTP response for a file.
+     *
+     * This function sets the content type and disposition of the given
+     * file from its extension: media, text and documents a browser can
+     * show are served inline, everything else as an attachment.
      *
      * @param file_path The path of the file being requested.
      * @param res The HTTP response object to modify.
      */
-    void configure_response_for_file(const fs::path& file_path, http::response<http::string_body>& res);
+    void configure_response_for_file(const fs::path& file_path, ArenaResponse& res);
 
     /**
-     * @brief Send the content of a file in chunks to the client.
+     * @brief Send file bodies through io_uring instead of sendfile().
      *
-     * This function reads the requested file's contents and streams it
-     * to the client over the provided socket.
+     * Must be called before run_server(). Worth it for files which are not
+     * in the page cache, where sendfile() blocks a worker thread on disk
+     * reads; page-cache-hot files are served as fast by sendfile(), which is
+     * why the backend is opt-in. Falls back to sendfile() when io_uring is
+     * unavailable.
      *
-     * @param file The input file stream of the file being sent.
-     * @param res The HTTP response object to populate.
-     * @param socket The TCP socket used for sending the file content.
+     * @return true if io_uring is in use
+     */
+    auto enable_io_uring() -> bool;
+
+    /**
+     * @brief Load media type overrides from a mime.types style file.
+     *
+     * Must be called before run_server(). Overrides take precedence over
+     * the built-in extension table.
+     *
+     * @param file Path of the file.
+     * @return true if the file could be read
+     */
+    auto load_mime_types(const std::string& file) -> bool;
+
+    /**
+     * @brief Accept connections on SO_REUSEPORT shards instead of one acceptor.
+     *
+     * Must be called before run_server(). Each shard owns a listening socket
+     * and an io_context run by one thread, so accepting needs no shared lock
+     * and a connection never moves between threads. The shared I/O context
+     * then only runs signals, inotify and io_uring completions, on the thread
+     * calling run_server(). With @p pin_threads shard threads are pinned to
+     * the CPUs the process may run on, one each in turn, and (when built
+     * with libnuma) prefer memory of the CPU's node.
+     *
+     * @param shards Number of shards (0 means one per hardware thread).
+     * @param pin_threads Whether to pin shard threads to CPUs.
+     */
+    void enable_sharding(std::size_t shards, bool pin_threads);
+
+    /**
+     * @brief Accept PUT and multipart POST uploads below the root.
+     *
+     * Must be called before run_server(). Without it both methods are
+     * answered with 405.
+     *
+     * @param limit Largest accepted body in bytes (0 means DEFAULT_UPLOAD_LIMIT).
+     */
+    void enable_uploads(std::uint64_t limit);
+
+    /**
+     * @brief Keep SHA-256 digests of the served files.
+     *
+     * Must be called before run_server(). A background pool hashes the tree
+     * (see DigestIndex); file responses then carry Repr-Digest and Digest
+     * fields once their file is hashed, and listings show the digests.
+     *
+     * @param store The file the digests persist in, empty to keep them in memory.
+     * @param threads The number of hashing threads (0 means DigestIndex::DEFAULT_THREADS).
+     * @param rate The read rate of all hashing threads in bytes per second (0 means unlimited).
      */
-    void send_file_content(std::ifstream& file, http::response<http::string_body>& res, tcp::socket& socket);
+    void enable_digests(std::string store, std::size_t threads, std::uint64_t rate);
 
     /**
      * @brief Run the server to start accepting connections.
      *
-     * This function enters the server's main loop, accepting and
-     * processing incoming requests as they arrive.
+     * This function opens the acceptor, starts the asynchronous accept loop
+     * and runs the I/O context on the configured number of worker threads.
+     * In sharded mode it opens the shards and runs one thread per shard
+     * instead. It blocks until the server is stopped.
      */
     void run_server();
 
+    /**
+     * @brief Open the listening sockets of the shards.
+     *
+     * @param endpoint The address every shard binds with SO_REUSEPORT.
+     */
+    void open_shards(const tcp::endpoint& endpoint);
+
+    /**
+     * @brief Stop the server.
+     *
+     * Closes the acceptor and stops the I/O context, which makes every
+     * worker thread return from run_server(). Safe to call from any thread.
+     */
+    void stop_server();
+
+    /**
+     * @brief Accept the next incoming connection.
+     *
+     * Every accepted socket gets its own strand on the acceptor's I/O
+     * context, so the handlers of one session never run concurrently while
+     * different sessions run in parallel.
+     *
+     * @param acceptor The listening socket, m_ACCEPTOR or one of a shard.
+     */
+    void do_accept(tcp::acceptor& acceptor);
+
+    /**
+     * @brief Completion handler for the asynchronous accept.
+     *
+     * Spawns a new SHSession for the accepted socket and queues the next accept.
+     *
+     * @param acceptor The listening socket which accepted the connection.
+     * @param ec The error code of the accept operation.
+     * @param socket The accepted client socket.
+     */
+    void on_accept(tcp::acceptor& acceptor, beast::error_code ec, tcp::socket socket);
+
     /**
      * @brief Root Path
      *
@@ -164,4 +746,165 @@ class SHServer {
      * The I/O context for managing asynchronous operations in the server.
      */
     net::io_context m_DEFAULT_IOC;
+
+    /**
+     * @brief Worker Threads
+     *
+     * The number of threads that run m_DEFAULT_IOC.
+     */
+    std::size_t m_THREADS;
+
+    /**
+     * @brief Acceptor
+     *
+     * The listening socket which accepts incoming connections.
+     */
+    tcp::acceptor m_ACCEPTOR;
+
+    /**
+     * @brief Signals
+     *
+     * SIGINT/SIGTERM handler which stops the server gracefully.
+     */
+    net::signal_set m_SIGNALS;
+
+    /**
+     * @brief io_uring Backend
+     *
+     * Batched file reads and socket writes for file bodies, disabled unless
+     * enable_io_uring() succeeded.
+     */
+    UringBackend m_URING;
+
+    /**
+     * @brief Inotify Watcher
+     *
+     * Reports changes in watched directories, used to invalidate caches.
+     */
+    InotifyWatcher m_WATCHER;
+
+    /**
+     * @brief Listing Cache
+     *
+     * Rendered directory listings, invalidated through m_WATCHER. Disabled
+     * when inotify is unavailable.
+     */
+    ListingCache m_LISTING_CACHE;
+
+    /**
+     * @brief Stat Cache
+     *
+     * Type and metadata of recently resolved paths, invalidated through
+     * m_WATCHER or after a short TTL.
+     */
+    StatCache m_STAT_CACHE;
+
+    /**
+     * @brief Path Filter
+     *
+     * Negative lookups for the served tree, indexed in the background.
+     */
+    PathFilter m_PATH_FILTER;
+
+    /**
+     * @brief Digest Index
+     *
+     * SHA-256 digests of the served files, hashed in the background.
+     * Disabled unless enable_digests() was called.
+     */
+    DigestIndex m_DIGESTS;
+
+    /**
+     * @brief Search Index
+     *
+     * Names of every path below the root, indexed in the background and
+     * kept current through m_WATCHER. Disabled when inotify is unavailable.
+     */
+    SearchIndex m_SEARCH;
+
+    /**
+     * @brief Hot File Cache
+     *
+     * Content of small, popular files, invalidated through m_WATCHER.
+     * Disabled when inotify is unavailable.
+     */
+    HotFileCache m_FILE_CACHE;
+
+    /**
+     * @brief Variant Cache
+     *
+     * Dynamically compressed files and listings, keyed by their version.
+     */
+    VariantCache m_VARIANT_CACHE;
+
+    /**
+     * @brief MIME Types
+     *
+     * Media types and dispositions by extension, with overrides.
+     */
+    MimeTypes m_MIME_TYPES;
+
+    /**
+     * @brief Metrics
+     *
+     * Request counters and phase latencies, served at /__metrics.
+     */
+    Metrics m_METRICS;
+
+    /**
+     * @brief Shard Count
+     *
+     * The number of SO_REUSEPORT acceptor shards, 0 for a single acceptor.
+     */
+    std::size_t m_SHARD_COUNT = 0;
+
+    /**
+     * @brief Pin Shard Threads
+     *
+     * Whether shard threads are pinned to CPUs.
+     */
+    bool m_PIN_THREADS = false;
+
+    /**
+     * @brief Acceptor Shards
+     *
+     * The listening sockets and I/O contexts of sharded mode.
+     */
+    std::vector<std::unique_ptr<AcceptorShard>> m_SHARDS;
+
+    /**
+     * @brief Keep-Alive Timeout
+     *
+     * How long a persistent connection may stay idle (or take to send one
+     * request) before the session closes it.
+     */
+    std::chrono::seconds m_KEEP_ALIVE_TIMEOUT {30};
+
+    /**
+     * @brief Keep-Alive Request Limit
+     *
+     * The maximum number of requests served over a single connection.
+     */
+    std::size_t m_MAX_KEEP_ALIVE_REQUESTS = 1000;
+
+    /**
+     * @brief Request Header Limit
+     *
+     * The maximum size in bytes of the request line and headers.
+     */
+    std::uint32_t m_HEADER_LIMIT = 8 * 1024;
+
+    /**
+     * @brief Request Body Limit
+     *
+     * The maximum size in bytes of a buffered request body.
+     */
+    std::uint64_t m_BODY_LIMIT = 1024 * 1024;
+
+    /**
+     * @brief Upload Limit
+     *
+     * The maximum size in bytes of an uploaded body, 0 while uploads are disabled.
+     */
+    std::uint64_t m_UPLOAD_LIMIT = 0;
 };
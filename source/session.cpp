@@ -0,0 +1,638 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <utility>
+
+#include "session.hpp"
+
+#include <boost/asio/dispatch.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/write.hpp>
+
+#include "logger.hpp"
+#include "server.hpp"
+#include "tracelogger.hpp"
+#include "uring_backend.hpp"
+
+/**
+ * @brief Construct a new SHSession::SHSession object
+ *
+ * @param socket accepted client socket
+ * @param server owning server
+ **/
+SHSession::SHSession(tcp::socket&& socket, SHServer& server)
+    : m_STREAM(std::move(socket))
+    , m_SEND_TIMER(m_STREAM.get_executor())
+    , m_RESPONSE(std::piecewise_construct, std::make_tuple(), std::make_tuple(ArenaAllocator<char>(m_ARENA)))
+    , m_SERVER(server)
+    , m_READ_START(std::chrono::steady_clock::now()) {
+    m_SERVER.m_METRICS.connection_opened();
+}
+
+/**
+ * @brief Destroy the SHSession::SHSession object
+ *
+ **/
+SHSession::~SHSession() {
+    BufferPool::release(m_UPLOAD_BUFFER, Upload::BUFFER_SIZE);
+    m_SERVER.m_METRICS.connection_closed();
+}
+
+/**
+ * @brief Start the session on its strand
+ *
+ **/
+void SHSession::run() {
+    net::dispatch(m_STREAM.get_executor(), beast::bind_front_handler(&SHSession::do_read, shared_from_this()));
+}
+
+/**
+ * @brief Read the next request from the client
+ *
+ **/
+void SHSession::do_read() {
+    // Everything allocated from the arena goes before the arena is reset
+    m_SERIALIZER.reset();
+    m_HEADER_PARSER.reset();
+    m_PARSER.reset();
+    m_UPLOAD_PARSER.reset();
+    m_UPLOAD.reset();
+    ArenaAllocator<char> const ALLOCATOR(m_ARENA);
+    m_RESPONSE = ArenaResponse(std::piecewise_construct, std::make_tuple(), std::make_tuple(ALLOCATOR));
+    m_ARENA.reset();
+    m_FILE.close();
+
+    // A fresh parser per message: the parser is not reusable once done. The body limit depends on
+    // the method and is set once the header is in. Not boost::none: this Beast compares a
+    // Content-Length against a disengaged limit as exceeded
+    m_HEADER_PARSER.emplace(std::piecewise_construct, std::make_tuple(), std::make_tuple(ALLOCATOR));
+    m_HEADER_PARSER->header_limit(m_SERVER.m_HEADER_LIMIT);
+    m_HEADER_PARSER->body_limit(std::numeric_limits<std::uint64_t>::max());
+    m_HEADER_BYTES = 0;
+    m_BODY_BYTES = 0;
+    m_HEAD_REQUEST = false;
+
+    // Time spent idle between keep-alive requests is not read time: only the first request of a
+    // connection (timed from the accept) and pipelined requests already in the buffer are timed
+    if (m_REQUEST_COUNT > 0) {
+        m_READ_START = m_BUFFER.size() > 0 ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point {};
+    }
+
+    // The first request may take as long as the idle timeout, too
+    m_STREAM.expires_after(m_SERVER.m_KEEP_ALIVE_TIMEOUT);
+
+    http::async_read_header(m_STREAM,
+                            m_BUFFER,
+                            *m_HEADER_PARSER,
+                            beast::bind_front_handler(&SHSession::on_read_header, shared_from_this()));
+}
+
+/**
+ * @brief Route the request by method once its header is read
+ *
+ * @param ec error code
+ * @param bytes_transferred number of bytes read
+ **/
+void SHSession::on_read_header(beast::error_code ec, std::size_t bytes_transferred) {
+    if (ec) {
+        on_read(ec, bytes_transferred);
+        return;
+    }
+
+    http::verb const METHOD = m_HEADER_PARSER->get().method();
+    if (METHOD == http::verb::put || METHOD == http::verb::post) {
+        start_upload();
+        return;
+    }
+
+    m_PARSER.emplace(std::move(*m_HEADER_PARSER));
+    m_PARSER->body_limit(m_SERVER.m_BODY_LIMIT);
+    http::async_read(
+        m_STREAM, m_BUFFER, *m_PARSER, beast::bind_front_handler(&SHSession::on_read, shared_from_this()));
+}
+
+/**
+ * @brief Handle the parsed request and start writing the response
+ *
+ * @param ec error code
+ * @param bytes_transferred number of bytes read
+ **/
+void SHSession::on_read(beast::error_code ec, std::size_t bytes_transferred) {
+    boost::ignore_unused(bytes_transferred);
+
+    if (ec == http::error::end_of_stream) {
+        log_debug("Client disconnected: %s\n", ec.message().c_str());
+        do_close();
+        return;
+    }
+
+    if (ec == beast::error::timeout) {
+        log_debug("Connection idle for too long, closing\n");
+        return;
+    }
+
+    if (ec) {
+        log_error("Error: %s\n", ec.message().c_str());
+        return;
+    }
+
+    mark_request_read();
+
+    // The request is handled in place, its fields stay in the arena
+    ArenaRequest& request = m_PARSER->get();
+    ++m_REQUEST_COUNT;
+
+    m_RESPONSE.version(request.version());
+    m_RESPONSE.keep_alive(request.keep_alive());
+    m_HEAD_REQUEST = request.method() == http::verb::head;
+
+    {
+        TRACE_REQUEST
+        m_ROUTE = m_SERVER.handle_request(m_SERVER.m_ROOT_PATH, request, m_RESPONSE, m_FILE);
+    }
+
+    do_write_response();
+}
+
+/**
+ * @brief Start an upload, or answer right away if the server refuses it
+ *
+ **/
+void SHSession::start_upload() {
+    const auto& header = m_HEADER_PARSER->get();
+    ++m_REQUEST_COUNT;
+    m_ROUTE = Route::UPLOAD;
+    m_RESPONSE.version(header.version());
+    m_RESPONSE.keep_alive(header.keep_alive());
+
+    std::optional<std::uint64_t> content_length;
+    if (m_HEADER_PARSER->content_length()) {
+        content_length = *m_HEADER_PARSER->content_length();
+    }
+    m_UPLOAD = m_SERVER.begin_upload(header, content_length, m_RESPONSE);
+    if (!m_UPLOAD) {
+        // The body was never read, the connection cannot carry another request after it
+        if (!m_HEADER_PARSER->is_done()) {
+            m_RESPONSE.keep_alive(false);
+        }
+        mark_request_read();
+        do_write_response();
+        return;
+    }
+
+    bool const EXPECTS_CONTINUE =
+        header.version() >= 11 && beast::iequals(header[http::field::expect], "100-continue");
+    m_UPLOAD_PARSER.emplace(std::move(*m_HEADER_PARSER));
+    m_UPLOAD_PARSER->body_limit(m_SERVER.m_UPLOAD_LIMIT);
+    if (m_UPLOAD_BUFFER == nullptr) {
+        m_UPLOAD_BUFFER = BufferPool::acquire(Upload::BUFFER_SIZE);
+    }
+
+    if (EXPECTS_CONTINUE && !m_UPLOAD_PARSER->is_done()) {
+        static constexpr std::string_view CONTINUE = "HTTP/1.1 100 Continue\r\n\r\n";
+        net::async_write(m_STREAM,
+                         net::buffer(CONTINUE.data(), CONTINUE.size()),
+                         [self = shared_from_this()](beast::error_code ec, std::size_t /*bytes_transferred*/)
+                         {
+                             if (ec) {
+                                 self->on_read(ec, 0);
+                                 return;
+                             }
+                             self->do_read_upload();
+                         });
+        return;
+    }
+
+    do_read_upload();
+}
+
+/**
+ * @brief Read the next piece of the upload body into the upload buffer
+ *
+ **/
+void SHSession::do_read_upload() {
+    if (m_UPLOAD_PARSER->is_done()) {
+        finish_upload();
+        return;
+    }
+
+    auto& body = m_UPLOAD_PARSER->get().body();
+    body.data = m_UPLOAD_BUFFER;
+    body.size = Upload::BUFFER_SIZE;
+
+    // Every read gets the full timeout, a slow sender is not cut off mid-upload
+    m_STREAM.expires_after(m_SERVER.m_KEEP_ALIVE_TIMEOUT);
+
+    http::async_read_some(m_STREAM,
+                          m_BUFFER,
+                          *m_UPLOAD_PARSER,
+                          beast::bind_front_handler(&SHSession::on_read_upload, shared_from_this()));
+}
+
+/**
+ * @brief Pass a piece of the upload body on to the upload
+ *
+ * @param ec error code
+ * @param bytes_transferred number of bytes read
+ **/
+void SHSession::on_read_upload(beast::error_code ec, std::size_t bytes_transferred) {
+    // The buffer is full, which is what this loop waits for
+    if (ec == http::error::need_buffer) {
+        ec = {};
+    }
+    if (ec == http::error::body_limit) {
+        m_UPLOAD->fail(http::status::payload_too_large, "The upload exceeds the size limit");
+        finish_upload();
+        return;
+    }
+    if (ec) {
+        // The client is gone or sent garbage; the upload is discarded with the session
+        on_read(ec, bytes_transferred);
+        return;
+    }
+
+    std::size_t const FILLED = Upload::BUFFER_SIZE - m_UPLOAD_PARSER->get().body().size;
+    if (FILLED > 0 && !m_UPLOAD->write({static_cast<const char*>(m_UPLOAD_BUFFER), FILLED})) {
+        finish_upload();
+        return;
+    }
+
+    do_read_upload();
+}
+
+/**
+ * @brief Finish the upload and answer it
+ *
+ **/
+void SHSession::finish_upload() {
+    mark_request_read();
+
+    // A failed upload leaves the rest of its body unread
+    if (!m_UPLOAD_PARSER->is_done()) {
+        m_RESPONSE.keep_alive(false);
+    }
+    m_SERVER.finish_upload(*m_UPLOAD, m_UPLOAD_PARSER->get(), m_RESPONSE);
+    m_UPLOAD.reset();
+
+    do_write_response();
+}
+
+/**
+ * @brief Record the read phase of the request
+ *
+ **/
+void SHSession::mark_request_read() {
+    auto const NOW = std::chrono::steady_clock::now();
+    if (m_READ_START != std::chrono::steady_clock::time_point {}) {
+        m_SERVER.m_METRICS.record_latency(Phase::READ, NOW - m_READ_START);
+    }
+    m_SEND_START = NOW;
+}
+
+/**
+ * @brief Write the response
+ *
+ **/
+void SHSession::do_write_response() {
+    // Handlers may force the connection closed; otherwise honour the client and the request limit
+    bool const KEEP_ALIVE = m_RESPONSE.keep_alive() && m_REQUEST_COUNT < m_SERVER.m_MAX_KEEP_ALIVE_REQUESTS;
+    m_RESPONSE.keep_alive(KEEP_ALIVE);
+
+    m_STREAM.expires_after(m_SERVER.m_KEEP_ALIVE_TIMEOUT);
+
+    // A HEAD response announces its body (Content-Length or chunked) without sending any of it.
+    // HTTP/1.0 has no chunking: the length of a stream is left out
+    if (m_HEAD_REQUEST) {
+        if (m_FILE.is_streaming()) {
+            m_RESPONSE.chunked(m_RESPONSE.version() >= 11);
+        } else if (!m_FILE.is_open() && m_RESPONSE.result() != http::status::not_modified) {
+            m_RESPONSE.prepare_payload();
+        }
+        m_RESPONSE.body().clear();
+        m_FILE.close();
+        m_SERIALIZER.emplace(m_RESPONSE);
+        http::async_write_header(
+            m_STREAM, *m_SERIALIZER, beast::bind_front_handler(&SHSession::on_write, shared_from_this()));
+        return;
+    }
+
+    if (m_FILE.is_open()) {
+        // Content-Length was set by the file handler, only the header goes through Beast
+        m_SERIALIZER.emplace(m_RESPONSE);
+        http::async_write_header(
+            m_STREAM, *m_SERIALIZER, beast::bind_front_handler(&SHSession::on_write_header, shared_from_this()));
+        return;
+    }
+
+    if (m_FILE.is_streaming()) {
+        m_RESPONSE.chunked(true);
+        m_SERIALIZER.emplace(m_RESPONSE);
+        http::async_write_header(
+            m_STREAM, *m_SERIALIZER, beast::bind_front_handler(&SHSession::on_write_header, shared_from_this()));
+        return;
+    }
+
+    // A 304 has no body and must not announce one
+    if (m_RESPONSE.result() != http::status::not_modified) {
+        m_RESPONSE.prepare_payload();
+    }
+    http::async_write(
+        m_STREAM, m_RESPONSE, beast::bind_front_handler(&SHSession::on_write, shared_from_this()));
+}
+
+/**
+ * @brief Start sending the file body once the header is out
+ *
+ * @param ec error code
+ * @param bytes_transferred number of header bytes written
+ **/
+void SHSession::on_write_header(beast::error_code ec, std::size_t bytes_transferred) {
+    m_HEADER_BYTES = bytes_transferred;
+    if (ec) {
+        on_write(ec, bytes_transferred);
+        return;
+    }
+
+    if (m_FILE.is_streaming()) {
+        do_write_chunk();
+        return;
+    }
+
+    beast::error_code nb_ec;
+    m_STREAM.socket().native_non_blocking(true, nb_ec);
+    if (nb_ec) {
+        on_write(nb_ec, 0);
+        return;
+    }
+
+    // Without a free registered buffer this transfer simply uses sendfile
+    if (m_SERVER.m_URING.is_enabled() && m_FILE.native_handle() != -1) {
+        m_URING_BUFFER = m_SERVER.m_URING.acquire_buffer();
+        m_URING_POS = 0;
+        m_URING_END = 0;
+    }
+
+    do_send_file();
+}
+
+/**
+ * @brief Write the next piece of the streamed body
+ *
+ **/
+void SHSession::do_write_chunk() {
+    m_CHUNK.clear();
+    bool const MORE = m_FILE.next_chunk(m_CHUNK);
+
+    // Every chunk gets the full timeout, a slow reader is not cut off mid-listing
+    m_STREAM.expires_after(m_SERVER.m_KEEP_ALIVE_TIMEOUT);
+
+    if (MORE) {
+        net::async_write(m_STREAM,
+                         http::make_chunk(net::buffer(m_CHUNK)),
+                         beast::bind_front_handler(&SHSession::on_write_chunk, shared_from_this(), false));
+    } else if (!m_CHUNK.empty()) {
+        net::async_write(m_STREAM,
+                         beast::buffers_cat(http::make_chunk(net::buffer(m_CHUNK)), http::make_chunk_last()),
+                         beast::bind_front_handler(&SHSession::on_write_chunk, shared_from_this(), true));
+    } else {
+        net::async_write(m_STREAM,
+                         http::make_chunk_last(),
+                         beast::bind_front_handler(&SHSession::on_write_chunk, shared_from_this(), true));
+    }
+}
+
+/**
+ * @brief Continue the streamed body once a chunk is out
+ *
+ * @param last whether the body is complete
+ * @param ec error code
+ * @param bytes_transferred number of bytes written
+ **/
+void SHSession::on_write_chunk(bool last, beast::error_code ec, std::size_t bytes_transferred) {
+    m_BODY_BYTES += bytes_transferred;
+    if (ec || last) {
+        on_write(ec, static_cast<std::size_t>(m_HEADER_BYTES + m_BODY_BYTES));
+        return;
+    }
+
+    do_write_chunk();
+}
+
+/**
+ * @brief Send the file body
+ *
+ **/
+void SHSession::do_send_file() {
+    if (m_URING_BUFFER != -1) {
+        do_send_file_uring();
+        return;
+    }
+
+    beast::error_code ec;
+    std::size_t sent_this_turn = 0;
+
+    while (m_FILE.remaining() > 0) {
+        sent_this_turn += m_FILE.send_some(m_STREAM.socket().native_handle(), ec);
+
+        if (ec == net::error::would_block) {
+            do_wait_writable();
+            return;
+        }
+
+        if (ec) {
+            on_write(ec, sent_this_turn);
+            return;
+        }
+
+        if (sent_this_turn >= FILE_TURN_BUDGET && m_FILE.remaining() > 0) {
+            net::post(m_STREAM.get_executor(),
+                      beast::bind_front_handler(&SHSession::do_send_file, shared_from_this()));
+            return;
+        }
+    }
+
+    on_write(ec, sent_this_turn);
+}
+
+/**
+ * @brief Send the file body through io_uring
+ *
+ **/
+void SHSession::do_send_file_uring() {
+    int const SOCKET = m_STREAM.socket().native_handle();
+    auto self = shared_from_this();
+    auto handler = [self](int read_result, int write_result)
+    {
+        net::post(self->m_STREAM.get_executor(),
+                  [self, read_result, write_result] { self->on_uring_complete(read_result, write_result); });
+    };
+
+    // Bytes of the last chunk the socket did not take yet
+    if (m_URING_POS < m_URING_END) {
+        m_SERVER.m_URING.submit_send(SOCKET, m_URING_BUFFER, m_URING_POS, m_URING_END - m_URING_POS, handler);
+        return;
+    }
+
+    beast::error_code ec;
+    std::size_t const SENT = m_FILE.send_some(SOCKET, ec, true);
+    if (ec == net::error::would_block) {
+        do_wait_writable();
+        return;
+    }
+    if (ec || m_FILE.remaining() == 0) {
+        on_write(ec, SENT);
+        return;
+    }
+
+    std::uint64_t offset = 0;
+    std::uint64_t length = 0;
+    if (!m_FILE.pending_file_range(offset, length)) {
+        m_SERVER.m_URING.release_buffer(std::exchange(m_URING_BUFFER, -1));
+        do_send_file();
+        return;
+    }
+
+    auto const CHUNK = static_cast<std::size_t>(std::min<std::uint64_t>(length, UringBackend::BUFFER_SIZE));
+    m_SERVER.m_URING.submit_read_send(m_FILE.native_handle(), offset, CHUNK, SOCKET, m_URING_BUFFER, handler);
+}
+
+/**
+ * @brief Account for a finished io_uring chunk and queue the next one
+ *
+ * @param read_result bytes read or -errno
+ * @param write_result bytes written or -errno
+ **/
+void SHSession::on_uring_complete(int read_result, int write_result) {
+    if (m_URING_POS == m_URING_END) {
+        if (read_result == -EINVAL || read_result == -EOPNOTSUPP || read_result == -EBUSY) {
+            // Nothing of this chunk was consumed, sendfile takes over where it stopped
+            log_debug("io_uring read refused (%s), using sendfile\n", std::strerror(-read_result));
+            m_SERVER.m_URING.release_buffer(std::exchange(m_URING_BUFFER, -1));
+            do_send_file();
+            return;
+        }
+        if (read_result <= 0) {
+            // File shrank underneath us, nothing more can be sent
+            on_write(read_result == 0 ? beast::error_code(net::error::eof)
+                                      : beast::error_code(-read_result, boost::system::system_category()),
+                     0);
+            return;
+        }
+        m_FILE.consume_file_bytes(static_cast<std::uint64_t>(read_result));
+        m_URING_POS = 0;
+        m_URING_END = static_cast<std::size_t>(read_result);
+    }
+
+    if (write_result == -EAGAIN || write_result == -EBUSY) {
+        do_wait_writable();
+        return;
+    }
+    if (write_result < 0 && write_result != -ECANCELED) {
+        on_write(beast::error_code(-write_result, boost::system::system_category()), 0);
+        return;
+    }
+
+    // -ECANCELED: a short read broke the link, the bytes read are sent on their own
+    if (write_result > 0) {
+        m_URING_POS += static_cast<std::size_t>(write_result);
+        m_FILE.mark_sent(static_cast<std::uint64_t>(write_result));
+    }
+    do_send_file_uring();
+}
+
+/**
+ * @brief Wait for room in the socket, cancelling the wait after the timeout
+ *
+ **/
+void SHSession::do_wait_writable() {
+    // Every wait gets the full timeout, a slow reader is not cut off mid-file
+    m_SEND_TIMER.expires_after(m_SERVER.m_KEEP_ALIVE_TIMEOUT);
+    auto self = shared_from_this();
+    m_SEND_TIMER.async_wait(
+        [self](beast::error_code ec)
+        {
+            // A timer re-armed meanwhile belongs to a later wait
+            if (!ec && self->m_SEND_TIMER.expiry() <= net::steady_timer::clock_type::now()) {
+                beast::error_code ignored;
+                self->m_STREAM.socket().cancel(ignored);
+            }
+        });
+    m_STREAM.socket().async_wait(tcp::socket::wait_write,
+                                 beast::bind_front_handler(&SHSession::on_socket_writable, self));
+}
+
+/**
+ * @brief Resume sending once the socket has room again
+ *
+ * @param ec error code
+ **/
+void SHSession::on_socket_writable(beast::error_code ec) {
+    // Cancelled by the timer when it expired before the socket had room
+    bool const TIMED_OUT = m_SEND_TIMER.cancel() == 0 && ec == net::error::operation_aborted;
+    if (TIMED_OUT) {
+        log_debug("Client stopped reading, closing\n");
+        on_write(beast::error::timeout, 0);
+        return;
+    }
+    if (ec) {
+        on_write(ec, 0);
+        return;
+    }
+
+    do_send_file();
+}
+
+/**
+ * @brief Finish the exchange once the response is written
+ *
+ * @param ec error code
+ * @param bytes_transferred number of bytes written
+ **/
+void SHSession::on_write(beast::error_code ec, std::size_t bytes_transferred) {
+    if (m_URING_BUFFER != -1) {
+        m_SERVER.m_URING.release_buffer(std::exchange(m_URING_BUFFER, -1));
+    }
+
+    // File bodies are written in many steps, their progress is in m_FILE
+    std::uint64_t const BYTES = m_FILE.is_open()
+        ? m_HEADER_BYTES + m_FILE.content_length() - m_FILE.remaining()
+        : bytes_transferred;
+    m_SERVER.m_METRICS.record_latency(Phase::SEND, std::chrono::steady_clock::now() - m_SEND_START);
+    m_SERVER.m_METRICS.count_request(m_ROUTE, m_RESPONSE.result_int(), BYTES);
+
+    if (ec) {
+        if (ec == beast::error::timeout) {
+            return;
+        }
+        if (ec == net::error::broken_pipe || ec == net::error::connection_reset) {
+            log_error("Client disconnected: %s\n", ec.message().c_str());
+        } else {
+            log_error("Error: %s\n", ec.message().c_str());
+        }
+        return;
+    }
+
+    m_FILE.close();
+
+    if (!m_RESPONSE.keep_alive()) {
+        do_close();
+        return;
+    }
+
+    do_read();
+}
+
+/**
+ * @brief Send a TCP shutdown to the client
+ *
+ **/
+void SHSession::do_close() {
+    beast::error_code ec;
+    m_STREAM.socket().shutdown(tcp::socket::shutdown_send, ec);
+}
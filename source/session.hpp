@@ -0,0 +1,264 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+
+#include "arena.hpp"
+#include "file_transfer.hpp"
+#include "metrics.hpp"
+#include "upload.hpp"
+
+namespace beast = boost::beast;
+namespace http = beast::http;
+namespace net = boost::asio;
+using tcp = boost::asio::ip::tcp;
+
+class SHServer;
+
+class SHSession : public std::enable_shared_from_this<SHSession> {
+    /**
+     * @brief SHSession - a single client connection
+     *
+     * Every accepted socket is owned by one session object. The session reads
+     * the request, hands it to SHServer::handle_request and writes the
+     * response back, all through asynchronous operations on the socket's strand.
+     * The object keeps itself alive through shared_from_this() for as long as an
+     * operation is pending.
+     *
+     * Connections are persistent (HTTP/1.1 keep-alive): after a response is
+     * written the session reads the next request unless the client asked to
+     * close, the per-connection request limit was reached or the connection
+     * stayed idle longer than the keep-alive timeout. Pipelined requests are
+     * already sitting in m_BUFFER and are therefore answered one by one, in order.
+     *
+     * File responses are written as a header followed by the file body, which
+     * m_FILE pushes to the socket with sendfile(2) whenever the socket is writable.
+     * When the server's io_uring backend is enabled, file-backed bodies are
+     * read and written through a registered buffer instead, and fall back to
+     * sendfile(2) if the kernel refuses the operations.
+     *
+     * Streamed bodies (large directory listings) are written with chunked
+     * transfer encoding, one chunk per piece the stream produces, so the
+     * rendering of the next piece waits until the previous one is out.
+     *
+     * A HEAD response is written as its header alone, whatever the body:
+     * the header announces the length (or chunking) the GET would have.
+     *
+     * The header of a request is read first. PUT and POST bodies are then
+     * read through a buffer_body parser into m_UPLOAD_BUFFER, one read at a
+     * time, and handed to the server's Upload; every other request has its
+     * (small, limited) body read into a string. A client which sent
+     * "Expect: 100-continue" is told to go on only once the upload was
+     * accepted.
+     *
+     * The header fields of the request and the response live in m_ARENA,
+     * which is reset before the next request is read, and the read and
+     * upload buffers come from the per-thread BufferPool; a keep-alive
+     * request whose fields fit into the first arena block does not allocate
+     * for them at all.
+     **/
+
+  public:
+    /**
+     * @brief Construct a new SHSession object
+     *
+     * @param socket accepted client socket (moved into the session)
+     * @param server server which handles the parsed requests
+     **/
+    SHSession(tcp::socket&& socket, SHServer& server);
+
+    /**
+     * @brief Destroy the SHSession object, counting the connection as closed
+     *
+     **/
+    ~SHSession();
+
+    SHSession(const SHSession&) = delete;
+    auto operator=(const SHSession&) -> SHSession& = delete;
+
+    /**
+     * @brief Start the session
+     *
+     * Dispatches the first read onto the socket's strand.
+     **/
+    void run();
+
+  private:
+    /**
+     * @brief Start reading a request
+     *
+     **/
+    void do_read();
+
+    /**
+     * @brief Completion handler for async_read_header
+     *
+     * @param ec error code
+     * @param bytes_transferred number of bytes read
+     **/
+    void on_read_header(beast::error_code ec, std::size_t bytes_transferred);
+
+    /**
+     * @brief Completion handler for async_read
+     *
+     * @param ec error code
+     * @param bytes_transferred number of bytes read
+     **/
+    void on_read(beast::error_code ec, std::size_t bytes_transferred);
+
+    /**
+     * @brief Hand a PUT or POST to the server and start reading its body
+     *
+     **/
+    void start_upload();
+
+    /**
+     * @brief Read the next piece of an upload body
+     *
+     **/
+    void do_read_upload();
+
+    /**
+     * @brief Completion handler for a piece of an upload body
+     *
+     * @param ec error code
+     * @param bytes_transferred number of bytes read
+     **/
+    void on_read_upload(beast::error_code ec, std::size_t bytes_transferred);
+
+    /**
+     * @brief Let the server finish the upload and write its response
+     *
+     **/
+    void finish_upload();
+
+    /**
+     * @brief Record the read phase once a request is complete
+     *
+     **/
+    void mark_request_read();
+
+    /**
+     * @brief Write m_RESPONSE, with the file or stream attached to m_FILE
+     *
+     **/
+    void do_write_response();
+
+    /**
+     * @brief Completion handler for async_write
+     *
+     * @param ec error code
+     * @param bytes_transferred number of bytes written
+     **/
+    void on_write(beast::error_code ec, std::size_t bytes_transferred);
+
+    /**
+     * @brief Completion handler for the header of a file response
+     *
+     * @param ec error code
+     * @param bytes_transferred number of header bytes written
+     **/
+    void on_write_header(beast::error_code ec, std::size_t bytes_transferred);
+
+    /**
+     * @brief Write the next piece of a streamed body as one chunk
+     *
+     * The last piece is followed by the terminating chunk.
+     **/
+    void do_write_chunk();
+
+    /**
+     * @brief Completion handler for a chunk of a streamed body
+     *
+     * @param last whether the terminating chunk was part of the write
+     * @param ec error code
+     * @param bytes_transferred number of bytes written
+     **/
+    void on_write_chunk(bool last, beast::error_code ec, std::size_t bytes_transferred);
+
+    /**
+     * @brief Push file bytes to the socket until it would block
+     *
+     * Yields back to the executor after FILE_TURN_BUDGET bytes, so a fast
+     * client downloading a large file cannot starve the other sessions.
+     **/
+    void do_send_file();
+
+    /**
+     * @brief Push the next chunk of the file body through io_uring
+     *
+     * In-memory prefixes are sent directly; file ranges go out as linked
+     * read/write pairs through m_URING_BUFFER, one chunk in flight at a time.
+     **/
+    void do_send_file_uring();
+
+    /**
+     * @brief Completion handler of an io_uring chunk
+     *
+     * @param read_result bytes read, or -errno
+     * @param write_result bytes written, or -errno
+     **/
+    void on_uring_complete(int read_result, int write_result);
+
+    /**
+     * @brief Wait until the socket is writable, for at most the keep-alive timeout
+     *
+     * The file body bypasses m_STREAM, whose timeout only covers its own
+     * reads and writes, so the wait is bounded by m_SEND_TIMER: a client
+     * which stops reading loses the connection instead of holding it open.
+     **/
+    void do_wait_writable();
+
+    /**
+     * @brief Completion handler for waiting until the socket is writable
+     *
+     * @param ec error code
+     **/
+    void on_socket_writable(beast::error_code ec);
+
+    /**
+     * @brief Gracefully shut down the connection
+     *
+     **/
+    void do_close();
+
+    /**
+     * @brief Bytes sent from a file before yielding to other handlers
+     *
+     **/
+    static constexpr std::size_t FILE_TURN_BUDGET = 16 * 1024 * 1024;
+
+    beast::tcp_stream m_STREAM;
+    net::steady_timer m_SEND_TIMER;
+    PooledFlatBuffer m_BUFFER;
+    ConnectionArena m_ARENA;
+    std::optional<http::request_parser<http::empty_body, ArenaAllocator<char>>> m_HEADER_PARSER;
+    std::optional<http::request_parser<http::string_body, ArenaAllocator<char>>> m_PARSER;
+    std::optional<http::request_parser<http::buffer_body, ArenaAllocator<char>>> m_UPLOAD_PARSER;
+    std::unique_ptr<Upload> m_UPLOAD;
+    void* m_UPLOAD_BUFFER = nullptr;
+    ArenaResponse m_RESPONSE;
+    std::optional<http::response_serializer<http::string_body, ArenaFields>> m_SERIALIZER;
+    FileTransfer m_FILE;
+    SHServer& m_SERVER;
+    std::size_t m_REQUEST_COUNT = 0;
+    Route m_ROUTE = Route::NOT_FOUND;
+    bool m_HEAD_REQUEST = false;
+    std::chrono::steady_clock::time_point m_READ_START;
+    std::chrono::steady_clock::time_point m_SEND_START;
+    std::uint64_t m_HEADER_BYTES = 0;
+    std::uint64_t m_BODY_BYTES = 0;
+    std::string m_CHUNK;
+    int m_URING_BUFFER = -1;
+    std::size_t m_URING_POS = 0;
+    std::size_t m_URING_END = 0;
+};
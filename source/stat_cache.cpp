@@ -0,0 +1,146 @@
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <mutex>
+#include <string>
+
+#include "stat_cache.hpp"
+
+#include <sys/stat.h>
+
+/**
+ * @brief Anonymous namespace for helper functions
+ *
+ **/
+namespace {
+    /**
+     * @brief stat(2) a path
+     *
+     * @param key path
+     * @return FileInfo metadata
+     **/
+    auto stat_path(const std::string& key) -> FileInfo {
+        FileInfo info;
+
+        struct stat file_stat {};
+        if (key.empty() || ::stat(key.c_str(), &file_stat) != 0) {
+            return info;
+        }
+
+        if (S_ISREG(file_stat.st_mode)) {
+            info.kind = FileKind::REGULAR;
+        } else if (S_ISDIR(file_stat.st_mode)) {
+            info.kind = FileKind::DIRECTORY;
+        } else {
+            info.kind = FileKind::OTHER;
+        }
+        info.size = static_cast<std::uint64_t>(file_stat.st_size);
+        info.mtime = file_stat.st_mtime;
+        info.mtime_ns = static_cast<std::int64_t>(file_stat.st_mtim.tv_sec) * 1000000000 + file_stat.st_mtim.tv_nsec;
+        info.inode = static_cast<std::uint64_t>(file_stat.st_ino);
+        return info;
+    }
+}    // namespace
+
+/**
+ * @brief Normalize a path
+ *
+ * @param path path
+ * @return std::string key
+ **/
+auto normalize_path(const fs::path& path) -> std::string {
+    fs::path normal = path.lexically_normal();
+    if (normal.filename() == "." && normal.has_parent_path()) {
+        normal = normal.parent_path();
+    }
+    return normal.string();
+}
+
+/**
+ * @brief Construct a new StatCache::StatCache object
+ *
+ * @param ttl entry lifetime
+ * @param max_entries capacity
+ **/
+StatCache::StatCache(std::chrono::milliseconds ttl, std::size_t max_entries)
+    : m_TTL(ttl)
+    , m_SHARD_CAPACITY(max_entries / SHARDS + 1) {}
+
+/**
+ * @brief Resolve a path
+ *
+ * @param key normalized path
+ * @return FileInfo metadata
+ **/
+auto StatCache::lookup(const std::string& key) -> FileInfo {
+    if (m_TTL.count() == 0) {
+        return stat_path(key);
+    }
+
+    Shard& shard = shard_of(key);
+    auto const NOW = std::chrono::steady_clock::now();
+    std::uint64_t generation = 0;
+    {
+        std::lock_guard<std::mutex> const LOCK(shard.mutex);
+        auto const IT = shard.entries.find(key);
+        if (IT != shard.entries.end() && IT->second.expires > NOW) {
+            return IT->second.info;
+        }
+        generation = shard.generation;
+    }
+
+    FileInfo const INFO = stat_path(key);
+
+    std::lock_guard<std::mutex> const LOCK(shard.mutex);
+    if (generation != shard.generation) {
+        return INFO;
+    }
+    if (shard.entries.size() >= m_SHARD_CAPACITY && shard.entries.count(key) == 0) {
+        // Expired entries go first; a shard full of live ones loses an arbitrary entry
+        for (auto it = shard.entries.begin(); it != shard.entries.end();) {
+            it = it->second.expires <= NOW ? shard.entries.erase(it) : std::next(it);
+        }
+        if (shard.entries.size() >= m_SHARD_CAPACITY) {
+            shard.entries.erase(shard.entries.begin());
+        }
+    }
+    shard.entries[key] = Entry {INFO, NOW + m_TTL};
+    return INFO;
+}
+
+/**
+ * @brief Drop one entry
+ *
+ * @param key normalized path
+ **/
+void StatCache::invalidate(const std::string& key) {
+    Shard& shard = shard_of(key);
+
+    std::lock_guard<std::mutex> const LOCK(shard.mutex);
+    ++shard.generation;
+    shard.entries.erase(key);
+}
+
+/**
+ * @brief Drop everything
+ *
+ **/
+void StatCache::clear() {
+    for (auto& shard : m_SHARDS) {
+        std::lock_guard<std::mutex> const LOCK(shard.mutex);
+        ++shard.generation;
+        shard.entries.clear();
+    }
+}
+
+/**
+ * @brief Shard of a key
+ *
+ * @param key normalized path
+ * @return Shard& shard
+ **/
+auto StatCache::shard_of(const std::string& key) -> Shard& {
+    return m_SHARDS[std::hash<std::string> {}(key) % SHARDS];
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include <boost/filesystem.hpp>
+
+namespace fs = boost::filesystem;
+
+/**
+ * @brief What a path resolves to
+ *
+ **/
+enum class FileKind : std::uint8_t
+{
+    MISSING,    // does not exist (or cannot be stat'ed)
+    REGULAR,
+    DIRECTORY,
+    OTHER    // sockets, fifos, devices: never served
+};
+
+/**
+ * @brief Metadata of a resolved path
+ *
+ **/
+struct FileInfo {
+    FileKind kind = FileKind::MISSING;
+    std::uint64_t size = 0;
+    std::int64_t mtime_ns = 0;
+    std::time_t mtime = 0;
+    std::uint64_t inode = 0;
+};
+
+/**
+ * @brief Normalize a path into a cache key
+ *
+ * @param path path
+ * @return std::string lexically normal path without a trailing separator
+ **/
+auto normalize_path(const fs::path& path) -> std::string;
+
+class StatCache {
+    /**
+     * @brief StatCache - stat(2) results keyed by normalized path
+     *
+     * Caches the type, size, mtime and inode of a path, including the fact
+     * that it does not exist, for a short time-to-live. The inotify watcher
+     * drops entries as soon as a change is reported, the TTL bounds staleness
+     * for paths in directories which are not watched.
+     *
+     * The map is split into shards with their own mutex, chosen by the hash
+     * of the key, so concurrent requests rarely contend. stat(2) runs outside
+     * the lock; a per-shard generation counter keeps a result which raced
+     * with an invalidation out of the cache.
+     **/
+
+  public:
+    /**
+     * @brief Construct a new Stat Cache object
+     *
+     * @param ttl lifetime of an entry, 0 disables the cache
+     * @param max_entries maximum number of cached paths
+     **/
+    StatCache(std::chrono::milliseconds ttl, std::size_t max_entries);
+
+    /**
+     * @brief Resolve a path, from the cache when possible
+     *
+     * Symbolic links are followed, like fs::is_directory() and friends.
+     *
+     * @param key normalized path (see normalize_path())
+     * @return FileInfo metadata, kind is MISSING if the path does not exist
+     **/
+    auto lookup(const std::string& key) -> FileInfo;
+
+    /**
+     * @brief Drop the entry of one path
+     *
+     * @param key normalized path
+     **/
+    void invalidate(const std::string& key);
+
+    /**
+     * @brief Drop every entry
+     *
+     **/
+    void clear();
+
+  private:
+    /**
+     * @brief Number of independently locked shards
+     *
+     **/
+    static constexpr std::size_t SHARDS = 16;
+
+    struct Entry {
+        FileInfo info;
+        std::chrono::steady_clock::time_point expires;
+    };
+
+    struct Shard {
+        std::mutex mutex;
+        std::uint64_t generation = 0;
+        std::unordered_map<std::string, Entry> entries;
+    };
+
+    /**
+     * @brief Get the shard of a key
+     *
+     * @param key normalized path
+     * @return Shard& shard
+     **/
+    auto shard_of(const std::string& key) -> Shard&;
+
+    std::chrono::milliseconds m_TTL;
+    std::size_t m_SHARD_CAPACITY;
+    std::array<Shard, SHARDS> m_SHARDS;
+};
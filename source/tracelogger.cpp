@@ -1,26 +1,158 @@
-#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
 #include <string>
+#include <vector>
 
 #include "tracelogger.hpp"
 
-#include "_default.hpp"
+#include <unistd.h>
 
-std::string TraceLogger::Indent;
+#include "http_utils.hpp"
+
+namespace {
+    std::atomic<std::uint32_t> g_SAMPLE_RATE {TraceLogger::DEFAULT_SAMPLE_RATE};
+    std::atomic<std::uint64_t> g_NEXT_REQUEST_ID {1};
+
+    thread_local std::uint64_t t_REQUEST_ID = 0;
+    thread_local bool t_SAMPLED = false;
+
+    auto now_ns() -> std::uint64_t {
+        return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                              std::chrono::steady_clock::now().time_since_epoch())
+                                              .count());
+    }
+}  // namespace
+
+TraceLogger::RequestScope::RequestScope(std::uint64_t request_id)
+    : m_PREVIOUS_ID(t_REQUEST_ID)
+    , m_PREVIOUS_SAMPLED(t_SAMPLED) {
+    std::uint32_t const RATE = sample_rate();
+    t_REQUEST_ID = request_id;
+    t_SAMPLED = RATE != 0 && request_id % RATE == 0;
+}
+
+TraceLogger::RequestScope::~RequestScope() {
+    t_REQUEST_ID = m_PREVIOUS_ID;
+    t_SAMPLED = m_PREVIOUS_SAMPLED;
+}
 
 TraceLogger::TraceLogger(const char* filename, const char* funcname, int linenumber)
     : m_FILENAME(filename)
-    , m_FUNCNAME(funcname) {
-    std::cout << GREY_COLOR << "::Trace::  " << BLUE_COLOR << Indent << "Entering " << m_FUNCNAME << "() - ("
-              << m_FILENAME << ":" << linenumber << ")" << RESET_CODE << '\n';
-    if (Indent.empty()) {
-        Indent.append(START_INDENT_SYMBOL);
-    } else {
-        Indent.append(INDENT_SYMBOL);
+    , m_FUNCNAME(funcname)
+    , m_LINE(linenumber)
+    // Spans outside of any request (startup, the run loop) are kept whenever tracing is on
+    , m_ACTIVE(t_REQUEST_ID != 0 ? t_SAMPLED : sample_rate() != 0) {
+    if (m_ACTIVE) {
+        m_START = now_ns();
     }
 }
 
 TraceLogger::~TraceLogger() {
-    Indent.resize(Indent.length() - INDENT_LENGTH);
-    std::cout << GREY_COLOR << "::Trace::  " << CYAN_COLOR << Indent << "Leaving " << m_FUNCNAME << "() - ("
-              << m_FILENAME << ")" << RESET_CODE << '\n';
+    if (!m_ACTIVE) {
+        return;
+    }
+    std::uint64_t const END = now_ns();
+
+    Ring& ring = local_ring();
+    std::lock_guard<std::mutex> const LOCK(ring.mutex);
+    ring.spans[ring.next] = Span {m_FILENAME, m_FUNCNAME, m_LINE, m_START, END - m_START, t_REQUEST_ID};
+    ring.next = (ring.next + 1) % RING_CAPACITY;
+    ring.count = std::min(ring.count + 1, RING_CAPACITY);
+}
+
+void TraceLogger::set_sample_rate(std::uint32_t rate) {
+    g_SAMPLE_RATE.store(rate, std::memory_order_relaxed);
+}
+
+auto TraceLogger::sample_rate() -> std::uint32_t {
+    return g_SAMPLE_RATE.load(std::memory_order_relaxed);
+}
+
+auto TraceLogger::next_request_id() -> std::uint64_t {
+    return g_NEXT_REQUEST_ID.fetch_add(1, std::memory_order_relaxed);
+}
+
+auto TraceLogger::registry() -> Registry& {
+    static Registry instance;
+    return instance;
+}
+
+auto TraceLogger::local_ring() -> Ring& {
+    thread_local std::shared_ptr<Ring> ring;
+    if (!ring) {
+        ring = std::make_shared<Ring>();
+        auto& rings = registry();
+        std::lock_guard<std::mutex> const LOCK(rings.mutex);
+        ring->thread = static_cast<std::uint32_t>(rings.rings.size() + 1);
+        rings.rings.push_back(ring);
+    }
+    return *ring;
+}
+
+void TraceLogger::export_chrome_trace(std::string& out) {
+    struct ThreadSpan {
+        Span span;
+        std::uint32_t thread;
+    };
+    std::vector<ThreadSpan> spans;
+
+    {
+        auto& rings = registry();
+        std::lock_guard<std::mutex> const LOCK(rings.mutex);
+        for (const auto& ring : rings.rings) {
+            std::lock_guard<std::mutex> const RING_LOCK(ring->mutex);
+            std::size_t const FIRST = (ring->next + RING_CAPACITY - ring->count) % RING_CAPACITY;
+            for (std::size_t i = 0; i < ring->count; ++i) {
+                spans.push_back({ring->spans[(FIRST + i) % RING_CAPACITY], ring->thread});
+            }
+        }
+    }
+
+    std::sort(spans.begin(),
+              spans.end(),
+              [](const ThreadSpan& a, const ThreadSpan& b) { return a.span.start_ns < b.span.start_ns; });
+
+    auto const PID = static_cast<long>(::getpid());
+    char number[96];
+    out += "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    bool first = true;
+    for (const auto& entry : spans) {
+        if (!first) {
+            out += ',';
+        }
+        first = false;
+        out += "\n{\"name\":";
+        append_json_string(out, entry.span.function);
+        out += ",\"cat\":\"httpfileserver\",\"ph\":\"X\"";
+        std::snprintf(number,
+                      sizeof(number),
+                      ",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%ld,\"tid\":%u",
+                      static_cast<double>(entry.span.start_ns) / 1000.0,
+                      static_cast<double>(entry.span.duration_ns) / 1000.0,
+                      PID,
+                      entry.thread);
+        out += number;
+        std::snprintf(number,
+                      sizeof(number),
+                      ",\"args\":{\"request\":%llu,\"line\":%d,\"file\":",
+                      static_cast<unsigned long long>(entry.span.request_id),
+                      entry.span.line);
+        out += number;
+        append_json_string(out, entry.span.file);
+        out += "}}";
+    }
+    out += "\n]}\n";
+}
+
+void TraceLogger::clear() {
+    auto& rings = registry();
+    std::lock_guard<std::mutex> const LOCK(rings.mutex);
+    for (const auto& ring : rings.rings) {
+        std::lock_guard<std::mutex> const RING_LOCK(ring->mutex);
+        ring->next = 0;
+        ring->count = 0;
+    }
 }
@@ -1,40 +1,186 @@
 #pragma once
 
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <vector>
 
-#include "_default.hpp"
-
-#ifdef DEBUG
-#    define LOG_TRACE TraceLogger logger(__FILE__, __FUNCTION__, __LINE__);
+#ifdef HTTPFILESERVER_TRACING
+#    define LOG_TRACE TraceLogger trace_span(__FILE__, __FUNCTION__, __LINE__);
+#    define TRACE_REQUEST TraceLogger::RequestScope trace_request(TraceLogger::next_request_id());
 #else
 #    define LOG_TRACE
+#    define TRACE_REQUEST
 #endif
 
 class TraceLogger {
     /**
-     * @brief TraceLogger - use LOG_TRACE for tracing function calls
+     * @brief TraceLogger - use LOG_TRACE to record a span for a function call
+     *
+     * Tracing is compiled in only when HTTPFILESERVER_TRACING is defined (the
+     * httpfileserver_ENABLE_TRACING CMake option); otherwise LOG_TRACE and
+     * TRACE_REQUEST expand to nothing.
      *
+     * A span covers the lifetime of the TraceLogger object: start time,
+     * duration, call site, thread and the id of the request being handled.
+     * Finished spans go into a ring owned by the recording thread, which keeps
+     * the most recent RING_CAPACITY spans. Only every n-th request is sampled
+     * (see set_sample_rate()); spans of other requests cost one thread-local
+     * check. export_chrome_trace() renders all rings as Chrome trace event
+     * JSON, which chrome://tracing and Perfetto load directly.
      **/
 
   public:
-    static std::string Indent;
+    /**
+     * @brief Spans kept per thread
+     *
+     **/
+    static constexpr std::size_t RING_CAPACITY = 4096;
 
     /**
-     * @brief Construct a new Trace Logger object
+     * @brief Requests per sampled request unless set_sample_rate() says otherwise
      *
-     * @param filename logged filename
-     * @param funcname logged function name
-     * @param linenumber logged line number where function called
+     **/
+    static constexpr std::uint32_t DEFAULT_SAMPLE_RATE = 64;
+
+    /**
+     * @brief A finished span
+     *
+     **/
+    struct Span {
+        const char* file = nullptr;
+        const char* function = nullptr;
+        int line = 0;
+        std::uint64_t start_ns = 0;
+        std::uint64_t duration_ns = 0;
+        std::uint64_t request_id = 0;
+    };
+
+    /**
+     * @brief Marks the calling thread as handling one request
+     *
+     * Spans recorded while the scope lives carry its request id, and are
+     * recorded only if the request is sampled. Scopes nest.
+     **/
+    class RequestScope {
+      public:
+        /**
+         * @brief Enter a request
+         *
+         * @param request_id id from next_request_id()
+         **/
+        explicit RequestScope(std::uint64_t request_id);
+
+        /**
+         * @brief Leave the request, restoring the enclosing one
+         *
+         **/
+        ~RequestScope();
+
+        RequestScope(const RequestScope&) = delete;
+        auto operator=(const RequestScope&) -> RequestScope& = delete;
+
+      private:
+        std::uint64_t m_PREVIOUS_ID;
+        bool m_PREVIOUS_SAMPLED;
+    };
+
+    /**
+     * @brief Construct a new Trace Logger object, starting a span
+     *
+     * @param filename source file
+     * @param funcname function name
+     * @param linenumber line of the LOG_TRACE
      **/
     TraceLogger(const char* filename, const char* funcname, int linenumber);
 
     /**
-     * @brief Destroy the Trace Logger object
+     * @brief Destroy the Trace Logger object, recording the span
      *
      **/
     ~TraceLogger();
 
+    TraceLogger(const TraceLogger&) = delete;
+    auto operator=(const TraceLogger&) -> TraceLogger& = delete;
+
+    /**
+     * @brief Trace every n-th request
+     *
+     * @param rate sampling rate, 1 traces all requests, 0 disables tracing
+     **/
+    static void set_sample_rate(std::uint32_t rate);
+
+    /**
+     * @brief Get the sampling rate
+     *
+     * @return std::uint32_t requests per sampled request, 0 if disabled
+     **/
+    static auto sample_rate() -> std::uint32_t;
+
+    /**
+     * @brief Get a fresh request id
+     *
+     * @return std::uint64_t id, never 0
+     **/
+    static auto next_request_id() -> std::uint64_t;
+
+    /**
+     * @brief Render the recorded spans as Chrome trace event JSON
+     *
+     * @param out string the JSON document is appended to
+     **/
+    static void export_chrome_trace(std::string& out);
+
+    /**
+     * @brief Forget all recorded spans
+     *
+     **/
+    static void clear();
+
   private:
+    /**
+     * @brief Spans of one thread, oldest overwritten first
+     *
+     * The mutex is only contended while an export copies the ring.
+     **/
+    struct Ring {
+        std::mutex mutex;
+        std::array<Span, RING_CAPACITY> spans {};
+        std::size_t next = 0;
+        std::size_t count = 0;
+        std::uint32_t thread = 0;
+    };
+
+    /**
+     * @brief Rings of all threads which ever recorded a span
+     *
+     * Rings outlive their threads, so spans of finished threads still export.
+     **/
+    struct Registry {
+        std::mutex mutex;
+        std::vector<std::shared_ptr<Ring>> rings;
+    };
+
+    /**
+     * @brief Get the process-wide ring registry
+     *
+     * @return Registry& registry
+     **/
+    static auto registry() -> Registry&;
+
+    /**
+     * @brief Get the ring of the calling thread, registering it on first use
+     *
+     * @return Ring& ring
+     **/
+    static auto local_ring() -> Ring&;
+
     const char* m_FILENAME;
     const char* m_FUNCNAME;
+    int m_LINE;
+    std::uint64_t m_START = 0;
+    bool m_ACTIVE;
 };
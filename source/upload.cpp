@@ -0,0 +1,502 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include "upload.hpp"
+
+#include <boost/beast/core/string.hpp>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "logger.hpp"
+
+namespace http = beast::http;
+
+/**
+ * @brief Anonymous namespace for helper functions
+ *
+ **/
+namespace {
+    /**
+     * @brief Permissions of uploaded files, before the umask
+     *
+     **/
+    constexpr mode_t UPLOAD_MODE = 0644;
+
+    std::atomic<std::uint64_t> g_TEMP_COUNTER {0};
+
+    /**
+     * @brief Get a fresh hidden name for a temporary file of a directory
+     *
+     * @param dir directory
+     * @return std::string path
+     **/
+    auto temp_name(const fs::path& dir) -> std::string {
+        char name[64];
+        std::uint64_t const NUMBER = g_TEMP_COUNTER.fetch_add(1, std::memory_order_relaxed);
+        std::snprintf(name,
+                      sizeof(name),
+                      ".upload-%ld-%llu",
+                      static_cast<long>(::getpid()),
+                      static_cast<unsigned long long>(NUMBER));
+        return (dir / name).string();
+    }
+
+    /**
+     * @brief Find a header field of a multipart header block
+     *
+     * @param headers header lines separated by CRLF
+     * @param name field name, lowercase
+     * @return std::string_view field value, empty if absent
+     **/
+    auto find_part_header(std::string_view headers, std::string_view name) -> std::string_view {
+        while (!headers.empty()) {
+            std::size_t const END = headers.find("\r\n");
+            std::string_view const LINE = headers.substr(0, END);
+            headers = END == std::string_view::npos ? std::string_view {} : headers.substr(END + 2);
+
+            std::size_t const COLON = LINE.find(':');
+            if (COLON == std::string_view::npos) {
+                continue;
+            }
+            beast::string_view const FIELD(LINE.data(), COLON);
+            if (beast::iequals(FIELD, beast::string_view(name.data(), name.size()))) {
+                std::string_view value = LINE.substr(COLON + 1);
+                while (!value.empty() && (value.front() == ' ' || value.front() == '\t')) {
+                    value.remove_prefix(1);
+                }
+                return value;
+            }
+        }
+        return {};
+    }
+
+    /**
+     * @brief Get the filename parameter of a Content-Disposition value
+     *
+     * filename* is not supported; browsers send filename as UTF-8.
+     *
+     * @param disposition field value
+     * @return std::optional<std::string> file name, empty if there is none
+     **/
+    auto disposition_filename(std::string_view disposition) -> std::optional<std::string> {
+        for (std::size_t at = 0; (at = disposition.find("filename", at)) != std::string_view::npos; ++at) {
+            bool const STARTS_PARAMETER = at == 0 || disposition[at - 1] == ';' || disposition[at - 1] == ' ';
+            std::size_t const EQUALS = at + 8;
+            if (!STARTS_PARAMETER || EQUALS >= disposition.size() || disposition[EQUALS] != '=') {
+                continue;
+            }
+            std::string_view const VALUE = disposition.substr(EQUALS + 1);
+            std::string name;
+            if (!VALUE.empty() && VALUE.front() == '"') {
+                for (std::size_t i = 1; i < VALUE.size() && VALUE[i] != '"'; ++i) {
+                    if (VALUE[i] == '\\' && i + 1 < VALUE.size()) {
+                        ++i;
+                    }
+                    name.push_back(VALUE[i]);
+                }
+            } else {
+                name = std::string(VALUE.substr(0, VALUE.find(';')));
+            }
+            return name;
+        }
+        return std::nullopt;
+    }
+
+    /**
+     * @brief Reduce a client file name to a safe entry name
+     *
+     * Directories are dropped (some clients send full Windows paths).
+     *
+     * @param name file name from the client
+     * @return std::string entry name, empty if none is left or it is unsafe
+     **/
+    auto safe_entry_name(std::string_view name) -> std::string {
+        std::size_t const SLASH = name.find_last_of("/\\");
+        if (SLASH != std::string_view::npos) {
+            name.remove_prefix(SLASH + 1);
+        }
+        if (name.empty() || name == "." || name == "..") {
+            return {};
+        }
+        for (char const CHARACTER : name) {
+            if (static_cast<unsigned char>(CHARACTER) < 0x20) {
+                return {};
+            }
+        }
+        return std::string(name);
+    }
+}  // namespace
+
+/**
+ * @brief Destroy the Upload object
+ *
+ **/
+Upload::~Upload() {
+    discard_temp();
+}
+
+/**
+ * @brief Stream the body into one file
+ *
+ * @param target final path
+ * @param size body length, if known
+ * @param expected expected SHA-256
+ * @return true if the temporary file was created
+ **/
+auto Upload::open_file(const fs::path& target,
+                       std::optional<std::uint64_t> size,
+                       std::optional<Sha256Digest> expected) -> bool {
+    m_EXPECTED = expected;
+    if (m_EXPECTED) {
+        m_HASH.emplace();
+    }
+    return open_temp(target, size);
+}
+
+/**
+ * @brief Stream a multipart body into a directory
+ *
+ * @param dir target directory
+ * @param boundary multipart boundary
+ **/
+void Upload::open_form(const fs::path& dir, std::string_view boundary) {
+    m_FORM = true;
+    m_DIR = dir;
+    m_DELIMITER = "\r\n--";
+    m_DELIMITER.append(boundary);
+    // The first delimiter opens the body without a line break of its own
+    m_PENDING = "\r\n";
+}
+
+/**
+ * @brief Consume body bytes
+ *
+ * @param data bytes
+ * @return true unless failed
+ **/
+auto Upload::write(std::string_view data) -> bool {
+    if (failed()) {
+        return false;
+    }
+    return m_FORM ? write_form(data) : write_temp(data);
+}
+
+/**
+ * @brief Finish the upload
+ *
+ * @return true unless failed
+ **/
+auto Upload::commit() -> bool {
+    if (failed()) {
+        return false;
+    }
+    if (m_FORM) {
+        if (m_FORM_STATE != FormState::EPILOGUE) {
+            fail(http::status::bad_request, "The multipart body ends before its closing boundary");
+        } else if (m_FILES.empty()) {
+            fail(http::status::bad_request, "The form contains no file");
+        }
+        return !failed();
+    }
+    if (m_EXPECTED && m_HASH->finish() != *m_EXPECTED) {
+        fail(http::status::bad_request, "The body does not match its SHA-256 digest");
+        return false;
+    }
+    return finish_temp();
+}
+
+/**
+ * @brief Fail the upload
+ *
+ * @param status status for the client
+ * @param reason message
+ **/
+void Upload::fail(http::status status, std::string reason) {
+    discard_temp();
+    if (!failed()) {
+        m_STATUS = status;
+        m_REASON = std::move(reason);
+    }
+}
+
+/**
+ * @brief Create the temporary file of a target
+ *
+ * @param target final path
+ * @param size expected size
+ * @return true on success
+ **/
+auto Upload::open_temp(const fs::path& target, std::optional<std::uint64_t> size) -> bool {
+    m_TARGET = target;
+    m_TEMP_NAME.clear();
+    m_WRITTEN = 0;
+    fs::path const DIR = target.parent_path();
+
+    int error = EOPNOTSUPP;
+#ifdef O_TMPFILE
+    m_FD = ::open(DIR.c_str(), O_TMPFILE | O_WRONLY | O_CLOEXEC, UPLOAD_MODE);
+    error = errno;
+#endif
+    if (m_FD == -1 && error != EOPNOTSUPP && error != EISDIR && error != EINVAL) {
+        fail_errno(error, "create");
+        return false;
+    }
+    // Filesystems without O_TMPFILE get a hidden name, removed again on failure
+    while (m_FD == -1) {
+        m_TEMP_NAME = temp_name(DIR);
+        m_FD = ::open(m_TEMP_NAME.c_str(), O_CREAT | O_EXCL | O_WRONLY | O_CLOEXEC, UPLOAD_MODE);
+        if (m_FD == -1 && errno != EEXIST) {
+            error = errno;
+            m_TEMP_NAME.clear();
+            fail_errno(error, "create");
+            return false;
+        }
+    }
+
+#ifdef __linux__
+    // Reserving the blocks up front keeps the file contiguous and fails a full disk before any byte is read
+    bool const PREALLOCATE = size && *size > 0;
+    if (PREALLOCATE && ::fallocate(m_FD, 0, 0, static_cast<off_t>(*size)) == -1 && errno != EOPNOTSUPP) {
+        fail_errno(errno, "preallocate");
+        return false;
+    }
+#else
+    static_cast<void>(size);
+#endif
+    return true;
+}
+
+/**
+ * @brief Append bytes to the temporary file
+ *
+ * @param data bytes
+ * @return true on success
+ **/
+auto Upload::write_temp(std::string_view data) -> bool {
+    if (m_HASH) {
+        m_HASH->update(data);
+    }
+    while (!data.empty()) {
+        ssize_t const WRITTEN = ::write(m_FD, data.data(), data.size());
+        if (WRITTEN == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fail_errno(errno, "write");
+            return false;
+        }
+        data.remove_prefix(static_cast<std::size_t>(WRITTEN));
+        m_WRITTEN += static_cast<std::uint64_t>(WRITTEN);
+    }
+    return true;
+}
+
+/**
+ * @brief Rename the temporary file over its target
+ *
+ * @return true on success
+ **/
+auto Upload::finish_temp() -> bool {
+    // A preallocated file is as long as announced; a shorter body must not leave zeros behind
+    if (::ftruncate(m_FD, static_cast<off_t>(m_WRITTEN)) == -1) {
+        fail_errno(errno, "truncate");
+        return false;
+    }
+
+    if (m_TEMP_NAME.empty()) {
+        // An O_TMPFILE gets a name through /proc; rename() then replaces the target atomically
+        std::string const PROC = "/proc/self/fd/" + std::to_string(m_FD);
+        for (;;) {
+            std::string name = temp_name(m_TARGET.parent_path());
+            if (::linkat(AT_FDCWD, PROC.c_str(), AT_FDCWD, name.c_str(), AT_SYMLINK_FOLLOW) == 0) {
+                m_TEMP_NAME = std::move(name);
+                break;
+            }
+            if (errno != EEXIST) {
+                fail_errno(errno, "link");
+                return false;
+            }
+        }
+    }
+
+    struct stat file_stat {};
+    ::fstat(m_FD, &file_stat);
+    struct stat previous {};
+    bool const REPLACED = ::lstat(m_TARGET.c_str(), &previous) == 0;
+
+    if (::rename(m_TEMP_NAME.c_str(), m_TARGET.c_str()) == -1) {
+        fail_errno(errno, "rename");
+        return false;
+    }
+    m_TEMP_NAME.clear();
+    ::close(std::exchange(m_FD, -1));
+
+    std::int64_t const MTIME_NS =
+        static_cast<std::int64_t>(file_stat.st_mtim.tv_sec) * 1000000000 + file_stat.st_mtim.tv_nsec;
+    auto const INODE = static_cast<std::uint64_t>(file_stat.st_ino);
+    m_FILES.push_back({m_TARGET, m_WRITTEN, INODE, MTIME_NS, REPLACED});
+    return true;
+}
+
+/**
+ * @brief Close and remove the temporary file
+ *
+ **/
+void Upload::discard_temp() {
+    if (m_FD != -1) {
+        ::close(std::exchange(m_FD, -1));
+    }
+    if (!m_TEMP_NAME.empty()) {
+        ::unlink(m_TEMP_NAME.c_str());
+        m_TEMP_NAME.clear();
+    }
+}
+
+/**
+ * @brief Fail the upload with the status matching an errno value
+ *
+ * @param error errno value
+ * @param what failed operation
+ **/
+void Upload::fail_errno(int error, const char* what) {
+    log_error("Upload to %s: %s failed: %s\n", m_TARGET.c_str(), what, std::strerror(error));
+    switch (error) {
+        case ENOSPC:
+        case EDQUOT:
+        case EFBIG:
+            fail(http::status::insufficient_storage, "Not enough space for the upload");
+            break;
+        case EACCES:
+        case EPERM:
+        case EROFS:
+            fail(http::status::forbidden, "The target cannot be written");
+            break;
+        case ENOENT:
+        case EISDIR:
+        case ENOTDIR:
+        case ENOTEMPTY:
+            fail(http::status::conflict, "The target conflicts with an existing directory or file");
+            break;
+        case ENAMETOOLONG:
+            fail(http::status::bad_request, "The file name is too long");
+            break;
+        default:
+            fail(http::status::internal_server_error, "The upload could not be stored");
+            break;
+    }
+}
+
+/**
+ * @brief Consume bytes of a multipart body
+ *
+ * Bytes which could be the start of a delimiter are held back until the
+ * next call, so m_PENDING never grows beyond one read plus a delimiter.
+ *
+ * @param data bytes
+ * @return true unless failed
+ **/
+auto Upload::write_form(std::string_view data) -> bool {
+    m_PENDING.append(data);
+    std::string_view const PENDING = m_PENDING;
+    std::size_t consumed = 0;
+
+    bool more = true;
+    while (more && !failed()) {
+        switch (m_FORM_STATE) {
+            case FormState::PREAMBLE:
+            case FormState::BODY: {
+                bool const KEEP = m_FORM_STATE == FormState::BODY && m_PART_HAS_FILE;
+                std::size_t const FOUND = PENDING.find(m_DELIMITER, consumed);
+                if (FOUND == std::string_view::npos) {
+                    std::size_t const HELD = std::min(PENDING.size() - consumed, m_DELIMITER.size() - 1);
+                    std::size_t const READY = PENDING.size() - consumed - HELD;
+                    if (KEEP) {
+                        write_temp(PENDING.substr(consumed, READY));
+                    }
+                    consumed += READY;
+                    more = false;
+                    break;
+                }
+                if (KEEP && write_temp(PENDING.substr(consumed, FOUND - consumed))) {
+                    finish_temp();
+                }
+                consumed = FOUND + m_DELIMITER.size();
+                m_FORM_STATE = FormState::DELIMITER;
+                m_PART_HAS_FILE = false;
+                break;
+            }
+            case FormState::DELIMITER:
+                // The last delimiter is followed by "--", the others by a line break
+                if (PENDING.size() - consumed < 2) {
+                    more = false;
+                } else if (PENDING.substr(consumed, 2) == "--") {
+                    m_FORM_STATE = FormState::EPILOGUE;
+                } else if (PENDING.substr(consumed, 2) == "\r\n") {
+                    consumed += 2;
+                    m_FORM_STATE = FormState::HEADERS;
+                } else {
+                    fail(http::status::bad_request, "Malformed multipart delimiter");
+                }
+                break;
+            case FormState::HEADERS: {
+                if (PENDING.size() - consumed < 2) {
+                    more = false;
+                    break;
+                }
+                // A part may have no headers at all, its blank line then follows the delimiter directly
+                std::size_t const END =
+                    PENDING.substr(consumed, 2) == "\r\n" ? consumed : PENDING.find("\r\n\r\n", consumed);
+                if (END == std::string_view::npos) {
+                    if (PENDING.size() - consumed > MAX_PART_HEADER) {
+                        fail(http::status::bad_request, "Multipart part headers are too long");
+                    }
+                    more = false;
+                    break;
+                }
+                begin_part(PENDING.substr(consumed, END - consumed));
+                consumed = END == consumed ? END + 2 : END + 4;
+                m_FORM_STATE = FormState::BODY;
+                break;
+            }
+            case FormState::EPILOGUE:
+                consumed = PENDING.size();
+                more = false;
+                break;
+        }
+    }
+
+    m_PENDING.erase(0, consumed);
+    return !failed();
+}
+
+/**
+ * @brief Start a part once its header block is complete
+ *
+ * Parts without a filename (plain form fields) are skipped.
+ *
+ * @param headers header block
+ * @return true unless failed
+ **/
+auto Upload::begin_part(std::string_view headers) -> bool {
+    auto const FILENAME = disposition_filename(find_part_header(headers, "content-disposition"));
+    if (!FILENAME) {
+        return true;
+    }
+    std::string const NAME = safe_entry_name(*FILENAME);
+    if (NAME.empty()) {
+        fail(http::status::bad_request, "Invalid file name in the form");
+        return false;
+    }
+    m_PART_HAS_FILE = open_temp(m_DIR / NAME, std::nullopt);
+    return m_PART_HAS_FILE;
+}
@@ -0,0 +1,234 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <boost/beast/core/error.hpp>
+#include <boost/beast/http/status.hpp>
+#include <boost/filesystem.hpp>
+
+#include "digest.hpp"
+
+namespace beast = boost::beast;
+namespace fs = boost::filesystem;
+
+/**
+ * @brief A file an upload put into place
+ *
+ **/
+struct UploadedFile {
+    fs::path path;
+    std::uint64_t size = 0;
+    std::uint64_t inode = 0;
+    std::int64_t mtime_ns = 0;
+    bool replaced = false;
+};
+
+class Upload {
+    /**
+     * @brief Upload - a request body streamed into files under the root
+     *
+     * A PUT body becomes one file; a multipart/form-data POST body becomes
+     * one file per part with a filename, in the target directory. Bytes are
+     * written as they arrive, so memory use does not depend on the size of
+     * the upload.
+     *
+     * Every file is first written to an unnamed O_TMPFILE in its target
+     * directory (or a hidden temporary name where the filesystem lacks
+     * O_TMPFILE), preallocated with fallocate(2) when its size is known, and
+     * renamed over the target only once it is complete. Readers therefore
+     * see either the old file or the whole new one, and an interrupted
+     * upload leaves nothing behind.
+     *
+     * A failed write or a malformed body puts the upload into a failed
+     * state with the status the client should get; later writes are ignored.
+     **/
+
+  public:
+    /**
+     * @brief Size of the buffer a session reads body bytes into
+     *
+     **/
+    static constexpr std::size_t BUFFER_SIZE = 256 * 1024;
+
+    /**
+     * @brief Longest header block of a multipart part
+     *
+     **/
+    static constexpr std::size_t MAX_PART_HEADER = 8 * 1024;
+
+    Upload() = default;
+
+    /**
+     * @brief Destroy the Upload object, discarding unfinished files
+     *
+     **/
+    ~Upload();
+
+    Upload(const Upload&) = delete;
+    auto operator=(const Upload&) -> Upload& = delete;
+
+    /**
+     * @brief Stream the body into one file
+     *
+     * @param target path the file is renamed to
+     * @param size body length if known, used to preallocate the file
+     * @param expected SHA-256 the body must have, if any
+     * @return true if the temporary file was created, false if failed()
+     **/
+    auto open_file(const fs::path& target,
+                   std::optional<std::uint64_t> size,
+                   std::optional<Sha256Digest> expected) -> bool;
+
+    /**
+     * @brief Stream a multipart/form-data body into files of a directory
+     *
+     * @param dir target directory
+     * @param boundary boundary parameter of the Content-Type
+     **/
+    void open_form(const fs::path& dir, std::string_view boundary);
+
+    /**
+     * @brief Consume body bytes
+     *
+     * @param data next bytes of the body
+     * @return true unless the upload failed
+     **/
+    auto write(std::string_view data) -> bool;
+
+    /**
+     * @brief Finish the upload once the whole body was written
+     *
+     * Checks the digest and moves the last file into place.
+     *
+     * @return true unless the upload failed
+     **/
+    auto commit() -> bool;
+
+    /**
+     * @brief Fail the upload and discard the unfinished file
+     *
+     * @param status status the client gets
+     * @param reason message of the response body
+     **/
+    void fail(beast::http::status status, std::string reason);
+
+    /**
+     * @brief Check whether the upload failed
+     *
+     * @return true if failed
+     **/
+    auto failed() const -> bool { return m_STATUS != beast::http::status::ok; }
+
+    /**
+     * @brief Get the status of a failed upload
+     *
+     * @return beast::http::status status, ok unless failed()
+     **/
+    auto status() const -> beast::http::status { return m_STATUS; }
+
+    /**
+     * @brief Get the reason of a failed upload
+     *
+     * @return const std::string& message
+     **/
+    auto reason() const -> const std::string& { return m_REASON; }
+
+    /**
+     * @brief Get the files put into place so far
+     *
+     * @return const std::vector<UploadedFile>& files in body order
+     **/
+    auto files() const -> const std::vector<UploadedFile>& { return m_FILES; }
+
+  private:
+    /**
+     * @brief Multipart parser states
+     *
+     **/
+    enum class FormState : std::uint8_t
+    {
+        PREAMBLE,     // before the first delimiter
+        DELIMITER,    // after a delimiter, before its line break or "--"
+        HEADERS,      // header block of a part
+        BODY,         // content of a part
+        EPILOGUE      // after the closing delimiter
+    };
+
+    /**
+     * @brief Create the temporary file of a target
+     *
+     * @param target final path
+     * @param size expected size, if known
+     * @return true on success, otherwise the upload failed
+     **/
+    auto open_temp(const fs::path& target, std::optional<std::uint64_t> size) -> bool;
+
+    /**
+     * @brief Append bytes to the temporary file
+     *
+     * @param data bytes
+     * @return true on success, otherwise the upload failed
+     **/
+    auto write_temp(std::string_view data) -> bool;
+
+    /**
+     * @brief Rename the temporary file over its target
+     *
+     * @return true on success, otherwise the upload failed
+     **/
+    auto finish_temp() -> bool;
+
+    /**
+     * @brief Close and remove the temporary file
+     *
+     **/
+    void discard_temp();
+
+    /**
+     * @brief Fail the upload with the status matching an errno value
+     *
+     * @param error errno value
+     * @param what operation which failed
+     **/
+    void fail_errno(int error, const char* what);
+
+    /**
+     * @brief Consume bytes of a multipart body
+     *
+     * @param data bytes
+     * @return true unless the upload failed
+     **/
+    auto write_form(std::string_view data) -> bool;
+
+    /**
+     * @brief Start a part once its header block is complete
+     *
+     * @param headers header block without the blank line
+     * @return true unless the upload failed
+     **/
+    auto begin_part(std::string_view headers) -> bool;
+
+    int m_FD = -1;
+    fs::path m_TARGET;
+    std::string m_TEMP_NAME;
+    std::uint64_t m_WRITTEN = 0;
+
+    std::optional<Sha256> m_HASH;
+    std::optional<Sha256Digest> m_EXPECTED;
+
+    bool m_FORM = false;
+    FormState m_FORM_STATE = FormState::PREAMBLE;
+    fs::path m_DIR;
+    std::string m_DELIMITER;
+    std::string m_PENDING;
+    bool m_PART_HAS_FILE = false;
+
+    std::vector<UploadedFile> m_FILES;
+    beast::http::status m_STATUS = beast::http::status::ok;
+    std::string m_REASON;
+};
@@ -0,0 +1,526 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "uring_backend.hpp"
+
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/post.hpp>
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "logger.hpp"
+
+/**
+ * @brief Anonymous namespace for helper functions
+ *
+ **/
+namespace {
+    /**
+     * @brief user_data bit which marks the read entry of a linked pair
+     *
+     * Operations are heap objects, so the lowest bit of their address is free.
+     **/
+    constexpr std::uint64_t READ_TAG = 1;
+
+    /**
+     * @brief Number of opcodes asked for when probing the kernel
+     *
+     **/
+    constexpr std::size_t PROBE_OPS = 256;
+
+    /**
+     * @brief io_uring_setup(2), which glibc does not wrap
+     *
+     * @param entries submission queue size
+     * @param params parameters, filled with the ring layout
+     * @return int ring descriptor, -1 with errno on failure
+     **/
+    auto uring_setup(unsigned entries, io_uring_params* params) -> int {
+        return static_cast<int>(::syscall(__NR_io_uring_setup, entries, params));
+    }
+
+    /**
+     * @brief io_uring_enter(2) without waiting for completions
+     *
+     * @param ring_fd ring descriptor
+     * @param to_submit entries to submit
+     * @return int entries submitted, -1 with errno on failure
+     **/
+    auto uring_enter(int ring_fd, unsigned to_submit) -> int {
+        return static_cast<int>(::syscall(__NR_io_uring_enter, ring_fd, to_submit, 0, 0, nullptr, 0));
+    }
+
+    /**
+     * @brief io_uring_register(2)
+     *
+     * @param ring_fd ring descriptor
+     * @param opcode IORING_REGISTER_* operation
+     * @param arg operation argument
+     * @param count number of elements in arg
+     * @return int 0 or a non-negative result, -1 with errno on failure
+     **/
+    auto uring_register(int ring_fd, unsigned opcode, const void* arg, unsigned count) -> int {
+        return static_cast<int>(::syscall(__NR_io_uring_register, ring_fd, opcode, arg, count));
+    }
+
+    /**
+     * @brief Load a ring index written by the kernel
+     *
+     * @param value shared ring index
+     * @return unsigned value
+     **/
+    auto load_acquire(unsigned* value) -> unsigned {
+        return std::atomic_ref<unsigned>(*value).load(std::memory_order_acquire);
+    }
+
+    /**
+     * @brief Store a ring index read by the kernel
+     *
+     * @param value shared ring index
+     * @param next new value
+     **/
+    void store_release(unsigned* value, unsigned next) {
+        std::atomic_ref<unsigned>(*value).store(next, std::memory_order_release);
+    }
+
+    /**
+     * @brief Check that the kernel supports every opcode the backend submits
+     *
+     * @param ring_fd ring descriptor
+     * @return true if READ_FIXED and WRITE_FIXED are supported
+     **/
+    auto probe_opcodes(int ring_fd) -> bool {
+        std::vector<char> storage(sizeof(io_uring_probe) + PROBE_OPS * sizeof(io_uring_probe_op));
+        auto* probe = reinterpret_cast<io_uring_probe*>(storage.data());
+        if (uring_register(ring_fd, IORING_REGISTER_PROBE, probe, PROBE_OPS) < 0) {
+            return false;
+        }
+        auto const SUPPORTED = [probe](unsigned opcode)
+        { return opcode <= probe->last_op && (probe->ops[opcode].flags & IO_URING_OP_SUPPORTED) != 0; };
+        return SUPPORTED(IORING_OP_READ_FIXED) && SUPPORTED(IORING_OP_WRITE_FIXED);
+    }
+}    // namespace
+
+/**
+ * @brief Construct a new UringBackend::UringBackend object
+ *
+ * @param ioc io_context
+ **/
+UringBackend::UringBackend(net::io_context& ioc)
+    : m_IOC(ioc)
+    , m_EVENTS(ioc) {}
+
+/**
+ * @brief Destroy the UringBackend::UringBackend object
+ *
+ **/
+UringBackend::~UringBackend() {
+    release();
+}
+
+/**
+ * @brief Set up io_uring
+ *
+ * @return true if usable
+ **/
+auto UringBackend::enable() -> bool {
+    if (is_enabled()) {
+        return true;
+    }
+
+    io_uring_params params {};
+    int const RING_FD = uring_setup(QUEUE_DEPTH, &params);
+    if (RING_FD < 0) {
+        log_warn("io_uring unavailable (%s), using sendfile\n", std::strerror(errno));
+        return false;
+    }
+    m_RING_FD = RING_FD;
+
+    const char* failure = nullptr;
+    if ((params.features & IORING_FEAT_NODROP) == 0) {
+        failure = "kernel may drop completions";
+    } else if (!probe_opcodes(m_RING_FD)) {
+        failure = "fixed-buffer reads and writes are not supported";
+    }
+
+    if (failure == nullptr) {
+        m_SQ_RING_SIZE = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        m_CQ_RING_SIZE = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool const SINGLE_MMAP = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (SINGLE_MMAP) {
+            m_SQ_RING_SIZE = m_CQ_RING_SIZE = std::max(m_SQ_RING_SIZE, m_CQ_RING_SIZE);
+        }
+
+        m_SQ_RING = ::mmap(
+            nullptr, m_SQ_RING_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_RING_FD, IORING_OFF_SQ_RING);
+        if (m_SQ_RING == MAP_FAILED) {
+            m_SQ_RING = nullptr;
+        } else if (SINGLE_MMAP) {
+            m_CQ_RING = m_SQ_RING;
+        } else {
+            m_CQ_RING = ::mmap(nullptr,
+                               m_CQ_RING_SIZE,
+                               PROT_READ | PROT_WRITE,
+                               MAP_SHARED | MAP_POPULATE,
+                               m_RING_FD,
+                               IORING_OFF_CQ_RING);
+            m_CQ_RING = m_CQ_RING == MAP_FAILED ? nullptr : m_CQ_RING;
+        }
+
+        m_SQES_SIZE = params.sq_entries * sizeof(io_uring_sqe);
+        m_SQES = ::mmap(
+            nullptr, m_SQES_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_RING_FD, IORING_OFF_SQES);
+        m_SQES = m_SQES == MAP_FAILED ? nullptr : m_SQES;
+
+        if (m_SQ_RING == nullptr || m_CQ_RING == nullptr || m_SQES == nullptr) {
+            failure = "cannot map the rings";
+        }
+    }
+
+    if (failure == nullptr) {
+        auto* sq = static_cast<char*>(m_SQ_RING);
+        auto* cq = static_cast<char*>(m_CQ_RING);
+        m_SQ_HEAD = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+        m_SQ_TAIL = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        m_SQ_ARRAY = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        m_SQ_MASK = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        m_SQ_ENTRIES = params.sq_entries;
+        m_CQ_HEAD = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        m_CQ_TAIL = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        m_CQ_MASK = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        m_CQES = cq + params.cq_off.cqes;
+
+        // One region split into equal buffers, registered once so reads and writes skip the page pinning
+        void* const BUFFERS = ::mmap(
+            nullptr, BUFFER_SIZE * BUFFER_COUNT, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (BUFFERS == MAP_FAILED) {
+            failure = "cannot allocate buffers";
+        } else {
+            m_BUFFERS = static_cast<char*>(BUFFERS);
+            std::vector<iovec> iovecs(BUFFER_COUNT);
+            for (std::size_t i = 0; i < BUFFER_COUNT; ++i) {
+                iovecs[i] = {buffer_data(static_cast<int>(i)), BUFFER_SIZE};
+            }
+            if (uring_register(m_RING_FD, IORING_REGISTER_BUFFERS, iovecs.data(), BUFFER_COUNT) < 0) {
+                failure = "cannot register buffers";
+            }
+        }
+    }
+
+    if (failure == nullptr) {
+        int const EVENT_FD = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (EVENT_FD == -1 || uring_register(m_RING_FD, IORING_REGISTER_EVENTFD, &EVENT_FD, 1) < 0) {
+            failure = "cannot register an eventfd";
+            if (EVENT_FD != -1) {
+                ::close(EVENT_FD);
+            }
+        } else {
+            m_EVENTS.assign(EVENT_FD);
+        }
+    }
+
+    if (failure != nullptr) {
+        log_warn("io_uring disabled (%s), using sendfile\n", failure);
+        release();
+        return false;
+    }
+
+    m_FREE_BUFFERS.clear();
+    for (std::size_t i = BUFFER_COUNT; i > 0; --i) {
+        m_FREE_BUFFERS.push_back(static_cast<int>(i - 1));
+    }
+    log_info("io_uring enabled: %u entries, %zu buffers of %zu bytes\n", m_SQ_ENTRIES, BUFFER_COUNT, BUFFER_SIZE);
+    return true;
+}
+
+/**
+ * @brief Start reading completions
+ *
+ **/
+void UringBackend::start() {
+    if (is_enabled()) {
+        do_wait();
+    }
+}
+
+/**
+ * @brief Take a buffer
+ *
+ * @return int buffer index or -1
+ **/
+auto UringBackend::acquire_buffer() -> int {
+    std::lock_guard<std::mutex> const LOCK(m_BUFFER_MUTEX);
+    if (m_FREE_BUFFERS.empty()) {
+        return -1;
+    }
+    int const INDEX = m_FREE_BUFFERS.back();
+    m_FREE_BUFFERS.pop_back();
+    return INDEX;
+}
+
+/**
+ * @brief Return a buffer
+ *
+ * @param index buffer index
+ **/
+void UringBackend::release_buffer(int index) {
+    std::lock_guard<std::mutex> const LOCK(m_BUFFER_MUTEX);
+    m_FREE_BUFFERS.push_back(index);
+}
+
+/**
+ * @brief Queue a linked read and write
+ *
+ * @param file_fd file
+ * @param offset file offset
+ * @param length length
+ * @param socket_fd socket
+ * @param buffer buffer index
+ * @param handler handler
+ **/
+void UringBackend::submit_read_send(int file_fd,
+                                    std::uint64_t offset,
+                                    std::size_t length,
+                                    int socket_fd,
+                                    int buffer,
+                                    Handler handler) {
+    std::unique_lock<std::mutex> lock(m_MUTEX);
+    if (!reserve_locked(2)) {
+        lock.unlock();
+        reject(std::move(handler));
+        return;
+    }
+
+    auto* operation = new Operation {std::move(handler), 0, 0, 2};
+    auto const USER_DATA = reinterpret_cast<std::uint64_t>(operation);
+
+    io_uring_sqe* read = entry_locked(0);
+    read->opcode = IORING_OP_READ_FIXED;
+    read->flags = IOSQE_IO_LINK;
+    read->fd = file_fd;
+    read->off = offset;
+    read->addr = reinterpret_cast<std::uint64_t>(buffer_data(buffer));
+    read->len = static_cast<std::uint32_t>(length);
+    read->buf_index = static_cast<std::uint16_t>(buffer);
+    read->user_data = USER_DATA | READ_TAG;
+
+    // A short read fails the link, so the write never sends bytes the read did not produce
+    io_uring_sqe* write = entry_locked(1);
+    write->opcode = IORING_OP_WRITE_FIXED;
+    write->fd = socket_fd;
+    write->addr = reinterpret_cast<std::uint64_t>(buffer_data(buffer));
+    write->len = static_cast<std::uint32_t>(length);
+    write->buf_index = static_cast<std::uint16_t>(buffer);
+    write->user_data = USER_DATA;
+
+    publish_locked(2);
+}
+
+/**
+ * @brief Queue a write from a buffer
+ *
+ * @param socket_fd socket
+ * @param buffer buffer index
+ * @param position offset in the buffer
+ * @param length length
+ * @param handler handler
+ **/
+void UringBackend::submit_send(int socket_fd, int buffer, std::size_t position, std::size_t length, Handler handler) {
+    std::unique_lock<std::mutex> lock(m_MUTEX);
+    if (!reserve_locked(1)) {
+        lock.unlock();
+        reject(std::move(handler));
+        return;
+    }
+
+    auto* operation = new Operation {std::move(handler), static_cast<int>(length), 0, 1};
+
+    io_uring_sqe* write = entry_locked(0);
+    write->opcode = IORING_OP_WRITE_FIXED;
+    write->fd = socket_fd;
+    write->addr = reinterpret_cast<std::uint64_t>(buffer_data(buffer) + position);
+    write->len = static_cast<std::uint32_t>(length);
+    write->buf_index = static_cast<std::uint16_t>(buffer);
+    write->user_data = reinterpret_cast<std::uint64_t>(operation);
+
+    publish_locked(1);
+}
+
+/**
+ * @brief Make room in the submission queue
+ *
+ * @param count entries needed
+ * @return true if available
+ **/
+auto UringBackend::reserve_locked(unsigned count) -> bool {
+    auto const FREE = [this] { return m_SQ_ENTRIES - (*m_SQ_TAIL - load_acquire(m_SQ_HEAD)); };
+    if (FREE() < count) {
+        flush_locked();
+    }
+    return FREE() >= count;
+}
+
+/**
+ * @brief Get an entry behind the tail
+ *
+ * @param index position after the tail
+ * @return io_uring_sqe* cleared entry
+ **/
+auto UringBackend::entry_locked(unsigned index) -> io_uring_sqe* {
+    auto* entry = static_cast<io_uring_sqe*>(m_SQES) + ((*m_SQ_TAIL + index) & m_SQ_MASK);
+    std::memset(entry, 0, sizeof(*entry));
+    return entry;
+}
+
+/**
+ * @brief Publish entries
+ *
+ * @param count entries filled
+ **/
+void UringBackend::publish_locked(unsigned count) {
+    unsigned const TAIL = *m_SQ_TAIL;
+    for (unsigned i = 0; i < count; ++i) {
+        m_SQ_ARRAY[(TAIL + i) & m_SQ_MASK] = (TAIL + i) & m_SQ_MASK;
+    }
+    store_release(m_SQ_TAIL, TAIL + count);
+
+    // The first entry of a batch schedules the flush, later ones just ride along
+    if (m_UNSUBMITTED == 0) {
+        net::post(m_IOC,
+                  [this]
+                  {
+                      std::lock_guard<std::mutex> const LOCK(m_MUTEX);
+                      flush_locked();
+                  });
+    }
+    m_UNSUBMITTED += count;
+}
+
+/**
+ * @brief Submit queued entries
+ *
+ **/
+void UringBackend::flush_locked() {
+    while (m_UNSUBMITTED > 0) {
+        int const SUBMITTED = uring_enter(m_RING_FD, m_UNSUBMITTED);
+        if (SUBMITTED > 0) {
+            m_UNSUBMITTED -= static_cast<unsigned>(SUBMITTED);
+            continue;
+        }
+
+        int const ERR = SUBMITTED < 0 ? errno : EAGAIN;
+        if (ERR == EINTR) {
+            continue;
+        }
+
+        // Completions must be reaped first (EBUSY) or the kernel is short of memory: try again later
+        log_once_warn("io_uring_enter failed (%s), retrying\n", std::strerror(ERR));
+        net::post(m_IOC,
+                  [this]
+                  {
+                      std::lock_guard<std::mutex> const LOCK(m_MUTEX);
+                      flush_locked();
+                  });
+        return;
+    }
+}
+
+/**
+ * @brief Fail a submission without queueing it
+ *
+ * @param handler handler
+ **/
+void UringBackend::reject(Handler handler) {
+    net::post(m_IOC, [handler = std::move(handler)] { handler(-EBUSY, -EBUSY); });
+}
+
+/**
+ * @brief Wait for the eventfd
+ *
+ **/
+void UringBackend::do_wait() {
+    m_EVENTS.async_read_some(net::buffer(&m_EVENT_COUNT, sizeof(m_EVENT_COUNT)),
+                             [this](beast::error_code ec, std::size_t) { on_completions(ec); });
+}
+
+/**
+ * @brief Reap completions
+ *
+ * Only one eventfd read is pending at a time, so this never runs concurrently.
+ *
+ * @param ec error code
+ **/
+void UringBackend::on_completions(beast::error_code ec) {
+    if (ec == net::error::operation_aborted) {
+        return;
+    }
+    if (ec) {
+        log_error("io_uring eventfd read failed: %s\n", ec.message().c_str());
+        return;
+    }
+
+    std::vector<Operation*> done;
+    unsigned head = *m_CQ_HEAD;
+    unsigned const TAIL = load_acquire(m_CQ_TAIL);
+    for (; head != TAIL; ++head) {
+        io_uring_cqe const& cqe = static_cast<io_uring_cqe*>(m_CQES)[head & m_CQ_MASK];
+        auto* operation = reinterpret_cast<Operation*>(cqe.user_data & ~READ_TAG);
+        if ((cqe.user_data & READ_TAG) != 0) {
+            operation->read_result = cqe.res;
+        } else {
+            operation->write_result = cqe.res;
+        }
+        if (--operation->pending == 0) {
+            done.push_back(operation);
+        }
+    }
+    store_release(m_CQ_HEAD, head);
+
+    for (Operation* operation : done) {
+        std::unique_ptr<Operation> const OWNED(operation);
+        OWNED->handler(OWNED->read_result, OWNED->write_result);
+    }
+
+    do_wait();
+}
+
+/**
+ * @brief Tear everything down
+ *
+ **/
+void UringBackend::release() {
+    beast::error_code ec;
+    m_EVENTS.close(ec);
+    if (m_BUFFERS != nullptr) {
+        ::munmap(m_BUFFERS, BUFFER_SIZE * BUFFER_COUNT);
+        m_BUFFERS = nullptr;
+    }
+    if (m_SQES != nullptr) {
+        ::munmap(m_SQES, m_SQES_SIZE);
+        m_SQES = nullptr;
+    }
+    if (m_CQ_RING != nullptr && m_CQ_RING != m_SQ_RING) {
+        ::munmap(m_CQ_RING, m_CQ_RING_SIZE);
+    }
+    m_CQ_RING = nullptr;
+    if (m_SQ_RING != nullptr) {
+        ::munmap(m_SQ_RING, m_SQ_RING_SIZE);
+        m_SQ_RING = nullptr;
+    }
+    if (m_RING_FD != -1) {
+        ::close(m_RING_FD);
+        m_RING_FD = -1;
+    }
+}
@@ -0,0 +1,248 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/posix/stream_descriptor.hpp>
+#include <boost/beast/core/error.hpp>
+
+namespace beast = boost::beast;
+namespace net = boost::asio;
+
+struct io_uring_sqe;
+
+class UringBackend {
+    /**
+     * @brief UringBackend - batched file reads and socket writes through io_uring
+     *
+     * An optional alternative to sendfile(2) for file bodies. The backend owns
+     * one io_uring instance and a pool of registered buffers; a session takes
+     * a buffer for the duration of a transfer and submits each chunk as a
+     * linked pair, a READ_FIXED from the file into the buffer followed by a
+     * WRITE_FIXED of the same buffer to the socket, so one chunk costs no
+     * syscall of its own. Submissions are queued under a mutex and handed to
+     * the kernel by a single io_uring_enter(2) per turn of the io_context,
+     * however many sessions queued work meanwhile.
+     *
+     * Completions are signalled through an eventfd which the io_context reads
+     * like any other descriptor; the handler of an operation runs on an
+     * io_context thread and must post to its own strand.
+     *
+     * The backend is off unless enable() is called, and enable() falls back
+     * to the sendfile path (is_enabled() stays false) when the kernel lacks
+     * io_uring, forbids it (seccomp, sysctl) or misses an opcode.
+     **/
+
+  public:
+    /**
+     * @brief Completion handler: read result and write result, negative errno on failure
+     *
+     * For a write-only submission the read result is the submitted length.
+     * A write which did not run because its read came back short reports
+     * -ECANCELED.
+     **/
+    using Handler = std::function<void(int read_result, int write_result)>;
+
+    /**
+     * @brief Submission queue entries, two per chunk in flight
+     *
+     **/
+    static constexpr unsigned QUEUE_DEPTH = 256;
+
+    /**
+     * @brief Size of one registered buffer, the largest chunk of one read
+     *
+     **/
+    static constexpr std::size_t BUFFER_SIZE = 256 * 1024;
+
+    /**
+     * @brief Number of registered buffers, the most transfers running at once
+     *
+     **/
+    static constexpr std::size_t BUFFER_COUNT = 32;
+
+    /**
+     * @brief Construct a new, disabled Uring Backend object
+     *
+     * @param ioc io_context which reads the completions and runs the batches
+     **/
+    explicit UringBackend(net::io_context& ioc);
+
+    ~UringBackend();
+
+    UringBackend(const UringBackend&) = delete;
+    auto operator=(const UringBackend&) -> UringBackend& = delete;
+
+    /**
+     * @brief Set up the ring, probe the opcodes and register buffers and eventfd
+     *
+     * @return true if the backend is usable
+     **/
+    auto enable() -> bool;
+
+    /**
+     * @brief Start reading completions
+     *
+     **/
+    void start();
+
+    /**
+     * @brief Check whether io_uring is in use
+     *
+     * @return true if enable() succeeded
+     **/
+    auto is_enabled() const -> bool { return m_RING_FD != -1; }
+
+    /**
+     * @brief Take a registered buffer
+     *
+     * @return int buffer index, -1 if all are in use
+     **/
+    auto acquire_buffer() -> int;
+
+    /**
+     * @brief Give a registered buffer back
+     *
+     * @param index buffer index
+     **/
+    void release_buffer(int index);
+
+    /**
+     * @brief Get the memory of a registered buffer
+     *
+     * @param index buffer index
+     * @return char* first byte, BUFFER_SIZE bytes long
+     **/
+    auto buffer_data(int index) const -> char* {
+        return m_BUFFERS + static_cast<std::size_t>(index) * BUFFER_SIZE;
+    }
+
+    /**
+     * @brief Queue a file read linked to a socket write of the same bytes
+     *
+     * @param file_fd file descriptor
+     * @param offset file offset
+     * @param length bytes to read and write, at most BUFFER_SIZE
+     * @param socket_fd socket descriptor
+     * @param buffer registered buffer index
+     * @param handler completion handler
+     **/
+    void submit_read_send(int file_fd,
+                          std::uint64_t offset,
+                          std::size_t length,
+                          int socket_fd,
+                          int buffer,
+                          Handler handler);
+
+    /**
+     * @brief Queue a socket write of bytes already in a registered buffer
+     *
+     * @param socket_fd socket descriptor
+     * @param buffer registered buffer index
+     * @param position first byte within the buffer
+     * @param length bytes to write
+     * @param handler completion handler
+     **/
+    void submit_send(int socket_fd, int buffer, std::size_t position, std::size_t length, Handler handler);
+
+  private:
+    /**
+     * @brief An operation in flight: one or two queue entries, one handler
+     *
+     **/
+    struct Operation {
+        Handler handler;
+        int read_result = 0;
+        int write_result = 0;
+        int pending = 0;
+    };
+
+    /**
+     * @brief Make room for entries, flushing the queue if it is full
+     *
+     * @param count number of entries needed, m_MUTEX must be held
+     * @return true if that many entries are free
+     **/
+    auto reserve_locked(unsigned count) -> bool;
+
+    /**
+     * @brief Get a cleared entry behind the published tail
+     *
+     * @param index position after the tail, m_MUTEX must be held
+     * @return io_uring_sqe* entry
+     **/
+    auto entry_locked(unsigned index) -> io_uring_sqe*;
+
+    /**
+     * @brief Publish filled entries and schedule a flush for this batch
+     *
+     * @param count number of entries filled, m_MUTEX must be held
+     **/
+    void publish_locked(unsigned count);
+
+    /**
+     * @brief Hand all queued entries to the kernel with one io_uring_enter(2)
+     *
+     * m_MUTEX must be held.
+     **/
+    void flush_locked();
+
+    /**
+     * @brief Report a submission which found the ring full
+     *
+     * @param handler completion handler, called with -EBUSY
+     **/
+    void reject(Handler handler);
+
+    /**
+     * @brief Queue the next read of the eventfd
+     *
+     **/
+    void do_wait();
+
+    /**
+     * @brief Walk the completion queue and run the handlers
+     *
+     * @param ec error code of the eventfd read
+     **/
+    void on_completions(beast::error_code ec);
+
+    /**
+     * @brief Unmap the rings and buffers and close the ring
+     *
+     **/
+    void release();
+
+    net::io_context& m_IOC;
+    net::posix::stream_descriptor m_EVENTS;
+    std::uint64_t m_EVENT_COUNT = 0;
+    int m_RING_FD = -1;
+
+    void* m_SQ_RING = nullptr;
+    void* m_CQ_RING = nullptr;
+    std::size_t m_SQ_RING_SIZE = 0;
+    std::size_t m_CQ_RING_SIZE = 0;
+    void* m_SQES = nullptr;
+    std::size_t m_SQES_SIZE = 0;
+
+    unsigned* m_SQ_HEAD = nullptr;
+    unsigned* m_SQ_TAIL = nullptr;
+    unsigned* m_SQ_ARRAY = nullptr;
+    unsigned m_SQ_MASK = 0;
+    unsigned m_SQ_ENTRIES = 0;
+    unsigned* m_CQ_HEAD = nullptr;
+    unsigned* m_CQ_TAIL = nullptr;
+    unsigned m_CQ_MASK = 0;
+    void* m_CQES = nullptr;
+
+    std::mutex m_MUTEX;
+    unsigned m_UNSUBMITTED = 0;
+
+    char* m_BUFFERS = nullptr;
+    std::mutex m_BUFFER_MUTEX;
+    std::vector<int> m_FREE_BUFFERS;
+};
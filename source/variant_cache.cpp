@@ -0,0 +1,100 @@
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+
+#include "variant_cache.hpp"
+
+/**
+ * @brief Construct a new VariantCache::VariantCache object
+ *
+ * @param budget_bytes memory budget
+ **/
+VariantCache::VariantCache(std::size_t budget_bytes)
+    : m_BUDGET(budget_bytes) {}
+
+/**
+ * @brief Build a variant key
+ *
+ * @param path normalized path
+ * @param etag identity entity tag
+ * @param coding coding
+ * @return std::string key
+ **/
+auto VariantCache::make_key(const std::string& path, const std::string& etag, ContentCoding coding) -> std::string {
+    std::string key;
+    key.reserve(path.size() + etag.size() + 10);
+    key.append(coding_name(coding));
+    key.push_back('\n');
+    key.append(etag);
+    key.push_back('\n');
+    key.append(path);
+    return key;
+}
+
+/**
+ * @brief Look up a variant
+ *
+ * @param key variant key
+ * @return std::shared_ptr<const CompressedVariant> variant or nullptr
+ **/
+auto VariantCache::find(const std::string& key) -> std::shared_ptr<const CompressedVariant> {
+    std::lock_guard<std::mutex> const LOCK(m_MUTEX);
+
+    auto const IT = m_ENTRIES.find(key);
+    if (IT == m_ENTRIES.end()) {
+        return nullptr;
+    }
+    m_LRU.splice(m_LRU.begin(), m_LRU, IT->second.lru);
+    return IT->second.variant;
+}
+
+/**
+ * @brief Insert a variant
+ *
+ * @param key variant key
+ * @param variant variant
+ **/
+void VariantCache::insert(const std::string& key, std::shared_ptr<const CompressedVariant> variant) {
+    std::size_t const BYTES = variant->bytes() + key.capacity();
+
+    std::lock_guard<std::mutex> const LOCK(m_MUTEX);
+
+    if (BYTES > m_BUDGET || m_ENTRIES.count(key) != 0) {
+        return;
+    }
+
+    while (m_BYTES + BYTES > m_BUDGET && !m_LRU.empty()) {
+        auto const VICTIM = m_ENTRIES.find(m_LRU.back());
+        m_BYTES -= VICTIM->second.bytes;
+        m_ENTRIES.erase(VICTIM);
+        m_LRU.pop_back();
+    }
+
+    m_LRU.push_front(key);
+    m_ENTRIES.emplace(key, Slot {std::move(variant), BYTES, m_LRU.begin()});
+    m_BYTES += BYTES;
+}
+
+/**
+ * @brief Drop everything
+ *
+ **/
+void VariantCache::clear() {
+    std::lock_guard<std::mutex> const LOCK(m_MUTEX);
+
+    m_ENTRIES.clear();
+    m_LRU.clear();
+    m_BYTES = 0;
+}
+
+/**
+ * @brief Memory charged to the cache
+ *
+ * @return std::size_t bytes
+ **/
+auto VariantCache::size_bytes() const -> std::size_t {
+    std::lock_guard<std::mutex> const LOCK(m_MUTEX);
+    return m_BYTES;
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+#include "compression.hpp"
+
+/**
+ * @brief A dynamically compressed representation
+ *
+ * Files store the whole encoded body; listings store a DeflateTemplate
+ * around their server time. A file which did not shrink is remembered as
+ * incompressible, so it is not compressed again on every request.
+ **/
+struct CompressedVariant {
+    ContentCoding coding = ContentCoding::IDENTITY;
+    std::string body;
+    std::optional<DeflateTemplate> page;
+    bool incompressible = false;
+
+    /**
+     * @brief Approximate memory charged to the cache for this variant
+     *
+     * @return std::size_t bytes
+     **/
+    auto bytes() const -> std::size_t { return sizeof(*this) + body.capacity() + (page ? page->bytes() : 0); }
+};
+
+class VariantCache {
+    /**
+     * @brief VariantCache - compressed variants keyed by representation version
+     *
+     * An LRU map bounded by a byte budget. Keys contain the entity tag of
+     * the uncompressed representation, so a changed file or directory simply
+     * stops hitting its old variants, which then age out; no invalidation is
+     * needed and compression runs once per version and coding.
+     **/
+
+  public:
+    /**
+     * @brief Construct a new Variant Cache object
+     *
+     * @param budget_bytes memory budget, 0 disables the cache
+     **/
+    explicit VariantCache(std::size_t budget_bytes);
+
+    /**
+     * @brief Build the key of a variant
+     *
+     * @param path normalized path of the resource
+     * @param etag entity tag of the identity representation
+     * @param coding content coding
+     * @return std::string key
+     **/
+    static auto make_key(const std::string& path, const std::string& etag, ContentCoding coding) -> std::string;
+
+    /**
+     * @brief Look up a variant and mark it as recently used
+     *
+     * @param key variant key
+     * @return std::shared_ptr<const CompressedVariant> variant, nullptr on a miss
+     **/
+    auto find(const std::string& key) -> std::shared_ptr<const CompressedVariant>;
+
+    /**
+     * @brief Insert a variant, evicting least recently used ones
+     *
+     * @param key variant key
+     * @param variant variant
+     **/
+    void insert(const std::string& key, std::shared_ptr<const CompressedVariant> variant);
+
+    /**
+     * @brief Drop every variant
+     *
+     **/
+    void clear();
+
+    /**
+     * @brief Get the memory currently charged to the cache
+     *
+     * @return std::size_t bytes
+     **/
+    auto size_bytes() const -> std::size_t;
+
+  private:
+    using LruList = std::list<std::string>;
+
+    struct Slot {
+        std::shared_ptr<const CompressedVariant> variant;
+        std::size_t bytes;
+        LruList::iterator lru;
+    };
+
+    mutable std::mutex m_MUTEX;
+    std::size_t m_BUDGET;
+    std::size_t m_BYTES = 0;
+    LruList m_LRU;
+    std::unordered_map<std::string, Slot> m_ENTRIES;
+};
@@ -1,4 +1,1119 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "archive.hpp"
+#include "arena.hpp"
+#include "async_logger.hpp"
+#include "compression.hpp"
+#include "digest.hpp"
+#include "digest_index.hpp"
+#include "hot_file_cache.hpp"
+#include "http_utils.hpp"
+#include "metrics.hpp"
+#include "mime_types.hpp"
+#include "path_filter.hpp"
+#include "search_index.hpp"
+#include "server.hpp"
+#include "tracelogger.hpp"
+#include "upload.hpp"
+
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+namespace {
+    int failures = 0;
+
+    /**
+     * @brief Record a failed expectation
+     *
+     * @param condition checked condition
+     * @param expression condition as text
+     * @param line source line
+     **/
+    void check(bool condition, const char* expression, int line) {
+        if (!condition) {
+            std::cerr << "FAILED (line " << line << "): " << expression << "\n";
+            ++failures;
+        }
+    }
+
+#define CHECK(...) check((__VA_ARGS__), #__VA_ARGS__, __LINE__)
+
+    void test_parse_range_header() {
+        std::vector<ByteRange> ranges;
+
+        CHECK(parse_range_header("bytes=0-499", 1000, ranges) == RangeResult::SATISFIABLE);
+        CHECK(ranges.size() == 1 && ranges[0].offset == 0 && ranges[0].length == 500);
+
+        CHECK(parse_range_header("bytes=900-", 1000, ranges) == RangeResult::SATISFIABLE);
+        CHECK(ranges.size() == 1 && ranges[0].offset == 900 && ranges[0].length == 100);
+
+        CHECK(parse_range_header("bytes=-300", 1000, ranges) == RangeResult::SATISFIABLE);
+        CHECK(ranges.size() == 1 && ranges[0].offset == 700 && ranges[0].length == 300);
+
+        CHECK(parse_range_header("bytes=-5000", 1000, ranges) == RangeResult::SATISFIABLE);
+        CHECK(ranges.size() == 1 && ranges[0].offset == 0 && ranges[0].length == 1000);
+
+        CHECK(parse_range_header("bytes=500-5000", 1000, ranges) == RangeResult::SATISFIABLE);
+        CHECK(ranges.size() == 1 && ranges[0].length == 500);
+
+        CHECK(parse_range_header("bytes=0-0, 10-19 ,-1", 1000, ranges) == RangeResult::SATISFIABLE);
+        CHECK(ranges.size() == 3 && ranges[1].offset == 10 && ranges[2].offset == 999);
+
+        CHECK(parse_range_header("bytes=1000-", 1000, ranges) == RangeResult::UNSATISFIABLE);
+        CHECK(parse_range_header("bytes=-0", 1000, ranges) == RangeResult::UNSATISFIABLE);
+
+        CHECK(parse_range_header("bytes=5-1", 1000, ranges) == RangeResult::IGNORED);
+        CHECK(parse_range_header("items=0-1", 1000, ranges) == RangeResult::IGNORED);
+        CHECK(parse_range_header("bytes=a-b", 1000, ranges) == RangeResult::IGNORED);
+        CHECK(parse_range_header("bytes=", 1000, ranges) == RangeResult::IGNORED);
+    }
+
+    void test_http_date() {
+        CHECK(format_http_date(784111777) == "Sun, 06 Nov 1994 08:49:37 GMT");
+        CHECK(parse_http_date("Sun, 06 Nov 1994 08:49:37 GMT") == 784111777);
+        CHECK(!parse_http_date("yesterday").has_value());
+    }
+
+    void test_conditional_requests() {
+        std::string const ETAG = make_etag(0x10, 0x20, 0x30);
+        CHECK(ETAG == "\"10-20-30\"");
+        CHECK(make_etag(1, 2, 3, true) == "W/\"1-2-3\"");
+
+        CHECK(etag_list_matches("*", ETAG));
+        CHECK(etag_list_matches("\"a\", W/\"10-20-30\"", ETAG));
+        CHECK(!etag_list_matches("\"10-20-31\"", ETAG));
+
+        CHECK(is_not_modified(ETAG, "", ETAG, 100));
+        CHECK(!is_not_modified("\"other\"", "Sun, 06 Nov 2094 08:49:37 GMT", ETAG, 100));
+        CHECK(is_not_modified("", "Sun, 06 Nov 1994 08:49:37 GMT", ETAG, 784111777));
+        CHECK(!is_not_modified("", "Sun, 06 Nov 1994 08:49:37 GMT", ETAG, 784111778));
+        CHECK(!is_not_modified("", "", ETAG, 100));
+    }
+
+    void test_normalize_target() {
+        CHECK(normalize_target("/") == "");
+        CHECK(normalize_target("/docs/./a%20b.txt?x=1") == "docs/a b.txt");
+        CHECK(normalize_target("//docs//sub/../c") == "docs/c");
+        CHECK(normalize_target("/docs/..") == "");
+
+        CHECK(!normalize_target("/../etc/passwd").has_value());
+        CHECK(!normalize_target("/%2e%2e/etc/passwd").has_value());
+        CHECK(!normalize_target("/a%2").has_value());
+        CHECK(!normalize_target("/a%00b").has_value());
+    }
+
+    void test_listing_page() {
+        CHECK(query_parameter("/d/?a=1&name=x%20y#frag", "name") == "x y");
+        CHECK(query_parameter("/d/?flag&b=2", "flag") == "");
+        CHECK(!query_parameter("/d/?b=2", "name").has_value());
+        CHECK(percent_decode(percent_encode("a b&c=d/%")) == "a b&c=d/%");
+
+        CHECK(!parse_listing_page("/docs/").has_value());
+        CHECK(!parse_listing_page("/docs/?download=1").has_value());
+
+        auto const PAGE = parse_listing_page("/docs/?offset=20&limit=5");
+        CHECK(PAGE && PAGE->offset == 20 && PAGE->limit == 5 && !PAGE->cursor);
+
+        auto const CLAMPED = parse_listing_page("/docs/?limit=99999999&offset=x");
+        CHECK(CLAMPED && CLAMPED->offset == 0 && CLAMPED->limit == ListingPage::MAX_LIMIT);
+
+        auto const NEXT = parse_listing_page("/docs/?cursor=fa%26b.txt");
+        CHECK(NEXT && NEXT->cursor == "fa&b.txt" && NEXT->limit == ListingPage::DEFAULT_LIMIT);
+    }
+
+    void test_listing_format() {
+        CHECK(parse_listing_format("/docs/", "") == ListingFormat::HTML);
+        CHECK(parse_listing_format("/docs/", "text/html, */*;q=0.8") == ListingFormat::HTML);
+        CHECK(parse_listing_format("/docs/", "application/json") == ListingFormat::JSON);
+        CHECK(parse_listing_format("/docs/", "Application/X-NDJSON; q=1") == ListingFormat::NDJSON);
+        CHECK(parse_listing_format("/docs/?format=ndjson", "application/json") == ListingFormat::NDJSON);
+        CHECK(parse_listing_format("/docs/?format=html", "application/json") == ListingFormat::HTML);
+
+        CHECK(parse_listing_depth("/docs/") == 0);
+        CHECK(parse_listing_depth("/docs/?depth=2") == 2);
+        CHECK(parse_listing_depth("/docs/?depth=1000") == MAX_LISTING_DEPTH);
+        CHECK(parse_listing_depth("/docs/?recursive") == MAX_LISTING_DEPTH);
+        CHECK(parse_listing_depth("/docs/?recursive=0") == 0);
+
+        std::string json;
+        append_json_string(json, "a\"b\\c\n");
+        CHECK(json == "\"a\\\"b\\\\c\\u000a\"");
+    }
+
+    void test_mime_types() {
+        CHECK(builtin_mime_type("movie.mp4").type == "video/mp4");
+        CHECK(builtin_mime_type("MOVIE.MP4").disposition == Disposition::INLINE);
+        CHECK(builtin_mime_type("backup.tar.gz").type == "application/gzip");
+        CHECK(builtin_mime_type("backup.tar.gz").disposition == Disposition::ATTACHMENT);
+        CHECK(builtin_mime_type("notes.txt").disposition == Disposition::INLINE);
+        CHECK(builtin_mime_type("Makefile").type == "application/octet-stream");
+        CHECK(builtin_mime_type(".bashrc").type == "application/octet-stream");
+        CHECK(builtin_mime_type("file.unknownext").disposition == Disposition::ATTACHMENT);
+
+        MimeTypes types;
+        types.add("MP4", "application/x-custom", Disposition::ATTACHMENT);
+        CHECK(types.lookup("clip.mp4").type == "application/x-custom");
+        CHECK(types.lookup("clip.mp3").type == "audio/mpeg");
+
+        std::string value;
+        append_content_disposition(value, Disposition::INLINE, "a\"b.txt");
+        CHECK(value == "inline; filename=\"a\\\"b.txt\"");
+        value.clear();
+        append_content_disposition(value, Disposition::ATTACHMENT, "caf\xc3\xa9.zip");
+        CHECK(value == "attachment; filename=\"caf__.zip\"; filename*=UTF-8''caf%C3%A9.zip");
+    }
+
+    void test_uploads() {
+        CHECK(parse_multipart_boundary("multipart/form-data; boundary=\"a b\"") == "a b");
+        CHECK(parse_multipart_boundary("Multipart/Form-Data;boundary=xyz") == "xyz");
+        CHECK(!parse_multipart_boundary("multipart/mixed; boundary=xyz").has_value());
+        CHECK(!parse_multipart_boundary("multipart/form-data").has_value());
+
+        Sha256 hash;
+        hash.update("abc");
+        Sha256Digest const DIGEST = hash.finish();
+        std::string hex;
+        append_hex(hex, digest_bytes(DIGEST));
+        CHECK(hex == "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+        CHECK(parse_sha256_hex(hex) == DIGEST);
+        std::string field = "md5=:AA==:, sha-256=:";
+        append_base64(field, digest_bytes(DIGEST));
+        field += ':';
+        CHECK(field.ends_with("ungWv48Bz+pBQUDeXa4iI7ADYaOWF3qctBD/YfIAFa0=:"));
+        CHECK(parse_sha256_field(field) == DIGEST);
+        CHECK(!parse_sha256_field("sha-256=:AAAA:").has_value());
+
+        fs::path const DIR = fs::temp_directory_path() / fs::unique_path("httpfileserver-test-%%%%%%%%");
+        fs::create_directories(DIR);
+        {
+            // The body arrives in pieces which split the delimiter
+            Upload upload;
+            upload.open_form(DIR, "xyz");
+            std::string const BODY = "preamble\r\n--xyz\r\n"
+                                     "Content-Disposition: form-data; name=\"f\"; filename=\"a.txt\"\r\n\r\n"
+                                     "one\r\n--xy\r\ntwo\r\n--xyz\r\n"
+                                     "Content-Disposition: form-data; name=\"note\"\r\n\r\n"
+                                     "ignored\r\n--xyz--\r\n";
+            for (std::size_t i = 0; i < BODY.size(); i += 5) {
+                CHECK(upload.write(std::string_view(BODY).substr(i, 5)));
+            }
+            CHECK(upload.commit());
+            CHECK(upload.files().size() == 1 && upload.files()[0].size == 14);
+        }
+        {
+            Upload upload;
+            upload.open_file(DIR / "b.txt", 3, parse_sha256_hex(hex));
+            upload.write("abd");
+            CHECK(!upload.commit() && upload.status() == beast::http::status::bad_request);
+        }
+        CHECK(fs::file_size(DIR / "a.txt") == 14);
+        CHECK(std::distance(fs::directory_iterator(DIR), fs::directory_iterator()) == 1);
+        fs::remove_all(DIR);
+    }
+
+    /**
+     * @brief Assemble an archive from a byte offset on, the way FileTransfer does
+     *
+     * @param layout archive layout
+     * @param position first byte
+     * @return std::string archive bytes from @p position to the end
+     **/
+    auto assemble_archive(ArchiveLayout& layout, std::uint64_t position) -> std::string {
+        std::string body;
+        PartSource::Segment segment;
+        std::uint64_t const START = layout.seek(position, segment);
+        do {
+            body += segment.prefix;
+            std::ifstream input(segment.path.string(), std::ios::binary);
+            std::string data(segment.length, '\0');
+            input.seekg(static_cast<std::streamoff>(segment.offset));
+            input.read(data.data(), static_cast<std::streamsize>(data.size()));
+            body += data;
+        } while (layout.next(segment));
+        return body.substr(position - START);
+    }
+
+    void test_archives() {
+        CHECK(parse_archive_format("/docs/") == ArchiveFormat::NONE);
+        CHECK(parse_archive_format("/docs/?archive=tar") == ArchiveFormat::TAR);
+        CHECK(parse_archive_format("/docs/?archive=zip") == ArchiveFormat::ZIP);
+        CHECK(parse_archive_format("/docs/?method=deflate&archive=zip") == ArchiveFormat::ZIP_DEFLATE);
+        CHECK(!parse_archive_format("/docs/?archive=rar").has_value());
+
+        fs::path const DIR = fs::temp_directory_path() / fs::unique_path("httpfileserver-test-%%%%%%%%");
+        fs::create_directories(DIR / "sub");
+        std::ofstream(DIR / "b.txt") << "hello";
+        std::ofstream(DIR / "sub" / "a.bin") << std::string(1000, 'z');
+
+        std::vector<ArchiveEntry> entries;
+        CHECK(!scan_archive(DIR, "top", 3, entries));
+        CHECK(scan_archive(DIR, "top", 4, entries) && entries.size() == 4);
+        CHECK(entries[0].name == "top/" && entries[1].name == "top/b.txt");
+        CHECK(entries[2].name == "top/sub/" && entries[3].name == "top/sub/a.bin");
+
+        // Tar: a header block per entry, data padded to blocks, two zero blocks at the end
+        ArchiveLayout tar(DIR, "top", entries, ArchiveFormat::TAR);
+        std::string const TAR = assemble_archive(tar, 0);
+        CHECK(TAR.size() == tar.size() && tar.size() == 4 * 512 + 512 + 1024 + 1024);
+        CHECK(TAR.compare(512 + 257, 5, "ustar") == 0 && TAR.compare(1024, 5, "hello") == 0);
+        CHECK(assemble_archive(tar, 1030) == TAR.substr(1030));
+
+        // Zip: the CRC comes from the files, the end record closes the archive
+        ArchiveLayout zip(DIR, "top", entries, ArchiveFormat::ZIP);
+        std::string const ZIP = assemble_archive(zip, 0);
+        CHECK(ZIP.size() == zip.size() && ZIP.compare(ZIP.size() - 22, 4, "PK\x05\x06") == 0);
+        std::size_t const DESCRIPTOR = ZIP.find("PK\x07\x08");
+        CHECK(DESCRIPTOR != std::string::npos);
+        std::uint32_t crc = 0;
+        for (std::size_t i = 4; i > 0; --i) {
+            crc = crc << 8 | static_cast<unsigned char>(ZIP[DESCRIPTOR + 3 + i]);
+        }
+        CHECK(crc == crc32(0, reinterpret_cast<const Bytef*>("hello"), 5));
+        CHECK(assemble_archive(zip, zip.size() - 100) == ZIP.substr(ZIP.size() - 100));
+        CHECK(tar.etag() != zip.etag());
+        fs::remove_all(DIR);
+    }
+
+    /**
+     * @brief Wait for the digest of a file, as the server sees it
+     *
+     * @param index digest index
+     * @param path file
+     * @return std::optional<Sha256Digest> digest, empty if it did not arrive in time
+     **/
+    auto await_digest(DigestIndex& index, const fs::path& path) -> std::optional<Sha256Digest> {
+        for (int i = 0; i < 500; ++i) {
+            struct stat file_stat {};
+            ::stat(path.c_str(), &file_stat);
+            std::int64_t const MTIME_NS =
+                static_cast<std::int64_t>(file_stat.st_mtim.tv_sec) * 1000000000 + file_stat.st_mtim.tv_nsec;
+            if (auto digest = index.lookup(path.string(),
+                                           static_cast<std::uint64_t>(file_stat.st_size),
+                                           MTIME_NS,
+                                           static_cast<std::uint64_t>(file_stat.st_ino)))
+            {
+                return digest;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        return std::nullopt;
+    }
+
+    void test_digest_index() {
+        fs::path const DIR = fs::temp_directory_path() / fs::unique_path("httpfileserver-test-%%%%%%%%");
+        fs::create_directories(DIR / "sub");
+        std::ofstream(DIR / "sub" / "a.txt") << "abc";
+        std::string const STORE = (DIR / "digests").string();
+
+        Sha256 hash;
+        hash.update("abc");
+        Sha256Digest const ABC = hash.finish();
+        {
+            // Hashed in the background, written to the store at stop
+            DigestIndex index;
+            index.configure(STORE, 2, 1024 * 1024);
+            index.start(DIR.string());
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            CHECK(await_digest(index, DIR / "sub" / "a.txt") == ABC);
+            index.stop();
+        }
+        CHECK(fs::exists(STORE));
+        {
+            // Loaded from the store, and withheld once the file changes
+            DigestIndex index;
+            index.configure(STORE, 1, 0);
+            index.start(DIR.string());
+            struct stat file_stat {};
+            ::stat((DIR / "sub" / "a.txt").c_str(), &file_stat);
+            std::int64_t const MTIME_NS =
+                static_cast<std::int64_t>(file_stat.st_mtim.tv_sec) * 1000000000 + file_stat.st_mtim.tv_nsec;
+            std::string const KEY = (DIR / "sub" / "a.txt").string();
+            auto const SIZE = static_cast<std::uint64_t>(file_stat.st_size);
+            auto const INODE = static_cast<std::uint64_t>(file_stat.st_ino);
+            CHECK(index.lookup(KEY, SIZE, MTIME_NS, INODE) == ABC);
+            CHECK(!index.lookup(KEY, SIZE, MTIME_NS + 1, INODE).has_value());
+
+            std::ofstream(DIR / "sub" / "a.txt") << "abcd";
+            hash.update("abcd");
+            CHECK(await_digest(index, DIR / "sub" / "a.txt") == hash.finish());
+        }
+        fs::remove_all(DIR);
+    }
+
+    /**
+     * @brief Search until the index answers, running the watcher meanwhile
+     *
+     * @param ioc io_context of the watcher
+     * @param index index
+     * @param query search text
+     * @param scope directory searched below
+     * @param page requested page
+     * @param next_cursor receives the cursor of the next page
+     * @param min_hits hits to wait for
+     * @return std::vector<std::string> paths of the hits
+     **/
+    auto await_search(net::io_context& ioc,
+                      const SearchIndex& index,
+                      std::string_view query,
+                      std::string_view scope,
+                      const ListingPage& page,
+                      std::string& next_cursor,
+                      std::size_t min_hits) -> std::vector<std::string> {
+        std::vector<SearchHit> hits;
+        for (int i = 0; i < 500; ++i) {
+            ioc.poll();
+            if (index.search(query, scope, page, hits, next_cursor) == SearchStatus::OK
+                && hits.size() >= min_hits)
+            {
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        std::vector<std::string> paths;
+        for (const SearchHit& hit : hits) {
+            paths.push_back(hit.path + (hit.directory ? "/" : ""));
+        }
+        return paths;
+    }
+
+    void test_search_index() {
+        fs::path const DIR = fs::temp_directory_path() / fs::unique_path("httpfileserver-test-%%%%%%%%");
+        fs::create_directories(DIR / "docs" / "Notes");
+        std::ofstream(DIR / "readme.md") << "a";
+        std::ofstream(DIR / "docs" / "Guide.md") << "b";
+        std::ofstream(DIR / "docs" / "Notes" / "todo.txt") << "c";
+
+        net::io_context ioc;
+        InotifyWatcher watcher(ioc);
+        if (!watcher.is_enabled()) {
+            fs::remove_all(DIR);
+            return;
+        }
+        SearchIndex index(watcher);
+        watcher.subscribe([&index](const fs::path& dir, std::string_view name, std::uint32_t mask)
+                          { index.on_event(dir, name, mask); });
+        watcher.start();
+        index.start(fs::canonical(DIR).string(), 2);
+        CHECK(index.is_enabled());
+
+        std::string cursor;
+        using Paths = std::vector<std::string>;
+        CHECK(await_search(ioc, index, "GUIDE", "", {}, cursor, 1) == Paths {"docs/Guide.md"});
+        CHECK(await_search(ioc, index, "*.md", "", {}, cursor, 2) == (Paths {"readme.md", "docs/Guide.md"}));
+        CHECK(await_search(ioc, index, "notes/t", "docs", {}, cursor, 1) == Paths {"docs/Notes/todo.txt"});
+        CHECK(await_search(ioc, index, "o", "docs", {}, cursor, 1).size() == 2);
+        CHECK(await_search(ioc, index, "readme", "docs", {}, cursor, 0).empty());
+
+        // One hit per page, the cursor resumes after it
+        ListingPage page;
+        page.limit = 1;
+        CHECK(await_search(ioc, index, ".md", "", page, cursor, 1) == Paths {"readme.md"});
+        CHECK(!cursor.empty());
+        page.cursor = cursor;
+        CHECK(await_search(ioc, index, ".md", "", page, cursor, 1) == Paths {"docs/Guide.md"});
+        CHECK(cursor.empty());
+        page.cursor = "x";
+        std::vector<SearchHit> hits;
+        CHECK(index.search(".md", "", page, hits, cursor) == SearchStatus::BAD_CURSOR);
+
+        // Kept current through the watcher
+        fs::create_directories(DIR / "new" / "deep");
+        std::ofstream(DIR / "new" / "deep" / "found.md") << "d";
+        CHECK(await_search(ioc, index, "found", "", {}, cursor, 1) == Paths {"new/deep/found.md"});
+        fs::remove_all(DIR / "docs");
+        for (int i = 0; i < 500 && !await_search(ioc, index, "Guide", "", {}, cursor, 0).empty(); ++i) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        CHECK(await_search(ioc, index, "Guide", "", {}, cursor, 0).empty());
+
+        index.stop();
+        fs::remove_all(DIR);
+    }
+
+    void test_stat_cache() {
+        fs::path const DIR = fs::temp_directory_path() / fs::unique_path("httpfileserver-test-%%%%%%%%");
+        fs::create_directories(DIR);
+        std::string const KEY = normalize_path(DIR / "a.txt");
+
+        // Results, missing paths included, are kept until invalidated
+        StatCache cache(std::chrono::hours(1), 64);
+        CHECK(cache.lookup(KEY).kind == FileKind::MISSING);
+        std::ofstream(DIR / "a.txt") << "abc";
+        CHECK(cache.lookup(KEY).kind == FileKind::MISSING);
+        cache.invalidate(KEY);
+        FileInfo const INFO = cache.lookup(KEY);
+        CHECK(INFO.kind == FileKind::REGULAR && INFO.size == 3);
+        std::ofstream(DIR / "a.txt", std::ios::app) << "def";
+        CHECK(cache.lookup(KEY).size == 3);
+        cache.clear();
+        CHECK(cache.lookup(KEY).size == 6);
+        CHECK(cache.lookup(normalize_path(DIR)).kind == FileKind::DIRECTORY);
+
+        // Unwatched paths are only trusted for the TTL
+        StatCache short_lived(std::chrono::milliseconds(20), 64);
+        CHECK(short_lived.lookup(KEY).size == 6);
+        fs::remove(DIR / "a.txt");
+        std::this_thread::sleep_for(std::chrono::milliseconds(40));
+        CHECK(short_lived.lookup(KEY).kind == FileKind::MISSING);
+
+        StatCache disabled(std::chrono::milliseconds(0), 64);
+        CHECK(disabled.lookup(KEY).kind == FileKind::MISSING);
+        std::ofstream(DIR / "a.txt") << "x";
+        CHECK(disabled.lookup(KEY).kind == FileKind::REGULAR);
+
+        fs::remove_all(DIR);
+    }
+
+    void test_path_filter() {
+        fs::path const DIR = fs::temp_directory_path() / fs::unique_path("httpfileserver-test-%%%%%%%%");
+        fs::create_directories(DIR);
+        std::string const ROOT = normalize_path(fs::canonical(DIR));
+
+        net::io_context ioc;
+        InotifyWatcher watcher(ioc);
+        if (!watcher.is_enabled()) {
+            fs::remove_all(DIR);
+            return;
+        }
+        PathFilter filter(watcher);
+        watcher.subscribe([&filter](const fs::path& dir, std::string_view name, std::uint32_t mask)
+                          { filter.on_event(dir, name, mask); });
+        watcher.start();
+        filter.start(ROOT);
+        for (int i = 0; i < 500 && !filter.is_missing(ROOT + "/late.txt"); ++i) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        CHECK(filter.is_missing(ROOT + "/late.txt"));
+
+        // Created by "another process": its event is queued but not applied yet
+        std::ofstream(DIR / "late.txt") << "x";
+        CHECK(!filter.is_missing(ROOT + "/late.txt"));
+        CHECK(!filter.is_missing(ROOT + "/other.txt"));
+
+        ioc.poll();
+        CHECK(!filter.is_missing(ROOT + "/late.txt"));
+        CHECK(filter.is_missing(ROOT + "/other.txt"));
+
+        filter.stop();
+        fs::remove_all(DIR);
+    }
+
+    /**
+     * @brief A server on a loopback port, run on its own thread while the object lives
+     *
+     **/
+    class LoopbackServer {
+      public:
+        using Configure = std::function<void(SHServer&)>;
+
+        explicit LoopbackServer(const fs::path& root, const Configure& configure = {})
+            : m_ROOT(root)
+            , m_PORT(next_port())
+            , m_SERVER(m_ROOT, m_PORT, 1) {
+            if (configure) {
+                configure(m_SERVER);
+            }
+            m_THREAD = std::thread([this] { m_SERVER.run_server(); });
+
+            // Listening once a connection goes through
+            for (int i = 0; i < 200; ++i) {
+                net::io_context ioc;
+                tcp::socket socket(ioc);
+                beast::error_code ec;
+                socket.connect({net::ip::make_address("127.0.0.1"), m_PORT}, ec);
+                if (!ec) {
+                    break;
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+        }
+
+        ~LoopbackServer() {
+            m_SERVER.stop_server();
+            m_THREAD.join();
+        }
+
+        LoopbackServer(const LoopbackServer&) = delete;
+        auto operator=(const LoopbackServer&) -> LoopbackServer& = delete;
+
+        /**
+         * @brief Send requests on one connection and read a response to each
+         *
+         * @param requests raw requests, pipelined
+         * @param methods method of every request, HEAD responses have no body
+         * @return std::vector<http::response<http::string_body>> responses read before the first error
+         **/
+        auto exchange(std::string_view requests, const std::vector<http::verb>& methods)
+            -> std::vector<http::response<http::string_body>> {
+            net::io_context ioc;
+            tcp::socket socket(ioc);
+            beast::error_code ec;
+            socket.connect({net::ip::make_address("127.0.0.1"), m_PORT}, ec);
+            net::write(socket, net::buffer(requests.data(), requests.size()), ec);
+
+            std::vector<http::response<http::string_body>> responses;
+            beast::flat_buffer buffer;
+            for (http::verb const METHOD : methods) {
+                http::response_parser<http::string_body> parser;
+                parser.body_limit(std::numeric_limits<std::uint64_t>::max());
+                parser.skip(METHOD == http::verb::head);
+                http::read(socket, buffer, parser, ec);
+                if (ec) {
+                    break;
+                }
+                responses.push_back(parser.release());
+            }
+            return responses;
+        }
+
+      private:
+        static auto next_port() -> std::uint16_t {
+            static std::uint16_t port = static_cast<std::uint16_t>(20000 + (::getpid() % 20000) * 2);
+            return port++;
+        }
+
+        fs::path m_ROOT;
+        std::uint16_t m_PORT;
+        SHServer m_SERVER;
+        std::thread m_THREAD;
+    };
+
+    /**
+     * @brief Create a directory for a loopback server with one file in it
+     *
+     * @param content content of "file.txt"
+     * @return fs::path directory
+     **/
+    auto make_served_tree(const std::string& content) -> fs::path {
+        fs::path const DIR = fs::temp_directory_path() / fs::unique_path("httpfileserver-test-%%%%%%%%");
+        fs::create_directories(DIR / "sub");
+        std::ofstream(DIR / "file.txt") << content;
+        return DIR;
+    }
+
+    void test_head_keep_alive() {
+        fs::path const DIR = make_served_tree("hello world");
+        {
+            LoopbackServer server(DIR);
+
+            // A HEAD response carries no body, so the responses that follow stay framed
+            auto const RESPONSES =
+                server.exchange("HEAD /file.txt HTTP/1.1\r\nHost: t\r\n\r\n"
+                                "HEAD /sub HTTP/1.1\r\nHost: t\r\n\r\n"
+                                "HEAD /missing HTTP/1.1\r\nHost: t\r\n\r\n"
+                                "GET /file.txt HTTP/1.1\r\nHost: t\r\n\r\n"
+                                "GET /missing HTTP/1.1\r\nHost: t\r\nConnection: close\r\n\r\n",
+                                {http::verb::head,
+                                 http::verb::head,
+                                 http::verb::head,
+                                 http::verb::get,
+                                 http::verb::get});
+            CHECK(RESPONSES.size() == 5);
+            if (RESPONSES.size() == 5) {
+                CHECK(RESPONSES[0].result() == http::status::ok
+                      && RESPONSES[0][http::field::content_length] == "11");
+                CHECK(RESPONSES[1].result() == http::status::ok && RESPONSES[1].has_content_length());
+                CHECK(RESPONSES[2].result() == http::status::not_found);
+                CHECK(RESPONSES[3].result() == http::status::ok && RESPONSES[3].body() == "hello world");
+                CHECK(RESPONSES[4].result() == http::status::not_found
+                      && RESPONSES[4].body() == "File not found");
+            }
+        }
+        fs::remove_all(DIR);
+    }
+
+    /**
+     * @brief Serve a file, a range of it and an archive over one connection
+     *
+     * The file goes out through sendfile(2) (or io_uring, when configured),
+     * the zip archive through the pread/send fallback, which it needs to
+     * compute the CRC of every member.
+     *
+     * @param configure server setup before it runs
+     **/
+    void test_file_responses(const LoopbackServer::Configure& configure) {
+        fs::path const DIR = make_served_tree("hello world");
+        std::string content(3 * 1024 * 1024 + 17, '\0');
+        for (std::size_t i = 0; i < content.size(); ++i) {
+            content[i] = static_cast<char>('a' + (i * 7 + i / 4096) % 26);
+        }
+        std::ofstream(DIR / "big.bin", std::ios::binary) << content;
+        {
+            LoopbackServer server(DIR, configure);
+            auto const RESPONSES =
+                server.exchange("GET /big.bin HTTP/1.1\r\nHost: t\r\n\r\n"
+                                "GET /big.bin HTTP/1.1\r\nHost: t\r\nRange: bytes=2000000-2000099\r\n\r\n"
+                                "GET /?archive=zip HTTP/1.1\r\nHost: t\r\nConnection: close\r\n\r\n",
+                                {http::verb::get, http::verb::get, http::verb::get});
+            CHECK(RESPONSES.size() == 3);
+            if (RESPONSES.size() == 3) {
+                CHECK(RESPONSES[0].result() == http::status::ok && RESPONSES[0].body() == content);
+                CHECK(RESPONSES[1].result() == http::status::partial_content
+                      && RESPONSES[1].body() == content.substr(2000000, 100));
+                CHECK(RESPONSES[1][http::field::content_range] == "bytes 2000000-2000099/3145745");
+                CHECK(RESPONSES[2].result() == http::status::ok
+                      && RESPONSES[2].body().find(content.substr(0, 4096)) != std::string::npos);
+            }
+        }
+        fs::remove_all(DIR);
+    }
+
+    void test_changed_file() {
+        fs::path const DIR = make_served_tree("hello world");
+        {
+            LoopbackServer server(DIR);
+            auto const GET = [&server]()
+            {
+                auto const RESPONSES = server.exchange(
+                    "GET /file.txt HTTP/1.1\r\nHost: t\r\nConnection: close\r\n\r\n", {http::verb::get});
+                return RESPONSES.size() == 1 ? RESPONSES[0] : http::response<http::string_body> {};
+            };
+            CHECK(GET().body() == "hello world");
+
+            // Replaced and removed behind the server's back, seen through the watcher
+            std::ofstream(DIR / "file.txt") << "bye";
+            for (int i = 0; i < 500 && GET().body() != "bye"; ++i) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+            CHECK(GET().body() == "bye");
+            fs::remove(DIR / "file.txt");
+            for (int i = 0; i < 500 && GET().result() != http::status::not_found; ++i) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+            CHECK(GET().result() == http::status::not_found);
+            std::ofstream(DIR / "file.txt") << "again";
+            for (int i = 0; i < 500 && GET().body() != "again"; ++i) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+            CHECK(GET().body() == "again");
+        }
+        fs::remove_all(DIR);
+    }
+
+    void test_refused_upload_keep_alive() {
+        fs::path const DIR = make_served_tree("hello world");
+        {
+            LoopbackServer server(DIR);
+
+            // Short fields cost more arena memory than their bytes: these spill past the first block
+            std::string request = "PUT /new.txt HTTP/1.1\r\nHost: t\r\nContent-Length: 0\r\n";
+            for (int i = 0; i < 600; ++i) {
+                request += "X-" + std::to_string(i) + ": y\r\n";
+            }
+            request += "\r\nGET /file.txt HTTP/1.1\r\nHost: t\r\nConnection: close\r\n\r\n";
+            CHECK(request.size() < 8 * 1024);
+
+            auto const RESPONSES = server.exchange(request, {http::verb::put, http::verb::get});
+            CHECK(RESPONSES.size() == 2);
+            if (RESPONSES.size() == 2) {
+                CHECK(RESPONSES[0].result() == http::status::method_not_allowed);
+                CHECK(RESPONSES[1].result() == http::status::ok && RESPONSES[1].body() == "hello world");
+            }
+        }
+        fs::remove_all(DIR);
+    }
+
+    void test_linked_file() {
+        fs::path const DIR = make_served_tree("hello world");
+        fs::path const OUTSIDE = fs::temp_directory_path() / fs::unique_path("httpfileserver-test-%%%%%%%%");
+        fs::create_directories(OUTSIDE);
+        std::ofstream(OUTSIDE / "target.txt") << "first";
+        fs::create_symlink(OUTSIDE / "target.txt", DIR / "link.txt");
+        {
+            LoopbackServer server(DIR);
+            auto const GET = [&server]()
+            {
+                auto const RESPONSES = server.exchange(
+                    "GET /link.txt HTTP/1.1\r\nHost: t\r\nConnection: close\r\n\r\n", {http::verb::get});
+                return RESPONSES.size() == 1 ? RESPONSES[0].body() : std::string();
+            };
+            CHECK(GET() == "first");
+            CHECK(GET() == "first");
+
+            // Written in a directory nobody watches: only a fresh read sees it
+            std::ofstream(OUTSIDE / "target.txt") << "second";
+            CHECK(GET() == "second");
+        }
+        fs::remove_all(DIR);
+        fs::remove_all(OUTSIDE);
+    }
+
+    void test_recursive_symlink_loop() {
+        fs::path const DIR = make_served_tree("hello world");
+        fs::create_directory_symlink(".", DIR / "loop");
+        fs::create_directory_symlink("..", DIR / "sub" / "up");
+        {
+            LoopbackServer server(DIR);
+            auto const RESPONSES =
+                server.exchange("HEAD /?format=ndjson&recursive HTTP/1.1\r\nHost: t\r\n\r\n"
+                                "GET /?format=ndjson&recursive HTTP/1.1\r\nHost: t\r\nConnection: close\r\n"
+                                "\r\n",
+                                {http::verb::head, http::verb::get});
+            CHECK(RESPONSES.size() == 2);
+            if (RESPONSES.size() == 2) {
+                CHECK(RESPONSES[0].result() == http::status::ok && RESPONSES[0].chunked());
+
+                // The links are listed once, as directories, and never followed
+                std::string_view const BODY = RESPONSES[1].body();
+                CHECK(BODY.find(R"({"dir":"","name":"loop","type":"directory")") != std::string_view::npos);
+                CHECK(BODY.find(R"({"dir":"sub","name":"up","type":"directory")") != std::string_view::npos);
+                CHECK(BODY.find(R"("dir":"loop)") == std::string_view::npos);
+                CHECK(BODY.find(R"("dir":"sub/up)") == std::string_view::npos);
+                CHECK(std::count(BODY.begin(), BODY.end(), '\n') == 4);
+            }
+        }
+        fs::remove_all(DIR);
+    }
+
+    void test_listing_render() {
+        fs::path const DIR = make_served_tree("hello world");
+        fs::create_directories(DIR / "many");
+        std::size_t const COUNT = SHServer::LISTING_STREAM_THRESHOLD + 10;
+        for (std::size_t i = 0; i < COUNT; ++i) {
+            std::string name = std::to_string(10000 + i);
+            name += i % 2 == 0 ? ".txt" : ".png";
+            std::ofstream(DIR / "many" / name) << "x";
+        }
+        // Sorted last, after the numbered names
+        std::ofstream(DIR / "many" / "x&y <z>#?%.txt") << "odd";
+        {
+            LoopbackServer server(DIR);
+
+            // The first page is streamed while it renders, the second one comes from the cache
+            auto responses = server.exchange("GET /many HTTP/1.1\r\nHost: t\r\n\r\n"
+                                             "GET /many HTTP/1.1\r\nHost: t\r\nConnection: close\r\n\r\n",
+                                             {http::verb::get, http::verb::get});
+            CHECK(responses.size() == 2);
+            if (responses.size() == 2) {
+                CHECK(responses[0].chunked() && !responses[1].chunked());
+                for (auto& response : responses) {
+                    std::string& body = response.body();
+                    std::size_t const TIME = body.find("Current Server Time: ");
+                    CHECK(TIME != std::string::npos);
+                    if (TIME != std::string::npos) {
+                        body.erase(TIME, body.find("</p>", TIME) - TIME);
+                    }
+                }
+                CHECK(responses[0].body() == responses[1].body());
+
+                std::string_view const BODY = responses[0].body();
+                std::size_t rows = 0;
+                for (std::size_t pos = BODY.find("<tr><td>"); pos != std::string_view::npos;
+                     pos = BODY.find("<tr><td>", pos + 1))
+                {
+                    ++rows;
+                }
+                CHECK(rows == COUNT + 1);
+                CHECK(BODY.find("<tr><td>1</td><td class='name-col' style='color: #FFFFFF;'>10000.txt</td>")
+                      != std::string_view::npos);
+                CHECK(BODY.find("style='color: #9C27B0;'>10001.png</td><td class='link-col'>"
+                                "<a href=\"/many/10001.png\">10001.png</a>")
+                      != std::string_view::npos);
+                CHECK(BODY.find("<tr><td>" + std::to_string(COUNT) + "</td>") != std::string_view::npos);
+
+                // Names are escaped in the text and percent-encoded in the link, which leads to the file
+                std::string_view const ODD_LINK = "/many/x%26y%20%3Cz%3E%23%3F%25.txt";
+                CHECK(BODY.find(">x&amp;y &lt;z&gt;#?%.txt</td><td class='link-col'><a href=\""
+                                + std::string(ODD_LINK) + "\">x&amp;y &lt;z&gt;#?%.txt</a>")
+                      != std::string_view::npos);
+                auto const ODD = server.exchange(
+                    "GET " + std::string(ODD_LINK) + " HTTP/1.1\r\nHost: t\r\nConnection: close\r\n\r\n",
+                    {http::verb::get});
+                CHECK(ODD.size() == 1 && ODD[0].body() == "odd");
+            }
+        }
+        fs::remove_all(DIR);
+    }
+
+    void test_listing_invalidation() {
+        fs::path const DIR = make_served_tree("hello world");
+        fs::last_write_time(DIR / "sub", 1000000000);
+        {
+            LoopbackServer server(DIR);
+            auto const GET = [&server](const std::string& target)
+            {
+                auto const RESPONSES = server.exchange(
+                    "GET " + target + " HTTP/1.1\r\nHost: t\r\nConnection: close\r\n\r\n", {http::verb::get});
+                return RESPONSES.size() == 1 ? RESPONSES[0].body() : std::string();
+            };
+            std::string const OLD_SUB = R"({"name":"sub","type":"directory","mtime":1000000000})";
+
+            // Both listings are cached, and sub is watched
+            CHECK(GET("/?format=ndjson").find(OLD_SUB) != std::string::npos);
+            CHECK(GET("/?format=ndjson&depth=1").find("new.txt") == std::string::npos);
+
+            // A change inside sub moves its mtime, which the cached root listing shows
+            std::ofstream(DIR / "sub" / "new.txt") << "x";
+            bool updated = false;
+            for (int i = 0; i < 500 && !updated; ++i) {
+                updated = GET("/?format=ndjson").find(OLD_SUB) == std::string::npos;
+                if (!updated) {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                }
+            }
+            CHECK(updated);
+            std::string const NEW_FILE = R"({"dir":"sub","name":"new.txt")";
+            CHECK(GET("/?format=ndjson&depth=1").find(NEW_FILE) != std::string::npos);
+        }
+        fs::remove_all(DIR);
+    }
+
+    void test_arena() {
+        CHECK(BufferPool::block_size(1) == BufferPool::MIN_BLOCK);
+        CHECK(BufferPool::block_size(5000) == 8192);
+        CHECK(BufferPool::block_size(BufferPool::MAX_BLOCK + 1) == BufferPool::MAX_BLOCK + 1);
+        void* const BLOCK = BufferPool::acquire(5000);
+        BufferPool::release(BLOCK, 5000);
+        CHECK(BufferPool::acquire(8000) == BLOCK);
+        BufferPool::release(BLOCK, 8000);
+
+        ConnectionArena arena;
+        ArenaAllocator<char> const ALLOCATOR(arena);
+        char* const FIRST = ArenaAllocator<char>(ALLOCATOR).allocate(64);
+        {
+            // Grows past the first block, and the fields move along with their allocator
+            ArenaResponse res(std::piecewise_construct, std::make_tuple(), std::make_tuple(ALLOCATOR));
+            for (int i = 0; i < 200; ++i) {
+                res.set("X-Field-" + std::to_string(i), std::string(100, 'v'));
+            }
+            ArenaResponse moved(std::piecewise_construct, std::make_tuple(), std::make_tuple(ALLOCATOR));
+            moved = std::move(res);
+            CHECK(moved["X-Field-199"] == std::string(100, 'v'));
+            CHECK(moved.get_allocator() == ALLOCATOR);
+        }
+        arena.reset();
+        CHECK(ArenaAllocator<char>(ALLOCATOR).allocate(64) == FIRST);
+    }
+
+    void test_hot_file_cache() {
+        HotFileCache cache(8 * 64 * 1024, 4096);
+        auto make_file = []
+        {
+            auto file = std::make_shared<CachedFile>();
+            file->body.assign(1024, 'x');
+            return file;
+        };
+
+        CHECK(cache.accepts(4096) && !cache.accepts(4097));
+
+        for (int i = 0; i < 5; ++i) {
+            cache.find("/srv/popular");
+        }
+        cache.insert("/srv/popular", make_file(), cache.epoch("/srv/popular"));
+        CHECK(cache.find("/srv/popular") != nullptr);
+
+        // A scan of one-off files must not push out the popular one
+        for (int i = 0; i < 2000; ++i) {
+            std::string const KEY = "/srv/scan/" + std::to_string(i);
+            cache.find(KEY);
+            cache.insert(KEY, make_file(), cache.epoch(KEY));
+        }
+        CHECK(cache.find("/srv/popular") != nullptr);
+        CHECK(cache.size_bytes() <= 8 * 64 * 1024);
+
+        std::uint64_t const EPOCH = cache.epoch("/srv/raced");
+        cache.invalidate("/srv/raced");
+        cache.insert("/srv/raced", make_file(), EPOCH);
+        CHECK(cache.find("/srv/raced") == nullptr);
+
+        cache.invalidate("/srv/popular");
+        CHECK(cache.find("/srv/popular") == nullptr);
+    }
+
+    /**
+     * @brief Inflate a gzip or zlib stream, checking its trailer
+     *
+     * @param encoded stream
+     * @param decoded receives the content
+     * @return true if the stream is complete and its checksum matches
+     **/
+    auto inflate_all(const std::string& encoded, std::string& decoded) -> bool {
+        z_stream stream {};
+        if (inflateInit2(&stream, 15 + 32) != Z_OK) {
+            return false;
+        }
+        decoded.resize(1 << 20);
+        stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(encoded.data()));
+        stream.avail_in = static_cast<uInt>(encoded.size());
+        stream.next_out = reinterpret_cast<Bytef*>(decoded.data());
+        stream.avail_out = static_cast<uInt>(decoded.size());
+        int const RESULT = inflate(&stream, Z_FINISH);
+        decoded.resize(stream.total_out);
+        inflateEnd(&stream);
+        return RESULT == Z_STREAM_END;
+    }
+
+    /**
+     * @brief Compare a parsed q-value with the expected one
+     *
+     * @param actual parsed value
+     * @param expected expected value
+     * @return true if they differ by less than the q-value resolution
+     **/
+    auto same_quality(float actual, float expected) -> bool {
+        return std::fabs(actual - expected) < 0.0005F;
+    }
+
+    void test_compression() {
+        CHECK(same_quality(encoding_quality("gzip, deflate", "gzip"), 1.0F));
+        CHECK(same_quality(encoding_quality("gzip;q=0.5, *;q=0.1", "deflate"), 0.1F));
+        CHECK(same_quality(encoding_quality("x-gzip;q=0.3", "gzip"), 0.3F));
+        CHECK(same_quality(encoding_quality("br", "gzip"), 0.0F));
+        CHECK(same_quality(encoding_quality("GZIP;Q=0", "gzip"), 0.0F));
+
+        CHECK(make_variant_etag("\"1-2-3\"", "gzip") == "\"1-2-3-gzip\"");
+        CHECK(make_variant_etag("W/\"a\"", "deflate") == "W/\"a-deflate\"");
+
+        std::string const HEAD(3000, 'h');
+        std::string const TAIL = "</p><table>" + std::string(5000, 't') + "</table>";
+        for (ContentCoding const CODING : {ContentCoding::GZIP, ContentCoding::DEFLATE}) {
+            auto const PAGE = make_deflate_template(CODING, HEAD, TAIL);
+            CHECK(PAGE.has_value());
+
+            std::string decoded;
+            CHECK(inflate_all(render_deflate_template(*PAGE, "Fri Oct 16 12:00:00 2026\n"), decoded));
+            CHECK(decoded == HEAD + "Fri Oct 16 12:00:00 2026\n" + TAIL);
+            CHECK(inflate_all(render_deflate_template(*PAGE, ""), decoded) && decoded == HEAD + TAIL);
+
+            std::string encoded;
+            CHECK(compress(TAIL, CODING, encoded) && encoded.size() < TAIL.size());
+            CHECK(inflate_all(encoded, decoded) && decoded == TAIL);
+        }
+    }
+
+    void test_async_logger() {
+        std::string const TEMPORARY = "served";
+        AsyncLogger::Record record;
+        AsyncLogger::capture(record, 1, "f.cpp", 7, "fn", "%s %zu|%5d|%-3u|%x|%.2f|%c|%%\n",
+                             TEMPORARY.c_str(), std::size_t {42}, -3, 7U, 255, 1.5, 'z');
+        std::string line;
+        AsyncLogger::format(record, line, false);
+        CHECK(line == "[INFO] served 42|   -3|7  |ff|1.50|z|%\n");
+
+        line.clear();
+        AsyncLogger::capture(record, 3, "f.cpp", 7, "fn", "bad: %s\n", "x");
+        AsyncLogger::format(record, line, false);
+        CHECK(line == "[ERROR] f.cpp:7 fn(): bad: x\n");
+
+        line.clear();
+        std::string const LONG(AsyncLogger::RECORD_PAYLOAD * 2, 'a');
+        AsyncLogger::capture(record, 0, "f.cpp", 7, "fn", "%s %d\n", LONG.c_str(), 1);
+        AsyncLogger::format(record, line, false);
+        CHECK(record.truncated && line.size() < LONG.size());
+        CHECK(line.find("<?> [truncated]\n") != std::string::npos);
+
+        // A precision bounds the copy, the text needs no NUL; '*' takes its int argument
+        char const TARGET[] = {'/', 'a', 'b', 'X'};
+        line.clear();
+        AsyncLogger::capture(record, 1, "f.cpp", 7, "fn", "%.*s|%*d|%-*s|%.*s|%.2s\n",
+                             3, TARGET, 4, 7, 3, "x", -1, "all", "abc");
+        AsyncLogger::format(record, line, false);
+        CHECK(line == "[INFO] /ab|   7|x  |all|ab\n");
+    }
+
+    void test_trace_spans() {
+        TraceLogger::clear();
+        TraceLogger::set_sample_rate(2);
+        {
+            TraceLogger::RequestScope const SKIPPED(3);
+            TraceLogger const SPAN("f.cpp", "skipped_fn", 1);
+        }
+        {
+            TraceLogger::RequestScope const SAMPLED(4);
+            TraceLogger const SPAN("f.cpp", "sampled_\"fn", 2);
+        }
+        std::string json;
+        TraceLogger::export_chrome_trace(json);
+        CHECK(json.find("skipped_fn") == std::string::npos);
+        CHECK(json.find("\"name\":\"sampled_\\\"fn\",\"cat\":\"httpfileserver\",\"ph\":\"X\"") != std::string::npos);
+        CHECK(json.find("\"args\":{\"request\":4,\"line\":2,\"file\":\"f.cpp\"}") != std::string::npos);
+
+        TraceLogger::set_sample_rate(0);
+        TraceLogger::clear();
+        {
+            TraceLogger const SPAN("f.cpp", "untraced_fn", 3);
+        }
+        json.clear();
+        TraceLogger::export_chrome_trace(json);
+        CHECK(json.find("untraced_fn") == std::string::npos);
+        TraceLogger::set_sample_rate(TraceLogger::DEFAULT_SAMPLE_RATE);
+    }
+
+    void test_metrics() {
+        CHECK(Metrics::bucket_of(0) == 0 && Metrics::bucket_of(1023) == 0);
+        CHECK(Metrics::bucket_of(std::uint64_t {1} << 62) == Metrics::BUCKETS - 1);
+        for (std::uint64_t const NANOS : {1024ULL, 1500ULL, 1999ULL, 123456ULL, 7654321ULL, 60000000000ULL}) {
+            std::size_t const BUCKET = Metrics::bucket_of(NANOS);
+            double const SECONDS = static_cast<double>(NANOS) * 1e-9;
+            CHECK(BUCKET > 0 && BUCKET < Metrics::BUCKETS - 1);
+            CHECK(Metrics::bucket_bound(BUCKET - 1) <= SECONDS && SECONDS < Metrics::bucket_bound(BUCKET));
+            CHECK(Metrics::bucket_bound(BUCKET) <= SECONDS * (1.0 + 1.0 / Metrics::SUB_BUCKETS));
+        }
+
+        auto metrics = std::make_unique<Metrics>();
+        metrics->count_request(Route::STATIC_FILE, 206, 100);
+        metrics->count_request(Route::STATIC_FILE, 200, 50);
+        metrics->count_cache(CacheKind::LISTING, true);
+        metrics->count_cache(CacheKind::LISTING, false);
+        metrics->record_latency(Phase::SEND, std::chrono::microseconds(3));
+        metrics->connection_opened();
+        std::string text;
+        metrics->render(text);
+        CHECK(text.find("httpfileserver_requests_total{handler=\"file\",code=\"2xx\"} 2\n") != std::string::npos);
+        CHECK(text.find("httpfileserver_response_bytes_total{handler=\"file\",code=\"2xx\"} 150\n") != std::string::npos);
+        CHECK(text.find("httpfileserver_cache_hit_ratio{cache=\"listing\"} 0.5\n") != std::string::npos);
+        CHECK(text.find("httpfileserver_connections_in_flight 1\n") != std::string::npos);
+        CHECK(text.find("httpfileserver_phase_duration_seconds_bucket{phase=\"send\",le=\"+Inf\"} 1\n")
+              != std::string::npos);
+        CHECK(text.find("httpfileserver_phase_duration_seconds_count{phase=\"read\"} 0\n") != std::string::npos);
+    }
+}    // namespace
 
 auto main() -> int {
-    return 0;
+    test_parse_range_header();
+    test_http_date();
+    test_conditional_requests();
+    test_normalize_target();
+    test_listing_page();
+    test_listing_format();
+    test_mime_types();
+    test_uploads();
+    test_archives();
+    test_digest_index();
+    test_search_index();
+    test_stat_cache();
+    test_path_filter();
+    test_head_keep_alive();
+    test_changed_file();
+    test_refused_upload_keep_alive();
+    test_linked_file();
+    test_recursive_symlink_loop();
+    test_listing_render();
+    test_listing_invalidation();
+    test_file_responses({});
+    // io_uring when the kernel allows it, the same bytes through sendfile(2) when it does not
+    test_file_responses([](SHServer& server) { server.enable_io_uring(); });
+    test_file_responses([](SHServer& server) { server.enable_sharding(2, false); });
+    test_arena();
+    test_hot_file_cache();
+    test_compression();
+    test_async_logger();
+    test_trace_spans();
+    test_metrics();
+
+    return failures == 0 ? 0 : 1;
 }